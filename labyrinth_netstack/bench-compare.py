@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+#
+# Compare two result files of the bench program, e.g.
+#
+#   ./bench -o before.json
+#   (change something, rebuild)
+#   ./bench -o after.json
+#   ../bench-compare.py before.json after.json
+#
+# Every benchmark is compared by its median time per operation. A
+# benchmark whose median grew by more than the threshold is a
+# regression, and then the exit status is 1. Benchmarks that are only
+# in one of the files are listed, but do not count.
+#
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    results = {}
+    for r in data.get("results", []):
+        results[(r["suite"], r["name"], r["param"])] = r
+    return data, results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two bench JSON files.")
+    parser.add_argument("base", help="results before the change")
+    parser.add_argument("new", help="results after the change")
+    parser.add_argument("-t", "--threshold", type=float, default=10.0,
+                        help="percent by which the median may grow before it counts "
+                             "as a regression (default 10)")
+    args = parser.parse_args()
+
+    base_info, base = load(args.base)
+    new_info, new = load(args.new)
+
+    for key in ("checksum_variant", "compiler", "quick", "cpus"):
+        if base_info.get(key) != new_info.get(key):
+            print("note: %s differs: %s -> %s" % (key, base_info.get(key), new_info.get(key)))
+
+    print("%-8s %-15s %8s %14s %14s %9s %9s" %
+          ("suite", "name", "param", "base p50 ns", "new p50 ns", "change", "new p99"))
+
+    regressions = 0
+    for key in list(base) + [k for k in new if k not in base]:
+        suite, name, param = key
+        if key not in new:
+            print("%-8s %-15s %8d %14.1f %14s" % (suite, name, param, base[key]["ns_per_op"]["p50"], "missing"))
+            continue
+        if key not in base:
+            print("%-8s %-15s %8d %14s %14.1f" % (suite, name, param, "missing", new[key]["ns_per_op"]["p50"]))
+            continue
+
+        b = base[key]["ns_per_op"]
+        n = new[key]["ns_per_op"]
+        change = (n["p50"] - b["p50"]) / b["p50"] * 100.0 if b["p50"] > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            flag = "  faster"
+        print("%-8s %-15s %8d %14.1f %14.1f %+8.1f%% %9.1f%s" %
+              (suite, name, param, b["p50"], n["p50"], change, n["p99"], flag))
+
+    if regressions:
+        print("%d regression(s) above %.1f%%" % (regressions, args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
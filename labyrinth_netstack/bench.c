@@ -0,0 +1,827 @@
+
+#define _GNU_SOURCE     // For sched_setaffinity and CPU_COUNT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "l2sap-checksum.h"
+#include "l4sap.h"
+#include "maze.h"
+
+/* Timed repetitions of every benchmark. Their spread gives the
+ * percentiles.
+ */
+#define DEFAULT_SAMPLES 50
+
+/* A sample runs for at least this long, so that the clock's
+ * resolution and the cost of reading it do not matter.
+ */
+#define SAMPLE_NS        2000000.0
+#define QUICK_SAMPLE_NS   200000.0
+
+/* Time that one benchmark may take at most; slow ones get fewer
+ * samples, but never fewer than MIN_SAMPLES.
+ */
+#define BUDGET_NS        1.0e9
+#define QUICK_BUDGET_NS  1.0e8
+#define MIN_SAMPLES      3
+
+#define DEFAULT_MAX_EDGE 4096
+
+static const int checksum_sizes[] = { 8, 64, 256, 1016, 4096, 65536 };
+static const int frame_sizes[]    = { 16, 64, 256, 1016 };
+static const int l4_sizes[]       = { 16, 256, L4Payloadsize };
+static const int solve_edges[]    = { 8, 64, 256, 1024, 4096, 8192 };
+static const int plot_edges[]     = { 8, 64, 256, 1024 };
+static const int scale_edges[]    = { 4096, 8192 };
+
+#define COUNT(a) (int)(sizeof(a)/sizeof((a)[0]))
+
+/* Keeps the compiler from dropping results that are never used. */
+static volatile uint8_t sink;
+
+static int         quick       = 0;
+static int         samples     = DEFAULT_SAMPLES;
+static int         max_edge    = DEFAULT_MAX_EDGE;
+static int         max_threads = 0;
+static const char* suites      = NULL;
+static FILE*       json        = NULL;
+static int         results     = 0;
+static int         failed      = 0;
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-q] [-s suites] [-n samples] [-m max-edge] [-t threads] [-c cpu] [-o file]\n"
+                     "       -q          - quick run: shorter samples, for a smoke test\n"
+                     "       -s suites   - comma separated list of checksum, frame, l4, solve, plot,\n"
+                     "                     scale, codec (default: all)\n"
+                     "       -n samples  - timed samples per benchmark (default %d)\n"
+                     "       -m max-edge - largest maze edge for solve, plot, scale and codec (default %d)\n"
+                     "       -t threads  - most threads for scale (default: one per CPU)\n"
+                     "       -c cpu      - pin the benchmark to this CPU\n"
+                     "       -o file     - write the JSON results to file instead of stdout\n"
+                     "A summary goes to stderr. Compare two result files with bench-compare.py.\n",
+                     name, DEFAULT_SAMPLES, DEFAULT_MAX_EDGE );
+    exit( -1 );
+}
+
+static double now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double( const void* a, const void* b )
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of n sorted values. */
+static double percentile( const double* v, int n, double p )
+{
+    int rank = (int)(p * n + 0.999999);
+    if( rank < 1 ) rank = 1;
+    if( rank > n ) rank = n;
+    return v[rank-1];
+}
+
+static int wanted( const char* suite )
+{
+    if( !suites ) return 1;
+    size_t len = strlen( suite );
+    for( const char* p = suites; *p; )
+    {
+        const char* end = strchr( p, ',' );
+        size_t      n   = end ? (size_t)(end - p) : strlen( p );
+        if( n == len && strncmp( p, suite, n ) == 0 ) return 1;
+        if( !end ) break;
+        p = end + 1;
+    }
+    return 0;
+}
+
+/* Runs ops operations of a benchmark. Returns 0, or -1 if an
+ * operation failed, which stops the benchmark.
+ */
+typedef int (*BenchFn)( void* ctx, long ops );
+
+/* Calibrate, take the samples and report one benchmark. bytes is the
+ * amount of data that one operation handles, for the throughput.
+ * Returns the median time per operation, or 0 if the benchmark failed.
+ */
+static double run( const char* suite, const char* name, int param, double bytes, BenchFn fn, void* ctx )
+{
+    double sample_ns = quick ? QUICK_SAMPLE_NS : SAMPLE_NS;
+    double budget_ns = quick ? QUICK_BUDGET_NS : BUDGET_NS;
+
+    /* Warm caches and branch predictors, then double the operations
+     * per sample until a sample is long enough.
+     */
+    if( fn( ctx, 1 ) < 0 ) goto fail;
+    long   ops = 1;
+    double t;
+    for( ;; )
+    {
+        double t0 = now_ns();
+        if( fn( ctx, ops ) < 0 ) goto fail;
+        t = now_ns() - t0;
+        if( t >= sample_ns || ops >= (1L << 40) ) break;
+        ops *= 2;
+    }
+
+    int n = samples;
+    if( t * n > budget_ns ) n = (int)(budget_ns / t);
+    if( n < MIN_SAMPLES ) n = MIN_SAMPLES;
+
+    double* v = (double*)malloc( n * sizeof(double) );
+    if( !v ) goto fail;
+    double sum = 0;
+    for( int i=0; i<n; i++ )
+    {
+        double t0 = now_ns();
+        if( fn( ctx, ops ) < 0 )
+        {
+            free( v );
+            goto fail;
+        }
+        v[i] = (now_ns() - t0) / ops;
+        sum += v[i];
+    }
+    qsort( v, n, sizeof(double), cmp_double );
+
+    double p50  = percentile( v, n, 0.50 );
+    double mean = sum / n;
+    double mbps = bytes > 0 ? bytes / p50 * 1e3 : 0; /* bytes per ns is GB/s, so MB/s */
+
+    fprintf( stderr, "%-8s %-15s %8d %14.1f %14.1f %14.1f %12.1f\n",
+             suite, name, param, p50, percentile( v, n, 0.99 ), mean, mbps );
+
+    fprintf( json, "%s\n    {\"suite\":\"%s\",\"name\":\"%s\",\"param\":%d,\"samples\":%d,\"ops_per_sample\":%ld,"
+                   "\"bytes_per_op\":%.0f,\"ns_per_op\":{\"min\":%.2f,\"mean\":%.2f,\"p50\":%.2f,\"p90\":%.2f,"
+                   "\"p99\":%.2f,\"max\":%.2f},\"ops_per_s\":%.1f,\"mb_per_s\":%.2f}",
+             results ? "," : "", suite, name, param, n, ops, bytes,
+             v[0], mean, p50, percentile( v, n, 0.90 ), percentile( v, n, 0.99 ), v[n-1],
+             1e9 / p50, mbps );
+    results++;
+    free( v );
+    return p50;
+
+fail:
+    fprintf( stderr, "%-8s %-15s %8d failed\n", suite, name, param );
+    failed = 1;
+    return 0;
+}
+
+/* checksum: the XOR over a buffer, with the variant that L2 uses. */
+typedef struct ChecksumCtx ChecksumCtx;
+
+struct ChecksumCtx
+{
+    const uint8_t* data;
+    int            len;
+};
+
+static int bench_checksum( void* arg, long ops )
+{
+    ChecksumCtx* c   = (ChecksumCtx*)arg;
+    uint8_t      acc = 0;
+    for( long i=0; i<ops; i++ ) acc ^= l2sap_checksum( c->data, c->len );
+    sink = acc;
+    return 0;
+}
+
+/* frame: build a frame (header, payload copy and checksum) as
+ * l2sap_sendto does, and validate and copy it out as the receive
+ * path does.
+ */
+typedef struct FrameCtx FrameCtx;
+
+struct FrameCtx
+{
+    uint8_t*       frame;
+    const uint8_t* payload;
+    uint8_t*       out;
+    int            len;
+};
+
+static int bench_frame_build( void* arg, long ops )
+{
+    FrameCtx* c = (FrameCtx*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        l2sap_frame_header( c->frame, 0x0100007f, L2Headersize + c->len );
+        uint8_t cs = l2sap_checksum_copy( c->frame + L2Headersize, c->payload, c->len );
+        c->frame[offsetof(L2Header, checksum)] = cs ^ l2sap_checksum( c->frame, L2Headersize );
+    }
+    sink = c->frame[offsetof(L2Header, checksum)];
+    return 0;
+}
+
+static int bench_frame_parse( void* arg, long ops )
+{
+    FrameCtx* c = (FrameCtx*)arg;
+    int       payload_len;
+    for( long i=0; i<ops; i++ )
+    {
+        if( l2sap_frame_check_copy( c->frame, L2Headersize + c->len, c->out, c->len, &payload_len ) != L2_FRAME_OK )
+            return -1;
+    }
+    sink = c->out[0];
+    return 0;
+}
+
+/* l4: one DATA packet in each direction between two entities on a
+ * connected pair of UDP sockets on loopback, driven from this thread
+ * with the non-blocking interface. Loopback delivers before sendto
+ * returns, so no operation waits, and the time is the cost of the two
+ * stacks and the system calls.
+ */
+typedef struct L4Ctx L4Ctx;
+
+struct L4Ctx
+{
+    L4SAP*   a;
+    L4SAP*   b;
+    uint8_t* payload;
+    uint8_t* buffer;
+    int      len;
+};
+
+static int bench_l4_rtt( void* arg, long ops )
+{
+    L4Ctx* c = (L4Ctx*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        if( l4sap_send_async( c->a, c->payload, c->len ) < 0 ) return -1;
+        l4sap_poll( c->b, NULL );
+        if( l4sap_recv_async( c->b, c->buffer, L4Payloadsize ) != c->len ) return -1;
+        if( l4sap_send_async( c->b, c->buffer, c->len ) < 0 ) return -1;
+        l4sap_poll( c->a, NULL );     /* the ACK and the answer */
+        if( l4sap_recv_async( c->a, c->buffer, L4Payloadsize ) != c->len ) return -1;
+        l4sap_poll( c->b, NULL );     /* the ACK of the answer */
+    }
+    return 0;
+}
+
+/* A UDP socket on 127.0.0.1 with an ephemeral port. */
+static int loopback_socket( struct sockaddr_in* addr )
+{
+    socklen_t len = sizeof(*addr);
+    int       fd  = socket( AF_INET, SOCK_DGRAM, 0 );
+    if( fd < 0 ) return -1;
+    memset( addr, 0, sizeof(*addr) );
+    addr->sin_family      = AF_INET;
+    addr->sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    if( bind( fd, (struct sockaddr*)addr, sizeof(*addr) ) < 0 ||
+        getsockname( fd, (struct sockaddr*)addr, &len ) < 0 )
+    {
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+/* Two L4 entities whose sockets are connected to each other. */
+static int l4_pair( L4SAP** a, L4SAP** b )
+{
+    struct sockaddr_in addr_a, addr_b;
+    int fa = loopback_socket( &addr_a );
+    int fb = loopback_socket( &addr_b );
+    if( fa < 0 || fb < 0 ||
+        connect( fa, (struct sockaddr*)&addr_b, sizeof(addr_b) ) < 0 ||
+        connect( fb, (struct sockaddr*)&addr_a, sizeof(addr_a) ) < 0 )
+    {
+        perror( "bench: Could not connect a loopback socket pair" );
+        if( fa >= 0 ) close( fa );
+        if( fb >= 0 ) close( fb );
+        return -1;
+    }
+    L2SAP* la = l2sap_create_from_fd( fa );
+    L2SAP* lb = l2sap_create_from_fd( fb );
+    *a = la ? l4sap_create_from_l2( la ) : NULL;
+    *b = lb ? l4sap_create_from_l2( lb ) : NULL;
+    if( !*a || !*b )
+    {
+        if( *a ) l4sap_destroy( *a ); else if( la ) l2sap_destroy( la ); else close( fa );
+        if( *b ) l4sap_destroy( *b ); else if( lb ) l2sap_destroy( lb ); else close( fb );
+        return -1;
+    }
+    return 0;
+}
+
+/* solve and plot: a generated maze of the given edge. mazeSolve
+ * clears its own marks, so every operation solves the same maze.
+ */
+static int bench_solve( void* arg, long ops )
+{
+    Maze* m = (Maze*)arg;
+    for( long i=0; i<ops; i++ ) mazeSolve( m );
+    sink = m->maze[m->endY * m->edgeLen + m->endX];
+    return (m->maze[m->startY * m->edgeLen + m->startX] & mark) ? 0 : -1;
+}
+
+/* The other strategies of mazeSolveEx. */
+typedef struct SolveArg
+{
+    Maze* maze;
+    int   strategy;
+    int   threads;
+} SolveArg;
+
+static int bench_solve_ex( void* arg, long ops )
+{
+    SolveArg*        s    = (SolveArg*)arg;
+    MazeSolveOptions opts = { .strategy = s->strategy, .threads = s->threads };
+    for( long i=0; i<ops; i++ )
+    {
+        if( mazeSolveEx( s->maze, &opts, NULL ) <= 0 ) return -1;
+    }
+    sink = s->maze->maze[s->maze->endY * s->maze->edgeLen + s->maze->endX];
+    return 0;
+}
+
+/* The tiled layout: solving on tiles that already exist, and the
+ * copies between the row-major form and the tiles.
+ */
+static int bench_solve_tiled( void* arg, long ops )
+{
+    MazeTiled* t = (MazeTiled*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        if( mazeSolveTiled( t ) <= 0 ) return -1;
+    }
+    sink = mazeTiledGet( t, t->endX, t->endY );
+    return 0;
+}
+
+static int bench_tile( void* arg, long ops )
+{
+    Maze* m = (Maze*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        MazeTiled t;
+        if( mazeTiledFromMaze( &t, m ) < 0 ) return -1;
+        sink = mazeTiledGet( &t, m->endX, m->endY );
+        mazeTiledFree( &t );
+    }
+    return 0;
+}
+
+typedef struct UntileArg
+{
+    MazeTiled* tiled;
+    Maze*      maze;
+} UntileArg;
+
+static int bench_untile( void* arg, long ops )
+{
+    UntileArg* u = (UntileArg*)arg;
+    for( long i=0; i<ops; i++ ) mazeTiledToMaze( u->tiled, u->maze );
+    sink = u->maze->maze[0];
+    return 0;
+}
+
+/* The packed layout, the same way. */
+static int bench_solve_packed( void* arg, long ops )
+{
+    MazePacked* p = (MazePacked*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        if( mazeSolvePacked( p ) <= 0 ) return -1;
+    }
+    sink = mazePackedGet( p, p->endX, p->endY );
+    return 0;
+}
+
+static int bench_pack( void* arg, long ops )
+{
+    Maze* m = (Maze*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        MazePacked p;
+        if( mazePackedFromMaze( &p, m ) < 0 ) return -1;
+        sink = mazePackedGet( &p, m->endX, m->endY );
+        mazePackedFree( &p );
+    }
+    return 0;
+}
+
+typedef struct UnpackArg
+{
+    MazePacked* packed;
+    Maze*       maze;
+} UnpackArg;
+
+static int bench_unpack( void* arg, long ops )
+{
+    UnpackArg* u = (UnpackArg*)arg;
+    for( long i=0; i<ops; i++ ) mazePackedToMaze( u->packed, u->maze );
+    sink = u->maze->maze[0];
+    return 0;
+}
+
+/* codec: both wire encodings of a solved maze, into a buffer of
+ * mazeEncodedBound bytes and back into a new grid, and the solution as
+ * a path, encoded and verified as the server does it.
+ */
+typedef struct CodecArg
+{
+    Maze*    maze;
+    int      encoding;
+    uint8_t* out;
+    uint32_t cap;
+    int      len;
+} CodecArg;
+
+static int bench_encode( void* arg, long ops )
+{
+    CodecArg* c = (CodecArg*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        c->len = mazeEncode( c->maze, c->encoding, c->out, c->cap );
+        if( c->len < 0 ) return -1;
+    }
+    sink = c->out[c->len-1];
+    return 0;
+}
+
+static int bench_decode( void* arg, long ops )
+{
+    CodecArg* c = (CodecArg*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        Maze m;
+        if( mazeDecode( &m, c->out, c->len ) != c->encoding ) return -1;
+        sink = m.maze[m.size-1];
+        free( m.maze );
+    }
+    return 0;
+}
+
+typedef struct PathArg
+{
+    Maze*     maze;
+    MazePath* path;
+    uint8_t*  out;
+    uint32_t  cap;
+    int       len;
+} PathArg;
+
+static int bench_encode_path( void* arg, long ops )
+{
+    PathArg* p = (PathArg*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        p->len = mazeEncodePath( p->maze, p->path, p->out, p->cap );
+        if( p->len < 0 ) return -1;
+    }
+    sink = p->out[p->len-1];
+    return 0;
+}
+
+/* What the server does with a path: decode it and replay it. */
+static int bench_verify_path( void* arg, long ops )
+{
+    PathArg* p = (PathArg*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        Maze     m;
+        MazePath path;
+        if( mazeDecodePath( &m, &path, p->out, p->len ) != MAZE_ENCODING_PATH ) return -1;
+        int result = mazeVerifyPath( p->maze, &m, &path );
+        mazePathFree( &path );
+        if( result != MAZE_VERIFY_OK ) return -1;
+    }
+    return 0;
+}
+
+/* The same for a raw grid, which is checked where it is. */
+static int bench_verify_raw( void* arg, long ops )
+{
+    Maze* m = (Maze*)arg;
+    for( long i=0; i<ops; i++ )
+    {
+        if( mazeVerify( m, m ) != MAZE_VERIFY_OK ) return -1;
+    }
+    return 0;
+}
+
+static FILE* plot_out;
+
+static int bench_plot( void* arg, long ops )
+{
+    Maze* m = (Maze*)arg;
+    for( long i=0; i<ops; i++ ) mazePlotFile( m, plot_out );
+    return ferror( plot_out ) ? -1 : 0;
+}
+
+static void suite_checksum( void )
+{
+    uint8_t* data = (uint8_t*)aligned_alloc( 64, 65536 );
+    if( !data )
+    {
+        failed = 1;
+        return;
+    }
+    for( int i=0; i<65536; i++ ) data[i] = (uint8_t)(i * 131 + 7);
+
+    for( int i=0; i<COUNT(checksum_sizes); i++ )
+    {
+        ChecksumCtx c = { data, checksum_sizes[i] };
+        run( "checksum", "xor", c.len, c.len, bench_checksum, &c );
+    }
+    free( data );
+}
+
+static void suite_frame( void )
+{
+    uint8_t frame[L2Framesize];
+    uint8_t payload[L2Payloadsize];
+    uint8_t out[L2Payloadsize];
+    for( int i=0; i<L2Payloadsize; i++ ) payload[i] = (uint8_t)(i * 31 + 3);
+
+    for( int i=0; i<COUNT(frame_sizes); i++ )
+    {
+        FrameCtx c = { frame, payload, out, frame_sizes[i] };
+        run( "frame", "build", c.len, c.len, bench_frame_build, &c );
+        run( "frame", "parse", c.len, c.len, bench_frame_parse, &c );
+    }
+}
+
+static void suite_l4( void )
+{
+    uint8_t payload[L4Payloadsize];
+    uint8_t buffer[L4Payloadsize];
+    for( int i=0; i<L4Payloadsize; i++ ) payload[i] = (uint8_t)i;
+
+    for( int i=0; i<COUNT(l4_sizes); i++ )
+    {
+        L4Ctx c = { NULL, NULL, payload, buffer, l4_sizes[i] };
+        if( l4_pair( &c.a, &c.b ) < 0 )
+        {
+            failed = 1;
+            return;
+        }
+        run( "l4", "rtt", c.len, 2.0 * c.len, bench_l4_rtt, &c );
+
+        /* b sends its RESETs after a's socket is closed. On a connected
+         * socket the kernel reports them as ECONNREFUSED, so b is
+         * disconnected in between.
+         */
+        struct sockaddr unspec;
+        memset( &unspec, 0, sizeof(unspec) );
+        unspec.sa_family = AF_UNSPEC;
+        l4sap_destroy( c.a );
+        connect( l4sap_get_fd( c.b ), &unspec, sizeof(unspec) );
+        l4sap_destroy( c.b );
+    }
+}
+
+static void suite_maze( int solve )
+{
+    const int* edges = solve ? solve_edges : plot_edges;
+    int        count = solve ? COUNT(solve_edges) : COUNT(plot_edges);
+
+    for( int i=0; i<count && edges[i] <= max_edge; i++ )
+    {
+        Maze m;
+        if( mazeGenerate( &m, edges[i], 1000 + edges[i] ) < 0 )
+        {
+            failed = 1;
+            return;
+        }
+        if( solve )
+        {
+            run( "solve", "mazeSolve", edges[i], m.size, bench_solve, &m );
+            for( int st=MAZE_STRATEGY_BITS; st<MAZE_STRATEGY_COUNT; st++ )
+            {
+                SolveArg s = { &m, st, 0 };
+                run( "solve", st == MAZE_STRATEGY_BITS ? "mazeSolveBits" : mazeStrategyName( st ),
+                     edges[i], m.size, bench_solve_ex, &s );
+            }
+
+            MazeTiled t;
+            if( mazeTiledFromMaze( &t, &m ) < 0 )
+            {
+                failed = 1;
+                free( m.maze );
+                return;
+            }
+            UntileArg u = { &t, &m };
+            run( "solve", "mazeSolveTiled", edges[i], m.size, bench_solve_tiled, &t );
+            run( "solve", "tile", edges[i], m.size, bench_tile, &m );
+            run( "solve", "untile", edges[i], m.size, bench_untile, &u );
+            mazeTiledFree( &t );
+
+            MazePacked p;
+            if( mazePackedFromMaze( &p, &m ) < 0 )
+            {
+                failed = 1;
+                free( m.maze );
+                return;
+            }
+            UnpackArg pu = { &p, &m };
+            run( "solve", "mazeSolvePacked", edges[i], m.size, bench_solve_packed, &p );
+            run( "solve", "pack", edges[i], m.size, bench_pack, &m );
+            run( "solve", "unpack", edges[i], m.size, bench_unpack, &pu );
+            mazePackedFree( &p );
+        }
+        else
+        {
+            mazeSolve( &m );
+            double bytes = (2.0 * edges[i] + 1) * (2.0 * edges[i] + 2) + 1;
+            run( "plot", "mazePlotFile", edges[i], bytes, bench_plot, &m );
+        }
+        free( m.maze );
+    }
+}
+
+static void suite_codec( void )
+{
+    for( int i=0; i<COUNT(solve_edges) && solve_edges[i] <= max_edge; i++ )
+    {
+        Maze m;
+        if( mazeGenerate( &m, solve_edges[i], 1000 + solve_edges[i] ) < 0 )
+        {
+            failed = 1;
+            return;
+        }
+        MazePath path;
+        if( mazeSolvePath( &m, &path ) < 0 )
+        {
+            failed = 1;
+            free( m.maze );
+            return;
+        }
+
+        uint32_t cap = mazeEncodedBound( &m );
+        uint8_t* out = (uint8_t*)malloc( cap );
+        if( !out )
+        {
+            failed = 1;
+            free( m.maze );
+            return;
+        }
+        int len[2];
+        for( int enc=MAZE_ENCODING_RAW; enc<=MAZE_ENCODING_PACKED; enc++ )
+        {
+            CodecArg c = { &m, enc, out, cap, 0 };
+            run( "codec", enc == MAZE_ENCODING_RAW ? "encode/raw" : "encode/packed",
+                 solve_edges[i], m.size, bench_encode, &c );
+            run( "codec", enc == MAZE_ENCODING_RAW ? "decode/raw" : "decode/packed",
+                 solve_edges[i], m.size, bench_decode, &c );
+            len[enc] = c.len;
+        }
+        run( "codec", "verify/raw", solve_edges[i], m.size, bench_verify_raw, &m );
+
+        /* The path is never longer than the grid, so out has room. */
+        PathArg p = { &m, &path, out, cap, 0 };
+        run( "codec", "encode/path", solve_edges[i], m.size, bench_encode_path, &p );
+        run( "codec", "verify/path", solve_edges[i], m.size, bench_verify_path, &p );
+
+        fprintf( stderr, "%-8s %-15s %8d %d bytes raw, %d packed (%.1f%%), %d path of %u steps (%.2f%%)\n", "", "",
+                 solve_edges[i], len[MAZE_ENCODING_RAW], len[MAZE_ENCODING_PACKED],
+                 100.0 * len[MAZE_ENCODING_PACKED] / len[MAZE_ENCODING_RAW],
+                 p.len, path.steps, 100.0 * p.len / len[MAZE_ENCODING_RAW] );
+        mazePathFree( &path );
+        free( out );
+        free( m.maze );
+    }
+}
+
+/* scale: strong scaling of the parallel solver, the same maze on 1, 2,
+ * 4, ... threads up to max_threads. The speedup is against one thread
+ * of the same solver; mazeSolve is the sequential reference.
+ */
+static void suite_scale( void )
+{
+    int threads = max_threads;
+    if( threads <= 0 )
+    {
+        cpu_set_t set;
+        threads = sched_getaffinity( 0, sizeof(set), &set ) == 0 ? CPU_COUNT( &set ) : 1;
+    }
+
+    for( int i=0; i<COUNT(scale_edges) && scale_edges[i] <= max_edge; i++ )
+    {
+        Maze m;
+        if( mazeGenerate( &m, scale_edges[i], 1000 + scale_edges[i] ) < 0 )
+        {
+            failed = 1;
+            return;
+        }
+        double seq = run( "scale", "mazeSolve", scale_edges[i], m.size, bench_solve, &m );
+        double one = 0;
+        for( int t=1; ; t *= 2 )
+        {
+            if( t > threads ) t = threads;
+            char     name[32];
+            SolveArg s = { &m, MAZE_STRATEGY_PARALLEL, t };
+            snprintf( name, sizeof(name), "parallel/%d", t );
+            double p50 = run( "scale", name, scale_edges[i], m.size, bench_solve_ex, &s );
+            if( t == 1 ) one = p50;
+            if( p50 > 0 && one > 0 )
+            {
+                fprintf( stderr, "%-8s %-15s %8d speedup %.2f (%.0f%% efficiency), %.2f against mazeSolve\n",
+                         "", "", t, one / p50, 100.0 * one / p50 / t, seq / p50 );
+            }
+            if( t == threads ) break;
+        }
+        free( m.maze );
+    }
+}
+
+static void bench_main( void )
+{
+    if( wanted( "checksum" ) ) suite_checksum();
+    if( wanted( "frame" ) )    suite_frame();
+    if( wanted( "l4" ) )       suite_l4();
+    if( wanted( "solve" ) )    suite_maze( 1 );
+    if( wanted( "plot" ) )     suite_maze( 0 );
+    if( wanted( "scale" ) )    suite_scale();
+    if( wanted( "codec" ) )    suite_codec();
+}
+
+int main( int argc, char *argv[] )
+{
+    const char* out = NULL;
+    int         cpu = -1;
+    int         opt;
+    while( (opt = getopt( argc, argv, "qs:n:m:t:c:o:" )) != -1 )
+    {
+        switch( opt )
+        {
+        case 'q' :
+            quick = 1;
+            break;
+        case 's' :
+            suites = optarg;
+            break;
+        case 'n' :
+            samples = atoi( optarg );
+            if( samples < MIN_SAMPLES ) usage( argv[0] );
+            break;
+        case 'm' :
+            max_edge = atoi( optarg );
+            if( max_edge < 1 || max_edge > MAZE_MAX_EDGE ) usage( argv[0] );
+            break;
+        case 't' :
+            max_threads = atoi( optarg );
+            if( max_threads < 1 ) usage( argv[0] );
+            break;
+        case 'c' :
+            cpu = atoi( optarg );
+            break;
+        case 'o' :
+            out = optarg;
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+    if( optind != argc ) usage( argv[0] );
+
+    if( cpu >= 0 )
+    {
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        CPU_SET( cpu, &set );
+        if( sched_setaffinity( 0, sizeof(set), &set ) < 0 ) perror( "bench: Could not pin to the CPU" );
+    }
+
+    json     = out ? fopen( out, "w" ) : stdout;
+    plot_out = fopen( "/dev/null", "w" );
+    if( !json || !plot_out )
+    {
+        perror( "bench: Could not open the output" );
+        return -1;
+    }
+    setvbuf( plot_out, NULL, _IOFBF, 1 << 20 );
+
+    cpu_set_t set;
+    int       cpus = sched_getaffinity( 0, sizeof(set), &set ) == 0 ? CPU_COUNT( &set ) : 1;
+    fprintf( json, "{\"benchmark\":\"labyrinth-netstack\",\"format\":1,\"time\":%ld,\"quick\":%s,"
+                   "\"samples\":%d,\"cpus\":%d,\"pinned_cpu\":%d,\"checksum_variant\":\"%s\",\"compiler\":\"%s\",\n"
+                   "  \"results\":[",
+             (long)time( NULL ), quick ? "true" : "false", samples, cpus, cpu,
+             l2sap_checksum_selected()->name, __VERSION__ );
+    fprintf( stderr, "%-8s %-15s %8s %14s %14s %14s %12s\n",
+             "suite", "name", "param", "p50 ns/op", "p99 ns/op", "mean ns/op", "MB/s" );
+
+    bench_main();
+
+    fprintf( json, "\n  ]}\n" );
+    if( json != stdout ) fclose( json );
+    fclose( plot_out );
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,96 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "l2sap-checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+/* Bytes that are checksummed per size and variant. Large enough that
+ * the timer resolution does not matter, small enough to finish fast.
+ */
+#define BYTES_PER_RUN (256 * 1024 * 1024)
+
+static const size_t sizes[] = { 8, 64, 256, 1016, 1024, 4096, 65536 };
+
+static uint64_t ticks( void )
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/* Keeps the compiler from dropping results that are never used. */
+static volatile uint8_t sink;
+
+int main( void )
+{
+    int                   count;
+    const L2ChecksumImpl* impls = l2sap_checksum_impls( &count );
+
+    uint8_t* src = malloc( 65536 + 64 );
+    uint8_t* dst = malloc( 65536 + 64 );
+    if( !src || !dst )
+    {
+        fprintf( stderr, "%s: Out of memory\n", __FUNCTION__ );
+        return -1;
+    }
+    srand( 1 );
+    for( int i=0; i<65536+64; i++ ) src[i] = (uint8_t)rand();
+
+    printf( "selected: %s\n", l2sap_checksum_selected()->name );
+#ifdef HAVE_TSC
+    printf( "unit: bytes per TSC cycle\n" );
+#else
+    printf( "unit: bytes per ns\n" );
+#endif
+    printf( "%-8s %8s %12s %12s\n", "variant", "size", "checksum", "copy+csum" );
+
+    for( int v=0; v<count; v++ )
+    {
+        for( size_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++ )
+        {
+            size_t len  = sizes[s];
+            long   reps = BYTES_PER_RUN / len;
+
+            // Every variant must agree with the scalar one, also for odd offsets
+            for( int off=0; off<3; off++ )
+            {
+                uint8_t expected = impls[0].checksum( src + off, len );
+                if( impls[v].checksum( src + off, len ) != expected ||
+                    impls[v].checksum_copy( dst, src + off, len ) != expected ||
+                    memcmp( dst, src + off, len ) != 0 )
+                {
+                    fprintf( stderr, "%s: %s gives a wrong result for %zu bytes\n",
+                             __FUNCTION__, impls[v].name, len );
+                    return -1;
+                }
+            }
+
+            uint8_t  acc = 0;
+            uint64_t t0  = ticks();
+            for( long r=0; r<reps; r++ ) acc ^= impls[v].checksum( src, len );
+            uint64_t t1  = ticks();
+            for( long r=0; r<reps; r++ ) acc ^= impls[v].checksum_copy( dst, src, len );
+            uint64_t t2  = ticks();
+            sink = acc;
+
+            double total = (double)reps * len;
+            printf( "%-8s %8zu %12.2f %12.2f\n", impls[v].name, len,
+                    total / (double)(t1 - t0), total / (double)(t2 - t1) );
+        }
+    }
+
+    free( src );
+    free( dst );
+    return 0;
+}
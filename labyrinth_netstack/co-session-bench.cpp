@@ -0,0 +1,149 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "l4sap-co.hpp"
+
+static double now_sec( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [sessions] [rounds] [size]\n"
+                     "       sessions - number of client/server pairs (default 10000)\n"
+                     "       rounds   - request/response exchanges per pair (default 20)\n"
+                     "       size     - bytes per request and response, 1..%d (default 100)\n"
+                     "Every pair is two coroutines on one Scheduler, i.e. one thread.\n"
+                     "The number of sessions is reduced to fit the file descriptor limit.\n",
+                     name, L4Payloadsize );
+    exit( -1 );
+}
+
+struct Stats
+{
+    long long exchanges = 0;
+    int       errors    = 0;
+};
+
+/* Send rounds numbered requests and check that every response is
+ * the request echoed back.
+ */
+static l4co::Task client( l4co::Scheduler& sched, L4SAP* l4, int rounds, int size, Stats* st )
+{
+    l4co::Session s( sched, l4 );
+    uint8_t       req[L4Payloadsize];
+    uint8_t       resp[L4Payloadsize];
+
+    for( int i=0; i<rounds; i++ )
+    {
+        memset( req, (uint8_t)i, size );
+        memcpy( req, &i, sizeof(i) < (size_t)size ? sizeof(i) : (size_t)size );
+        if( co_await s.send( req, size ) != size )
+        {
+            st->errors++;
+            co_return;
+        }
+        int n = co_await s.recv( resp, sizeof(resp) );
+        if( n != size || memcmp( req, resp, size ) != 0 )
+        {
+            st->errors++;
+            co_return;
+        }
+        st->exchanges++;
+    }
+    /* The Session's destructor resets the connection, which ends the server. */
+}
+
+/* Echo every request until the client resets the connection. */
+static l4co::Task server( l4co::Scheduler& sched, L4SAP* l4 )
+{
+    l4co::Session s( sched, l4 );
+    uint8_t       buffer[L4Payloadsize];
+
+    while( 1 )
+    {
+        int n = co_await s.recv( buffer, sizeof(buffer) );
+        if( n < 0 ) break;
+        if( co_await s.send( buffer, n ) < 0 ) break;
+    }
+}
+
+/* Bind an entity to an ephemeral loopback port and return the port. */
+static int bind_any( L4SAP* l4 )
+{
+    struct sockaddr_in addr;
+    socklen_t          addrlen = sizeof(addr);
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port        = 0;
+    if( bind( l4->l2->socket, (struct sockaddr*)&addr, sizeof(addr) ) < 0 ||
+        getsockname( l4->l2->socket, (struct sockaddr*)&addr, &addrlen ) < 0 )
+    {
+        perror( "bind" );
+        return -1;
+    }
+    return ntohs( addr.sin_port );
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc > 4 ) usage( argv[0] );
+
+    int sessions = argc > 1 ? atoi( argv[1] ) : 10000;
+    int rounds   = argc > 2 ? atoi( argv[2] ) : 20;
+    int size     = argc > 3 ? atoi( argv[3] ) : 100;
+    if( sessions <= 0 || rounds <= 0 || size <= 0 || size > L4Payloadsize ) usage( argv[0] );
+
+    /* Every pair needs two sockets. */
+    struct rlimit rl;
+    if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < rl.rlim_max )
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit( RLIMIT_NOFILE, &rl );
+    }
+    if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && (rlim_t)sessions * 2 + 16 > rl.rlim_cur )
+    {
+        sessions = (int)((rl.rlim_cur - 16) / 2);
+        fprintf( stderr, "%s: Only %d sessions fit into the file descriptor limit\n", argv[0], sessions );
+    }
+
+    l4co::Scheduler sched;
+    Stats           st;
+    for( int i=0; i<sessions; i++ )
+    {
+        L4SAP* c = l4sap_create( "127.0.0.1", 9 );
+        L4SAP* s = l4sap_create( "127.0.0.1", 9 );
+        if( !c || !s ) return -1;
+        int c_port = bind_any( c );
+        int s_port = bind_any( s );
+        if( c_port < 0 || s_port < 0 ) return -1;
+        c->l2->peer_addr.sin_port = htons( s_port );
+        s->l2->peer_addr.sin_port = htons( c_port );
+
+        sched.spawn( server( sched, s ) );
+        sched.spawn( client( sched, c, rounds, size, &st ) );
+    }
+
+    double start   = now_sec();
+    int    r       = sched.run( );
+    double elapsed = now_sec() - start;
+
+    struct rusage ru;
+    getrusage( RUSAGE_SELF, &ru );
+
+    printf( "%d sessions, %d rounds of %d bytes, one thread\n", sessions, rounds, size );
+    printf( "  %lld of %lld exchanges in %.2f s, %d errors\n",
+            st.exchanges, (long long)sessions * rounds, elapsed, st.errors );
+    printf( "  %10.0f exchanges/s, max RSS %ld KB (%.1f KB per pair)\n",
+            st.exchanges / elapsed, ru.ru_maxrss, (double)ru.ru_maxrss / sessions );
+    return (r < 0 || st.errors > 0) ? -1 : 0;
+}
@@ -0,0 +1,296 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "l2sap.h"
+
+/* How long the server waits at most before it looks for idle sessions
+ * and for Ctrl-C, in microseconds.
+ */
+#define TICK_US 100000
+
+/* A peer is one session of an L2 server, and a server holds at most
+ * max_sessions of them. The L2 protocol has no goodbye, so sessions
+ * that have been quiet for this long are closed.
+ */
+#define DEFAULT_IDLE_SEC 10
+
+static volatile sig_atomic_t stop = 0;
+
+static int verbose  = 0;
+static int idle_sec = DEFAULT_IDLE_SEC;
+
+static void on_signal( int sig )
+{
+    (void)sig;
+    stop = 1;
+}
+
+static double now_sec( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-v] [-t threads] [-i idle] <port>\n"
+                     "       -v         - print every session and the counters at the end\n"
+                     "       -t threads - serve with this many threads, all bound to the port\n"
+                     "                    with SO_REUSEPORT (default 1)\n"
+                     "       -i idle    - close sessions that were quiet for idle seconds (default %d)\n"
+                     "       port       - The UDP port to serve on\n"
+                     "Every valid L2 frame is sent back to its sender. Stop with Ctrl-C.\n",
+                     name, DEFAULT_IDLE_SEC );
+    exit( -1 );
+}
+
+/* One server thread with its own socket and sessions. */
+typedef struct Worker Worker;
+
+struct Worker
+{
+    pthread_t thread;
+    int       index;
+    L2SAP*    server;
+
+    /* The accepted sessions. Every session's L2SAP.upper holds its
+     * index here + 1, and last[i] the time of its last frame.
+     */
+    L2SAP**   sessions;
+    double*   last;
+    int       count;
+    int       capacity;
+
+    long long frames;
+    long long bytes;
+    long long send_errors;
+    long long sessions_total;
+    long long sessions_idle;
+};
+
+static void add_session( Worker* w, L2SAP* l2, double now )
+{
+    if( w->count == w->capacity )
+    {
+        int     capacity = w->capacity ? 2 * w->capacity : 64;
+        L2SAP** sessions = (L2SAP**)realloc( w->sessions, capacity * sizeof(L2SAP*) );
+        double* last     = sessions ? (double*)realloc( w->last, capacity * sizeof(double) ) : NULL;
+        if( sessions ) w->sessions = sessions;
+        if( !sessions || !last )
+        {
+            fprintf( stderr, "%s: Could not grow the session list\n", __FUNCTION__ );
+            l2sap_destroy( l2 );
+            return;
+        }
+        w->last     = last;
+        w->capacity = capacity;
+    }
+    w->sessions[w->count] = l2;
+    w->last[w->count]     = now;
+    l2->upper = (void*)(intptr_t)(w->count + 1);
+    w->count++;
+    w->sessions_total++;
+
+    if( verbose )
+    {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop( AF_INET, &l2->peer_addr.sin_addr, ip, sizeof(ip) );
+        fprintf( stderr, "thread %d: new session %s:%d\n", w->index, ip, ntohs( l2->peer_addr.sin_port ) );
+    }
+}
+
+/* Move the last session into the hole and close the session. */
+static void remove_session( Worker* w, int index )
+{
+    L2SAP* l2   = w->sessions[index];
+    int    last = w->count - 1;
+    if( index != last )
+    {
+        w->sessions[index] = w->sessions[last];
+        w->last[index]     = w->last[last];
+        w->sessions[index]->upper = (void*)(intptr_t)(index + 1);
+    }
+    w->count--;
+
+    if( verbose )
+    {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop( AF_INET, &l2->peer_addr.sin_addr, ip, sizeof(ip) );
+        fprintf( stderr, "thread %d: closing session %s:%d\n", w->index, ip, ntohs( l2->peer_addr.sin_port ) );
+    }
+    l2sap_destroy( l2 );
+}
+
+/* Send back everything that is queued for one session, up to
+ * L2_BATCH_MAX frames with one sendmmsg call at a time.
+ */
+static void echo( Worker* w, L2SAP* l2, uint8_t (*buffers)[L2Payloadsize], L2Msg* msgs )
+{
+    for( ;; )
+    {
+        for( int i=0; i<L2_BATCH_MAX; i++ )
+        {
+            msgs[i].data = buffers[i];
+            msgs[i].len  = L2Payloadsize;
+        }
+        struct timeval zero = { 0, 0 };
+        int n = l2sap_recvfrom_batch( l2, msgs, L2_BATCH_MAX, &zero );
+        if( n <= 0 ) return;
+
+        for( int i=0; i<n; i++ ) w->bytes += msgs[i].len;
+        w->frames += n;
+
+        int sent = l2sap_sendto_batch( l2, msgs, n );
+        if( sent < n ) w->send_errors += n - ( sent < 0 ? 0 : sent );
+        if( n < L2_BATCH_MAX ) return;
+    }
+}
+
+static void* worker_main( void* arg )
+{
+    Worker*  w     = (Worker*)arg;
+    double   check = now_sec() + 1;
+    L2Msg    msgs[L2_BATCH_MAX];
+    uint8_t (*buffers)[L2Payloadsize] = malloc( L2_BATCH_MAX * L2Payloadsize );
+    if( !buffers )
+    {
+        fprintf( stderr, "%s: Could not allocate buffers\n", __FUNCTION__ );
+        return NULL;
+    }
+
+    while( !stop )
+    {
+        struct timeval tv = { 0, TICK_US };
+        if( l2sap_server_poll( w->server, &tv ) < 0 )
+        {
+            if( !stop ) fprintf( stderr, "thread %d: Polling the server failed\n", w->index );
+            break;
+        }
+        double now = now_sec();
+
+        while( w->server->server->accept_head )
+        {
+            struct timeval zero = { 0, 0 };
+            L2SAP*         l2   = l2sap_server_accept( w->server, &zero );
+            if( l2 ) add_session( w, l2, now );
+        }
+
+        L2SAP* l2;
+        while( (l2 = l2sap_server_next_ready( w->server )) )
+        {
+            if( !l2->upper ) continue;
+            w->last[(intptr_t)l2->upper - 1] = now;
+            echo( w, l2, buffers, msgs );
+        }
+
+        if( now >= check )
+        {
+            for( int i=0; i<w->count; i++ )
+            {
+                if( now - w->last[i] > idle_sec )
+                {
+                    remove_session( w, i );
+                    w->sessions_idle++;
+                    i--;
+                }
+            }
+            check = now + 1;
+        }
+    }
+
+    free( buffers );
+    return NULL;
+}
+
+int main( int argc, char *argv[] )
+{
+    int threads = 1;
+    int opt;
+    while( (opt = getopt( argc, argv, "vt:i:" )) != -1 )
+    {
+        switch( opt )
+        {
+        case 'v' :
+            verbose = 1;
+            break;
+        case 't' :
+            threads = atoi( optarg );
+            if( threads < 1 ) usage( argv[0] );
+            break;
+        case 'i' :
+            idle_sec = atoi( optarg );
+            if( idle_sec < 1 ) usage( argv[0] );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+    if( argc - optind != 1 ) usage( argv[0] );
+    int port = atoi( argv[optind] );
+
+    struct sigaction sa;
+    memset( &sa, 0, sizeof(sa) );
+    sa.sa_handler = on_signal;
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+
+    L2ServerConfig config;
+    memset( &config, 0, sizeof(config) );
+    config.reuseport = threads > 1;
+
+    Worker* w = (Worker*)calloc( threads, sizeof(Worker) );
+    if( !w )
+    {
+        fprintf( stderr, "%s: Could not allocate %d threads\n", __FUNCTION__, threads );
+        return -1;
+    }
+    for( int i=0; i<threads; i++ )
+    {
+        w[i].index  = i;
+        w[i].server = l2sap_server_create_ex( port, &config );
+        if( !w[i].server )
+        {
+            fprintf( stderr, "%s: Failed to create server on port %d\n", __FUNCTION__, port );
+            return -1;
+        }
+    }
+    for( int i=0; i<threads; i++ )
+    {
+        pthread_create( &w[i].thread, NULL, worker_main, &w[i] );
+    }
+    fprintf( stderr, "%s: Serving port %d with %d thread(s)\n", argv[0], port, threads );
+
+    long long frames = 0, bytes = 0, send_errors = 0, sessions = 0, idle = 0, drops = 0;
+    for( int i=0; i<threads; i++ )
+    {
+        pthread_join( w[i].thread, NULL );
+        frames      += w[i].frames;
+        bytes       += w[i].bytes;
+        send_errors += w[i].send_errors;
+        sessions    += w[i].sessions_total;
+        idle        += w[i].sessions_idle;
+        drops       += w[i].server->server->drops_invalid + w[i].server->server->drops_no_session;
+
+        while( w[i].count > 0 ) remove_session( &w[i], w[i].count - 1 );
+        free( w[i].sessions );
+        free( w[i].last );
+        l2sap_destroy( w[i].server );
+    }
+    free( w );
+
+    if( verbose )
+    {
+        fprintf( stderr, "%s: %lld frames (%lld bytes) echoed, %lld send errors, "
+                         "%lld sessions (%lld closed when idle), %lld frames dropped\n",
+                 argv[0], frames, bytes, send_errors, sessions, idle, drops );
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/select.h>
+
+#include "l2sap.h"
+
+/* Number of frames that are sent before the receiver drains them.
+ * It is kept below the default UDP receive buffer so that loopback
+ * does not drop frames in the middle of a burst.
+ */
+#define BURST 32
+
+static double now_sec( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [frames] [payload]\n"
+                     "       frames  - number of frames per measurement (default 200000)\n"
+                     "       payload - payload bytes per frame, at most %d (default %d)\n",
+                     name, L2Payloadsize, L2Payloadsize );
+    exit( -1 );
+}
+
+/* Create two L2 entities on loopback that point at each other.
+ * l2sap_create does not bind, so the receiver is bound to an
+ * ephemeral port here and the sender is created for that port.
+ */
+static int make_pair( L2SAP** tx, L2SAP** rx )
+{
+    *rx = l2sap_create( "127.0.0.1", 9 );
+    if( !*rx ) return -1;
+
+    struct sockaddr_in addr;
+    socklen_t          addrlen = sizeof(addr);
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port        = 0;
+    if( bind( (*rx)->socket, (struct sockaddr*)&addr, sizeof(addr) ) < 0 ||
+        getsockname( (*rx)->socket, (struct sockaddr*)&addr, &addrlen ) < 0 )
+    {
+        perror( "bind" );
+        return -1;
+    }
+
+    *tx = l2sap_create( "127.0.0.1", ntohs(addr.sin_port) );
+    if( !*tx ) return -1;
+    return 0;
+}
+
+static double run_single( L2SAP* tx, L2SAP* rx, uint8_t* payload, int len, int frames, int* lost )
+{
+    uint8_t        buffer[L2Payloadsize];
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    int            done = 0;
+
+    *lost = 0;
+    double start = now_sec();
+    while( done < frames )
+    {
+        int burst = frames - done < BURST ? frames - done : BURST;
+        for( int i=0; i<burst; i++ )
+        {
+            l2sap_sendto( tx, payload, len );
+        }
+        for( int i=0; i<burst; i++ )
+        {
+            if( l2sap_recvfrom_timeout( rx, buffer, sizeof(buffer), &tv ) != len )
+            {
+                (*lost)++;
+                break;
+            }
+        }
+        done += burst;
+    }
+    return now_sec() - start;
+}
+
+static double run_batch( L2SAP* tx, L2SAP* rx, uint8_t* payload, int len, int frames, int* lost )
+{
+    static uint8_t buffers[BURST][L2Payloadsize];
+    L2Msg          out[BURST];
+    L2Msg          in[BURST];
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    int            done = 0;
+
+    for( int i=0; i<BURST; i++ )
+    {
+        out[i].data = payload;
+        out[i].len  = len;
+    }
+
+    *lost = 0;
+    double start = now_sec();
+    while( done < frames )
+    {
+        int burst = frames - done < BURST ? frames - done : BURST;
+        l2sap_sendto_batch( tx, out, burst );
+
+        int got = 0;
+        while( got < burst )
+        {
+            for( int i=0; i<burst-got; i++ )
+            {
+                in[i].data = buffers[i];
+                in[i].len  = L2Payloadsize;
+            }
+            int n = l2sap_recvfrom_batch( rx, in, burst-got, &tv );
+            if( n <= 0 )
+            {
+                *lost += burst - got;
+                break;
+            }
+            for( int i=0; i<n; i++ )
+            {
+                if( in[i].status != L2_FRAME_OK || in[i].len != len ) (*lost)++;
+            }
+            got += n;
+        }
+        done += burst;
+    }
+    return now_sec() - start;
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc > 3 ) usage( argv[0] );
+
+    int frames = argc > 1 ? atoi( argv[1] ) : 200000;
+    int len    = argc > 2 ? atoi( argv[2] ) : L2Payloadsize;
+    if( frames <= 0 || len < 0 || len > L2Payloadsize ) usage( argv[0] );
+
+    L2SAP* tx;
+    L2SAP* rx;
+    if( make_pair( &tx, &rx ) < 0 )
+    {
+        fprintf( stderr, "%s: Failed to create loopback pair\n", __FUNCTION__ );
+        return -1;
+    }
+
+    uint8_t payload[L2Payloadsize];
+    for( int i=0; i<len; i++ ) payload[i] = (uint8_t)(i * 7 + 1);
+
+    int    lost_single, lost_batch;
+    double t_single = run_single( tx, rx, payload, len, frames, &lost_single );
+    double t_batch  = run_batch( tx, rx, payload, len, frames, &lost_batch );
+
+    printf( "frames=%d payload=%d burst=%d\n", frames, len, BURST );
+    printf( "single: %10.0f frames/s  (%.3f s, %d lost)\n", frames / t_single, t_single, lost_single );
+    printf( "batch:  %10.0f frames/s  (%.3f s, %d lost)\n", frames / t_batch, t_batch, lost_batch );
+    printf( "speedup: %.2fx\n", t_single / t_batch );
+
+    l2sap_destroy( tx );
+    l2sap_destroy( rx );
+    return 0;
+}
@@ -0,0 +1,212 @@
+#include <string.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "l2sap-checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define L2_CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+// Slaar sammen 8 bytes til en, XOR er assosiativ saa rekkefoelgen spiller ingen rolle
+static inline uint8_t fold64(uint64_t v) {
+    v ^= v >> 32;
+    v ^= v >> 16;
+    v ^= v >> 8;
+    return (uint8_t)v;
+}
+
+/* Portabel variant: XOR 8 bytes om gangen, resten byte for byte. */
+static uint8_t checksum_scalar(const uint8_t* data, size_t len) {
+    uint64_t acc = 0;
+    size_t   i   = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, sizeof(w)); // Ujustert lesing uten undefined behaviour
+        acc ^= w;
+    }
+    uint8_t checksum = fold64(acc);
+    for (; i < len; ++i) {
+        checksum ^= data[i];
+    }
+    return checksum;
+}
+
+static uint8_t checksum_copy_scalar(uint8_t* dst, const uint8_t* src, size_t len) {
+    uint64_t acc = 0;
+    size_t   i   = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, src + i, sizeof(w));
+        memcpy(dst + i, &w, sizeof(w));
+        acc ^= w;
+    }
+    uint8_t checksum = fold64(acc);
+    for (; i < len; ++i) {
+        dst[i] = src[i];
+        checksum ^= src[i];
+    }
+    return checksum;
+}
+
+#ifdef L2_CHECKSUM_X86
+
+__attribute__((target("sse2")))
+static uint8_t fold128(__m128i v) {
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, v);
+    return fold64(lanes[0] ^ lanes[1]);
+}
+
+/* SSE2: fire uavhengige akkumulatorer, 64 bytes per runde. */
+__attribute__((target("sse2")))
+static uint8_t checksum_sse2(const uint8_t* data, size_t len) {
+    if (len < 16) { // F.eks. L2 headeren, her koster vektor-oppsettet mer enn det sparer
+        return checksum_scalar(data, len);
+    }
+    __m128i a0 = _mm_setzero_si128();
+    __m128i a1 = a0, a2 = a0, a3 = a0;
+    size_t  i  = 0;
+    for (; i + 64 <= len; i += 64) {
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i*)(data + i)));
+        a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i*)(data + i + 16)));
+        a2 = _mm_xor_si128(a2, _mm_loadu_si128((const __m128i*)(data + i + 32)));
+        a3 = _mm_xor_si128(a3, _mm_loadu_si128((const __m128i*)(data + i + 48)));
+    }
+    a0 = _mm_xor_si128(_mm_xor_si128(a0, a1), _mm_xor_si128(a2, a3));
+    for (; i + 16 <= len; i += 16) {
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i*)(data + i)));
+    }
+    return fold128(a0) ^ checksum_scalar(data + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static uint8_t checksum_copy_sse2(uint8_t* dst, const uint8_t* src, size_t len) {
+    if (len < 16) {
+        return checksum_copy_scalar(dst, src, len);
+    }
+    __m128i a0 = _mm_setzero_si128();
+    __m128i a1 = a0;
+    size_t  i  = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m128i v0 = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        _mm_storeu_si128((__m128i*)(dst + i), v0);
+        _mm_storeu_si128((__m128i*)(dst + i + 16), v1);
+        a0 = _mm_xor_si128(a0, v0);
+        a1 = _mm_xor_si128(a1, v1);
+    }
+    a0 = _mm_xor_si128(a0, a1);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+        a0 = _mm_xor_si128(a0, v);
+    }
+    return fold128(a0) ^ checksum_copy_scalar(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint8_t fold256(__m256i v) {
+    __m128i x = _mm_xor_si128(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, x);
+    return fold64(lanes[0] ^ lanes[1]);
+}
+
+/* AVX2: fire akkumulatorer paa 32 bytes, 128 bytes per runde. */
+__attribute__((target("avx2")))
+static uint8_t checksum_avx2(const uint8_t* data, size_t len) {
+    if (len < 32) {
+        return checksum_scalar(data, len);
+    }
+    __m256i a0 = _mm256_setzero_si256();
+    __m256i a1 = a0, a2 = a0, a3 = a0;
+    size_t  i  = 0;
+    for (; i + 128 <= len; i += 128) {
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i*)(data + i)));
+        a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((const __m256i*)(data + i + 32)));
+        a2 = _mm256_xor_si256(a2, _mm256_loadu_si256((const __m256i*)(data + i + 64)));
+        a3 = _mm256_xor_si256(a3, _mm256_loadu_si256((const __m256i*)(data + i + 96)));
+    }
+    a0 = _mm256_xor_si256(_mm256_xor_si256(a0, a1), _mm256_xor_si256(a2, a3));
+    for (; i + 32 <= len; i += 32) {
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i*)(data + i)));
+    }
+    return fold256(a0) ^ checksum_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint8_t checksum_copy_avx2(uint8_t* dst, const uint8_t* src, size_t len) {
+    if (len < 32) {
+        return checksum_copy_scalar(dst, src, len);
+    }
+    __m256i a0 = _mm256_setzero_si256();
+    __m256i a1 = a0;
+    size_t  i  = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        _mm256_storeu_si256((__m256i*)(dst + i), v0);
+        _mm256_storeu_si256((__m256i*)(dst + i + 32), v1);
+        a0 = _mm256_xor_si256(a0, v0);
+        a1 = _mm256_xor_si256(a1, v1);
+    }
+    a0 = _mm256_xor_si256(a0, a1);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+        a0 = _mm256_xor_si256(a0, v);
+    }
+    return fold256(a0) ^ checksum_copy_scalar(dst + i, src + i, len - i);
+}
+
+#endif /* L2_CHECKSUM_X86 */
+
+/* Rekkefoelgen er viktig: hver variant forutsetter de foregaaende. */
+static const L2ChecksumImpl impls[] = {
+    { "scalar", checksum_scalar, checksum_copy_scalar },
+#ifdef L2_CHECKSUM_X86
+    { "sse2",   checksum_sse2,   checksum_copy_sse2 },
+    { "avx2",   checksum_avx2,   checksum_copy_avx2 },
+#endif
+};
+
+static const L2ChecksumImpl* selected_impl = NULL;
+
+// Velger den beste varianten CPUen stoetter
+static const L2ChecksumImpl* select_impl(void) {
+    const L2ChecksumImpl* impl = &impls[0];
+#ifdef L2_CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impl = &impls[2];
+    } else if (__builtin_cpu_supports("sse2")) {
+        impl = &impls[1];
+    }
+#endif
+    // Flere traader kan komme hit samtidig, men de skriver samme verdi
+    __atomic_store_n(&selected_impl, impl, __ATOMIC_RELEASE);
+    return impl;
+}
+
+const L2ChecksumImpl* l2sap_checksum_selected(void) {
+    const L2ChecksumImpl* impl = __atomic_load_n(&selected_impl, __ATOMIC_ACQUIRE);
+    if (!impl) {
+        impl = select_impl();
+    }
+    return impl;
+}
+
+const L2ChecksumImpl* l2sap_checksum_impls(int* count) {
+    *count = (int)(l2sap_checksum_selected() - impls) + 1;
+    return impls;
+}
+
+uint8_t l2sap_checksum(const uint8_t* data, size_t len) {
+    return l2sap_checksum_selected()->checksum(data, len);
+}
+
+uint8_t l2sap_checksum_copy(uint8_t* dst, const uint8_t* src, size_t len) {
+    return l2sap_checksum_selected()->checksum_copy(dst, src, len);
+}
@@ -0,0 +1,41 @@
+#ifndef L2SAP_CHECKSUM_H
+#define L2SAP_CHECKSUM_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/* The L2 checksum is the XOR of all bytes of a frame. These functions
+ * compute it with the widest vector unit that the CPU supports. The
+ * variant is chosen at runtime on the first call; on CPUs other than
+ * x86 the portable scalar variant is always used.
+ */
+
+/* XOR of len bytes starting at data. */
+uint8_t l2sap_checksum( const uint8_t* data, size_t len );
+
+/* Copy len bytes from src to dst and return their XOR. This touches
+ * every byte once, instead of once for the copy and once more for
+ * the checksum.
+ */
+uint8_t l2sap_checksum_copy( uint8_t* dst, const uint8_t* src, size_t len );
+
+/* One implementation of the two functions above. */
+typedef struct L2ChecksumImpl L2ChecksumImpl;
+
+struct L2ChecksumImpl
+{
+    const char* name;
+    uint8_t   (*checksum)( const uint8_t* data, size_t len );
+    uint8_t   (*checksum_copy)( uint8_t* dst, const uint8_t* src, size_t len );
+};
+
+/* All implementations that this CPU can run, best one last.
+ * *count receives the number of entries. Meant for benchmarks.
+ */
+const L2ChecksumImpl* l2sap_checksum_impls( int* count );
+
+/* The implementation that l2sap_checksum uses on this CPU. */
+const L2ChecksumImpl* l2sap_checksum_selected( void );
+
+#endif
+
@@ -0,0 +1,447 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "l2sap.h"
+#include "l2sap-server.h"
+#include "trace.h"
+
+/* The impairment state of one entity. Only the thread that owns the
+ * entity uses it.
+ */
+struct L2Impair
+{
+    L2Impairment conf;
+    uint64_t     rng;
+};
+
+/* A frame that waits in the background thread until due. */
+typedef struct HeldFrame HeldFrame;
+
+struct HeldFrame
+{
+    struct timespec    due;
+    uint64_t           order;   /* frames with the same due time keep their order */
+    int                socket;
+    struct sockaddr_in addr;
+    int                len;
+    uint8_t            data[L2Framesize];
+};
+
+static L2Impairment env_conf;
+static int          env_set;
+static uint32_t     next_entity;
+
+/* Min-heap of held frames by due time, shared by all entities of the
+ * process and emptied by wire_main.
+ */
+static pthread_once_t  wire_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t wire_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wire_cond;
+static int             wire_started;
+static HeldFrame**     held;
+static int             held_count;
+static uint64_t        held_order;
+
+static uint64_t   rng_next(uint64_t* state);
+static double     rng_uniform(uint64_t* state);
+static void       wire_start(void);
+static void*      wire_main(void* arg);
+static int        wire_hold(int socket, const struct sockaddr_in* addr, const uint8_t* frame, int len, long hold_us);
+static int        held_before(const HeldFrame* a, const HeldFrame* b);
+static void       heap_up(int i);
+static void       heap_down(int i);
+
+/* Leser L2_IMPAIR foer main, som NETSTACK_TRACE i trace.c. */
+__attribute__((constructor))
+static void impair_env_init(void) {
+    const char* spec = getenv("L2_IMPAIR");
+    if (!spec || !*spec) {
+        return;
+    }
+    if (l2sap_parse_impairment(spec, &env_conf) < 0) {
+        fprintf(stderr, "L2_IMPAIR: Ignoring invalid settings \"%s\".\n", spec);
+        return;
+    }
+    env_set = 1;
+}
+
+/**
+ * @brief Parses impairment settings of the form key=value,key=value.
+ *
+ * The keys are loss, corrupt, dup, reorder, delay_us, jitter_us,
+ * reorder_us and seed.
+ *
+ * @param spec The settings.
+ * @param imp Receives the settings; keys that are missing are 0.
+ * @return int 0 on success, -1 on an unknown key or a bad value.
+ */
+int l2sap_parse_impairment(const char* spec, L2Impairment* imp) {
+    if (!spec || !imp) {
+        fprintf(stderr, "L2SAP parse_impairment: Invalid arguments.\n");
+        return -1;
+    }
+    memset(imp, 0, sizeof(*imp));
+
+    const char* p = spec;
+    while (*p) {
+        const char* eq  = strchr(p, '=');
+        const char* end = strchr(p, ',');
+        if (!end) {
+            end = p + strlen(p);
+        }
+        if (!eq || eq > end) {
+            fprintf(stderr, "L2SAP parse_impairment: Expected key=value at \"%s\".\n", p);
+            return -1;
+        }
+
+        char value[32];
+        size_t key_len = (size_t)(eq - p);
+        size_t val_len = (size_t)(end - eq - 1);
+        if (val_len == 0 || val_len >= sizeof(value)) {
+            fprintf(stderr, "L2SAP parse_impairment: Bad value at \"%s\".\n", p);
+            return -1;
+        }
+        memcpy(value, eq + 1, val_len);
+        value[val_len] = '\0';
+
+        char* rest;
+        errno = 0;
+        if (key_len == 4 && strncmp(p, "loss", 4) == 0) {
+            imp->loss = strtod(value, &rest);
+        } else if (key_len == 7 && strncmp(p, "corrupt", 7) == 0) {
+            imp->corrupt = strtod(value, &rest);
+        } else if (key_len == 3 && strncmp(p, "dup", 3) == 0) {
+            imp->duplicate = strtod(value, &rest);
+        } else if (key_len == 7 && strncmp(p, "reorder", 7) == 0) {
+            imp->reorder = strtod(value, &rest);
+        } else if (key_len == 8 && strncmp(p, "delay_us", 8) == 0) {
+            imp->delay_us = strtol(value, &rest, 10);
+        } else if (key_len == 9 && strncmp(p, "jitter_us", 9) == 0) {
+            imp->jitter_us = strtol(value, &rest, 10);
+        } else if (key_len == 10 && strncmp(p, "reorder_us", 10) == 0) {
+            imp->reorder_us = strtol(value, &rest, 10);
+        } else if (key_len == 4 && strncmp(p, "seed", 4) == 0) {
+            imp->seed = strtoull(value, &rest, 0);
+        } else {
+            fprintf(stderr, "L2SAP parse_impairment: Unknown key \"%.*s\".\n", (int)key_len, p);
+            return -1;
+        }
+        if (errno != 0 || *rest != '\0') {
+            fprintf(stderr, "L2SAP parse_impairment: Bad value \"%s\".\n", value);
+            return -1;
+        }
+
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return 0;
+}
+
+/**
+ * @brief Turns the impairment stage of an entity on, or off with NULL.
+ *
+ * @param sap Pointer to the L2SAP structure.
+ * @param imp The settings, or NULL.
+ * @return int 0 on success, -1 if a setting is out of range.
+ */
+int l2sap_set_impairment(L2SAP* sap, const L2Impairment* imp) {
+    if (!sap) {
+        fprintf(stderr, "L2SAP set_impairment: Invalid arguments.\n");
+        return -1;
+    }
+    if (!imp) {
+        free(sap->impair);
+        sap->impair = NULL;
+        return 0;
+    }
+    if (imp->loss < 0 || imp->loss > 1 || imp->corrupt < 0 || imp->corrupt > 1 ||
+        imp->duplicate < 0 || imp->duplicate > 1 || imp->reorder < 0 || imp->reorder > 1 ||
+        imp->delay_us < 0 || imp->jitter_us < 0 || imp->reorder_us < 0) {
+        fprintf(stderr, "L2SAP set_impairment: Probabilities must be in [0,1] and times >= 0.\n");
+        return -1;
+    }
+
+    if (!sap->impair) {
+        sap->impair = (L2Impair*)malloc(sizeof(L2Impair));
+        if (!sap->impair) {
+            perror("Failed to allocate L2SAP impairment");
+            return -1;
+        }
+    }
+    sap->impair->conf = *imp;
+    if (sap->impair->conf.reorder_us == 0) {
+        sap->impair->conf.reorder_us = L2_IMPAIR_REORDER_USEC;
+    }
+    // xorshift64* maa ikke starte paa 0, og naerliggende seeds skal gi ulike tall
+    sap->impair->rng = imp->seed * 0x9E3779B97F4A7C15ull + 0x2545F4914F6CDD1Dull;
+    if (sap->impair->rng == 0) {
+        sap->impair->rng = 1;
+    }
+    return 0;
+}
+
+void l2sap_impair_init(L2SAP* sap) {
+    if (!env_set) {
+        return;
+    }
+    L2Impairment conf = env_conf;
+    conf.seed += __atomic_fetch_add(&next_entity, 1, __ATOMIC_RELAXED); // Hver entitet faar sin egen rekke
+    l2sap_set_impairment(sap, &conf);
+}
+
+void l2sap_impair_inherit(L2SAP* session, const L2SAP* server) {
+    if (!server->impair) {
+        return;
+    }
+    L2Impairment conf = server->impair->conf;
+    conf.seed += __atomic_fetch_add(&next_entity, 1, __ATOMIC_RELAXED);
+    l2sap_set_impairment(session, &conf);
+}
+
+void l2sap_impair_free(L2SAP* sap, int close_socket) {
+    free(sap->impair);
+    sap->impair = NULL;
+
+    if (!close_socket || !__atomic_load_n(&wire_started, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    // Socketen lukkes, og nummeret kan gaa til en ny socket. Frames som
+    // fortsatt holdes (f.eks. RESET fra l4sap_destroy) sendes derfor naa.
+    pthread_mutex_lock(&wire_lock);
+    int kept = 0;
+    for (int i = 0; i < held_count; i++) {
+        if (held[i]->socket == sap->socket) {
+            sendto(held[i]->socket, held[i]->data, held[i]->len, 0, (struct sockaddr*)&held[i]->addr,
+                   sizeof(held[i]->addr));
+            free(held[i]);
+        } else {
+            held[kept++] = held[i];
+        }
+    }
+    held_count = kept;
+    for (int i = held_count / 2 - 1; i >= 0; i--) { // Bygg heapen paa nytt
+        heap_down(i);
+    }
+    pthread_mutex_unlock(&wire_lock);
+}
+
+/**
+ * @brief Sends a frame through the impairment stage.
+ *
+ * The random numbers are drawn in the same order for every frame, so
+ * the decisions depend only on the seed and the number of frames sent
+ * before.
+ *
+ * @param sap Pointer to the L2SAP structure; sap->impair is set.
+ * @param iov The frame, L2 header included.
+ * @param iovcnt Number of segments.
+ * @param len Length of the frame.
+ * @return int len, or -1 if sendto failed.
+ */
+int l2sap_impair_send(L2SAP* sap, const struct iovec* iov, int iovcnt, int len) {
+    L2Impair* imp = sap->impair;
+    uint8_t   frame[L2Framesize];
+    int       off = 0;
+    for (int i = 0; i < iovcnt && off < len; i++) { // Samle framen, den kan bli endret under
+        int take = ((int)iov[i].iov_len < len - off) ? (int)iov[i].iov_len : len - off;
+        memcpy(frame + off, iov[i].iov_base, take);
+        off += take;
+    }
+
+    double   drop    = rng_uniform(&imp->rng);
+    double   corrupt = rng_uniform(&imp->rng);
+    uint64_t bit     = rng_next(&imp->rng);
+    double   dup     = rng_uniform(&imp->rng);
+
+    if (drop < imp->conf.loss) {
+        TRACE(TRACE_PACKET, TRACE_L2_IMPAIR_DROP, len);
+        sap->stats.impair_dropped++;
+        for (int i = 0; i < 2; i++) { // Trekk resten, saa neste frame faar de samme tallene uansett
+            rng_next(&imp->rng);
+            rng_next(&imp->rng);
+        }
+        return len;
+    }
+    if (corrupt < imp->conf.corrupt && len > 0) {
+        uint32_t b = (uint32_t)(bit % (uint64_t)(len * 8));
+        frame[b / 8] ^= (uint8_t)(1u << (b % 8));
+        TRACE(TRACE_PACKET, TRACE_L2_IMPAIR_CORRUPT, len, b);
+        sap->stats.impair_corrupted++;
+    }
+    int copies = (dup < imp->conf.duplicate) ? 2 : 1;
+    if (copies == 2) {
+        sap->stats.impair_duplicated++;
+    }
+
+    int result = len;
+    for (int c = 0; c < 2; c++) {
+        double jitter  = rng_uniform(&imp->rng);
+        double reorder = rng_uniform(&imp->rng);
+        if (c >= copies) {
+            break;
+        }
+
+        long hold = imp->conf.delay_us;
+        if (imp->conf.jitter_us > 0) {
+            hold += (long)((2.0 * jitter - 1.0) * (double)imp->conf.jitter_us);
+        }
+        if (reorder < imp->conf.reorder) {
+            hold += imp->conf.reorder_us;
+        }
+
+        if (hold > 0) {
+            TRACE(TRACE_PACKET, TRACE_L2_IMPAIR_HOLD, len, hold);
+            sap->stats.impair_held++;
+            if (wire_hold(sap->socket, &sap->peer_addr, frame, len, hold) < 0) {
+                sap->stats.impair_dropped++;
+            }
+            continue;
+        }
+        ssize_t sent = sendto(sap->socket, frame, len, 0, (struct sockaddr*)&sap->peer_addr, sizeof(sap->peer_addr));
+        if (sent < 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/* xorshift64*: raskt, og godt nok til aa bestemme tap og forsinkelse. */
+static uint64_t rng_next(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+// Jevnt fordelt i [0, 1) fra de oeverste 53 bitene
+static double rng_uniform(uint64_t* state) {
+    return (double)(rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void wire_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // Samme klokke som due
+    pthread_cond_init(&wire_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    held = (HeldFrame**)malloc(L2_IMPAIR_MAX_HELD * sizeof(HeldFrame*));
+    pthread_t thread;
+    if (!held || pthread_create(&thread, NULL, wire_main, NULL) != 0) {
+        fprintf(stderr, "L2SAP impair: Could not start the delay thread, held frames are dropped.\n");
+        free(held);
+        held = NULL;
+        return;
+    }
+    pthread_detach(thread);
+    __atomic_store_n(&wire_started, 1, __ATOMIC_RELEASE);
+}
+
+/* Sender holdte frames naar tiden deres er kommet. Traaden lever til
+ * prosessen avslutter; frames som fortsatt venter da, gaar tapt.
+ */
+static void* wire_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&wire_lock);
+    while (1) {
+        if (held_count == 0) {
+            pthread_cond_wait(&wire_cond, &wire_lock);
+            continue;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        HeldFrame* f = held[0];
+        if (f->due.tv_sec > now.tv_sec || (f->due.tv_sec == now.tv_sec && f->due.tv_nsec > now.tv_nsec)) {
+            pthread_cond_timedwait(&wire_cond, &wire_lock, &f->due);
+            continue;
+        }
+        held[0] = held[--held_count];
+        heap_down(0);
+        // Under laasen, saa l2sap_impair_free ikke kan lukke socketen imens
+        sendto(f->socket, f->data, f->len, 0, (struct sockaddr*)&f->addr, sizeof(f->addr));
+        free(f);
+    }
+    return NULL;
+}
+
+static int wire_hold(int socket, const struct sockaddr_in* addr, const uint8_t* frame, int len, long hold_us) {
+    pthread_once(&wire_once, wire_start);
+    if (!held) {
+        return -1;
+    }
+
+    HeldFrame* f = (HeldFrame*)malloc(sizeof(HeldFrame));
+    if (!f) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &f->due);
+    f->due.tv_sec  += hold_us / 1000000L;
+    f->due.tv_nsec += (hold_us % 1000000L) * 1000L;
+    if (f->due.tv_nsec >= 1000000000L) {
+        f->due.tv_sec++;
+        f->due.tv_nsec -= 1000000000L;
+    }
+    f->socket = socket;
+    f->addr   = *addr;
+    f->len    = len;
+    memcpy(f->data, frame, len);
+
+    pthread_mutex_lock(&wire_lock);
+    if (held_count == L2_IMPAIR_MAX_HELD) {
+        pthread_mutex_unlock(&wire_lock);
+        free(f);
+        return -1;
+    }
+    f->order = held_order++;
+    held[held_count] = f;
+    heap_up(held_count++);
+    if (held[0] == f) { // Ny foerste frame, traaden maa vaakne tidligere
+        pthread_cond_signal(&wire_cond);
+    }
+    pthread_mutex_unlock(&wire_lock);
+    return 0;
+}
+
+static int held_before(const HeldFrame* a, const HeldFrame* b) {
+    if (a->due.tv_sec != b->due.tv_sec) return a->due.tv_sec < b->due.tv_sec;
+    if (a->due.tv_nsec != b->due.tv_nsec) return a->due.tv_nsec < b->due.tv_nsec;
+    return a->order < b->order;
+}
+
+static void heap_up(int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!held_before(held[i], held[parent])) {
+            break;
+        }
+        HeldFrame* t = held[i];
+        held[i] = held[parent];
+        held[parent] = t;
+        i = parent;
+    }
+}
+
+static void heap_down(int i) {
+    while (1) {
+        int l = 2 * i + 1;
+        int r = l + 1;
+        int m = i;
+        if (l < held_count && held_before(held[l], held[m])) m = l;
+        if (r < held_count && held_before(held[r], held[m])) m = r;
+        if (m == i) {
+            break;
+        }
+        HeldFrame* t = held[i];
+        held[i] = held[m];
+        held[m] = t;
+        i = m;
+    }
+}
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE     // For recvmmsg
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "l2sap.h"
+#include "l2sap-server.h"
+#include "trace.h"
+
+/* Cache line size of the CPUs we run on. L2Framesize is a multiple of
+ * it, so every buffer in a pool starts on its own cache line.
+ */
+#define L2_CACHELINE 64
+
+static void pool_free(L2BufPool* pool);
+
+/**
+ * @brief Creates a pool of receive buffers.
+ *
+ * All frame buffers are allocated in one cache-aligned block, and the
+ * handles in a second one.
+ *
+ * @param count Number of buffers.
+ * @return L2BufPool* Pointer to the pool, or NULL on error.
+ */
+L2BufPool* l2bufpool_create(int count) {
+    if (count <= 0) {
+        fprintf(stderr, "L2SAP pool: Invalid buffer count %d.\n", count);
+        return NULL;
+    }
+
+    L2BufPool* pool = (L2BufPool*)calloc(1, sizeof(L2BufPool));
+    if (!pool) {
+        perror("Failed to allocate L2SAP buffer pool");
+        return NULL;
+    }
+    pool->memory = (uint8_t*)aligned_alloc(L2_CACHELINE, (size_t)count * L2Framesize);
+    pool->bufs   = (L2Buf*)calloc((size_t)count, sizeof(L2Buf));
+    if (!pool->memory || !pool->bufs) {
+        perror("Failed to allocate L2SAP buffer pool");
+        pool_free(pool);
+        return NULL;
+    }
+    pool->count = count;
+
+    // Bygg fri-lista baklengs, saa foerste buffer deles ut foerst
+    for (int i = count - 1; i >= 0; i--) {
+        L2Buf* b     = &pool->bufs[i];
+        b->data      = pool->memory + (size_t)i * L2Framesize;
+        b->pool      = pool;
+        b->next_free = pool->free_list;
+        pool->free_list = b;
+    }
+    return pool;
+}
+
+/**
+ * @brief Destroys a pool.
+ *
+ * Buffers that are still lent out stay valid; the pool is freed by
+ * the l2buf_release of the last one.
+ *
+ * @param pool The pool, NULL is ignored.
+ */
+void l2bufpool_destroy(L2BufPool* pool) {
+    if (!pool) {
+        return;
+    }
+    if (pool->in_use > 0) { // Noen har fortsatt buffere, la den siste frigjoere
+        pool->orphaned = 1;
+        return;
+    }
+    pool_free(pool);
+}
+
+/**
+ * @brief Takes a free buffer from a pool.
+ *
+ * @param pool The pool.
+ * @return L2Buf* The buffer, or NULL if all buffers are lent out.
+ */
+L2Buf* l2bufpool_get(L2BufPool* pool) {
+    L2Buf* b = pool->free_list;
+    if (!b) {
+        return NULL;
+    }
+    pool->free_list = b->next_free;
+    pool->in_use++;
+    b->next_free = NULL;
+    b->offset    = 0;
+    b->len       = 0;
+    b->lent      = 1;
+    return b;
+}
+
+/**
+ * @brief Gives a lent buffer back to its pool.
+ *
+ * @param buf The buffer, NULL is ignored.
+ */
+void l2buf_release(L2Buf* buf) {
+    if (!buf) {
+        return;
+    }
+    if (!buf->lent) { // Dobbel release ville oedelagt fri-lista
+        fprintf(stderr, "L2SAP pool: Buffer released twice, ignoring.\n");
+        return;
+    }
+    L2BufPool* pool = buf->pool;
+    buf->lent       = 0;
+    buf->next_free  = pool->free_list;
+    pool->free_list = buf;
+    pool->in_use--;
+
+    if (pool->orphaned && pool->in_use == 0) {
+        pool_free(pool);
+    }
+}
+
+/**
+ * @brief Receives an L2 frame into a pool buffer, with an optional timeout.
+ *
+ * Invalid frames are discarded like in l2sap_recvfrom_timeout, and
+ * the same buffer is used for the next attempt.
+ *
+ * @param client Pointer to the L2SAP structure.
+ * @param buf Receives the lent buffer, or NULL.
+ * @param timeout Optional timeout value. If NULL, waits indefinitely.
+ * @return int Payload length, L2_TIMEOUT (0) if timeout occurred,
+ * or -1 on error.
+ */
+int l2sap_recv_lend(L2SAP* client, L2Buf** buf, struct timeval* timeout) {
+    if (!client || client->socket < 0 || !buf) { // Sjekk om argumentene er gyldige
+        fprintf(stderr, "L2SAP recv_lend: Invalid arguments.\n");
+        return -1;
+    }
+    *buf = NULL;
+    if (client->server && !client->session) {
+        fprintf(stderr, "L2SAP recv_lend: Use l2sap_server_accept on a server entity.\n");
+        return -1;
+    }
+
+    if (!client->pool) { // Alloker poolen ved foerste bruk
+        client->pool = l2bufpool_create(L2_POOL_BUFFERS);
+        if (!client->pool) {
+            return -1;
+        }
+    }
+
+    L2Buf* b = l2bufpool_get(client->pool);
+    if (!b) {
+        fprintf(stderr, "L2SAP recv_lend: All %d buffers are lent out.\n", client->pool->count);
+        return -1;
+    }
+    b->offset = L2Headersize;
+
+    if (client->session) { // Sesjonen har allerede validert framen inn i koen sin
+        int r = l2sap_session_wait(client, timeout);
+        if (r <= 0) {
+            l2buf_release(b);
+            return r;
+        }
+        L2Msg msg;
+        msg.data = b->data + L2Headersize;
+        msg.len  = L2Payloadsize;
+        l2sap_session_pop(client, &msg);
+        b->len  = msg.len;
+        b->addr = msg.addr;
+        *buf = b;
+        TRACE(TRACE_PACKET, TRACE_L2_RECV, b->len);
+        return b->len;
+    }
+
+    struct iovec   iov;
+    struct mmsghdr mmsg;
+    while (1) {
+        iov.iov_base = b->data;
+        iov.iov_len  = L2Framesize;
+        memset(&mmsg, 0, sizeof(mmsg));
+        mmsg.msg_hdr.msg_name    = &b->addr;
+        mmsg.msg_hdr.msg_namelen = sizeof(b->addr);
+        mmsg.msg_hdr.msg_iov     = &iov;
+        mmsg.msg_hdr.msg_iovlen  = 1;
+
+        int r = l2sap_recvmmsg_wait(client, &mmsg, 1, timeout);
+        if (r <= 0) {
+            l2buf_release(b);
+            return r;
+        }
+
+        // Validerer i bufferet, payload blir liggende der den er
+        int payload_len;
+        int status = l2sap_frame_check(b->data, (int)mmsg.msg_len, &payload_len);
+        l2sap_count_in(client, status, payload_len);
+        if (status != L2_FRAME_OK) {
+            TRACE(TRACE_ERROR, TRACE_L2_DROP_INVALID, status, mmsg.msg_len);
+            continue; // Vent for neste frame i samme buffer
+        }
+
+        b->len = payload_len;
+        *buf = b;
+        TRACE(TRACE_PACKET, TRACE_L2_RECV, payload_len);
+        return payload_len;
+    }
+}
+
+/**
+ * @brief Replaces the receive pool of an entity.
+ *
+ * @param client Pointer to the L2SAP structure.
+ * @param count Number of buffers in the new pool.
+ * @return int 0 on success, -1 on error.
+ */
+int l2sap_set_pool_size(L2SAP* client, int count) {
+    if (!client) {
+        fprintf(stderr, "L2SAP set_pool_size: Invalid arguments.\n");
+        return -1;
+    }
+    L2BufPool* pool = l2bufpool_create(count);
+    if (!pool) {
+        return -1;
+    }
+    l2bufpool_destroy(client->pool); // Utlaante buffere frigjoeres ved siste release
+    client->pool = pool;
+    return 0;
+}
+
+static void pool_free(L2BufPool* pool) {
+    free(pool->memory);
+    free(pool->bufs);
+    free(pool);
+}
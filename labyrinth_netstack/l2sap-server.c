@@ -0,0 +1,545 @@
+#define _GNU_SOURCE     // For recvmmsg
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <inttypes.h>
+
+#include "l2sap.h"
+#include "l2sap-server.h"
+#include "trace.h"
+
+static uint64_t   addr_key(const struct sockaddr_in* addr);
+static uint32_t   key_slot(const L2Server* srv, uint64_t key);
+static L2Session* session_create(L2Server* srv, const struct sockaddr_in* addr);
+static void       session_free(L2Server* srv, L2Session* s);
+static void       list_remove_ready(L2Server* srv, L2Session* s);
+static void       list_remove_accept(L2Server* srv, L2Session* s);
+static void       deadline_start(struct timespec* deadline, const struct timeval* timeout);
+static void       deadline_left(const struct timespec* deadline, struct timeval* left);
+
+/**
+ * @brief Creates a server-side L2SAP entity with default limits.
+ *
+ * @param port The UDP port the server listens on.
+ * @return L2SAP* Pointer to the server entity, or NULL on error.
+ */
+L2SAP* l2sap_server_create(int port) {
+    return l2sap_server_create_ex(port, NULL);
+}
+
+/**
+ * @brief Creates a server-side L2SAP entity.
+ *
+ * Binds one UDP socket to the port on all local interfaces and
+ * allocates the session table. The table has at least twice as many
+ * slots as sessions, so that linear probing stays short.
+ *
+ * @param port The UDP port the server listens on.
+ * @param config Optional limits, NULL for the defaults.
+ * @return L2SAP* Pointer to the server entity, or NULL on error.
+ */
+L2SAP* l2sap_server_create_ex(int port, const L2ServerConfig* config) {
+    int max_sessions = (config && config->max_sessions > 0) ? config->max_sessions : L2_SERVER_MAX_SESSIONS;
+    int queue_len    = (config && config->queue_len > 0)    ? config->queue_len    : L2_SESSION_QUEUE_LEN;
+
+    L2SAP*    sap = (L2SAP*)calloc(1, sizeof(L2SAP));
+    L2Server* srv = (L2Server*)calloc(1, sizeof(L2Server));
+    if (!sap || !srv) {
+        perror("Failed to allocate memory for L2SAP server");
+        free(sap);
+        free(srv);
+        return NULL;
+    }
+
+    uint32_t table_size = 16;
+    while (table_size < 2u * (uint32_t)max_sessions) { // Minst halvparten av tabellen er ledig
+        table_size <<= 1;
+    }
+    srv->table = (L2ServerSlot*)calloc(table_size, sizeof(L2ServerSlot));
+    if (!srv->table) {
+        perror("Failed to allocate L2SAP session table");
+        free(srv);
+        free(sap);
+        return NULL;
+    }
+    srv->table_mask   = table_size - 1;
+    srv->max_sessions = max_sessions;
+    srv->queue_len    = queue_len;
+    srv->entity       = sap;
+
+    sap->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sap->socket < 0) {
+        perror("L2SAP server socket creation failed");
+        free(srv->table);
+        free(srv);
+        free(sap);
+        return NULL;
+    }
+
+    int one = 1;
+    if (config && config->reuseport &&
+        setsockopt(sap->socket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("L2SAP server SO_REUSEPORT failed");
+        close(sap->socket);
+        free(srv->table);
+        free(srv);
+        free(sap);
+        return NULL;
+    }
+
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family      = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port        = htons(port);
+    if (bind(sap->socket, (struct sockaddr*)&local, sizeof(local)) < 0) {
+        perror("L2SAP server bind failed");
+        close(sap->socket);
+        free(srv->table);
+        free(srv);
+        free(sap);
+        return NULL;
+    }
+
+    sap->peer_addr.sin_family = AF_INET; // Serveren selv har ingen peer
+    sap->server  = srv;
+    sap->session = NULL;
+    l2sap_impair_init(sap);
+
+    TRACE(TRACE_INFO, TRACE_L2_SERVER_CREATE, port, max_sessions);
+    return sap;
+}
+
+/**
+ * @brief Reads waiting datagrams and sorts them into sessions.
+ *
+ * Up to L2_BATCH_MAX datagrams are read with one recvmmsg call. Valid
+ * frames are appended to the queue of the session of their sender;
+ * a session is created for every new sender. Invalid frames, frames
+ * for which no session can be created and frames for full queues
+ * are counted and dropped.
+ *
+ * @param server Pointer to the server entity.
+ * @param timeout How long to wait for the first datagram, NULL for ever.
+ * @return int Number of datagrams read, L2_TIMEOUT (0) if none
+ * arrived, or -1 on error.
+ */
+int l2sap_server_poll(L2SAP* server, struct timeval* timeout) {
+    if (!server || !server->server || server->session) {
+        fprintf(stderr, "L2SAP server_poll: Not a server entity.\n");
+        return -1;
+    }
+    L2Server* srv = server->server;
+
+    if (!server->batch_buffer) { // Alloker mottaksomraadet ved foerste bruk
+        server->batch_buffer = (uint8_t*)malloc((size_t)L2_BATCH_MAX * L2Framesize);
+        if (!server->batch_buffer) {
+            perror("Failed to allocate L2SAP batch buffer");
+            return -1;
+        }
+    }
+
+    struct sockaddr_in addrs[L2_BATCH_MAX];
+    struct iovec       iov[L2_BATCH_MAX];
+    struct mmsghdr     mmsg[L2_BATCH_MAX];
+    for (int i = 0; i < L2_BATCH_MAX; i++) {
+        iov[i].iov_base = server->batch_buffer + (size_t)i * L2Framesize;
+        iov[i].iov_len  = L2Framesize;
+        memset(&mmsg[i], 0, sizeof(mmsg[i]));
+        mmsg[i].msg_hdr.msg_name    = &addrs[i];
+        mmsg[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        mmsg[i].msg_hdr.msg_iov     = &iov[i];
+        mmsg[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    int received = l2sap_recvmmsg_wait(server, mmsg, L2_BATCH_MAX, timeout);
+    if (received <= 0) {
+        return received;
+    }
+
+    for (int i = 0; i < received; i++) {
+        const uint8_t* frame = (const uint8_t*)iov[i].iov_base;
+        int            len   = (int)mmsg[i].msg_len;
+        int            payload_len;
+
+        uint64_t   key  = addr_key(&addrs[i]);
+        uint32_t   slot = key_slot(srv, key);
+        L2Session* s    = NULL;
+        while (srv->table[slot].session) { // Lineaer proeving til vi treffer noekkelen eller en ledig plass
+            if (srv->table[slot].key == key) {
+                s = srv->table[slot].session;
+                break;
+            }
+            slot = (slot + 1) & srv->table_mask;
+        }
+
+        if (s && s->queue_count < srv->queue_len) {
+            // Vanlig tilfelle: valider og kopier rett inn i koen i en runde
+            L2QueuedFrame* qf = &s->queue[(s->queue_head + s->queue_count) % srv->queue_len];
+            int status = l2sap_frame_check_copy(frame, len, qf->data, L2Payloadsize, &payload_len);
+            l2sap_count_in(server, status, payload_len);
+            if (status != L2_FRAME_OK) {
+                srv->drops_invalid++; // Samme regler som l2sap_recvfrom_timeout, bare telles
+                continue;
+            }
+            qf->len = payload_len;
+        } else {
+            // Ny peer eller full koe: valider foer vi lager en sesjon eller teller en drop
+            int status = l2sap_frame_check(frame, len, &payload_len);
+            l2sap_count_in(server, status, payload_len);
+            if (status != L2_FRAME_OK) {
+                srv->drops_invalid++;
+                continue;
+            }
+            if (!s) {
+                s = session_create(srv, &addrs[i]);
+                if (!s) {
+                    srv->drops_no_session++;
+                    continue;
+                }
+                srv->table[slot].key     = key;
+                srv->table[slot].session = s;
+            }
+            if (s->queue_count == srv->queue_len) { // Koen er full, dropp framen
+                s->drops_queue_full++;
+                continue;
+            }
+            L2QueuedFrame* qf = &s->queue[(s->queue_head + s->queue_count) % srv->queue_len];
+            qf->len = payload_len;
+            memcpy(qf->data, frame + L2Headersize, payload_len);
+        }
+        s->queue_count++;
+        s->frames_queued++;
+
+        if (!s->in_ready) { // Legg sesjonen bakerst i ready-lista
+            s->ready_prev = srv->ready_tail;
+            s->ready_next = NULL;
+            if (srv->ready_tail) srv->ready_tail->ready_next = s;
+            else                 srv->ready_head = s;
+            srv->ready_tail = s;
+            s->in_ready = 1;
+        }
+    }
+
+    return received;
+}
+
+/**
+ * @brief Returns the next new session of a server.
+ *
+ * @param server Pointer to the server entity.
+ * @param timeout How long to wait for a new peer, NULL for ever.
+ * @return L2SAP* The session entity, or NULL on timeout or error.
+ */
+L2SAP* l2sap_server_accept(L2SAP* server, struct timeval* timeout) {
+    if (!server || !server->server || server->session) {
+        fprintf(stderr, "L2SAP server_accept: Not a server entity.\n");
+        return NULL;
+    }
+    L2Server* srv = server->server;
+
+    struct timespec deadline;
+    if (timeout) {
+        deadline_start(&deadline, timeout);
+    }
+
+    while (!srv->accept_head) {
+        struct timeval  remaining;
+        struct timeval* p_tv = NULL;
+        if (timeout) { // Regn ut hvor lang tid som er igjen
+            deadline_left(&deadline, &remaining);
+            p_tv = &remaining;
+        }
+
+        int r = l2sap_server_poll(server, p_tv);
+        if (r < 0) {
+            return NULL;
+        }
+        if (r == L2_TIMEOUT && !srv->accept_head) {
+            return NULL;
+        }
+    }
+
+    L2Session* s = srv->accept_head;
+    list_remove_accept(srv, s);
+    return &s->sap;
+}
+
+/**
+ * @brief Returns a session with queued frames, or NULL.
+ */
+L2SAP* l2sap_server_next_ready(L2SAP* server) {
+    if (!server || !server->server || server->session) {
+        return NULL;
+    }
+    L2Server* srv = server->server;
+
+    while (srv->ready_head) {
+        L2Session* s = srv->ready_head;
+        list_remove_ready(srv, s);
+        if (s->queue_count > 0) {
+            return &s->sap;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the session of a peer, or returns NULL.
+ */
+L2SAP* l2sap_server_lookup(L2SAP* server, const struct sockaddr_in* addr) {
+    if (!server || !server->server || !addr) {
+        return NULL;
+    }
+    L2Server* srv  = server->server;
+    uint64_t  key  = addr_key(addr);
+    uint32_t  slot = key_slot(srv, key);
+    while (srv->table[slot].session) {
+        if (srv->table[slot].key == key) {
+            return &srv->table[slot].session->sap;
+        }
+        slot = (slot + 1) & srv->table_mask;
+    }
+    return NULL;
+}
+
+/* Venter til sesjonens koe ikke er tom. Mens vi venter leses server
+ * socketen, og frames til andre sesjoner havner i deres koer.
+ */
+int l2sap_session_wait(L2SAP* sap, struct timeval* timeout) {
+    L2Session* s   = sap->session;
+    L2Server*  srv = sap->server;
+
+    struct timespec deadline;
+    if (timeout) {
+        deadline_start(&deadline, timeout);
+    }
+
+    while (s->queue_count == 0) {
+        struct timeval  remaining;
+        struct timeval* p_tv = NULL;
+        if (timeout) { // Regn ut hvor lang tid som er igjen
+            deadline_left(&deadline, &remaining);
+            p_tv = &remaining;
+        }
+
+        int r = l2sap_server_poll(srv->entity, p_tv);
+        if (r < 0) {
+            return -1;
+        }
+        if (r == L2_TIMEOUT && s->queue_count == 0) {
+            return L2_TIMEOUT;
+        }
+    }
+    return 1;
+}
+
+/* Tar den eldste framen ut av sesjonens koe og kopierer payload til
+ * msg->data. Returnerer 0 hvis koen er tom.
+ */
+int l2sap_session_pop(L2SAP* sap, L2Msg* msg) {
+    L2Session* s   = sap->session;
+    L2Server*  srv = sap->server;
+
+    if (s->queue_count == 0) {
+        return 0;
+    }
+
+    L2QueuedFrame* qf = &s->queue[s->queue_head];
+    s->queue_head = (s->queue_head + 1) % srv->queue_len;
+    s->queue_count--;
+    if (s->queue_count == 0) { // Ingenting mer aa hente, ta den ut av ready-lista
+        list_remove_ready(srv, s);
+    }
+
+    int copy_len = (qf->len < msg->len) ? qf->len : msg->len; // Min(payload_len, user_buffer_len)
+    if (copy_len > 0) {
+        memcpy(msg->data, qf->data, copy_len);
+    }
+    msg->status = (qf->len > msg->len) ? L2_FRAME_TRUNCATED : L2_FRAME_OK;
+    l2sap_count_in(sap, msg->status, qf->len);
+    msg->len    = copy_len;
+    msg->addr   = sap->peer_addr;
+    return 1;
+}
+
+int l2sap_session_recv(L2SAP* sap, uint8_t* data, int len, struct timeval* timeout) {
+    int r = l2sap_session_wait(sap, timeout);
+    if (r <= 0) {
+        return r;
+    }
+
+    L2Msg msg;
+    msg.data = data;
+    msg.len  = len;
+    l2sap_session_pop(sap, &msg);
+    if (msg.status == L2_FRAME_TRUNCATED) {
+        fprintf(stderr, "L2SAP recv: Warning: Received payload larger than provided buffer (%d bytes), truncated.\n",
+                len);
+    }
+    TRACE(TRACE_PACKET, TRACE_L2_RECV, msg.len);
+    return msg.len;
+}
+
+/* Fjerner en sesjon fra serveren, eller frigjoer hele serveren. */
+void l2sap_server_destroy(L2SAP* sap) {
+    L2Server* srv = sap->server;
+
+    if (sap->session) {
+        L2Session* s    = sap->session;
+        uint64_t   key  = addr_key(&s->sap.peer_addr);
+        uint32_t   slot = key_slot(srv, key);
+        while (srv->table[slot].session && srv->table[slot].session != s) {
+            slot = (slot + 1) & srv->table_mask;
+        }
+        if (srv->table[slot].session == s) {
+            // Backward shift sletting, saa proevesekvensene forblir hele
+            uint32_t hole = slot;
+            srv->table[hole].session = NULL;
+            uint32_t j = hole;
+            while (1) {
+                j = (j + 1) & srv->table_mask;
+                if (!srv->table[j].session) {
+                    break;
+                }
+                uint32_t home = key_slot(srv, srv->table[j].key);
+                // Flytt bare hvis hjemmeplassen ikke ligger syklisk i (hole, j]
+                int stays = (hole <= j) ? (home > hole && home <= j)
+                                        : (home > hole || home <= j);
+                if (!stays) {
+                    srv->table[hole] = srv->table[j];
+                    srv->table[j].session = NULL;
+                    hole = j;
+                }
+            }
+        }
+        session_free(srv, s);
+        return;
+    }
+
+    for (uint32_t i = 0; i <= srv->table_mask; i++) { // Frigjoer alle sesjoner
+        if (srv->table[i].session) {
+            session_free(srv, srv->table[i].session);
+        }
+    }
+    l2sap_impair_free(sap, 1);
+    if (sap->socket >= 0) {
+        close(sap->socket);
+    }
+    free(srv->table);
+    free(srv);
+    free(sap->batch_buffer);
+    l2bufpool_destroy(sap->pool);
+    free(sap);
+    TRACE(TRACE_INFO, TRACE_L2_SERVER_DESTROY, 0);
+}
+
+// Noekkelen er IPv4 adressen og porten, begge i nettverk byte order
+static uint64_t addr_key(const struct sockaddr_in* addr) {
+    return ((uint64_t)addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
+
+// Fibonacci hashing, de oeverste bitene av produktet er best fordelt
+static uint32_t key_slot(const L2Server* srv, uint64_t key) {
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & srv->table_mask;
+}
+
+static L2Session* session_create(L2Server* srv, const struct sockaddr_in* addr) {
+    if (srv->num_sessions >= srv->max_sessions) { // Tabellen er full
+        return NULL;
+    }
+
+    L2Session* s = (L2Session*)calloc(1, sizeof(L2Session));
+    if (!s) {
+        return NULL;
+    }
+    s->queue = (L2QueuedFrame*)malloc((size_t)srv->queue_len * sizeof(L2QueuedFrame));
+    if (!s->queue) {
+        free(s);
+        return NULL;
+    }
+
+    s->sap.socket       = srv->entity->socket; // Deler socket med serveren
+    s->sap.peer_addr    = *addr;
+    s->sap.batch_buffer = NULL;
+    s->sap.pool         = NULL;
+    s->sap.server       = srv;
+    s->sap.session      = s;
+    s->sap.upper        = NULL;
+    l2sap_impair_inherit(&s->sap, srv->entity);
+
+    // Legg den nye sesjonen bakerst i accept-lista
+    s->accept_prev = srv->accept_tail;
+    s->accept_next = NULL;
+    if (srv->accept_tail) srv->accept_tail->accept_next = s;
+    else                  srv->accept_head = s;
+    srv->accept_tail = s;
+    s->in_accept = 1;
+
+    srv->num_sessions++;
+    return s;
+}
+
+static void session_free(L2Server* srv, L2Session* s) {
+    list_remove_accept(srv, s);
+    list_remove_ready(srv, s);
+    srv->num_sessions--;
+    l2sap_impair_free(&s->sap, 0); // Socketen er serverens
+    free(s->sap.batch_buffer);
+    l2bufpool_destroy(s->sap.pool); // Utlaante buffere frigjoeres ved siste release
+    free(s->queue);
+    free(s);
+}
+
+static void list_remove_ready(L2Server* srv, L2Session* s) {
+    if (!s->in_ready) {
+        return;
+    }
+    if (s->ready_prev) s->ready_prev->ready_next = s->ready_next;
+    else               srv->ready_head = s->ready_next;
+    if (s->ready_next) s->ready_next->ready_prev = s->ready_prev;
+    else               srv->ready_tail = s->ready_prev;
+    s->ready_prev = s->ready_next = NULL;
+    s->in_ready = 0;
+}
+
+// Absolutt tidspunkt (CLOCK_MONOTONIC) naar timeout er ute
+static void deadline_start(struct timespec* deadline, const struct timeval* timeout) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec  += timeout->tv_sec;
+    deadline->tv_nsec += timeout->tv_usec * 1000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// Tiden som er igjen til deadline, aldri negativ
+static void deadline_left(const struct timespec* deadline, struct timeval* left) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long left_us = (deadline->tv_sec - now.tv_sec) * 1000000LL
+                      + (deadline->tv_nsec - now.tv_nsec) / 1000;
+    if (left_us < 0) left_us = 0;
+    left->tv_sec  = left_us / 1000000;
+    left->tv_usec = left_us % 1000000;
+}
+
+static void list_remove_accept(L2Server* srv, L2Session* s) {
+    if (!s->in_accept) {
+        return;
+    }
+    if (s->accept_prev) s->accept_prev->accept_next = s->accept_next;
+    else                srv->accept_head = s->accept_next;
+    if (s->accept_next) s->accept_next->accept_prev = s->accept_prev;
+    else                srv->accept_tail = s->accept_prev;
+    s->accept_prev = s->accept_next = NULL;
+    s->in_accept = 0;
+}
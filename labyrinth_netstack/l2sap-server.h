@@ -0,0 +1,64 @@
+#ifndef L2SAP_SERVER_H
+#define L2SAP_SERVER_H
+
+#include "l2sap.h"
+
+/* Internal interface between l2sap.c, l2sap-server.c, l2sap-pool.c
+ * and l2sap-impair.c.
+ * Applications use the server functions that are declared in l2sap.h.
+ */
+
+struct mmsghdr;
+
+/* Receive up to count datagrams into mmsg with one recvmmsg call.
+ * Only if none are queued, wait with poll() for up to timeout
+ * (forever if NULL) and try again.
+ * Returns the number of datagrams, L2_TIMEOUT, or -1 on error.
+ */
+int  l2sap_recvmmsg_wait( L2SAP* sap, struct mmsghdr* mmsg, int count, struct timeval* timeout );
+
+/* Poll the server socket until the session's queue is not empty.
+ * Returns 1, L2_TIMEOUT, or -1 on error.
+ */
+int  l2sap_session_wait( L2SAP* session, struct timeval* timeout );
+
+/* Move the oldest queued payload of a session into msg (data and len
+ * must be set, like for l2sap_recvfrom_batch). Returns 0 if the
+ * queue is empty, otherwise 1.
+ */
+int  l2sap_session_pop( L2SAP* session, L2Msg* msg );
+
+/* l2sap_recvfrom_timeout for a session: l2sap_session_wait followed
+ * by l2sap_session_pop.
+ */
+int  l2sap_session_recv( L2SAP* session, uint8_t* data, int len, struct timeval* timeout );
+
+/* Count a received frame in sap->stats by its L2_FRAME_* status. */
+void l2sap_count_in( L2SAP* sap, int status, int payload_len );
+
+/* Give a new entity the settings of L2_IMPAIR, if it is set. */
+void l2sap_impair_init( L2SAP* sap );
+
+/* Give a new session the impairment settings of its server. */
+void l2sap_impair_inherit( L2SAP* session, const L2SAP* server );
+
+/* Free the impairment state of an entity. If close_socket is set, the
+ * socket is about to be closed, and the frames that are still held
+ * for it are sent at once.
+ */
+void l2sap_impair_free( L2SAP* sap, int close_socket );
+
+/* Send a complete frame of len bytes, given as iovcnt segments,
+ * through the impairment stage of sap. Returns len, or -1 if sendto
+ * failed.
+ */
+int  l2sap_impair_send( L2SAP* sap, const struct iovec* iov, int iovcnt, int len );
+
+/* l2sap_destroy for a server or a session. Destroying a session
+ * removes it from its server; destroying the server closes the
+ * socket and frees all of its sessions.
+ */
+void l2sap_server_destroy( L2SAP* sap );
+
+#endif
+
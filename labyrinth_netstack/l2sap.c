@@ -1,3 +1,5 @@
+#define _GNU_SOURCE     // For sendmmsg/recvmmsg
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -6,13 +8,18 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <sys/time.h>   // For struct timeval
 #include <inttypes.h>   // For uintX_t types
 #include <stddef.h>
 
 #include "l2sap.h"
+#include "l2sap-server.h"
+#include "l2sap-checksum.h"
+#include "trace.h"
 
 static uint8_t compute_checksum(const uint8_t* frame, int len);
+static int     check_frame(const uint8_t* frame, int bytes_received, uint8_t* dst, int dst_len, int* payload_len);
 
 /**
  * @brief Creates an L2SAP entity (client-side).
@@ -42,6 +49,13 @@ static uint8_t compute_checksum(const uint8_t* frame, int len);
      memset(&client->peer_addr, 0, sizeof(client->peer_addr)); //setter peer_addr strukturen til 0 overskriver eksisterende verdier med funksjonen memset
      client->peer_addr.sin_family = AF_INET; // setter peer_addr familien til af_inet som definerer at vi bruker IPv4
      client->peer_addr.sin_port = htons(server_port); //setter server port nummer. htons() konverterer port nummeret fra host's byte rekkefoelge
+     client->batch_buffer = NULL; // allokeres foerst naar l2sap_recvfrom_batch brukes
+     client->pool = NULL; // allokeres foerst naar l2sap_recv_lend brukes
+     client->server = NULL; // klienter tilhoerer ingen server
+     client->session = NULL;
+     client->upper = NULL;
+     memset(&client->stats, 0, sizeof(client->stats)); // Tellerne starter paa 0
+     client->impair = NULL;
      if (inet_pton(AF_INET, server_ip, &client->peer_addr.sin_addr) <= 0) {  //konverterer ip adresse fra tekst strengen til den binaere nettverksformatet som sockaddr_in strukturen trenger, resultatet blir lagret i peer_addr.sin.addr
          fprintf(stderr, "L2SAP invalid server IP address: %s\n", server_ip); //printer feilmelding
          close(client->socket); //lukker socket til klienten
@@ -50,10 +64,49 @@ static uint8_t compute_checksum(const uint8_t* frame, int len);
      }
 
 
-     fprintf(stderr, "L2SAP created for server %s:%d\n", server_ip, server_port); //hvis alt passerer over så får vi ut en melding som bekrefter at L2SAP er lagd for gitt server ip og port
+     l2sap_impair_init(client); // L2_IMPAIR gjelder ogsaa entiteter som ikke vet om det
+     TRACE(TRACE_INFO, TRACE_L2_CREATE, server_port); //hvis alt passerer over så sporer vi at L2SAP er lagd for gitt port
      return client; //returnerer client
 }
 
+/**
+ * @brief Creates an L2SAP entity around a UDP socket that already exists.
+ *
+ * The socket must be an IPv4 datagram socket that is connected to its
+ * peer; the peer address is taken from the socket. Meant for sockets
+ * that are set up by the caller, e.g. a connected pair on loopback for
+ * benchmarks. The entity owns fd from now on and closes it in
+ * l2sap_destroy.
+ *
+ * @param fd The connected socket.
+ * @return L2SAP* Pointer to the created L2SAP structure, or NULL on error
+ *         (then fd still belongs to the caller).
+ */
+L2SAP* l2sap_create_from_fd(int fd) {
+    struct sockaddr_in peer;
+    socklen_t          peerlen = sizeof(peer);
+    if (fd < 0 || getpeername(fd, (struct sockaddr*)&peer, &peerlen) < 0) {
+        perror("L2SAP create_from_fd: Socket is not connected");
+        return NULL;
+    }
+    if (peer.sin_family != AF_INET) {
+        fprintf(stderr, "L2SAP create_from_fd: Socket is not an IPv4 socket.\n");
+        return NULL;
+    }
+
+    L2SAP* client = (L2SAP*)calloc(1, sizeof(L2SAP)); // Alle pekere NULL og tellerne 0
+    if (!client) {
+        perror("Failed to allocate memory for L2SAP");
+        return NULL;
+    }
+    client->socket    = fd;
+    client->peer_addr = peer;
+
+    l2sap_impair_init(client);
+    TRACE(TRACE_INFO, TRACE_L2_CREATE, ntohs(peer.sin_port));
+    return client;
+}
+
 /**
  * @brief Destroys an L2SAP entity.
  *
@@ -65,12 +118,18 @@ void l2sap_destroy(L2SAP* client) {
     if (!client) { // Om client er null, returner
         return;
     }
+    if (client->server) { // Server og sesjoner eier ikke socketen paa samme maate
+        l2sap_server_destroy(client);
+        return;
+    }
+    l2sap_impair_free(client, 1); // Holdte frames skal ikke sendes fra en gjenbrukt socket
     if (client->socket >= 0) { // Hvis socket har en gyldig verdi
         close(client->socket); // Lukk socketen
-        fprintf(stderr, "L2SAP socket closed.\n");
     }
+    free(client->batch_buffer); // Frigjoer batch bufferet (NULL er ok)
+    l2bufpool_destroy(client->pool); // Utlaante buffere frigjoeres ved siste release
     free(client); // Fjern client fra minne
-    fprintf(stderr, "L2SAP destroyed.\n");
+    TRACE(TRACE_INFO, TRACE_L2_DESTROY, 0);
 }
 
 /**
@@ -103,48 +162,42 @@ int l2sap_sendto(L2SAP* client, const uint8_t* data, int len) {
         return -1;
     }
 
-    // Alloker buffer for hele framen
+    // Alloker buffer for hele framen. Den nullstilles ikke, bare de
+    // total_len bytene som sendes blir skrevet.
     uint8_t frame_buffer[L2Framesize]; // Bruk stack allocation
-    memset(frame_buffer, 0, L2Framesize);
-
-    // Konstruer headeren
-    L2Header header;
-    header.dst_addr = client->peer_addr.sin_addr.s_addr; // Allerede i netverk byte order
-    header.len = htons((uint16_t)total_len); // setter lengden
-    header.mbz = 0; // setter mbz (skal alltid vaere 0)
-    header.checksum = 0; // Sett til 0 for checksum kalku
-
-    // Kopier header til buffer (handle byte order)
-    // dst_addr er allrede i nettverk
-    memcpy(frame_buffer, &header.dst_addr, sizeof(header.dst_addr));
-    // len maa konverteres
-    uint16_t len_n = htons((uint16_t)total_len);
-    memcpy(frame_buffer + offsetof(L2Header, len), &len_n, sizeof(header.len));
-    // checksum og mbz er enkelt bytes, ingen konvertering trengs
-    frame_buffer[offsetof(L2Header, checksum)] = 0; // dobbeltsjekker at det er 0
-    frame_buffer[offsetof(L2Header, mbz)] = 0;
 
-    // Kopier payload til buffer
+    // Konstruer headeren, dst_addr er allerede i nettverk byte order
+    l2sap_frame_header(frame_buffer, client->peer_addr.sin_addr.s_addr, total_len);
+
+    // Kopier payload til buffer og regn ut checksum i samme runde
+    uint8_t checksum = compute_checksum(frame_buffer, L2Headersize);
     if (len > 0) {
-        memcpy(frame_buffer + L2Headersize, data, len);
+        checksum ^= l2sap_checksum_copy(frame_buffer + L2Headersize, data, len);
     }
-
-    // Kalkuler og plasser checksum
-    uint8_t checksum = compute_checksum(frame_buffer, total_len);
     frame_buffer[offsetof(L2Header, checksum)] = checksum;
 
     // Send framen
-    ssize_t bytes_sent = sendto(client->socket, frame_buffer, total_len, 0,
-                              (struct sockaddr*)&client->peer_addr, sizeof(client->peer_addr));
+    ssize_t bytes_sent;
+    if (client->impair) { // Tap, forsinkelse osv. for tester
+        struct iovec v = { frame_buffer, (size_t)total_len };
+        bytes_sent = l2sap_impair_send(client, &v, 1, total_len);
+    } else {
+        bytes_sent = sendto(client->socket, frame_buffer, total_len, 0,
+                            (struct sockaddr*)&client->peer_addr, sizeof(client->peer_addr));
+    }
 
     if (bytes_sent < 0) {
         perror("L2SAP sendto failed");
+        client->stats.send_errors++;
         return -1;
     }
 
     if (bytes_sent != total_len) {
         fprintf(stderr, "L2SAP sendto: Warning: Sent %zd bytes, expected %d bytes.\n", bytes_sent, total_len);
     }
+    client->stats.frames_out++;
+    client->stats.bytes_out += (uint64_t)len;
+    TRACE(TRACE_PACKET, TRACE_L2_SEND, len);
 
     // Returner lengden til payloaden som var akseptert
     return len;
@@ -170,6 +223,13 @@ int l2sap_recvfrom_timeout(L2SAP* client, uint8_t* data, int len, struct timeval
         fprintf(stderr, "L2SAP recvfrom: Invalid arguments.\n");
         return -1;
     }
+    if (client->session) { // Sesjoner henter frames fra sin egen koe
+        return l2sap_session_recv(client, data, len, timeout);
+    }
+    if (client->server) {
+        fprintf(stderr, "L2SAP recvfrom: Use l2sap_server_accept on a server entity.\n");
+        return -1;
+    }
 
     fd_set readfds;
     int activity;
@@ -218,73 +278,471 @@ int l2sap_recvfrom_timeout(L2SAP* client, uint8_t* data, int len, struct timeval
             return -1;
         }
 
-        // Hvis vi har motatt mindre bytes enn header-stoerrelsen saa maa vi avvise
-        if (bytes_received < L2Headersize) {
-            fprintf(stderr, "L2SAP recv: Received runt frame (%zd bytes), discarding.\n", bytes_received);
+        // Validerer og kopierer payload til data i en runde. Ved en
+        // ugyldig frame kan data derfor allerede vaere overskrevet.
+        int payload_len;
+        int status = l2sap_frame_check_copy(recv_buffer, (int)bytes_received, data, len, &payload_len);
+        l2sap_count_in(client, status, payload_len);
+
+        if (status == L2_FRAME_RUNT) { // Mindre bytes enn header-stoerrelsen, maa avvises
+            TRACE(TRACE_ERROR, TRACE_L2_DROP_RUNT, bytes_received);
             continue; // Vent for neste frame
         }
+        if (status == L2_FRAME_BADLEN) {
+            TRACE(TRACE_ERROR, TRACE_L2_DROP_LENGTH, payload_len + L2Headersize, bytes_received);
+            continue;
+        }
+        if (status == L2_FRAME_CHECKSUM) {
+            TRACE(TRACE_ERROR, TRACE_L2_DROP_CHECKSUM, recv_buffer[offsetof(L2Header, checksum)]);
+            continue;
+        }
 
-        L2Header received_header; // Hold header felt
-        uint16_t len_n; // Temp variabel for lengde i byte order
+        int copy_len = (payload_len < len) ? payload_len : len; // Min(payload_len, user_buffer_len)
 
-        // Kopier dataen
-        memcpy(&received_header.dst_addr, recv_buffer + offsetof(L2Header, dst_addr), sizeof(received_header.dst_addr));
-        memcpy(&len_n,                 recv_buffer + offsetof(L2Header, len), sizeof(received_header.len));
-        received_header.checksum = recv_buffer[offsetof(L2Header, checksum)];
+        if (status == L2_FRAME_TRUNCATED) {
+             fprintf(stderr, "L2SAP recv: Warning: Received payload (%d bytes) larger than provided buffer (%d bytes), truncated.\n",
+                    payload_len, len);
+        }
 
-        received_header.len = ntohs(len_n); // Konverter byte order til host byte order
+        // Faatt og validert et frame
+        TRACE(TRACE_PACKET, TRACE_L2_RECV, payload_len);
+        return copy_len;
 
-        // Valider frame header lengden
-        if (received_header.len < L2Headersize || received_header.len > bytes_received) {
-             fprintf(stderr, "L2SAP recv: Invalid header length (%u bytes) for received size (%zd bytes), discarding.\n",
-                    received_header.len, bytes_received);
-             continue;
-        }
+    }
+}
 
-        // Checksum validering
-        uint8_t received_checksum = received_header.checksum;
+/**
+ * @brief Sends one L2 frame built from several payload segments.
+ *
+ * The frame is prepared on the stack with l2sap_prepare and sent with
+ * l2sap_send_prepared. Header and segments are passed to sendmsg as
+ * an iovec list, so the kernel's copy is the only one.
+ *
+ * @param client Pointer to the L2SAP structure.
+ * @param iov Payload segments.
+ * @param iovcnt Number of segments, at most L2_MAX_IOV.
+ * @return int Payload bytes sent, or -1 on error.
+ */
+int l2sap_sendv(L2SAP* client, const struct iovec* iov, int iovcnt) {
+    L2Prepared frame;
+    if (l2sap_prepare(client, &frame, iov, iovcnt) < 0) {
+        return -1;
+    }
+    return l2sap_send_prepared(client, &frame);
+}
 
-        // Sett checksum felt til 0 midlertidig for begregning (checksum er 0 i opprinnelig beregning)
-        recv_buffer[offsetof(L2Header, checksum)] = 0;
-        uint8_t calculated_checksum = compute_checksum(recv_buffer, received_header.len); // Beregn checksum
+/**
+ * @brief Builds header and checksum for a scatter-gather frame.
+ *
+ * @param client Pointer to the L2SAP structure (gives the destination).
+ * @param frame The prepared frame to fill in.
+ * @param iov Payload segments; they are referenced, not copied.
+ * @param iovcnt Number of segments, at most L2_MAX_IOV.
+ * @return int Payload length, or -1 on invalid arguments or a frame
+ * that exceeds L2Framesize.
+ */
+int l2sap_prepare(L2SAP* client, L2Prepared* frame, const struct iovec* iov, int iovcnt) {
+    if (!client || !frame || iovcnt < 0 || iovcnt > L2_MAX_IOV || (iovcnt > 0 && !iov)) {
+        fprintf(stderr, "L2SAP prepare: Invalid arguments.\n");
+        return -1;
+    }
 
-        // Restorer checksum i buffer
-        recv_buffer[offsetof(L2Header, checksum)] = received_checksum;
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) { // Summer lengden av alle segmentene
+        len += iov[i].iov_len;
+    }
+    int total_len = L2Headersize + (int)len;
+    if (len > (size_t)L2Payloadsize) {
+        fprintf(stderr, "L2SAP prepare: Data too large (%zu bytes payload), exceeds L2Framesize (%d bytes total).\n",
+                len, L2Framesize);
+        return -1;
+    }
+
+    // Headeren foerst, deretter checksum over alle segmentene uten aa kopiere dem
+    l2sap_frame_header(frame->header, client->peer_addr.sin_addr.s_addr, total_len);
+    uint8_t checksum = compute_checksum(frame->header, L2Headersize);
 
-        if (calculated_checksum != received_checksum) {
-            fprintf(stderr, "L2SAP recv: Checksum mismatch (received 0x%02x, calculated 0x%02x), discarding frame.\n",
-                   received_checksum, calculated_checksum);
+    frame->iov[0].iov_base = frame->header;
+    frame->iov[0].iov_len  = L2Headersize;
+    frame->iovcnt = 1;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) { // Tomme segmenter trengs ikke
             continue;
         }
+        checksum ^= compute_checksum((const uint8_t*)iov[i].iov_base, (int)iov[i].iov_len);
+        frame->iov[frame->iovcnt++] = iov[i];
+    }
+
+    frame->header[offsetof(L2Header, checksum)] = checksum;
+    frame->len = total_len;
+    return (int)len;
+}
 
-        int payload_len = received_header.len - L2Headersize; // Regn ut lengde paa payload
+/**
+ * @brief Sends a frame that was built by l2sap_prepare.
+ *
+ * @param client Pointer to the L2SAP structure.
+ * @param frame The prepared frame.
+ * @return int Payload bytes sent, or -1 on error.
+ */
+int l2sap_send_prepared(L2SAP* client, const L2Prepared* frame) {
+    if (!client || client->socket < 0 || !frame) {
+        fprintf(stderr, "L2SAP send_prepared: Invalid client or frame.\n");
+        return -1;
+    }
 
-        int copy_len = (payload_len < len) ? payload_len : len; // Min(payload_len, user_buffer_len)
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name    = &client->peer_addr;
+    msg.msg_namelen = sizeof(client->peer_addr);
+    msg.msg_iov     = (struct iovec*)frame->iov; // sendmsg endrer ikke iov
+    msg.msg_iovlen  = frame->iovcnt;
+
+    ssize_t bytes_sent = client->impair ? l2sap_impair_send(client, frame->iov, frame->iovcnt, frame->len)
+                                        : sendmsg(client->socket, &msg, 0);
+    if (bytes_sent < 0) {
+        perror("L2SAP sendmsg failed");
+        client->stats.send_errors++;
+        return -1;
+    }
+    if (bytes_sent != frame->len) {
+        fprintf(stderr, "L2SAP sendmsg: Warning: Sent %zd bytes, expected %d bytes.\n", bytes_sent, frame->len);
+    }
+    client->stats.frames_out++;
+    client->stats.bytes_out += (uint64_t)(frame->len - L2Headersize);
+    TRACE(TRACE_PACKET, TRACE_L2_SEND, frame->len - L2Headersize);
+
+    return frame->len - L2Headersize;
+}
+
+void l2sap_prepared_adjust(L2Prepared* frame, uint8_t old_byte, uint8_t new_byte) {
+    // XOR ut den gamle verdien og inn den nye
+    frame->header[offsetof(L2Header, checksum)] ^= (uint8_t)(old_byte ^ new_byte);
+}
+
+/**
+ * @brief Sends several L2 frames to the configured peer.
+ *
+ * Every frame gets its own header and checksum, exactly as in
+ * l2sap_sendto. The header and the caller's payload are passed to
+ * the kernel as two iovec segments, so the payload is not copied
+ * in user space, and up to L2_BATCH_MAX frames share one sendmmsg call.
+ *
+ * @param client Pointer to the L2SAP structure.
+ * @param msgs Array of frames to send (data and len are used).
+ * @param count Number of entries in msgs.
+ * @return int Number of frames handed to the kernel, or -1 if the
+ * arguments are invalid or the first frame could not be sent.
+ */
+int l2sap_sendto_batch(L2SAP* client, const L2Msg* msgs, int count) {
+    if (!client || client->socket < 0 || !msgs || count < 0) { // Sjekk om argumentene er gyldige
+        fprintf(stderr, "L2SAP sendto_batch: Invalid arguments.\n");
+        return -1;
+    }
 
+    int sent_total = 0;
+    int stop = 0;
+    while (sent_total < count && !stop) {
+        int n = count - sent_total;
+        if (n > L2_BATCH_MAX) n = L2_BATCH_MAX; // En syscall haandterer maks L2_BATCH_MAX frames
+
+        uint8_t        headers[L2_BATCH_MAX][sizeof(L2Header)];
+        struct iovec   iov[L2_BATCH_MAX][2];
+        struct mmsghdr mmsg[L2_BATCH_MAX];
+
+        for (int i = 0; i < n; i++) {
+            const L2Msg* m = &msgs[sent_total + i];
+            int total_len = L2Headersize + m->len;
+            if (m->len < 0 || total_len > L2Framesize) { // Samme regler som l2sap_sendto
+                fprintf(stderr, "L2SAP sendto_batch: Frame %d has invalid length %d, stopping batch.\n",
+                        sent_total + i, m->len);
+                n = i;
+                stop = 1;
+                break;
+            }
 
-        if (copy_len > 0) {
-             memcpy(data, recv_buffer + L2Headersize, copy_len); // Kopier payload
+            // Checksum over header (med checksum = 0) og payload, uten aa kopiere payload
+            l2sap_frame_header(headers[i], client->peer_addr.sin_addr.s_addr, total_len);
+            uint8_t checksum = compute_checksum(headers[i], L2Headersize);
+            checksum ^= compute_checksum(m->data, m->len);
+            headers[i][offsetof(L2Header, checksum)] = checksum;
+
+            iov[i][0].iov_base = headers[i];
+            iov[i][0].iov_len  = L2Headersize;
+            iov[i][1].iov_base = m->data;
+            iov[i][1].iov_len  = m->len;
+
+            memset(&mmsg[i], 0, sizeof(mmsg[i]));
+            mmsg[i].msg_hdr.msg_name    = &client->peer_addr;
+            mmsg[i].msg_hdr.msg_namelen = sizeof(client->peer_addr);
+            mmsg[i].msg_hdr.msg_iov     = iov[i];
+            mmsg[i].msg_hdr.msg_iovlen  = (m->len > 0) ? 2 : 1;
         }
-        if (payload_len > len) {
-             fprintf(stderr, "L2SAP recv: Warning: Received payload (%d bytes) larger than provided buffer (%d bytes), truncated.\n",
-                    payload_len, len);
+
+        if (n == 0) { // Ugyldig frame foerst i batchen
+            break;
         }
 
-        // Faatt og validert et frame
-        return copy_len;
+        int sent;
+        if (client->impair) { // En frame om gangen gjennom impairment-steget
+            sent = 0;
+            while (sent < n && l2sap_impair_send(client, iov[sent], (int)mmsg[sent].msg_hdr.msg_iovlen,
+                                                 L2Headersize + msgs[sent_total + sent].len) >= 0) {
+                sent++;
+            }
+            if (sent == 0) { // Ikke proev igjen: en kopi kan alt vaere sendt, og tallene er trukket
+                perror("L2SAP sendto_batch: Impaired send failed");
+                client->stats.send_errors++;
+                break;
+            }
+        } else {
+            sent = sendmmsg(client->socket, mmsg, n, 0);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("L2SAP sendmmsg failed");
+                client->stats.send_errors++;
+                break;
+            }
+        }
 
+        for (int i = 0; i < sent; i++) {
+            client->stats.bytes_out += (uint64_t)msgs[sent_total + i].len;
+        }
+        client->stats.frames_out += (uint64_t)sent;
+        sent_total += sent;
+        if (sent < n) { // Kernel tok ikke imot alle, proev ikke videre
+            break;
+        }
     }
+
+    return (sent_total == 0 && count > 0) ? -1 : sent_total;
 }
 
-// Vi gjoer en for-lokke som sjekker saa lenge i er mindre enn lengden av framen
-// Deretter gjoer vi en XOR operasjon mellom checksummen og i-te index til framen
-// Tilslutt returnerer vi checksummen
-static uint8_t compute_checksum(const uint8_t* frame, int len) {
-    uint8_t checksum = 0;
-    for (int i = 0; i < len; ++i) {
-        checksum ^= frame[i];
+/**
+ * @brief Receives up to count L2 frames with a single recvmmsg call.
+ *
+ * The socket is read without waiting first. Only if no datagram is
+ * queued, poll() waits for up to timeout before trying again, so a
+ * busy receiver pays for neither poll() nor one syscall per frame.
+ * Every datagram is validated with the same rules as in
+ * l2sap_recvfrom_timeout; unlike there, invalid frames are reported
+ * in msgs[i].status instead of being skipped silently.
+ *
+ * @param client Pointer to the L2SAP structure.
+ * @param msgs Array of receive slots (data and len must be set).
+ * @param count Number of entries in msgs.
+ * @param timeout Optional timeout value. If NULL, waits indefinitely.
+ * @return int Number of filled entries, L2_TIMEOUT (0) if timeout
+ * occurred, or -1 on error.
+ */
+int l2sap_recvfrom_batch(L2SAP* client, L2Msg* msgs, int count, struct timeval* timeout) {
+    if (!client || client->socket < 0 || !msgs || count <= 0) { // Sjekk om argumentene er gyldige
+        fprintf(stderr, "L2SAP recvfrom_batch: Invalid arguments.\n");
+        return -1;
+    }
+    if (count > L2_BATCH_MAX) count = L2_BATCH_MAX;
+    if (client->server && !client->session) { // Serverens socket deles av alle sesjonene
+        fprintf(stderr, "L2SAP recvfrom_batch: Use l2sap_server_accept on a server entity.\n");
+        return -1;
+    }
+
+    if (client->session) { // Sesjoner henter fra sin egen koe
+        int r = l2sap_session_wait(client, timeout);
+        if (r <= 0) {
+            return r;
+        }
+        int filled = 0;
+        while (filled < count && l2sap_session_pop(client, &msgs[filled])) {
+            filled++;
+        }
+        return filled;
+    }
+
+    if (!client->batch_buffer) { // Alloker mottaksomraadet ved foerste bruk
+        client->batch_buffer = (uint8_t*)malloc((size_t)L2_BATCH_MAX * L2Framesize);
+        if (!client->batch_buffer) {
+            perror("Failed to allocate L2SAP batch buffer");
+            return -1;
+        }
+    }
+
+    struct iovec   iov[L2_BATCH_MAX];
+    struct mmsghdr mmsg[L2_BATCH_MAX];
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = client->batch_buffer + (size_t)i * L2Framesize;
+        iov[i].iov_len  = L2Framesize;
+        memset(&mmsg[i], 0, sizeof(mmsg[i]));
+        mmsg[i].msg_hdr.msg_name    = &msgs[i].addr;
+        mmsg[i].msg_hdr.msg_namelen = sizeof(msgs[i].addr);
+        mmsg[i].msg_hdr.msg_iov     = &iov[i];
+        mmsg[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    int received = l2sap_recvmmsg_wait(client, mmsg, count, timeout);
+    if (received <= 0) {
+        return received;
+    }
+
+    for (int i = 0; i < received; i++) { // Valider hver frame for seg
+        uint8_t* frame = (uint8_t*)iov[i].iov_base;
+        int payload_len;
+        msgs[i].status = l2sap_frame_check_copy(frame, (int)mmsg[i].msg_len, msgs[i].data, msgs[i].len, &payload_len);
+        l2sap_count_in(client, msgs[i].status, payload_len);
+        if (msgs[i].status == L2_FRAME_OK) {
+            msgs[i].len = payload_len;
+        } else if (msgs[i].status != L2_FRAME_TRUNCATED) {
+            msgs[i].len = 0;
+        }
+    }
+
+    return received;
+}
+
+/* Kopierer tellerne, saa kalleren faar et bilde som ikke endrer seg. */
+void l2sap_get_stats(const L2SAP* sap, L2Stats* stats) {
+    if (!sap || !stats) {
+        return;
+    }
+    *stats = sap->stats;
+}
+
+/* Teller en mottatt frame etter statusen fra l2sap_frame_check(_copy). */
+void l2sap_count_in(L2SAP* sap, int status, int payload_len) {
+    switch (status) {
+    case L2_FRAME_TRUNCATED:
+        sap->stats.truncated++;
+        /* fall through */
+    case L2_FRAME_OK:
+        sap->stats.frames_in++;
+        sap->stats.bytes_in += (uint64_t)payload_len;
+        break;
+    case L2_FRAME_RUNT:
+        sap->stats.drops_runt++;
+        break;
+    case L2_FRAME_BADLEN:
+        sap->stats.drops_badlen++;
+        break;
+    default:
+        sap->stats.drops_checksum++;
+        break;
+    }
+}
+
+/* Leser uten aa vente foerst. Bare hvis ingenting ligger i koen,
+ * venter poll() paa socketen (maks timeout) foer vi proever igjen.
+ */
+int l2sap_recvmmsg_wait(L2SAP* sap, struct mmsghdr* mmsg, int count, struct timeval* timeout) {
+    while (1) {
+        int received = recvmmsg(sap->socket, mmsg, count, MSG_DONTWAIT, NULL);
+        if (received > 0) {
+            return received;
+        }
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("L2SAP recvmmsg failed");
+            return -1;
+        }
+
+        // Ingenting i koen, vent med poll (ingen FD_SETSIZE grense, serveren kan ha mange fds)
+        struct pollfd pfd;
+        pfd.fd      = sap->socket;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+
+        int timeout_ms = -1;
+        if (timeout) { // Rund opp, saa vi ikke vaakner for tidlig
+            timeout_ms = (int)(timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000);
+        }
+
+        int activity = poll(&pfd, 1, timeout_ms);
+        if (activity < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("L2SAP poll failed");
+            return -1;
+        }
+        if (activity == 0) {
+            return L2_TIMEOUT;
+        }
+    }
+}
+
+/* Skriver L2 headeren inn i starten av frame. Checksum og mbz settes
+ * til 0, saa checksummen kan regnes ut over hele framen etterpaa.
+ */
+void l2sap_frame_header(uint8_t* frame, uint32_t dst_addr, int total_len) {
+    // dst_addr er allerede i nettverk byte order
+    memcpy(frame + offsetof(L2Header, dst_addr), &dst_addr, sizeof(dst_addr));
+    // len maa konverteres
+    uint16_t len_n = htons((uint16_t)total_len);
+    memcpy(frame + offsetof(L2Header, len), &len_n, sizeof(len_n));
+    // checksum og mbz er enkelt bytes, ingen konvertering trengs
+    frame[offsetof(L2Header, checksum)] = 0;
+    frame[offsetof(L2Header, mbz)] = 0;
+}
+
+int l2sap_frame_check(const uint8_t* frame, int bytes_received, int* payload_len) {
+    return check_frame(frame, bytes_received, NULL, 0, payload_len);
+}
+
+int l2sap_frame_check_copy(const uint8_t* frame, int bytes_received, uint8_t* dst, int dst_len, int* payload_len) {
+    int status = check_frame(frame, bytes_received, dst, dst_len, payload_len);
+    if (status == L2_FRAME_OK && *payload_len > dst_len) {
+        status = L2_FRAME_TRUNCATED;
+    }
+    return status;
+}
+
+/* Validerer en mottatt frame av bytes_received bytes og kopierer opptil
+ * dst_len bytes payload til dst mens checksummen regnes ut.
+ * Ved L2_FRAME_BADLEN inneholder *payload_len lengden fra headeren
+ * minus L2Headersize, slik at kalleren kan rapportere den.
+ */
+static int check_frame(const uint8_t* frame, int bytes_received, uint8_t* dst, int dst_len, int* payload_len) {
+    *payload_len = 0;
+
+    // Hvis vi har motatt mindre bytes enn header-stoerrelsen saa maa vi avvise
+    if (bytes_received < L2Headersize) {
+        return L2_FRAME_RUNT;
     }
-    return checksum;
+
+    uint16_t len_n; // Temp variabel for lengde i byte order
+    memcpy(&len_n, frame + offsetof(L2Header, len), sizeof(len_n));
+    int frame_len = ntohs(len_n); // Konverter byte order til host byte order
+
+    // Valider frame header lengden
+    if (frame_len < L2Headersize || frame_len > bytes_received) {
+        *payload_len = frame_len - L2Headersize;
+        return L2_FRAME_BADLEN;
+    }
+
+    // Checksum feltet er XOR av alle andre bytes, saa XOR over hele
+    // framen (checksum inkludert) er 0 for en gyldig frame. Da slipper
+    // vi aa nullstille feltet, og hver byte leses bare en gang.
+    int plen     = frame_len - L2Headersize;
+    int copy_len = (dst && dst_len > 0) ? ((plen < dst_len) ? plen : dst_len) : 0;
+    uint8_t sum  = compute_checksum(frame, L2Headersize);
+    if (copy_len > 0) {
+        sum ^= l2sap_checksum_copy(dst, frame + L2Headersize, copy_len);
+    }
+    sum ^= compute_checksum(frame + L2Headersize + copy_len, plen - copy_len);
+
+    if (sum != 0) {
+        return L2_FRAME_CHECKSUM;
+    }
+
+    *payload_len = plen; // Lengde paa payload
+    return L2_FRAME_OK;
+}
+
+// XOR av alle bytes i frame, se l2sap-checksum.c for variantene
+static uint8_t compute_checksum(const uint8_t* frame, int len) {
+    return l2sap_checksum(frame, (size_t)len);
 }
 
 int l2sap_recvfrom( L2SAP* client, uint8_t* data, int len )
@@ -6,6 +6,11 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /* This is the maximum size of a frame in bytes.
  * Frames that are sent over our emulated network can never
@@ -18,6 +23,28 @@
 
 #define L2_TIMEOUT    0
 
+/* The largest number of frames that l2sap_sendto_batch and
+ * l2sap_recvfrom_batch handle in a single system call.
+ * Larger batches are split into several calls.
+ */
+#define L2_BATCH_MAX  64
+
+/* The largest number of payload segments in l2sap_sendv and
+ * l2sap_prepare.
+ */
+#define L2_MAX_IOV    8
+
+/* Per-frame validation results reported by l2sap_recvfrom_batch.
+ * The rules are the same as for l2sap_recvfrom_timeout, which
+ * silently discards every frame that is not L2_FRAME_OK or
+ * L2_FRAME_TRUNCATED.
+ */
+#define L2_FRAME_OK         0  /* valid frame, payload copied completely */
+#define L2_FRAME_TRUNCATED  1  /* valid frame, payload cut to buffer size */
+#define L2_FRAME_RUNT       2  /* shorter than L2Headersize */
+#define L2_FRAME_BADLEN     3  /* header len does not match datagram */
+#define L2_FRAME_CHECKSUM   4  /* XOR checksum mismatch */
+
 typedef struct L2Header L2Header;
 
 struct L2Header
@@ -58,20 +85,442 @@ struct L2Header
     uint8_t  mbz;
 };
 
-typedef struct L2SAP L2SAP;
+/* Default limits of a server created with l2sap_server_create.
+ * Each session owns a queue of L2_SESSION_QUEUE_LEN frames.
+ */
+#define L2_SERVER_MAX_SESSIONS  16384
+#define L2_SESSION_QUEUE_LEN    8
+
+typedef struct L2SAP     L2SAP;
+typedef struct L2Server  L2Server;
+typedef struct L2Session L2Session;
+typedef struct L2BufPool L2BufPool;
+typedef struct L2Buf     L2Buf;
+typedef struct L2Impair  L2Impair;
+
+/* Number of buffers in the receive pool that l2sap_recv_lend
+ * attaches to an entity on first use.
+ */
+#define L2_POOL_BUFFERS  64
+
+/* Counters of an entity. An entity belongs to one thread, so they are
+ * plain increments and always on. Byte counts are payload bytes.
+ * A server counts every frame that arrives on its socket; a session
+ * counts the frames it takes out of its queue.
+ */
+typedef struct L2Stats L2Stats;
+
+struct L2Stats
+{
+    uint64_t frames_out;
+    uint64_t bytes_out;
+    uint64_t send_errors;
+    uint64_t frames_in;
+    uint64_t bytes_in;
+    uint64_t drops_runt;        /* L2_FRAME_RUNT */
+    uint64_t drops_badlen;      /* L2_FRAME_BADLEN */
+    uint64_t drops_checksum;    /* L2_FRAME_CHECKSUM */
+    uint64_t truncated;         /* delivered, but cut to the caller's buffer */
+
+    /* Frames that the impairment stage (l2sap_set_impairment) dropped,
+     * corrupted, sent twice or held back. They are counted in
+     * frames_out as well.
+     */
+    uint64_t impair_dropped;
+    uint64_t impair_corrupted;
+    uint64_t impair_duplicated;
+    uint64_t impair_held;
+};
+
+/* Settings of the impairment stage, see l2sap_set_impairment. The
+ * probabilities are from 0 to 1, times are in microseconds.
+ */
+typedef struct L2Impairment L2Impairment;
+
+struct L2Impairment
+{
+    double   loss;          /* frame is not sent */
+    double   corrupt;       /* one random bit of the frame is flipped */
+    double   duplicate;     /* frame is sent twice */
+    double   reorder;       /* frame is held back reorder_us longer than the rest */
+    long     delay_us;      /* every frame is held back this long ... */
+    long     jitter_us;     /* ... plus or minus up to this much */
+    long     reorder_us;    /* 0 means L2_IMPAIR_REORDER_USEC */
+    uint64_t seed;          /* of the random numbers that decide all of the above */
+};
+
+#define L2_IMPAIR_REORDER_USEC  1000
+
+/* Frames that may be held back at the same time in a process. Frames
+ * beyond that are dropped.
+ */
+#define L2_IMPAIR_MAX_HELD      16384
 
 struct L2SAP
 {
     int                socket;
     struct sockaddr_in peer_addr;
+
+    /* Receive area for l2sap_recvfrom_batch, L2_BATCH_MAX frames.
+     * Allocated on first use.
+     */
+    uint8_t*           batch_buffer;
+
+    /* Buffers lent out by l2sap_recv_lend. Allocated on first use. */
+    L2BufPool*         pool;
+
+    /* NULL for an entity created with l2sap_create.
+     * For the entity returned by l2sap_server_create, server is set
+     * and session is NULL. For a session accepted from a server,
+     * both are set. A session shares the server's socket, and its
+     * peer_addr is the address of its client.
+     */
+    L2Server*          server;
+    L2Session*         session;
+
+    /* Free for the layer above, e.g. the L4SAP that owns a session.
+     * L2 never touches it.
+     */
+    void*              upper;
+
+    L2Stats            stats;
+
+    /* NULL unless frames are sent through the impairment stage. */
+    L2Impair*          impair;
+};
+
+/* Optional settings for l2sap_server_create_ex. Fields that are 0
+ * take the defaults above.
+ */
+typedef struct L2ServerConfig L2ServerConfig;
+
+struct L2ServerConfig
+{
+    int max_sessions;
+    int queue_len;
+
+    /* Set SO_REUSEPORT before binding, so that several servers (one
+     * per thread) can share the port. The kernel hashes every flow to
+     * one of their sockets.
+     */
+    int reuseport;
+};
+
+/* One queued payload of a session. */
+typedef struct L2QueuedFrame L2QueuedFrame;
+
+struct L2QueuedFrame
+{
+    int     len;
+    uint8_t data[L2Payloadsize];
+};
+
+/* A peer of a server. The session's L2SAP is what the application
+ * uses: l2sap_sendto sends to the peer through the server socket, and
+ * l2sap_recvfrom_timeout takes frames from the session's queue. When
+ * the queue is empty, it reads from the server socket and sorts the
+ * frames of other peers into their queues while it waits.
+ */
+struct L2Session
+{
+    L2SAP          sap;
+
+    /* Bounded ring of received payloads. */
+    L2QueuedFrame* queue;
+    int            queue_head;
+    int            queue_count;
+
+    /* Frames from this peer that were accepted into the queue, and
+     * frames that were dropped because the queue was full.
+     */
+    uint64_t       frames_queued;
+    uint64_t       drops_queue_full;
+
+    /* Links in the server's accept and ready lists. */
+    L2Session*     accept_prev;
+    L2Session*     accept_next;
+    L2Session*     ready_prev;
+    L2Session*     ready_next;
+    uint8_t        in_accept;
+    uint8_t        in_ready;
+};
+
+/* Open-addressing (linear probing) table entry. The key is the IPv4
+ * address and UDP port of the peer. An entry with session NULL is free.
+ */
+typedef struct L2ServerSlot L2ServerSlot;
+
+struct L2ServerSlot
+{
+    uint64_t   key;
+    L2Session* session;
+};
+
+struct L2Server
+{
+    /* The server entity that owns the socket. */
+    L2SAP*        entity;
+
+    L2ServerSlot* table;
+    uint32_t      table_mask;
+    int           num_sessions;
+    int           max_sessions;
+    int           queue_len;
+
+    /* Sessions that have not been returned by l2sap_server_accept,
+     * and sessions with queued frames, both in FIFO order.
+     */
+    L2Session*    accept_head;
+    L2Session*    accept_tail;
+    L2Session*    ready_head;
+    L2Session*    ready_tail;
+
+    /* Frames that were discarded before they reached a session. */
+    uint64_t      drops_invalid;
+    uint64_t      drops_no_session;
+};
+
+/* One frame in a batched send or receive.
+ *
+ * For l2sap_sendto_batch, data and len describe the payload
+ * (L2 SDU) that is sent. The payload is not modified.
+ * For l2sap_recvfrom_batch, data points to a buffer of len
+ * bytes. On return, len contains the number of payload bytes
+ * copied into data, status contains one of the L2_FRAME_*
+ * values above and addr the sender of the datagram.
+ * On send, addr is ignored.
+ */
+typedef struct L2Msg L2Msg;
+
+struct L2Msg
+{
+    uint8_t*           data;
+    int                len;
+    int                status;
+    struct sockaddr_in addr;
+};
+
+/* A received frame that is lent to the caller instead of being copied.
+ * data points to the whole frame, L2 header included, and is aligned
+ * to a cache line. The payload of the layer that lent the buffer is
+ * the len bytes starting at data + offset: offset is L2Headersize for
+ * l2sap_recv_lend, and L4 adds the size of its own header.
+ * addr is the sender of the frame.
+ * The caller must give the buffer back with l2buf_release.
+ */
+struct L2Buf
+{
+    uint8_t*           data;
+    int                offset;
+    int                len;
+    struct sockaddr_in addr;
+
+    L2BufPool*         pool;
+    L2Buf*             next_free;
+    int                lent;
+};
+
+/* A fixed set of L2Framesize buffers in one cache-aligned allocation.
+ * The free buffers form a LIFO list, so a buffer that was just
+ * released, and is probably still in the cache, is reused first.
+ */
+struct L2BufPool
+{
+    uint8_t* memory;
+    L2Buf*   bufs;
+    L2Buf*   free_list;
+    int      count;
+    int      in_use;
+
+    /* Set when the pool is destroyed while buffers are still lent
+     * out. The last l2buf_release frees it.
+     */
+    int      orphaned;
 };
 
+/* A frame that is ready to be sent, possibly several times.
+ * The header (with its checksum) is stored here, while the payload
+ * stays in the caller's segments, which must not change as long as
+ * the frame is used. iov[0] points to header, so an L2Prepared must
+ * not be copied or moved after l2sap_prepare.
+ */
+typedef struct L2Prepared L2Prepared;
+
+struct L2Prepared
+{
+    uint8_t      header[sizeof(L2Header)];
+    struct iovec iov[L2_MAX_IOV + 1];
+    int          iovcnt;
+    int          len;     /* whole frame, header included */
+};
+
+/* Create a server-side L2 entity that is bound to port on all local
+ * interfaces. The server uses a single UDP socket for all of its peers
+ * and creates a session for every new source address.
+ */
 struct L2SAP* l2sap_server_create( int port );
+struct L2SAP* l2sap_server_create_ex( int port, const L2ServerConfig* config );
+
+/* Read the datagrams that are waiting on the server socket (waiting up
+ * to timeout for the first one, forever if NULL) and queue the valid
+ * ones in the sessions of their senders.
+ * Returns the number of datagrams read, including the ones that were
+ * dropped, L2_TIMEOUT if none arrived, or -1 on error.
+ */
+int    l2sap_server_poll( L2SAP* server, struct timeval* timeout );
+
+/* Return the next session that has not been accepted yet, polling the
+ * socket for up to timeout if there is none. Returns NULL on timeout
+ * or error. The session is closed with l2sap_destroy.
+ */
+L2SAP* l2sap_server_accept( L2SAP* server, struct timeval* timeout );
+
+/* Return a session that has frames in its queue, or NULL. Each call
+ * removes the session from the ready list; it is added again when a
+ * new frame arrives for it. Does not poll the socket.
+ */
+L2SAP* l2sap_server_next_ready( L2SAP* server );
+
+/* Find the session of a peer address, or NULL. */
+L2SAP* l2sap_server_lookup( L2SAP* server, const struct sockaddr_in* addr );
 
 L2SAP* l2sap_create( const char* server_ip, int server_port );
+
+/* Create an entity around an IPv4 UDP socket that is already
+ * connected to its peer. The entity owns fd and closes it in
+ * l2sap_destroy. Returns NULL on error, and then fd still belongs
+ * to the caller.
+ */
+L2SAP* l2sap_create_from_fd( int fd );
 void l2sap_destroy( L2SAP* client );
+
+/* Copy the counters of an entity. */
+void l2sap_get_stats( const L2SAP* sap, L2Stats* stats );
 int  l2sap_sendto( L2SAP* client, const uint8_t* data, int len );
 int  l2sap_recvfrom_timeout( L2SAP* client, uint8_t* data, int len, struct timeval* timeout );
 
+/* Send count frames to the peer with as few sendmmsg calls as
+ * possible. Returns the number of frames that were handed to the
+ * kernel, or -1 if not even the first one could be sent.
+ */
+int  l2sap_sendto_batch( L2SAP* client, const L2Msg* msgs, int count );
+
+/* Wait up to timeout (forever if NULL) for at least one datagram,
+ * then receive up to count datagrams with a single recvmmsg call.
+ * Every datagram is validated like in l2sap_recvfrom_timeout, and
+ * the result is stored in msgs[i].status.
+ * Returns the number of entries in msgs that were filled,
+ * L2_TIMEOUT if nothing arrived, or -1 on error.
+ */
+int  l2sap_recvfrom_batch( L2SAP* client, L2Msg* msgs, int count, struct timeval* timeout );
+
+/* Send one frame whose payload is the concatenation of iovcnt
+ * segments (at most L2_MAX_IOV). The checksum is computed across the
+ * segments and the frame goes to the kernel with sendmsg, so the
+ * payload is never copied in user space.
+ * Returns the payload length, or -1 on error.
+ */
+int  l2sap_sendv( L2SAP* client, const struct iovec* iov, int iovcnt );
+
+/* Build header and checksum for a frame with the given payload
+ * segments, without sending it. Returns the payload length, or -1 if
+ * the frame would be too large or has too many segments.
+ */
+int  l2sap_prepare( L2SAP* client, L2Prepared* frame, const struct iovec* iov, int iovcnt );
+
+/* Send a prepared frame. Retransmissions can call this again without
+ * building the frame again. Returns the payload length, or -1.
+ */
+int  l2sap_send_prepared( L2SAP* client, const L2Prepared* frame );
+
+/* Tell a prepared frame that one payload byte changed from old_byte
+ * to new_byte. Since the checksum is an XOR, it is fixed without
+ * reading the payload again.
+ */
+void l2sap_prepared_adjust( L2Prepared* frame, uint8_t old_byte, uint8_t new_byte );
+
+/* Create a pool of count receive buffers, or NULL on error. */
+L2BufPool* l2bufpool_create( int count );
+
+/* Free a pool. If buffers are still lent out, the memory is freed when
+ * the last of them is released.
+ */
+void   l2bufpool_destroy( L2BufPool* pool );
+
+/* Take a free buffer from the pool, or NULL if all are lent out. */
+L2Buf* l2bufpool_get( L2BufPool* pool );
+
+/* Give a lent buffer back to its pool. NULL is ignored. */
+void   l2buf_release( L2Buf* buf );
+
+/* Like l2sap_recvfrom_timeout, but the frame is received into a buffer
+ * from the entity's pool and validated in place. On success *buf is
+ * the lent buffer and the payload length is returned; the payload is
+ * never copied in user space. On L2_TIMEOUT and on error, *buf is
+ * NULL, so that an empty payload can be told apart from a timeout.
+ * Returns -1 also if all L2_POOL_BUFFERS buffers are lent out.
+ * For a session of a server, the payload is copied once from the
+ * session's queue into the buffer.
+ */
+int  l2sap_recv_lend( L2SAP* client, L2Buf** buf, struct timeval* timeout );
+
+/* Give the entity a new pool of count buffers instead of the default
+ * L2_POOL_BUFFERS, for example a small one when many entities hold
+ * few buffers each. Buffers that are still lent out stay valid and go
+ * back to the old pool. Returns 0 or -1.
+ */
+int  l2sap_set_pool_size( L2SAP* client, int count );
+
+/* Impair the frames that the entity sends, for tests and benchmarks
+ * on one machine without a lossy network. Every frame is dropped,
+ * corrupted (after the checksum was computed, so the receiver has to
+ * notice), duplicated and held back as imp says, decided by a random
+ * number generator that starts from imp->seed. The same seed and the
+ * same sequence of frames give the same decisions in every run.
+ * Held frames are sent by a background thread at their time, so the
+ * receiver sees delay and reordering whether it blocks or polls.
+ * A NULL imp turns the stage off. Returns 0, or -1 if a setting is
+ * out of range.
+ *
+ * Without a call, every entity takes its settings from the
+ * environment variable L2_IMPAIR, if it is set, for example
+ *   L2_IMPAIR="loss=0.01,corrupt=0.001,dup=0.01,reorder=0.05,delay_us=2000,jitter_us=500,seed=7"
+ * Then the seed of each entity is the given seed plus the number of
+ * entities created before it, so that two ends do not make the same
+ * decisions. Sessions of a server take the settings of the server.
+ */
+int  l2sap_set_impairment( L2SAP* sap, const L2Impairment* imp );
+
+/* Parse settings in the format of L2_IMPAIR into imp. Keys that are
+ * missing are 0. Returns 0, or -1 on an unknown key or a bad value.
+ */
+int  l2sap_parse_impairment( const char* spec, L2Impairment* imp );
+
+/* Write the L2 header for a frame of total_len bytes (header
+ * included) to the start of frame. The checksum byte is set to 0,
+ * so the checksum can be computed over the whole frame afterwards.
+ */
+void l2sap_frame_header( uint8_t* frame, uint32_t dst_addr, int total_len );
+
+/* Validate a received frame of bytes_received bytes with the rules
+ * of l2sap_recvfrom_timeout. Returns L2_FRAME_OK and sets
+ * *payload_len to the payload size if the frame is valid, otherwise
+ * L2_FRAME_RUNT, L2_FRAME_BADLEN or L2_FRAME_CHECKSUM.
+ */
+int  l2sap_frame_check( const uint8_t* frame, int bytes_received, int* payload_len );
+
+/* Like l2sap_frame_check, but copies up to dst_len payload bytes to
+ * dst while the checksum is computed, so that the frame is read only
+ * once. Returns L2_FRAME_TRUNCATED instead of L2_FRAME_OK if the
+ * payload is larger than dst_len; *payload_len is the full payload
+ * size in both cases. dst may be overwritten even if the frame turns
+ * out to be invalid.
+ */
+int  l2sap_frame_check_copy( const uint8_t* frame, int bytes_received, uint8_t* dst, int dst_len, int* payload_len );
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
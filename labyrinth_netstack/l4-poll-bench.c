@@ -0,0 +1,228 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "l4sap.h"
+
+/* Events that one epoll_wait returns at most. */
+#define MAX_EVENTS 256
+
+static double now_sec( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [sessions] [packets] [window]\n"
+                     "       sessions - number of sender/receiver pairs (default 1000)\n"
+                     "       packets  - packets that every sender sends (default 200)\n"
+                     "       window   - L4 window, 1 for stop-and-wait (default 1)\n"
+                     "All entities are driven by one thread with epoll and l4sap_poll.\n",
+                     name );
+    exit( -1 );
+}
+
+/* One end of a pair. The sender keeps its window full with
+ * l4sap_send_async, the receiver drains with l4sap_recv_async.
+ */
+typedef struct End End;
+
+struct End
+{
+    L4SAP* l4;
+    int    sender;
+    int    to_send;
+    int    received;
+    int    failed;
+};
+
+static long long total_received;
+static int       packets;
+static uint8_t   payload[L4Payloadsize];
+
+static void fill_window( End* e )
+{
+    while( e->to_send > 0 )
+    {
+        int r = l4sap_send_async( e->l4, payload, sizeof(payload) );
+        if( r == L4_WOULDBLOCK ) break;
+        if( r < 0 )
+        {
+            e->failed = 1;
+            break;
+        }
+        e->to_send--;
+    }
+}
+
+static void on_event( L4SAP* l4, int event, int value, void* user )
+{
+    End*    e = (End*)user;
+    uint8_t buffer[L4Payloadsize];
+    (void)l4;
+    (void)value;
+
+    switch( event )
+    {
+    case L4_EVENT_SENT :
+        fill_window( e );
+        break;
+    case L4_EVENT_RECV :
+        while( l4sap_recv_async( e->l4, buffer, sizeof(buffer) ) >= 0 )
+        {
+            e->received++;
+            total_received++;
+        }
+        break;
+    case L4_EVENT_FAILED :
+    case L4_EVENT_QUIT :
+        e->failed = 1;
+        break;
+    default :
+        break;
+    }
+}
+
+/* Bind an entity to an ephemeral loopback port and return the port. */
+static int bind_any( L4SAP* l4 )
+{
+    struct sockaddr_in addr;
+    socklen_t          addrlen = sizeof(addr);
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port        = 0;
+    if( bind( l4->l2->socket, (struct sockaddr*)&addr, sizeof(addr) ) < 0 ||
+        getsockname( l4->l2->socket, (struct sockaddr*)&addr, &addrlen ) < 0 )
+    {
+        perror( "bind" );
+        return -1;
+    }
+    return ntohs( addr.sin_port );
+}
+
+/* Milliseconds until the earliest retransmission of all entities,
+ * or -1 if none is pending.
+ */
+static int next_timeout_ms( End* ends, int count )
+{
+    struct timespec first = { 0, 0 };
+    struct timespec d, now;
+    int             found = 0;
+    for( int i=0; i<count; i++ )
+    {
+        if( !l4sap_next_deadline( ends[i].l4, &d ) ) continue;
+        if( !found || d.tv_sec < first.tv_sec || (d.tv_sec == first.tv_sec && d.tv_nsec < first.tv_nsec) )
+        {
+            first = d;
+            found = 1;
+        }
+    }
+    if( !found ) return -1;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    long long ms = (long long)(first.tv_sec - now.tv_sec) * 1000 + (first.tv_nsec - now.tv_nsec) / 1000000 + 1;
+    return ms < 0 ? 0 : (int)ms;
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc > 4 ) usage( argv[0] );
+
+    int sessions = argc > 1 ? atoi( argv[1] ) : 1000;
+    packets      = argc > 2 ? atoi( argv[2] ) : 200;
+    int window   = argc > 3 ? atoi( argv[3] ) : 1;
+    if( sessions <= 0 || packets <= 0 || window < 1 || window > L4_MAX_WINDOW ) usage( argv[0] );
+
+    /* Every pair needs two sockets. */
+    struct rlimit rl;
+    if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < rl.rlim_max )
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit( RLIMIT_NOFILE, &rl );
+    }
+    if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && (rlim_t)sessions * 2 + 16 > rl.rlim_cur )
+    {
+        sessions = (int)((rl.rlim_cur - 16) / 2);
+        fprintf( stderr, "%s: Only %d sessions fit into the file descriptor limit\n", argv[0], sessions );
+    }
+
+    for( int i=0; i<L4Payloadsize; i++ ) payload[i] = (uint8_t)i;
+
+    int  count = 2 * sessions;
+    End* ends  = (End*)calloc( count, sizeof(End) );
+    int  ep    = epoll_create1( 0 );
+    if( !ends || ep < 0 ) return -1;
+
+    for( int i=0; i<sessions; i++ )
+    {
+        End* tx = &ends[2*i];
+        End* rx = &ends[2*i+1];
+        tx->l4 = l4sap_create( "127.0.0.1", 9 );
+        rx->l4 = l4sap_create( "127.0.0.1", 9 );
+        if( !tx->l4 || !rx->l4 ) return -1;
+        int tx_port = bind_any( tx->l4 );
+        int rx_port = bind_any( rx->l4 );
+        if( tx_port < 0 || rx_port < 0 ) return -1;
+        tx->l4->l2->peer_addr.sin_port = htons( rx_port );
+        rx->l4->l2->peer_addr.sin_port = htons( tx_port );
+        if( window > 1 && (l4sap_set_window( tx->l4, window ) < 0 || l4sap_set_window( rx->l4, window ) < 0) ) return -1;
+
+        tx->sender  = 1;
+        tx->to_send = packets;
+        for( int j=0; j<2; j++ )
+        {
+            End* e = &ends[2*i+j];
+            l4sap_set_callback( e->l4, on_event, e );
+            struct epoll_event ev;
+            ev.events   = EPOLLIN;
+            ev.data.ptr = e;
+            epoll_ctl( ep, EPOLL_CTL_ADD, l4sap_get_fd( e->l4 ), &ev );
+        }
+    }
+
+    long long expected = (long long)sessions * packets;
+    double    start    = now_sec();
+    for( int i=0; i<sessions; i++ ) fill_window( &ends[2*i] );
+
+    struct epoll_event events[MAX_EVENTS];
+    int                polls = 0;
+    while( total_received < expected )
+    {
+        int n = epoll_wait( ep, events, MAX_EVENTS, next_timeout_ms( ends, count ) );
+        if( n < 0 ) break;
+        if( n == 0 )
+        {
+            /* A timer expired somewhere; let every entity check its own. */
+            for( int i=0; i<count; i++ ) l4sap_poll( ends[i].l4, NULL );
+            continue;
+        }
+        for( int i=0; i<n; i++ )
+        {
+            End* e = (End*)events[i].data.ptr;
+            l4sap_poll( e->l4, NULL );
+            polls++;
+        }
+        int failed = 0;
+        for( int i=0; i<count && !failed; i++ ) failed = ends[i].failed;
+        if( failed ) break;
+    }
+    double elapsed = now_sec() - start;
+
+    for( int i=0; i<count; i++ ) l4sap_destroy( ends[i].l4 );
+    close( ep );
+    free( ends );
+
+    printf( "%d sessions, %d packets each, window %d, one thread\n", sessions, packets, window );
+    printf( "  delivered %lld of %lld packets in %.2f s\n", total_received, expected, elapsed );
+    printf( "  %10.0f packets/s, %.1f MB/s, %d polls\n",
+            total_received / elapsed, total_received * (double)L4Payloadsize / elapsed / 1e6, polls );
+    return total_received == expected ? 0 : -1;
+}
@@ -0,0 +1,261 @@
+
+#define _GNU_SOURCE     // For CPU_COUNT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "l4sap-shard.h"
+
+/* Events that one epoll_wait returns at most. */
+#define MAX_EVENTS 256
+
+/* Bytes per request and response. */
+#define MSG_SIZE 64
+
+static double now_sec( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [shards] [clients] [sessions] [seconds]\n"
+                     "       shards   - measure with 1..shards server threads (default: number of CPUs)\n"
+                     "       clients  - client threads (default: shards)\n"
+                     "       sessions - L4 sessions per client thread (default 64)\n"
+                     "       seconds  - duration of every measurement (default 2)\n"
+                     "The server echoes every request. Every session keeps one request\n"
+                     "of %d bytes in flight. The shards are pinned to CPUs.\n",
+                     name, MSG_SIZE );
+    exit( -1 );
+}
+
+/* The server side: send every request back. */
+static void echo( L4SAP* l4, const uint8_t* data, int len, void* user )
+{
+    (void)user;
+    if( data ) l4sap_send_async( l4, data, len );
+}
+
+/* One client session. */
+typedef struct End End;
+
+struct End
+{
+    L4SAP*     l4;
+    long long* done;
+    int        failed;
+};
+
+typedef struct Client Client;
+
+struct Client
+{
+    pthread_t thread;
+    int       port;
+    int       sessions;
+    double    until;
+    long long exchanges;
+    int       failed;
+};
+
+static uint8_t request[MSG_SIZE];
+
+static void on_event( L4SAP* l4, int event, int value, void* user )
+{
+    End*    e = (End*)user;
+    uint8_t buffer[L4Payloadsize];
+    (void)value;
+
+    switch( event )
+    {
+    case L4_EVENT_RECV :
+        while( l4sap_recv_async( l4, buffer, sizeof(buffer) ) >= 0 )
+        {
+            (*e->done)++;
+            if( l4sap_send_async( l4, request, sizeof(request) ) < 0 ) e->failed = 1;
+        }
+        break;
+    case L4_EVENT_FAILED :
+    case L4_EVENT_QUIT :
+        e->failed = 1;
+        break;
+    default :
+        break;
+    }
+}
+
+/* Drive the sessions of one client thread until the time is up. */
+static void* client_main( void* arg )
+{
+    Client* c    = (Client*)arg;
+    End*    ends = (End*)calloc( c->sessions, sizeof(End) );
+    int     ep   = epoll_create1( 0 );
+    if( !ends || ep < 0 )
+    {
+        c->failed = 1;
+        free( ends );
+        return NULL;
+    }
+
+    for( int i=0; i<c->sessions; i++ )
+    {
+        End* e  = &ends[i];
+        e->l4   = l4sap_create( "127.0.0.1", c->port );
+        e->done = &c->exchanges;
+        if( !e->l4 )
+        {
+            c->failed = 1;
+            break;
+        }
+        l4sap_set_callback( e->l4, on_event, e );
+        struct epoll_event ev;
+        ev.events   = EPOLLIN;
+        ev.data.ptr = e;
+        epoll_ctl( ep, EPOLL_CTL_ADD, l4sap_get_fd( e->l4 ), &ev );
+        /* The first send binds the socket, so it comes after epoll_ctl. */
+        l4sap_send_async( e->l4, request, sizeof(request) );
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while( !c->failed && now_sec() < c->until )
+    {
+        int n = epoll_wait( ep, events, MAX_EVENTS, 10 );
+        if( n < 0 ) break;
+        if( n == 0 )
+        {
+            /* Let every session check its retransmission timers. */
+            for( int i=0; i<c->sessions; i++ ) if( ends[i].l4 ) l4sap_poll( ends[i].l4, NULL );
+            continue;
+        }
+        for( int i=0; i<n; i++ )
+        {
+            End* e = (End*)events[i].data.ptr;
+            l4sap_poll( e->l4, NULL );
+            if( e->failed ) c->failed = 1;
+        }
+    }
+
+    for( int i=0; i<c->sessions; i++ ) l4sap_destroy( ends[i].l4 );
+    close( ep );
+    free( ends );
+    return NULL;
+}
+
+/* One measurement with the given number of shards. Returns the
+ * exchanges per second, or -1 on error.
+ */
+static double run( int shards, int clients, int sessions, double seconds, int verbose )
+{
+    L4ShardConfig config;
+    memset( &config, 0, sizeof(config) );
+    config.shards = shards;
+    config.pin    = 1;
+
+    L4ShardServer* srv = l4shard_server_start( 0, &config, echo, NULL );
+    if( !srv ) return -1;
+
+    Client* c     = (Client*)calloc( clients, sizeof(Client) );
+    double  start = now_sec();
+    for( int i=0; i<clients; i++ )
+    {
+        c[i].port     = l4shard_server_port( srv );
+        c[i].sessions = sessions;
+        c[i].until    = start + seconds;
+        pthread_create( &c[i].thread, NULL, client_main, &c[i] );
+    }
+
+    long long exchanges = 0;
+    int       failed    = 0;
+    for( int i=0; i<clients; i++ )
+    {
+        pthread_join( c[i].thread, NULL );
+        exchanges += c[i].exchanges;
+        failed    |= c[i].failed;
+    }
+    double elapsed = now_sec() - start;
+
+    L4ShardStats  total;
+    L4ShardStats* per_shard = (L4ShardStats*)calloc( shards, sizeof(L4ShardStats) );
+    l4shard_server_stats( srv, &total, per_shard );
+    l4shard_server_stop( srv );
+
+    if( verbose )
+    {
+        printf( "  %d shards: %llu sessions, %llu packets in, %llu out, %llu failed, %llu L2 drops\n",
+                shards, (unsigned long long)total.sessions_total, (unsigned long long)total.packets_in,
+                (unsigned long long)total.packets_out, (unsigned long long)total.send_failed,
+                (unsigned long long)total.l2_drops );
+        for( int i=0; i<shards; i++ )
+        {
+            printf( "    shard %2d: %5llu sessions, %10llu packets\n", i,
+                    (unsigned long long)per_shard[i].sessions_total,
+                    (unsigned long long)per_shard[i].packets_in );
+        }
+    }
+    free( per_shard );
+    free( c );
+    return failed ? -1 : exchanges / elapsed;
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc > 5 ) usage( argv[0] );
+
+    cpu_set_t set;
+    int       cpus = sched_getaffinity( 0, sizeof(set), &set ) == 0 ? CPU_COUNT( &set ) : 1;
+
+    int    shards   = argc > 1 ? atoi( argv[1] ) : cpus;
+    int    clients  = argc > 2 ? atoi( argv[2] ) : shards;
+    int    sessions = argc > 3 ? atoi( argv[3] ) : 64;
+    double seconds  = argc > 4 ? atof( argv[4] ) : 2.0;
+    if( shards <= 0 || clients <= 0 || sessions <= 0 || seconds <= 0 ) usage( argv[0] );
+
+    /* Every client session has its own socket. */
+    struct rlimit rl;
+    if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < rl.rlim_max )
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit( RLIMIT_NOFILE, &rl );
+    }
+    if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && (rlim_t)clients * sessions + shards + 16 > rl.rlim_cur )
+    {
+        sessions = (int)((rl.rlim_cur - shards - 16) / clients);
+        fprintf( stderr, "%s: Only %d sessions per client fit into the file descriptor limit\n", argv[0], sessions );
+    }
+
+    for( int i=0; i<MSG_SIZE; i++ ) request[i] = (uint8_t)i;
+
+    printf( "%d client threads x %d sessions, %d-byte echo, %.1f s per run, %d CPUs\n",
+            clients, sessions, MSG_SIZE, seconds, cpus );
+    printf( "  shards    exchanges/s   speedup\n" );
+
+    double base = 0;
+    int    ret  = 0;
+    for( int n=1; n<=shards; n++ )
+    {
+        double rate = run( n, clients, sessions, seconds, 0 );
+        if( rate < 0 )
+        {
+            printf( "  %6d    failed\n", n );
+            ret = -1;
+            continue;
+        }
+        if( n == 1 ) base = rate;
+        printf( "  %6d  %13.0f   %6.2fx\n", n, rate, base > 0 ? rate / base : 0 );
+    }
+
+    /* How the kernel spread the sessions over the shards. */
+    printf( "Distribution with %d shards:\n", shards );
+    if( run( shards, clients, sessions, seconds, 1 ) < 0 ) ret = -1;
+    return ret;
+}
@@ -0,0 +1,249 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "l4sap.h"
+
+/* Packets the relay can hold back at once, more than any window. */
+#define RELAY_QUEUE 4096
+
+static double now_sec( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [seconds] [loss] [delay] [window] [rto_min]\n"
+                     "       seconds - duration of each measurement (default 2)\n"
+                     "       loss    - probability that the relay drops a packet, 0..1 (default 0)\n"
+                     "       delay   - one-way delay of the relay in ms (default 1)\n"
+                     "       window  - window of the windowed run, 2..%d (default 32)\n"
+                     "       rto_min - floor of the retransmission timeout in ms (default %ld)\n",
+                     name, L4_MAX_WINDOW, L4_RTO_MIN_USEC / 1000 );
+    exit( -1 );
+}
+
+/* A UDP relay between two ports on loopback. Every datagram is dropped
+ * with probability loss, otherwise it is forwarded to the other port
+ * after delay seconds. L4_RESET is never dropped, so that a run can
+ * always be ended.
+ */
+typedef struct Relay Relay;
+
+struct Relay
+{
+    int                socket;
+    struct sockaddr_in a;
+    struct sockaddr_in b;
+    double             loss;
+    double             delay;
+    volatile int       stop;
+    unsigned int       seed;
+
+    struct
+    {
+        double             due;
+        struct sockaddr_in to;
+        int                len;
+        uint8_t            data[L2Framesize];
+    } queue[RELAY_QUEUE];
+    int head;
+    int count;
+};
+
+static void* relay_main( void* arg )
+{
+    Relay* r = (Relay*)arg;
+
+    while( !r->stop )
+    {
+        // Forward everything that is due
+        double now = now_sec();
+        while( r->count > 0 && r->queue[r->head].due <= now )
+        {
+            sendto( r->socket, r->queue[r->head].data, r->queue[r->head].len, 0,
+                    (struct sockaddr*)&r->queue[r->head].to, sizeof(r->queue[r->head].to) );
+            r->head = (r->head + 1) % RELAY_QUEUE;
+            r->count--;
+        }
+
+        int timeout_ms = 10;
+        if( r->count > 0 )
+        {
+            timeout_ms = (int)((r->queue[r->head].due - now) * 1000) + 1;
+        }
+        struct pollfd pfd = { .fd = r->socket, .events = POLLIN, .revents = 0 };
+        if( poll( &pfd, 1, timeout_ms ) <= 0 ) continue;
+
+        while( r->count < RELAY_QUEUE )
+        {
+            int                slot = (r->head + r->count) % RELAY_QUEUE;
+            struct sockaddr_in from;
+            socklen_t          fromlen = sizeof(from);
+            ssize_t n = recvfrom( r->socket, r->queue[slot].data, L2Framesize, MSG_DONTWAIT,
+                                  (struct sockaddr*)&from, &fromlen );
+            if( n < 0 ) break;
+
+            int is_reset = n > L2Headersize && r->queue[slot].data[L2Headersize] == L4_RESET;
+            if( !is_reset && (double)rand_r( &r->seed ) / RAND_MAX < r->loss ) continue;
+
+            r->queue[slot].to  = (from.sin_port == r->a.sin_port) ? r->b : r->a;
+            r->queue[slot].len = (int)n;
+            r->queue[slot].due = now_sec() + r->delay;
+            r->count++;
+        }
+    }
+    return NULL;
+}
+
+/* Bind a socket to an ephemeral loopback port and return the address. */
+static int bind_any( int sock, struct sockaddr_in* addr )
+{
+    socklen_t addrlen = sizeof(*addr);
+    memset( addr, 0, sizeof(*addr) );
+    addr->sin_family      = AF_INET;
+    addr->sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr->sin_port        = 0;
+    if( bind( sock, (struct sockaddr*)addr, sizeof(*addr) ) < 0 ||
+        getsockname( sock, (struct sockaddr*)addr, &addrlen ) < 0 )
+    {
+        perror( "bind" );
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct Receiver Receiver;
+
+struct Receiver
+{
+    L4SAP*    l4;
+    long long bytes;
+};
+
+/* Receive until the sender's l4sap_destroy resets the connection. */
+static void* receiver_main( void* arg )
+{
+    Receiver* rcv = (Receiver*)arg;
+    uint8_t   buffer[L4Payloadsize];
+
+    while( 1 )
+    {
+        int len = l4sap_recv( rcv->l4, buffer, sizeof(buffer) );
+        if( len < 0 ) break;
+        rcv->bytes += len;
+    }
+    return NULL;
+}
+
+/* Send full packets for the given time through a relay and return
+ * the goodput in bytes per second, or -1 if the transfer failed.
+ */
+static double run( int window, double seconds, double loss, double delay, long rto_min_us,
+                   long long* delivered, L4Rtt* rtt, L4Stats* stats, L4Histogram* latency )
+{
+    static Relay relay;
+    memset( &relay, 0, sizeof(relay) );
+    relay.loss  = loss;
+    relay.delay = delay;
+    relay.seed  = 1;
+
+    struct sockaddr_in raddr;
+    relay.socket = socket( AF_INET, SOCK_DGRAM, 0 );
+    if( relay.socket < 0 || bind_any( relay.socket, &raddr ) < 0 ) return -1;
+
+    L4SAP* tx = l4sap_create( "127.0.0.1", ntohs(raddr.sin_port) );
+    L4SAP* rx = l4sap_create( "127.0.0.1", ntohs(raddr.sin_port) );
+    if( !tx || !rx ) return -1;
+    if( bind_any( tx->l2->socket, &relay.a ) < 0 || bind_any( rx->l2->socket, &relay.b ) < 0 ) return -1;
+    if( window > 1 && (l4sap_set_window( tx, window ) < 0 || l4sap_set_window( rx, window ) < 0) ) return -1;
+    if( l4sap_set_rto_limits( tx, rto_min_us, 0 ) < 0 || l4sap_set_rto_limits( rx, rto_min_us, 0 ) < 0 ) return -1;
+
+    pthread_t relay_thread, rx_thread;
+    Receiver  rcv = { rx, 0 };
+    pthread_create( &relay_thread, NULL, relay_main, &relay );
+    pthread_create( &rx_thread, NULL, receiver_main, &rcv );
+
+    uint8_t payload[L4Payloadsize];
+    for( int i=0; i<L4Payloadsize; i++ ) payload[i] = (uint8_t)i;
+
+    long long sent   = 0;
+    int       failed = 0;
+    double    start  = now_sec();
+    while( now_sec() - start < seconds )
+    {
+        if( l4sap_send( tx, payload, sizeof(payload) ) < 0 )
+        {
+            failed = 1;
+            break;
+        }
+        sent += sizeof(payload);
+    }
+    if( !failed && l4sap_flush( tx ) < 0 ) failed = 1;
+    double elapsed = now_sec() - start;
+    l4sap_get_rtt( tx, rtt );
+    l4sap_get_stats( tx, stats );
+    l4sap_get_ack_latency( tx, latency );
+
+    l4sap_destroy( tx );
+    pthread_join( rx_thread, NULL );
+    relay.stop = 1;
+    pthread_join( relay_thread, NULL );
+    l4sap_destroy( rx );
+    close( relay.socket );
+
+    *delivered = rcv.bytes;
+    if( failed || rcv.bytes != sent ) return -1;
+    return sent / elapsed;
+}
+
+/* Time from the first transmission to the ACK, retransmissions included. */
+static void print_latency( const char* name, const L4Stats* st, const L4Histogram* lat )
+{
+    printf( "%-14s ack latency p50 %ld us, p99 %ld us, max %u us; %llu packets, %llu retransmits\n",
+            name, l4hist_percentile( lat, 0.5 ), l4hist_percentile( lat, 0.99 ), lat->max_us,
+            (unsigned long long)st->data_out, (unsigned long long)st->retransmits );
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc > 6 ) usage( argv[0] );
+
+    double seconds = argc > 1 ? atof( argv[1] ) : 2.0;
+    double loss    = argc > 2 ? atof( argv[2] ) : 0.0;
+    double delay   = argc > 3 ? atof( argv[3] ) : 1.0;
+    int    window  = argc > 4 ? atoi( argv[4] ) : 32;
+    double rto_min = argc > 5 ? atof( argv[5] ) : L4_RTO_MIN_USEC / 1000.0;
+    if( seconds <= 0 || loss < 0 || loss >= 1 || delay < 0 || window < 2 || window > L4_MAX_WINDOW ||
+        rto_min <= 0 )
+    {
+        usage( argv[0] );
+    }
+
+    static L4Histogram lat_sw, lat_win;
+    long long          d_sw, d_win;
+    L4Rtt              rtt_sw, rtt_win;
+    L4Stats            st_sw, st_win;
+    double sw  = run( 1, seconds, loss, delay / 1000, (long)(rto_min * 1000), &d_sw, &rtt_sw, &st_sw, &lat_sw );
+    double win = run( window, seconds, loss, delay / 1000, (long)(rto_min * 1000), &d_win, &rtt_win, &st_win, &lat_win );
+
+    printf( "loss=%.3f delay=%.1f ms seconds=%.1f rto_min=%.1f ms\n", loss, delay, seconds, rto_min );
+    if( sw < 0 )  printf( "stop-and-wait: transfer failed (%lld bytes delivered)\n", d_sw );
+    else          printf( "stop-and-wait:    %10.1f KB/s  (srtt %ld us, rto %ld us)\n",
+                          sw / 1000, rtt_sw.srtt_us, rtt_sw.rto_us );
+    if( win < 0 ) printf( "window %3d: transfer failed (%lld bytes delivered)\n", window, d_win );
+    else          printf( "window %3d:       %10.1f KB/s  (srtt %ld us, rto %ld us)\n",
+                          window, win / 1000, rtt_win.srtt_us, rtt_win.rto_us );
+    if( sw > 0 && win > 0 ) printf( "speedup: %.1fx\n", win / sw );
+    print_latency( "stop-and-wait", &st_sw, &lat_sw );
+    print_latency( "window", &st_win, &lat_win );
+    return 0;
+}
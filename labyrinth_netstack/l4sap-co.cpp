@@ -0,0 +1,401 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "l4sap-co.hpp"
+
+namespace l4co
+{
+
+/* Receive buffers of a session in addition to its window. A session
+ * never lends buffers to L5, so the L2 default of L2_POOL_BUFFERS per
+ * entity would only cost memory.
+ */
+static const int SESSION_POOL_EXTRA = 4;
+
+/* Events that one epoll_wait returns at most. */
+static const int MAX_EVENTS = 256;
+
+/* --- Task --- */
+
+Task Task::promise_type::get_return_object( )
+{
+    return Task( std::coroutine_handle<promise_type>::from_promise( *this ) );
+}
+
+void Task::promise_type::unhandled_exception( )
+{
+    fprintf( stderr, "l4co: Exception escaped from a Task.\n" );
+    std::terminate( );
+}
+
+Task::promise_type::~promise_type( )
+{
+    if( sched ) sched->task_done( );
+}
+
+Task::Task( Task&& other ) noexcept : handle_( other.handle_ )
+{
+    other.handle_ = nullptr;
+}
+
+Task::~Task( )
+{
+    /* Only a Task that was never spawned still owns its frame. */
+    if( handle_ ) handle_.destroy( );
+}
+
+/* --- Scheduler --- */
+
+Scheduler::Scheduler( ) : epoll_( epoll_create1( 0 ) ), live_( 0 ), next_id_( 1 )
+{
+    if( epoll_ < 0 ) perror( "l4co: epoll_create1" );
+}
+
+Scheduler::~Scheduler( )
+{
+    if( epoll_ >= 0 ) close( epoll_ );
+}
+
+void Scheduler::spawn( Task t )
+{
+    std::coroutine_handle<Task::promise_type> h = t.handle_;
+    t.handle_ = nullptr;
+    h.promise( ).sched = this;
+    live_++;
+    ready_.push_back( h );
+}
+
+uint64_t Scheduler::attach( Session* s )
+{
+    uint64_t id = next_id_++;
+    sessions_[id] = s;
+
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.u64 = id;
+    if( epoll_ctl( epoll_, EPOLL_CTL_ADD, l4sap_get_fd( s->l4_ ), &ev ) < 0 )
+    {
+        perror( "l4co: epoll_ctl" );
+    }
+    return id;
+}
+
+void Scheduler::detach( Session* s )
+{
+    /* Timers of the session stay in the heap and are skipped when they
+     * expire, because the id is no longer known.
+     */
+    epoll_ctl( epoll_, EPOLL_CTL_DEL, l4sap_get_fd( s->l4_ ), nullptr );
+    sessions_.erase( s->id_ );
+}
+
+/* Put the next retransmission of s into the heap. Older timers of s
+ * become stale; the heap is cleaned lazily instead of searched. Stale
+ * timers are only popped when they reach the top, so a session that
+ * re-arms often would grow the heap without bound; once they outnumber
+ * the sessions, the heap is compacted.
+ */
+void Scheduler::arm( Session* s )
+{
+    Timer t;
+    if( !l4sap_next_deadline( s->l4_, &t.when ) ) return;
+    t.session    = s->id_;
+    t.generation = ++s->generation_;
+    timers_.push_back( t );
+    std::push_heap( timers_.begin( ), timers_.end( ), std::greater<Timer>( ) );
+
+    /* Every session has at most one live timer. */
+    if( timers_.size( ) > 2 * sessions_.size( ) ) compact_timers( );
+}
+
+void Scheduler::pop_timer( )
+{
+    std::pop_heap( timers_.begin( ), timers_.end( ), std::greater<Timer>( ) );
+    timers_.pop_back( );
+}
+
+/* Drop the stale timers and rebuild the heap from the live ones, in
+ * time linear in the size of the heap. Afterwards there are at most as
+ * many timers as sessions, so this runs at most once per that many
+ * calls of arm.
+ */
+void Scheduler::compact_timers( )
+{
+    std::erase_if( timers_, [this]( const Timer& t ) {
+        auto it = sessions_.find( t.session );
+        return it == sessions_.end( ) || it->second->generation_ != t.generation;
+    } );
+    std::make_heap( timers_.begin( ), timers_.end( ), std::greater<Timer>( ) );
+}
+
+int Scheduler::next_timeout_ms( )
+{
+    while( !timers_.empty( ) )
+    {
+        const Timer& t = timers_.front( );
+        auto it = sessions_.find( t.session );
+        if( it != sessions_.end( ) && it->second->generation_ == t.generation ) break;
+        pop_timer( );
+    }
+    if( timers_.empty( ) ) return -1;
+
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    const struct timespec& when = timers_.front( ).when;
+    long long ms = (long long)(when.tv_sec - now.tv_sec) * 1000 + (when.tv_nsec - now.tv_nsec + 999999) / 1000000;
+    return ms < 0 ? 0 : (int)ms;
+}
+
+int Scheduler::run( )
+{
+    if( epoll_ < 0 ) return -1;
+
+    struct epoll_event events[MAX_EVENTS];
+    while( live_ > 0 )
+    {
+        /* Resuming may make more Tasks ready; run them in this turn. */
+        while( !ready_.empty( ) )
+        {
+            std::coroutine_handle<> h = ready_.front( );
+            ready_.pop_front( );
+            h.resume( );
+        }
+        if( live_ == 0 ) break;
+
+        int n = epoll_wait( epoll_, events, MAX_EVENTS, next_timeout_ms( ) );
+        if( n < 0 )
+        {
+            if( errno == EINTR ) continue;
+            perror( "l4co: epoll_wait" );
+            return -1;
+        }
+        for( int i=0; i<n; i++ )
+        {
+            auto it = sessions_.find( events[i].data.u64 );
+            if( it != sessions_.end( ) ) it->second->poll( nullptr );
+        }
+
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        while( !timers_.empty( ) )
+        {
+            Timer t = timers_.front( );
+            if( t.when.tv_sec > now.tv_sec || (t.when.tv_sec == now.tv_sec && t.when.tv_nsec > now.tv_nsec) ) break;
+            pop_timer( );
+            auto it = sessions_.find( t.session );
+            if( it != sessions_.end( ) && it->second->generation_ == t.generation ) it->second->poll( &now );
+        }
+    }
+    return 0;
+}
+
+/* --- Session --- */
+
+Session::Session( Scheduler& sched, const char* server_ip, int server_port, int window )
+    : sched_( sched ), l4_( l4sap_create( server_ip, server_port ) )
+{
+    if( l4_ && window > 1 && l4sap_set_window( l4_, window ) < 0 )
+    {
+        l4sap_destroy( l4_ );
+        l4_ = nullptr;
+    }
+    attach( );
+}
+
+Session::Session( Scheduler& sched, L4SAP* l4 ) : sched_( sched ), l4_( l4 )
+{
+    attach( );
+}
+
+void Session::attach( )
+{
+    if( !l4_ ) return;
+    if( l2sap_set_pool_size( l4_->l2, l4_->window + SESSION_POOL_EXTRA ) < 0 )
+    {
+        l4sap_destroy( l4_ );
+        l4_ = nullptr;
+        return;
+    }
+    l4sap_set_callback( l4_, on_event, this );
+    id_ = sched_.attach( this );
+}
+
+Session::~Session( )
+{
+    if( !l4_ ) return;
+    sched_.detach( this );
+    l4sap_set_callback( l4_, nullptr, nullptr );
+    l4sap_destroy( l4_ );
+}
+
+/* Handle what has arrived and what has expired, then set the timer
+ * again, since ACKs and retransmissions move the deadline.
+ */
+void Session::poll( const struct timespec* now )
+{
+    int r = l4sap_poll( l4_, now );
+    if( r == L4_QUIT ) return; // on_event has woken everybody
+    sched_.arm( this );
+}
+
+/* Called from inside l4sap_poll. Waiting Tasks are only made ready
+ * here and resumed by the Scheduler afterwards, so that a Task never
+ * runs, and never destroys its Session, inside L4.
+ */
+void Session::on_event( L4SAP* l4, int event, int value, void* user )
+{
+    Session* s = (Session*)user;
+    (void)l4;
+    (void)value;
+
+    switch( event )
+    {
+    case L4_EVENT_SENT :
+        if( s->sender_ && s->sender_->try_send( ) )
+        {
+            s->sched_.make_ready( s->sender_->handle_ );
+            s->sender_ = nullptr;
+        }
+        if( s->flusher_ && s->flusher_->try_flush( ) )
+        {
+            s->sched_.make_ready( s->flusher_->handle_ );
+            s->flusher_ = nullptr;
+        }
+        break;
+    case L4_EVENT_RECV :
+        if( s->receiver_ && s->receiver_->try_recv( ) )
+        {
+            s->sched_.make_ready( s->receiver_->handle_ );
+            s->receiver_ = nullptr;
+        }
+        break;
+    case L4_EVENT_FAILED :
+        s->error_ = L4_SEND_FAILED;
+        if( s->sender_ && s->sender_->try_send( ) )
+        {
+            s->sched_.make_ready( s->sender_->handle_ );
+            s->sender_ = nullptr;
+        }
+        if( s->flusher_ && s->flusher_->try_flush( ) )
+        {
+            s->sched_.make_ready( s->flusher_->handle_ );
+            s->flusher_ = nullptr;
+        }
+        break;
+    case L4_EVENT_QUIT :
+        s->quit_ = true;
+        if( s->sender_ )   { s->sender_->try_send( );   s->sched_.make_ready( s->sender_->handle_ ); }
+        if( s->receiver_ ) { s->receiver_->try_recv( ); s->sched_.make_ready( s->receiver_->handle_ ); }
+        if( s->flusher_ )  { s->flusher_->try_flush( ); s->sched_.make_ready( s->flusher_->handle_ ); }
+        s->sender_   = nullptr;
+        s->receiver_ = nullptr;
+        s->flusher_  = nullptr;
+        break;
+    default :
+        break;
+    }
+}
+
+Session::SendOp Session::send( const uint8_t* data, int len )
+{
+    return SendOp( this, data, len );
+}
+
+Session::RecvOp Session::recv( uint8_t* data, int len )
+{
+    return RecvOp( this, data, len );
+}
+
+Session::FlushOp Session::flush( )
+{
+    return FlushOp( this );
+}
+
+/* The try functions set result_ and return true when the operation is
+ * complete, or return false if it has to wait.
+ */
+bool Session::SendOp::try_send( )
+{
+    if( !s_->l4_ )   { result_ = -1;      return true; }
+    if( s_->quit_ )  { result_ = L4_QUIT; return true; }
+    if( s_->error_ ) // as in l4sap_sendv, the failure is that of an earlier packet
+    {
+        result_    = s_->error_;
+        s_->error_ = 0;
+        return true;
+    }
+    int r = l4sap_send_async( s_->l4_, data_, len_ );
+    if( r == L4_WOULDBLOCK ) return false;
+    result_ = r;
+    s_->sched_.arm( s_ );
+    return true;
+}
+
+bool Session::SendOp::await_ready( )
+{
+    return try_send( );
+}
+
+void Session::SendOp::await_suspend( std::coroutine_handle<> h )
+{
+    handle_     = h;
+    s_->sender_ = this;
+}
+
+bool Session::RecvOp::try_recv( )
+{
+    if( !s_->l4_ ) { result_ = -1; return true; }
+    int r = l4sap_recv_async( s_->l4_, data_, len_ );
+    if( r == L4_WOULDBLOCK )
+    {
+        if( !s_->quit_ ) return false;
+        r = L4_QUIT;
+    }
+    result_ = r;
+    return true;
+}
+
+bool Session::RecvOp::await_ready( )
+{
+    return try_recv( );
+}
+
+void Session::RecvOp::await_suspend( std::coroutine_handle<> h )
+{
+    handle_       = h;
+    s_->receiver_ = this;
+}
+
+bool Session::FlushOp::try_flush( )
+{
+    if( !s_->l4_ )  { result_ = -1;      return true; }
+    if( s_->quit_ ) { result_ = L4_QUIT; return true; }
+    if( s_->error_ )
+    {
+        result_    = s_->error_;
+        s_->error_ = 0;
+        return true;
+    }
+    if( s_->l4_->snd_una != s_->l4_->snd_nxt ) return false;
+    result_ = 0;
+    return true;
+}
+
+bool Session::FlushOp::await_ready( )
+{
+    return try_flush( );
+}
+
+void Session::FlushOp::await_suspend( std::coroutine_handle<> h )
+{
+    handle_      = h;
+    s_->flusher_ = this;
+}
+
+} // namespace l4co
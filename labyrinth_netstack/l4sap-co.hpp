@@ -0,0 +1,245 @@
+#ifndef L4SAP_CO_HPP
+#define L4SAP_CO_HPP
+
+#include <coroutine>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "l4sap.h"
+
+/* A C++20 coroutine layer over the non-blocking L4 interface.
+ *
+ * A Scheduler owns an epoll instance and runs any number of Tasks on
+ * one thread. A Task is a coroutine that uses Sessions; co_await on
+ * session.send() or session.recv() suspends the Task instead of
+ * blocking the thread, and the Scheduler resumes it when the socket
+ * of the session becomes readable or one of its retransmission
+ * timers expires. A suspended Task costs its coroutine frame, so tens
+ * of thousands of sessions can be kept in flight from one core.
+ *
+ * Nothing here is thread-safe: a Scheduler, its Tasks and their
+ * Sessions belong to one thread.
+ */
+namespace l4co
+{
+
+class Scheduler;
+class Session;
+
+/* The return type of a coroutine that the Scheduler runs. A Task does
+ * not start before it is handed to Scheduler::spawn, and its frame is
+ * freed when it returns. Exceptions are not supported; one that
+ * escapes a Task terminates the program.
+ */
+class Task
+{
+public:
+    struct promise_type
+    {
+        Scheduler* sched = nullptr;
+
+        Task                get_return_object( );
+        std::suspend_always initial_suspend( ) noexcept { return {}; }
+        std::suspend_never  final_suspend( ) noexcept { return {}; }
+        void                return_void( ) { }
+        void                unhandled_exception( );
+        ~promise_type( );
+    };
+
+    Task( Task&& other ) noexcept;
+    Task( const Task& ) = delete;
+    Task& operator=( const Task& ) = delete;
+    ~Task( );
+
+private:
+    friend class Scheduler;
+    explicit Task( std::coroutine_handle<promise_type> h ) : handle_( h ) { }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/* The event loop. run() returns when every spawned Task has returned.
+ */
+class Scheduler
+{
+public:
+    Scheduler( );
+    ~Scheduler( );
+    Scheduler( const Scheduler& ) = delete;
+    Scheduler& operator=( const Scheduler& ) = delete;
+
+    /* Start t at the next turn of the loop. */
+    void spawn( Task t );
+
+    /* Run until all Tasks have returned. Returns 0, or -1 if epoll
+     * failed.
+     */
+    int run( );
+
+    /* Number of Tasks that have not returned yet. */
+    int live( ) const { return live_; }
+
+private:
+    friend class Task;
+    friend class Session;
+
+    struct Timer
+    {
+        struct timespec when;
+        uint64_t        session;
+        uint64_t        generation;
+        bool operator>( const Timer& o ) const
+        {
+            return when.tv_sec != o.when.tv_sec ? when.tv_sec > o.when.tv_sec : when.tv_nsec > o.when.tv_nsec;
+        }
+    };
+
+    void     task_done( ) { live_--; }
+    void     make_ready( std::coroutine_handle<> h ) { ready_.push_back( h ); }
+    uint64_t attach( Session* s );
+    void     detach( Session* s );
+    void     arm( Session* s );
+    void     pop_timer( );
+    void     compact_timers( );
+    int      next_timeout_ms( );
+
+    int                                    epoll_;
+    int                                    live_;
+    uint64_t                               next_id_;
+    std::deque<std::coroutine_handle<>>    ready_;
+    std::unordered_map<uint64_t, Session*> sessions_;
+
+    /* A min-heap on when (std::push_heap with std::greater), a vector
+     * rather than a priority_queue so that compact_timers can filter it.
+     */
+    std::vector<Timer>                     timers_;
+};
+
+/* An L4 entity driven by a Scheduler. The operations return awaitables
+ * whose co_await yields what the blocking function of l4sap.h would
+ * return. At most one send, one recv and one flush may be waiting on a
+ * session at the same time, usually all from the Task that owns it.
+ * The session must be the only user of its socket in the Scheduler,
+ * so sessions of an L2 server (which share one socket) do not work.
+ */
+class Session
+{
+public:
+    /* Create an L4 client for server_ip:server_port, like l4sap_create,
+     * with the given window (see l4sap_set_window).
+     */
+    Session( Scheduler& sched, const char* server_ip, int server_port, int window = 1 );
+
+    /* Take over an entity that was created with l4sap_create. */
+    Session( Scheduler& sched, L4SAP* l4 );
+
+    /* Sends L4_RESET to the peer and destroys the entity. */
+    ~Session( );
+
+    Session( const Session& ) = delete;
+    Session& operator=( const Session& ) = delete;
+
+    /* False if the entity could not be created. */
+    bool ok( ) const { return l4_ != nullptr; }
+
+    L4SAP* l4( ) const { return l4_; }
+
+    class SendOp;
+    class RecvOp;
+    class FlushOp;
+
+    /* co_await yields the number of bytes accepted, L4_SEND_FAILED if
+     * an earlier packet was given up, or L4_QUIT. Like l4sap_send in
+     * windowed mode, it completes when the packet is in the window;
+     * use flush() to wait for the ACKs. data must stay valid until the
+     * co_await has completed; it is copied into the window then.
+     */
+    SendOp send( const uint8_t* data, int len );
+
+    /* co_await yields the number of bytes copied to data, or L4_QUIT. */
+    RecvOp recv( uint8_t* data, int len );
+
+    /* co_await yields 0 when every sent packet is acknowledged,
+     * L4_SEND_FAILED, or L4_QUIT.
+     */
+    FlushOp flush( );
+
+    class SendOp
+    {
+    public:
+        bool await_ready( );
+        void await_suspend( std::coroutine_handle<> h );
+        int  await_resume( ) const { return result_; }
+
+    private:
+        friend class Session;
+        SendOp( Session* s, const uint8_t* data, int len ) : s_( s ), data_( data ), len_( len ) { }
+        bool try_send( );
+
+        Session*                s_;
+        const uint8_t*          data_;
+        int                     len_;
+        int                     result_ = 0;
+        std::coroutine_handle<> handle_;
+    };
+
+    class RecvOp
+    {
+    public:
+        bool await_ready( );
+        void await_suspend( std::coroutine_handle<> h );
+        int  await_resume( ) const { return result_; }
+
+    private:
+        friend class Session;
+        RecvOp( Session* s, uint8_t* data, int len ) : s_( s ), data_( data ), len_( len ) { }
+        bool try_recv( );
+
+        Session*                s_;
+        uint8_t*                data_;
+        int                     len_;
+        int                     result_ = 0;
+        std::coroutine_handle<> handle_;
+    };
+
+    class FlushOp
+    {
+    public:
+        bool await_ready( );
+        void await_suspend( std::coroutine_handle<> h );
+        int  await_resume( ) const { return result_; }
+
+    private:
+        friend class Session;
+        explicit FlushOp( Session* s ) : s_( s ) { }
+        bool try_flush( );
+
+        Session*                s_;
+        int                     result_ = 0;
+        std::coroutine_handle<> handle_;
+    };
+
+private:
+    friend class Scheduler;
+
+    void        attach( );
+    void        poll( const struct timespec* now );
+    static void on_event( L4SAP* l4, int event, int value, void* user );
+
+    Scheduler& sched_;
+    L4SAP*     l4_;
+    uint64_t   id_         = 0;
+    uint64_t   generation_ = 0;     /* of the newest timer in the heap */
+    int        error_      = 0;     /* L4_SEND_FAILED for the next send or flush */
+    bool       quit_       = false;
+    SendOp*    sender_     = nullptr;
+    RecvOp*    receiver_   = nullptr;
+    FlushOp*   flusher_    = nullptr;
+};
+
+} // namespace l4co
+
+#endif
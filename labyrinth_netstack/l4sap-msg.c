@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include "l4sap.h"
+#include "l2sap.h"
+#include "trace.h"
+
+static int recv_msg(L4SAP* l4, uint8_t* data, int len, uint8_t** alloc);
+
+/**
+ * @brief Sends a message of any length as a sequence of fragments.
+ *
+ * @param l4 Pointer to the L4SAP structure.
+ * @param data The message.
+ * @param len Length of the message, at most L4_MAX_MSG.
+ * @return int len, or the error of l4sap_sendv.
+ */
+int l4sap_send_msg(L4SAP* l4, const uint8_t* data, int len) {
+    if (!l4 || !l4->l2 || (!data && len > 0)) { // Sjekker om argumentene er gyldige
+        fprintf(stderr, "L4SAP send_msg: Invalid arguments.\n");
+        return -1;
+    }
+
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len  = (size_t)(len > 0 ? len : 0);
+    return l4sap_send_msgv(l4, &iov, 1);
+}
+
+/**
+ * @brief Sends the concatenation of iovcnt segments as one message.
+ *
+ * Every fragment is handed to l4sap_sendv as the fragment header
+ * followed by the slices of the segments that it covers. A fragment
+ * takes at most one slice of every segment, so together with the
+ * header it never needs more than L4_MAX_IOV entries.
+ *
+ * @param l4 Pointer to the L4SAP structure.
+ * @param iov The segments.
+ * @param iovcnt Number of segments, at most L4_MSG_MAX_IOV.
+ * @return int Length of the message, or the error of l4sap_sendv.
+ */
+int l4sap_send_msgv(L4SAP* l4, const struct iovec* iov, int iovcnt) {
+    if (!l4 || !l4->l2 || iovcnt < 0 || iovcnt > L4_MSG_MAX_IOV || (iovcnt > 0 && !iov)) { // Sjekker om argumentene er gyldige
+        fprintf(stderr, "L4SAP send_msgv: Invalid arguments.\n");
+        return -1;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (total > (size_t)L4_MAX_MSG) {
+        fprintf(stderr, "L4SAP send_msgv: Message of %zu bytes exceeds L4_MAX_MSG %d.\n",
+                total, L4_MAX_MSG);
+        return -1;
+    }
+
+    L4MsgHeader  hdr;
+    struct iovec segs[L4_MAX_IOV];
+    int          seg = 0;   // Segmentet vi er kommet til
+    size_t       pos = 0;   // Posisjon i det segmentet
+    size_t       offset = 0;
+
+    hdr.total_len = htonl((uint32_t)total);
+
+    // En tom melding blir ett fragment uten data, saa mottakeren faar den likevel
+    do {
+        hdr.offset = htonl((uint32_t)offset);
+        segs[0].iov_base = &hdr;
+        segs[0].iov_len  = L4MsgHeadersize;
+        int    nsegs = 1;
+        size_t room  = L4MsgFragsize;
+
+        while (room > 0 && seg < iovcnt) { // Plukk ut biter av segmentene til fragmentet er fullt
+            size_t avail = iov[seg].iov_len - pos;
+            size_t take  = (avail < room) ? avail : room;
+            if (take > 0) {
+                segs[nsegs].iov_base = (uint8_t*)iov[seg].iov_base + pos;
+                segs[nsegs].iov_len  = take;
+                nsegs++;
+            }
+            pos  += take;
+            room -= take;
+            if (pos == iov[seg].iov_len) {
+                seg++;
+                pos = 0;
+            }
+        }
+
+        int r = l4sap_sendv(l4, segs, nsegs);
+        if (r < 0) {
+            fprintf(stderr, "L4SAP send_msgv: Fragment at offset %zu failed, message incomplete.\n", offset);
+            return r;
+        }
+        offset += L4MsgFragsize - room;
+    } while (offset < total);
+
+    return (int)total;
+}
+
+/**
+ * @brief Receives a message and reassembles it in the caller's buffer.
+ *
+ * @param l4 Pointer to the L4SAP structure.
+ * @param data Buffer for the message.
+ * @param len Size of the buffer.
+ * @return int Number of bytes copied to data, L4_QUIT, or -1 on error.
+ */
+int l4sap_recv_msg(L4SAP* l4, uint8_t* data, int len) {
+    if (!l4 || !l4->l2 || (!data && len > 0) || len < 0) { // Sjekker for ugyldige argumenter
+        fprintf(stderr, "L4SAP recv_msg: Invalid arguments.\n");
+        return -1;
+    }
+    return recv_msg(l4, data, len, NULL);
+}
+
+/**
+ * @brief Receives a message into a buffer of the message's size.
+ *
+ * @param l4 Pointer to the L4SAP structure.
+ * @param data Receives the buffer, which the caller frees, or NULL.
+ * @return int Length of the message, L4_QUIT, or -1 on error.
+ */
+int l4sap_recv_msg_alloc(L4SAP* l4, uint8_t** data) {
+    if (!l4 || !l4->l2 || !data) { // Sjekker for ugyldige argumenter
+        fprintf(stderr, "L4SAP recv_msg_alloc: Invalid arguments.\n");
+        return -1;
+    }
+    *data = NULL;
+    return recv_msg(l4, NULL, 0, data);
+}
+
+/* Felles mottak for begge varianter. Med alloc != NULL allokeres
+ * bufferet naar det foerste fragmentet forteller hvor stor meldingen er,
+ * ellers kopieres det som faar plass i data.
+ */
+static int recv_msg(L4SAP* l4, uint8_t* data, int len, uint8_t** alloc) {
+    uint8_t* msg      = NULL;
+    uint32_t total    = 0;
+    uint32_t received = 0;
+    int      active   = 0; // Om vi er midt i en melding
+
+    while (1) {
+        L2Buf* b;
+        int n = l4sap_recv_lend(l4, &b);
+        if (n < 0) {
+            if (alloc) {
+                free(msg);
+            }
+            return n;
+        }
+
+        if (n < L4MsgHeadersize) { // For kort til aa vaere et fragment
+            TRACE(TRACE_ERROR, TRACE_L4_MSG_DISCARD, 0, 0, n);
+            l2buf_release(b);
+            continue;
+        }
+
+        L4MsgHeader hdr;
+        memcpy(&hdr, b->data + b->offset, L4MsgHeadersize);
+        uint32_t frag_total  = ntohl(hdr.total_len);
+        uint32_t frag_offset = ntohl(hdr.offset);
+        uint32_t frag_len    = (uint32_t)(n - L4MsgHeadersize);
+
+        if (frag_offset == 0) { // Starten paa en ny melding
+            if (active) {
+                TRACE(TRACE_ERROR, TRACE_L4_MSG_DISCARD, received, total, 0); // Den halve meldingen
+            }
+            active = 0;
+            if (frag_total > (uint32_t)L4_MAX_MSG) {
+                TRACE(TRACE_ERROR, TRACE_L4_MSG_DISCARD, frag_offset, frag_total, frag_len);
+                l2buf_release(b);
+                continue;
+            }
+            if (alloc) {
+                free(msg);
+                msg = (uint8_t*)malloc(frag_total > 0 ? frag_total : 1);
+                if (!msg) {
+                    perror("L4 Recv_msg: Failed to allocate message buffer");
+                    l2buf_release(b);
+                    return -1;
+                }
+            }
+            total    = frag_total;
+            received = 0;
+            active   = 1;
+        } else if (!active || frag_total != total || frag_offset != received) {
+            // Resten av en melding vi ikke har starten paa, eller noe som ikke passer inn
+            TRACE(TRACE_ERROR, TRACE_L4_MSG_DISCARD, frag_offset, frag_total, frag_len);
+            active = 0;
+            l2buf_release(b);
+            continue;
+        }
+
+        if (frag_len > total - received) {
+            TRACE(TRACE_ERROR, TRACE_L4_MSG_DISCARD, frag_offset, frag_total, frag_len);
+            active = 0;
+            l2buf_release(b);
+            continue;
+        }
+
+        // Kopier fragmentet inn, i kallerens buffer bare det som faar plass
+        const uint8_t* src = b->data + b->offset + L4MsgHeadersize;
+        if (alloc) {
+            memcpy(msg + received, src, frag_len);
+        } else if (received < (uint32_t)len) {
+            uint32_t room = (uint32_t)len - received;
+            memcpy(data + received, src, frag_len < room ? frag_len : room);
+        }
+        received += frag_len;
+        l2buf_release(b);
+
+        if (received == total) { // Meldingen er komplett
+            if (alloc) {
+                *alloc = msg;
+                return (int)total;
+            }
+            if (total > (uint32_t)len) {
+                fprintf(stderr, "L4 Recv_msg: Warning: Message (%u bytes) larger than buffer (%d bytes), truncated.\n",
+                        total, len);
+                return len;
+            }
+            return (int)total;
+        }
+    }
+}
@@ -0,0 +1,433 @@
+#define _GNU_SOURCE     // For pthread_setaffinity_np og CPU_* makroene
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "l4sap-shard.h"
+
+/* How long a shard waits at most before it looks at the stop flag. */
+#define L4_SHARD_TICK_US 50000
+
+/* Receive buffers of a session in addition to its window. The shard
+ * copies every packet to the handler, so it never holds more.
+ */
+#define L4_SHARD_POOL_EXTRA 4
+
+typedef struct L4Shard L4Shard;
+
+struct L4Shard
+{
+    /* Written by the shard only. Alone on its cache lines, so that the
+     * shards do not invalidate each other's counters.
+     */
+    L4ShardStats  stats __attribute__((aligned(64)));
+
+    L4ShardServer* owner __attribute__((aligned(64)));
+    int            index;
+    int            cpu;           /* -1: not pinned */
+    L2SAP*         server;
+    pthread_t      thread;
+    int            started;
+
+    /* The L4 entities of the accepted sessions. Every session's
+     * L2SAP.upper holds its index here + 1, so removal is O(1).
+     */
+    L4SAP**        sessions;
+    int            count;
+    int            capacity;
+};
+
+struct L4ShardServer
+{
+    int            port;
+    int            shards;
+    int            window;
+    L4ShardHandler handler;
+    void*          user;
+    int            stop;
+    L4Shard*       shard;
+};
+
+static void* shard_main(void* arg);
+static void  shard_accept(L4Shard* sh, L2SAP* l2);
+static void  shard_serve(L4Shard* sh, L4SAP* l4, const struct timespec* now, struct timespec* next);
+static void  shard_remove(L4Shard* sh, L4SAP* l4);
+static void  shard_timers(L4Shard* sh, const struct timespec* now, struct timespec* next);
+static int   pick_cpu(int index);
+static int   ts_before(const struct timespec* a, const struct timespec* b);
+
+/**
+ * @brief Starts a sharded L4 server.
+ *
+ * Creates one L2 server per shard, all bound to port with
+ * SO_REUSEPORT, and one thread per shard that accepts and serves the
+ * sessions that the kernel gives to its socket.
+ *
+ * @param port The UDP port, or 0 for an ephemeral port.
+ * @param config Optional settings, NULL for the defaults.
+ * @param handler Called for every DATA packet.
+ * @param user Passed to handler.
+ * @return L4ShardServer* The running server, or NULL on error.
+ */
+L4ShardServer* l4shard_server_start(int port, const L4ShardConfig* config,
+                                    L4ShardHandler handler, void* user) {
+    if (port < 0 || !handler) {
+        fprintf(stderr, "L4 shard server_start: Invalid arguments.\n");
+        return NULL;
+    }
+
+    int shards = (config && config->shards > 0) ? config->shards : 0;
+    if (shards == 0) { // En shard per CPU vi faar kjoere paa
+        cpu_set_t set;
+        shards = (sched_getaffinity(0, sizeof(set), &set) == 0) ? CPU_COUNT(&set) : 1;
+    }
+    int window = (config && config->window > 1) ? config->window : 1;
+    if (window > L4_MAX_WINDOW) {
+        fprintf(stderr, "L4 shard server_start: Window %d is larger than %d.\n", window, L4_MAX_WINDOW);
+        return NULL;
+    }
+
+    L4ShardServer* srv = (L4ShardServer*)calloc(1, sizeof(L4ShardServer));
+    L4Shard*       sh  = NULL;
+    if (srv && posix_memalign((void**)&sh, 64, (size_t)shards * sizeof(L4Shard)) != 0) {
+        sh = NULL;
+    }
+    if (!srv || !sh) {
+        perror("Failed to allocate L4 shard server");
+        free(srv);
+        return NULL;
+    }
+    memset(sh, 0, (size_t)shards * sizeof(L4Shard));
+    srv->shards  = shards;
+    srv->window  = window;
+    srv->handler = handler;
+    srv->user    = user;
+    srv->shard   = sh;
+
+    L2ServerConfig l2config;
+    memset(&l2config, 0, sizeof(l2config));
+    l2config.max_sessions = config ? config->max_sessions : 0;
+    l2config.reuseport    = 1;
+
+    for (int i = 0; i < shards; i++) {
+        sh[i].owner  = srv;
+        sh[i].index  = i;
+        sh[i].cpu    = (config && config->pin) ? pick_cpu(i) : -1;
+        sh[i].server = l2sap_server_create_ex(port, &l2config);
+        if (!sh[i].server) {
+            l4shard_server_stop(srv);
+            return NULL;
+        }
+        if (port == 0) { // Resten av shardene binder seg til porten den foerste fikk
+            struct sockaddr_in addr;
+            socklen_t          addrlen = sizeof(addr);
+            if (getsockname(sh[i].server->socket, (struct sockaddr*)&addr, &addrlen) < 0) {
+                perror("L4 shard getsockname failed");
+                l4shard_server_stop(srv);
+                return NULL;
+            }
+            port = ntohs(addr.sin_port);
+        }
+    }
+    srv->port = port;
+
+    // Start traadene foerst naar alle socketene finnes, saa ingen peer havner paa en halvferdig server
+    for (int i = 0; i < shards; i++) {
+        if (pthread_create(&sh[i].thread, NULL, shard_main, &sh[i]) != 0) {
+            fprintf(stderr, "L4 shard server_start: Could not start shard %d.\n", i);
+            l4shard_server_stop(srv);
+            return NULL;
+        }
+        sh[i].started = 1;
+    }
+    return srv;
+}
+
+int l4shard_server_port(const L4ShardServer* srv) {
+    return srv ? srv->port : -1;
+}
+
+int l4shard_server_shards(const L4ShardServer* srv) {
+    return srv ? srv->shards : 0;
+}
+
+/* Leser tellerne mens shardene skriver dem. Hver teller er konsistent
+ * for seg, men summen er ikke et oejeblikksbilde av alle.
+ */
+void l4shard_server_stats(const L4ShardServer* srv, L4ShardStats* total, L4ShardStats* per_shard) {
+    if (!srv) {
+        return;
+    }
+    if (total) {
+        memset(total, 0, sizeof(*total));
+    }
+    for (int i = 0; i < srv->shards; i++) {
+        const L4ShardStats* s = &srv->shard[i].stats;
+        L4ShardStats        c;
+        c.packets_in     = __atomic_load_n(&s->packets_in, __ATOMIC_RELAXED);
+        c.bytes_in       = __atomic_load_n(&s->bytes_in, __ATOMIC_RELAXED);
+        c.packets_out    = __atomic_load_n(&s->packets_out, __ATOMIC_RELAXED);
+        c.send_failed    = __atomic_load_n(&s->send_failed, __ATOMIC_RELAXED);
+        c.sessions_open  = __atomic_load_n(&s->sessions_open, __ATOMIC_RELAXED);
+        c.sessions_total = __atomic_load_n(&s->sessions_total, __ATOMIC_RELAXED);
+        c.l2_drops       = __atomic_load_n(&s->l2_drops, __ATOMIC_RELAXED);
+        if (per_shard) {
+            per_shard[i] = c;
+        }
+        if (total) {
+            total->packets_in     += c.packets_in;
+            total->bytes_in       += c.bytes_in;
+            total->packets_out    += c.packets_out;
+            total->send_failed    += c.send_failed;
+            total->sessions_open  += c.sessions_open;
+            total->sessions_total += c.sessions_total;
+            total->l2_drops       += c.l2_drops;
+        }
+    }
+}
+
+/**
+ * @brief Stops the shards and frees the server.
+ *
+ * Every shard resets its sessions (l4sap_destroy) before its L2 server
+ * is destroyed.
+ */
+void l4shard_server_stop(L4ShardServer* srv) {
+    if (!srv) {
+        return;
+    }
+    __atomic_store_n(&srv->stop, 1, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < srv->shards; i++) {
+        L4Shard* sh = &srv->shard[i];
+        if (sh->started) {
+            pthread_join(sh->thread, NULL);
+        }
+        while (sh->count > 0) { // Traaden er ferdig, saa vi eier sesjonene naa
+            shard_remove(sh, sh->sessions[sh->count - 1]);
+        }
+        free(sh->sessions);
+        if (sh->server) {
+            l2sap_destroy(sh->server);
+        }
+    }
+    free(srv->shard);
+    free(srv);
+}
+
+/* Hovedloekka til en shard. Bare denne traaden roerer serveren og
+ * sesjonene dens, saa ingenting trenger laas.
+ */
+static void* shard_main(void* arg) {
+    L4Shard*        sh    = (L4Shard*)arg;
+    L4ShardServer*  owner = sh->owner;
+    L2Server*       l2srv = sh->server->server;
+    struct timespec next  = { 0, 0 }; // Tidligste kjente frist, 0 naar ingen
+    struct timespec now;
+
+    if (sh->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(sh->cpu, &set);
+        int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (r != 0) {
+            fprintf(stderr, "L4 shard %d: Could not pin to CPU %d (%s).\n", sh->index, sh->cpu, strerror(r));
+        }
+    }
+
+    while (!__atomic_load_n(&owner->stop, __ATOMIC_RELAXED)) {
+        // Vent paa pakker, men ikke forbi neste gjensending eller stoppsjekken
+        long wait_us = L4_SHARD_TICK_US;
+        if (next.tv_sec || next.tv_nsec) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long long left_us = ((long long)(next.tv_sec - now.tv_sec) * 1000000000LL +
+                                 (next.tv_nsec - now.tv_nsec) + 999) / 1000;
+            if (left_us < wait_us) {
+                wait_us = left_us < 0 ? 0 : (long)left_us;
+            }
+        }
+        struct timeval tv = { wait_us / 1000000, wait_us % 1000000 };
+        if (l2sap_server_poll(sh->server, &tv) < 0) {
+            fprintf(stderr, "L4 shard %d: Polling the server failed.\n", sh->index);
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        while (l2srv->accept_head) { // Nye peers
+            struct timeval zero = { 0, 0 };
+            L2SAP*         l2   = l2sap_server_accept(sh->server, &zero);
+            if (l2) {
+                shard_accept(sh, l2);
+            }
+        }
+
+        L2SAP* l2;
+        while ((l2 = l2sap_server_next_ready(sh->server))) {
+            if (l2->upper) {
+                shard_serve(sh, sh->sessions[(intptr_t)l2->upper - 1], &now, &next);
+            }
+        }
+
+        if ((next.tv_sec || next.tv_nsec) && !ts_before(&now, &next)) {
+            shard_timers(sh, &now, &next);
+        }
+
+        __atomic_store_n(&sh->stats.l2_drops, l2srv->drops_invalid + l2srv->drops_no_session, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* Lager en L4 entitet for en ny sesjon og legger den i shardens liste.
+ * Sesjonen forsvinner igjen hvis noe feiler.
+ */
+static void shard_accept(L4Shard* sh, L2SAP* l2) {
+    if (sh->count == sh->capacity) {
+        int     capacity = sh->capacity ? 2 * sh->capacity : 64;
+        L4SAP** sessions = (L4SAP**)realloc(sh->sessions, (size_t)capacity * sizeof(L4SAP*));
+        if (!sessions) {
+            perror("Failed to grow L4 shard session list");
+            l2sap_destroy(l2);
+            return;
+        }
+        sh->sessions = sessions;
+        sh->capacity = capacity;
+    }
+
+    L4SAP* l4 = l4sap_create_from_l2(l2);
+    if (!l4) {
+        l2sap_destroy(l2);
+        return;
+    }
+    int window = sh->owner->window;
+    if ((window > 1 && l4sap_set_window(l4, window) < 0) ||
+        l2sap_set_pool_size(l2, window + L4_SHARD_POOL_EXTRA) < 0) {
+        l4sap_destroy(l4); // Peeren faar RESET
+        return;
+    }
+
+    sh->sessions[sh->count] = l4;
+    l2->upper = (void*)(intptr_t)(sh->count + 1);
+    sh->count++;
+    __atomic_store_n(&sh->stats.sessions_open, sh->stats.sessions_open + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&sh->stats.sessions_total, sh->stats.sessions_total + 1, __ATOMIC_RELAXED);
+}
+
+/* Behandler det sesjonen har i koen og gir hver DATA pakke til
+ * handleren. Naar peeren har sendt RESET, forsvinner sesjonen etter at
+ * handleren har faatt pakkene som kom foer RESET. next
+ * flyttes frem hvis svarene fra handleren har en tidligere frist.
+ */
+static void shard_serve(L4Shard* sh, L4SAP* l4, const struct timespec* now, struct timespec* next) {
+    L4ShardServer* owner = sh->owner;
+    uint8_t        buffer[L4Payloadsize];
+
+    uint32_t sent = l4->snd_nxt; // Foer poll, saa det handleren sender fra sin callback ogsaa telles
+    int      r    = l4sap_poll(l4, now);
+    if (r == L4_SEND_FAILED) {
+        __atomic_store_n(&sh->stats.send_failed, sh->stats.send_failed + 1, __ATOMIC_RELAXED);
+    }
+
+    uint64_t packets = 0;
+    uint64_t bytes   = 0;
+    int      len;
+    while ((len = l4sap_recv_async(l4, buffer, sizeof(buffer))) >= 0) {
+        packets++;
+        bytes += (uint64_t)len;
+        owner->handler(l4, buffer, len, owner->user);
+    }
+    if (packets) {
+        __atomic_store_n(&sh->stats.packets_in, sh->stats.packets_in + packets, __ATOMIC_RELAXED);
+        __atomic_store_n(&sh->stats.bytes_in, sh->stats.bytes_in + bytes, __ATOMIC_RELAXED);
+    }
+    if (l4->snd_nxt != sent) {
+        __atomic_store_n(&sh->stats.packets_out, sh->stats.packets_out + (l4->snd_nxt - sent), __ATOMIC_RELAXED);
+    }
+    if (r == L4_QUIT) { // Foerst naa: pakkene foran RESET er kvittert og skal frem til handleren
+        shard_remove(sh, l4);
+        return;
+    }
+
+    struct timespec d;
+    if (l4sap_next_deadline(l4, &d) && ((!next->tv_sec && !next->tv_nsec) || ts_before(&d, next))) {
+        *next = d;
+    }
+}
+
+/* Tar sesjonen ut av lista ved aa flytte den siste inn i hullet, og
+ * resetter og frigjoer den. Handleren faar vite det foerst.
+ */
+static void shard_remove(L4Shard* sh, L4SAP* l4) {
+    sh->owner->handler(l4, NULL, 0, sh->owner->user);
+    int index = (int)(intptr_t)l4->l2->upper - 1;
+    int last  = sh->count - 1;
+    if (index != last) {
+        sh->sessions[index] = sh->sessions[last];
+        sh->sessions[index]->l2->upper = (void*)(intptr_t)(index + 1);
+    }
+    sh->count--;
+    l4->l2->upper = NULL;
+    l4sap_destroy(l4); // Fjerner ogsaa L2 sesjonen fra serveren
+    __atomic_store_n(&sh->stats.sessions_open, sh->stats.sessions_open - 1, __ATOMIC_RELAXED);
+}
+
+/* Gjensender for sesjonene med en frist som har gaatt ut, og finner
+ * den neste fristen. Bare de med utgaatt frist polles, fordi l4sap_poll
+ * paa en tom sesjon ogsaa leser server socketen. De polles gjennom
+ * shard_serve, saa pakker som poll tar fra sesjonens koe ogsaa naar
+ * handleren.
+ */
+static void shard_timers(L4Shard* sh, const struct timespec* now, struct timespec* next) {
+    struct timespec d;
+    next->tv_sec  = 0;
+    next->tv_nsec = 0;
+    for (int i = 0; i < sh->count; i++) {
+        L4SAP* l4 = sh->sessions[i];
+        if (!l4sap_next_deadline(l4, &d)) {
+            continue;
+        }
+        if (!ts_before(now, &d)) {
+            int count = sh->count;
+            shard_serve(sh, l4, now, next); // Flytter next frem til sin nye frist
+            if (sh->count < count) {
+                i--; // Den siste sesjonen ligger naa paa plass i
+            }
+            continue;
+        }
+        if ((!next->tv_sec && !next->tv_nsec) || ts_before(&d, next)) {
+            *next = d;
+        }
+    }
+}
+
+/* Shard nummer index faar den index-te CPUen prosessen kan kjoere paa,
+ * rundt igjen hvis det er flere shards enn CPUer.
+ */
+static int pick_cpu(int index) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return -1;
+    }
+    int count = CPU_COUNT(&set);
+    if (count == 0) {
+        return -1;
+    }
+    int want = index % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set) && want-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+static int ts_before(const struct timespec* a, const struct timespec* b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
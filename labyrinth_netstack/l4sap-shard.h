@@ -0,0 +1,83 @@
+#ifndef L4SAP_SHARD_H
+#define L4SAP_SHARD_H
+
+#include "l4sap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A sharded L4 server. Every shard is a thread with its own L2 server
+ * socket; all sockets are bound to the same port with SO_REUSEPORT,
+ * and the kernel hashes every peer (address and port) to one of
+ * them. All L4 state of a peer therefore lives in one thread, and
+ * the shards share nothing but the port and their counters.
+ */
+typedef struct L4ShardServer L4ShardServer;
+
+/* Called in the shard's thread for every DATA packet that arrives.
+ * The handler may answer with l4sap_send_async on l4. Handlers of
+ * different shards run at the same time.
+ * Before a session is destroyed (RESET from the peer, or the server
+ * stops), the handler is called once more with data NULL and len 0,
+ * so that it can free what it keeps for the session. A handler that
+ * has more to send than the window holds can set its own callback on
+ * l4 with l4sap_set_callback and continue on L4_EVENT_SENT.
+ */
+typedef void (*L4ShardHandler)( L4SAP* l4, const uint8_t* data, int len, void* user );
+
+/* Settings for l4shard_server_start. Fields that are 0 take the
+ * defaults.
+ */
+typedef struct L4ShardConfig L4ShardConfig;
+
+struct L4ShardConfig
+{
+    int shards;         /* number of threads, default: the CPUs this process may use */
+    int pin;            /* pin shard i to the i-th of those CPUs */
+    int window;         /* L4 window of every session, default stop-and-wait */
+    int max_sessions;   /* per shard, default L2_SERVER_MAX_SESSIONS */
+};
+
+/* Counters of one shard. Only the shard's thread writes them, so
+ * they need no locks; l4shard_server_stats reads them while the
+ * shards run.
+ */
+typedef struct L4ShardStats L4ShardStats;
+
+struct L4ShardStats
+{
+    uint64_t packets_in;      /* DATA handed to the handler */
+    uint64_t bytes_in;
+    uint64_t packets_out;     /* DATA the handler sent */
+    uint64_t send_failed;     /* packets given up after max retries */
+    uint64_t sessions_open;
+    uint64_t sessions_total;
+    uint64_t l2_drops;        /* frames the L2 server dropped */
+};
+
+/* Start the shards on port (0 for an ephemeral port, see
+ * l4shard_server_port). Returns NULL on error.
+ */
+L4ShardServer* l4shard_server_start( int port, const L4ShardConfig* config,
+                                     L4ShardHandler handler, void* user );
+
+/* The port that the shards are bound to. */
+int  l4shard_server_port( const L4ShardServer* srv );
+
+/* The number of shards. */
+int  l4shard_server_shards( const L4ShardServer* srv );
+
+/* Add the counters of all shards into total. If per_shard is not
+ * NULL, it receives the counters of every shard (one entry per shard).
+ */
+void l4shard_server_stats( const L4ShardServer* srv, L4ShardStats* total, L4ShardStats* per_shard );
+
+/* Stop the shards, reset all sessions and free the server. */
+void l4shard_server_stop( L4ShardServer* srv );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "l4sap.h"
+#include "l2sap.h"
+
+static int  hist_index(long us);
+static long hist_bucket_end(int index);
+
+void l4sap_get_stats(const L4SAP* l4, L4Stats* stats) {
+    if (!l4 || !stats) {
+        return;
+    }
+    *stats = l4->stats;
+}
+
+void l4sap_get_ack_latency(const L4SAP* l4, L4Histogram* hist) {
+    if (!l4 || !hist) {
+        return;
+    }
+    *hist = l4->ack_latency;
+}
+
+/**
+ * @brief Adds one value to a histogram.
+ *
+ * @param hist Pointer to the histogram.
+ * @param us The value in microseconds. Negative values count as 0,
+ *           values above L4_HIST_MAX_US as L4_HIST_MAX_US.
+ */
+void l4hist_record(L4Histogram* hist, long us) {
+    if (us < 0) {
+        us = 0;
+    }
+    if (us > L4_HIST_MAX_US) {
+        us = L4_HIST_MAX_US;
+    }
+    hist->buckets[hist_index(us)]++;
+    if (hist->count == 0 || (uint32_t)us < hist->min_us) {
+        hist->min_us = (uint32_t)us;
+    }
+    if ((uint32_t)us > hist->max_us) {
+        hist->max_us = (uint32_t)us;
+    }
+    hist->count++;
+    hist->sum_us += (uint64_t)us;
+}
+
+void l4hist_merge(L4Histogram* hist, const L4Histogram* from) {
+    if (!hist || !from || from->count == 0) {
+        return;
+    }
+    for (int i = 0; i < L4_HIST_BUCKETS; i++) {
+        hist->buckets[i] += from->buckets[i];
+    }
+    if (hist->count == 0 || from->min_us < hist->min_us) {
+        hist->min_us = from->min_us;
+    }
+    if (from->max_us > hist->max_us) {
+        hist->max_us = from->max_us;
+    }
+    hist->count  += from->count;
+    hist->sum_us += from->sum_us;
+}
+
+/**
+ * @brief Finds the value below which a fraction of the values lie.
+ *
+ * @param hist Pointer to the histogram.
+ * @param p The fraction, from 0 to 1.
+ * @return long The end of the bucket that contains the value, but at
+ *         most the largest value recorded. 0 if hist is empty.
+ */
+long l4hist_percentile(const L4Histogram* hist, double p) {
+    if (!hist || hist->count == 0) {
+        return 0;
+    }
+    if (p < 0) p = 0;
+    if (p > 1) p = 1;
+
+    uint64_t rank = (uint64_t)(p * (double)hist->count + 0.5); // Antall verdier som skal ligge under
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < L4_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            long end = hist_bucket_end(i);
+            return (end < (long)hist->max_us) ? end : (long)hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
+
+/**
+ * @brief Writes the counters and the ACK latency as one JSON object.
+ *
+ * Only the buckets that are not empty are written, as pairs of the
+ * bucket's last value and its count.
+ *
+ * @param l4 Pointer to the L4SAP structure.
+ * @param f The file to write to.
+ * @return int 0 on success, -1 on error.
+ */
+int l4sap_write_stats_json(const L4SAP* l4, FILE* f) {
+    if (!l4 || !f) {
+        fprintf(stderr, "L4SAP write_stats_json: Invalid arguments.\n");
+        return -1;
+    }
+
+    L2Stats l2;
+    memset(&l2, 0, sizeof(l2));
+    l2sap_get_stats(l4->l2, &l2);
+    const L4Stats*     s = &l4->stats;
+    const L4Histogram* h = &l4->ack_latency;
+
+    fprintf(f, "{\"l2\":{\"frames_out\":%" PRIu64 ",\"bytes_out\":%" PRIu64 ",\"send_errors\":%" PRIu64
+               ",\"frames_in\":%" PRIu64 ",\"bytes_in\":%" PRIu64 ",\"drops_runt\":%" PRIu64
+               ",\"drops_badlen\":%" PRIu64 ",\"drops_checksum\":%" PRIu64 ",\"truncated\":%" PRIu64
+               ",\"impair_dropped\":%" PRIu64 ",\"impair_corrupted\":%" PRIu64 ",\"impair_duplicated\":%" PRIu64
+               ",\"impair_held\":%" PRIu64 "},\n",
+            l2.frames_out, l2.bytes_out, l2.send_errors, l2.frames_in, l2.bytes_in,
+            l2.drops_runt, l2.drops_badlen, l2.drops_checksum, l2.truncated,
+            l2.impair_dropped, l2.impair_corrupted, l2.impair_duplicated, l2.impair_held);
+    fprintf(f, " \"l4\":{\"data_out\":%" PRIu64 ",\"bytes_out\":%" PRIu64 ",\"retransmits\":%" PRIu64
+               ",\"send_failed\":%" PRIu64 ",\"acks_out\":%" PRIu64 ",\"data_in\":%" PRIu64
+               ",\"bytes_in\":%" PRIu64 ",\"duplicates\":%" PRIu64 ",\"outside_window\":%" PRIu64
+               ",\"window_full\":%" PRIu64 ",\"acks_in\":%" PRIu64 ",\"acks_unexpected\":%" PRIu64
+               ",\"resets_in\":%" PRIu64 ",\"runts\":%" PRIu64 ",\"unknown\":%" PRIu64 "},\n",
+            s->data_out, s->bytes_out, s->retransmits, s->send_failed, s->acks_out, s->data_in,
+            s->bytes_in, s->duplicates, s->outside_window, s->window_full, s->acks_in,
+            s->acks_unexpected, s->resets_in, s->runts, s->unknown);
+    fprintf(f, " \"ack_latency_us\":{\"count\":%" PRIu64 ",\"min\":%u,\"mean\":%.1f"
+               ",\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"p999\":%ld,\"max\":%u,\"buckets\":[",
+            h->count, h->count ? h->min_us : 0, h->count ? (double)h->sum_us / (double)h->count : 0.0,
+            l4hist_percentile(h, 0.5), l4hist_percentile(h, 0.9), l4hist_percentile(h, 0.99),
+            l4hist_percentile(h, 0.999), h->max_us);
+    int first = 1;
+    for (int i = 0; i < L4_HIST_BUCKETS; i++) {
+        if (h->buckets[i]) {
+            fprintf(f, "%s[%ld,%u]", first ? "" : ",", hist_bucket_end(i), h->buckets[i]);
+            first = 0;
+        }
+    }
+    fprintf(f, "]}}\n");
+
+    if (ferror(f)) {
+        perror("L4SAP write_stats_json");
+        return -1;
+    }
+    return 0;
+}
+
+/* Verdier under L4_HIST_SUB har en bucket hver. Over det deles hver
+ * toerpotens 2^e i L4_HIST_SUB like store bucketer, og de hoeyeste
+ * L4_HIST_SUB_BITS bitene av verdien velger bucketen.
+ */
+static int hist_index(long us) {
+    if (us < L4_HIST_SUB) {
+        return (int)us;
+    }
+    int e     = 63 - __builtin_clzl((unsigned long)us); // floor(log2(us))
+    int shift = e - L4_HIST_SUB_BITS;
+    return (shift + 1) * L4_HIST_SUB + (int)((us >> shift) - L4_HIST_SUB);
+}
+
+/* Den stoerste verdien som havner i bucketen index. */
+static long hist_bucket_end(int index) {
+    if (index < L4_HIST_SUB) {
+        return index;
+    }
+    int shift = index / L4_HIST_SUB - 1;
+    long m    = L4_HIST_SUB + index % L4_HIST_SUB;
+    return ((m + 1) << shift) - 1;
+}
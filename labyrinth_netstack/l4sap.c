@@ -6,14 +6,35 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <time.h>
 #include <stddef.h>
 
 #include "l4sap.h"
 #include "l2sap.h"
+#include "trace.h"
 
-#define L4_MAX_RETRIES 5
-#define L4_RETRY_TIMEOUT_SEC 1
-#define L4_RETRY_TIMEOUT_USEC 0
+/* Smallest variance term of the RTO, so that a perfectly stable RTT
+ * does not give an RTO equal to the RTT.
+ */
+#define L4_RTO_GRANULARITY_USEC 100
+
+/* Packets that one l4sap_poll handles at most. */
+#define L4_POLL_BATCH 64
+
+static int  window_alloc(L4SAP* l4, int window);
+static void window_free(L4SAP* l4);
+static int  l4_step(L4SAP* l4);
+static int  handle_packet(L4SAP* l4, L2Buf* b);
+static void handle_ack(L4SAP* l4, uint8_t seqno, uint8_t ackno, int implicit);
+static int  handle_data(L4SAP* l4, L2Buf* b);
+static void send_ack(L4SAP* l4, uint8_t seqno);
+static int  queue_packet(L4SAP* l4, const struct iovec* iov, int iovcnt, int copy);
+static int  copy_out(L2Buf* buf, uint8_t* data, int len);
+static int  check_timers(L4SAP* l4, const struct timespec* now);
+static void fail_all(L4SAP* l4);
+static void rtt_sample(L4SAP* l4, const L4TxSlot* slot, const struct timespec* now);
+static void slot_acked(L4SAP* l4, L4TxSlot* slot, const struct timespec* now);
+static void deadline_set(struct timespec* deadline, const struct timespec* now, long usec);
 
 /* Create an L4 client.
  * It returns a dynamically allocated struct L4SAP that contains the
@@ -21,28 +42,110 @@
  * used).
  */
 L4SAP* l4sap_create(const char* server_ip, int server_port) {
-    L4SAP* l4 = (L4SAP*)malloc(sizeof(L4SAP)); // Allokerer minne for L4SAP
+    // Oppretter L2 SAP.
+    L2SAP* l2 = l2sap_create(server_ip, server_port);
+    if (!l2) { // Sjekker om peker ble laget
+        fprintf(stderr, "L4SAP creation failed: Could not create L2SAP.\n");
+        return NULL;
+    }
+
+    L4SAP* l4 = l4sap_create_from_l2(l2);
+    if (!l4) {
+        l2sap_destroy(l2);
+    }
+    return l4;
+}
+
+/* Create an L4 entity on an existing L2 entity, which it owns from
+ * now on. On error, l2 is left to the caller.
+ */
+L4SAP* l4sap_create_from_l2(L2SAP* l2) {
+    L4SAP* l4 = (L4SAP*)calloc(1, sizeof(L4SAP)); // Allokerer minne for L4SAP
     if (!l4) { // Hvis allokeringen mislykkes
         perror("Failed to allocate memory for L4SAP");
         return NULL;
     }
+    l4->l2 = l2;
 
-    // Oppretter L2 SAP.
-    l4->l2 = l2sap_create(server_ip, server_port);
-    if (!l4->l2) { // Sjekker om peker ble laget
-        fprintf(stderr, "L4SAP creation failed: Could not create L2SAP.\n");
+    // Initialiserer Stop-and-Wait, det er et vindu paa 1 med sekvensnummer 0/1
+    if (window_alloc(l4, 1) < 0) {
         free(l4);
         return NULL;
     }
 
-    // Initialiserer Stop-and-Wait
-    l4->next_seqno_send = 0; // sekvensnummeret for neste pakke som skal sendes
-    l4->expected_seqno_recv = 0; // forventede sekvensnummeret for neste mottatte pakke
+    // Ingen RTT maalt ennaa, start med 1 sekund som foer
+    l4->rtt.srtt_us    = 0;
+    l4->rtt.rttvar_us  = 0;
+    l4->rtt.rto_us     = L4_RTO_INITIAL_USEC;
+    l4->rtt.rto_min_us = L4_RTO_MIN_USEC;
+    l4->rtt.rto_max_us = L4_RTO_MAX_USEC;
+    l4->max_retries    = L4_MAX_RETRIES;
 
-    fprintf(stderr, "L4SAP created.\n");
+    TRACE(TRACE_INFO, TRACE_L4_CREATE, 0);
     return l4;
 }
 
+/* Switches between stop-and-wait and Selective Repeat. The counters
+ * start from 0 again, which is why both peers have to switch before
+ * anything has been sent.
+ */
+int l4sap_set_window(L4SAP* l4, int window) {
+    if (!l4 || window < 0 || window > L4_MAX_WINDOW) {
+        fprintf(stderr, "L4SAP set_window: Invalid window %d (max %d).\n", window, L4_MAX_WINDOW);
+        return -1;
+    }
+    if (l4->snd_una != l4->snd_nxt || l4->rcv_deliver != l4->rcv_nxt) {
+        fprintf(stderr, "L4SAP set_window: Packets are in flight, cannot change the window.\n");
+        return -1;
+    }
+    if (window < 1) {
+        window = 1;
+    }
+
+    // Mottaksvinduet holder laante L2 buffere, saa poolen maa ha plass til hele vinduet
+    L2SAP* l2     = l4->l2;
+    int    needed = window + L2_POOL_BUFFERS;
+    if (window > 1 && (!l2->pool || l2->pool->count < needed)) {
+        if (l2sap_set_pool_size(l2, needed) < 0) {
+            return -1;
+        }
+    }
+
+    window_free(l4);
+    return window_alloc(l4, window);
+}
+
+int l4sap_set_rto_limits(L4SAP* l4, long min_us, long max_us) {
+    if (!l4 || min_us < 0 || max_us < 0) {
+        fprintf(stderr, "L4SAP set_rto_limits: Invalid arguments.\n");
+        return -1;
+    }
+    long lo = min_us ? min_us : l4->rtt.rto_min_us;
+    long hi = max_us ? max_us : l4->rtt.rto_max_us;
+    if (lo > hi) {
+        fprintf(stderr, "L4SAP set_rto_limits: Floor %ld us is above ceiling %ld us.\n", lo, hi);
+        return -1;
+    }
+    l4->rtt.rto_min_us = lo;
+    l4->rtt.rto_max_us = hi;
+    if (l4->rtt.rto_us < lo) l4->rtt.rto_us = lo;
+    if (l4->rtt.rto_us > hi) l4->rtt.rto_us = hi;
+    return 0;
+}
+
+int l4sap_set_max_retries(L4SAP* l4, int max_retries) {
+    if (!l4 || max_retries < 1) {
+        fprintf(stderr, "L4SAP set_max_retries: Invalid arguments.\n");
+        return -1;
+    }
+    l4->max_retries = max_retries;
+    return 0;
+}
+
+void l4sap_get_rtt(const L4SAP* l4, L4Rtt* rtt) {
+    *rtt = l4->rtt;
+}
+
 /* The functions sends a packet to the network. The packet's payload
  * is copied from the buffer that it is passed as an argument from
  * the caller at L5.
@@ -54,11 +157,16 @@ L4SAP* l4sap_create(const char* server_ip, int server_port) {
  * When a suitable ACK arrives, the function returns the number of bytes
  * that were accepted for sending (the potentially truncated packet length).
  *
- * Waiting for a correct ACK may fail after a timeout of 1 second
- * (timeval.tv_sec = 1, timeval.tv_usec = 0). The function retransmits
- * the packet in that case.
- * The function attempts up to 4 retransmissions. If the last retransmission
- * fails with a timeout as well, the function returns L4_SEND_FAILED.
+ * Waiting for a correct ACK may fail after a timeout, which is 1 second
+ * until the round-trip time has been measured and then follows the
+ * RTT estimate (see L4Rtt). The function retransmits the packet in that
+ * case.
+ * The function attempts up to 4 retransmissions (l4sap_set_max_retries).
+ * If the last retransmission fails with a timeout as well, the function
+ * returns L4_SEND_FAILED.
+ *
+ * In windowed mode (l4sap_set_window), the function returns as soon as
+ * the packet fits into the window, see l4sap.h.
  *
  * The function may also return:
  * - L4_QUIT if the peer entity has sent an L4_RESET packet.
@@ -71,106 +179,93 @@ int l4sap_send(L4SAP* l4, const uint8_t* data, int len) {
     }
 
      if (len < 0) { // Sjekker om den oppgitte datalengden er negativ
-         fprintf(stderr, "L4SAP send: Invalid data length %d.\n");
+         fprintf(stderr, "L4SAP send: Invalid data length %d.\n", len);
          return -1;
      }
 
-    // Regner ut payload-lengde (truncater om noedvendig)
-    int payload_len = (len > L4Payloadsize) ? L4Payloadsize : len; // Setter payload_len til 'len', men begrenser den til L4Payloadsize hvis 'len' er stoerre.
-    if (len > L4Payloadsize) { // Sjekker om den opprinnelige lengden 'len' overstiger L4Payloadsize.
-        fprintf(stderr, "L4SAP send: Warning: Data length %d exceeds L4Payloadsize %d, truncating to %d bytes.\n",
-                 len, L4Payloadsize, payload_len);
+    // Ett segment, ingen kopi: payload sendes rett fra kallerens buffer
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len  = (size_t)len;
+    return l4sap_sendv(l4, &iov, 1);
+}
+
+/* Like l4sap_send, but the payload is the concatenation of iovcnt
+ * segments. The L4 header and the segments are handed to L2 as an
+ * iovec list, so nothing is copied before the kernel copies the frame.
+ * The frame (header, segments and checksum) is prepared once, and
+ * every retransmission sends the same prepared frame again.
+ * In windowed mode the segments are gathered into the packet's slot
+ * first, because the caller may reuse them before the ACK arrives.
+ * In stop-and-wait mode the frame points into the segments, so if the
+ * wait for the ACK ends with an error, the packet is failed (as after
+ * the last retransmission) before returning, and is never sent again.
+ */
+int l4sap_sendv(L4SAP* l4, const struct iovec* iov, int iovcnt) {
+    if (!l4 || !l4->l2 || iovcnt < 0 || iovcnt > L4_MAX_IOV || (iovcnt > 0 && !iov)) { // Sjekker om argumentene er gyldige.
+        fprintf(stderr, "L4SAP sendv: Invalid arguments.\n");
+        return -1;
     }
 
-    // Klargjoer L4-pakkebuffer (header + payload).
-    uint8_t packet_buffer[L4Framesize]; // Deklarerer en buffer packet_buffer paa stacken med stoerrelse L4Framesize
-    memset(packet_buffer, 0, L4Framesize); // Nullstiller hele packet_buffer
-
-    // Deklarerer L4Header
-    L4Header data_header;
-    data_header.type = L4_DATA;
-    data_header.seqno = l4->next_seqno_send; // Setter sekvensnummeret (seqno) i headeren til det neste som skal sendes.
-    data_header.ackno = l4->expected_seqno_recv; // Setter ackno til det sekvensnummeret vi forventer aa motta neste gang.
-    data_header.mbz = 0;
-
-    // Kopierer header og payload inn i bufferen.
-    memcpy(packet_buffer, &data_header, L4Headersize); // Kopierer innholdet av data_header inn i starten av packet_buffer
-    if (payload_len > 0) {
-        memcpy(packet_buffer + L4Headersize, data, payload_len); // Kopierer payload_len bytes fra data inn i packet_buffer, rett etter headeren.
-    }
-    int packet_len = L4Headersize + payload_len; // Beregner den totale lengden
-
-
-    int attempts = 0;
-    while (attempts < L4_MAX_RETRIES) {
-        attempts++;
-        fprintf(stderr, "L4 Send: Attempt %d: Sending DATA (Seq=%u, Payload=%d bytes)\n",
-                attempts, data_header.seqno, payload_len);
-
-
-        int l2_sent = l2sap_sendto(l4->l2, packet_buffer, packet_len); // Sender pakken (packet_buffer med lengde packet_len) via L2-laget.
-        if (l2_sent < 0) {
-            fprintf(stderr, "L4 Send: Attempt %d: L2 send failed.\n", attempts);
-        }
-        else if (l2_sent != packet_len) {
-              fprintf(stderr, "L4 Send: Attempt %d: L2 send returned unexpected length %d (expected %d).\n", attempts, l2_sent, packet_len);
-
-         }
-
-        // Venter paa ACK med timeout.
-        struct timeval timeout = { .tv_sec = L4_RETRY_TIMEOUT_SEC, .tv_usec = L4_RETRY_TIMEOUT_USEC }; // Setter opp en struct timeval for timeout-verdien definert tidligere.
-        uint8_t recv_buffer[L4Framesize]; // lager en buffer recv_buffer for aa motta payload
-        int recv_len;
-
-        // haandtere ikke-ACK-pakker mottatt mens vi venter.
-        while (1) {
-             recv_len = l2sap_recvfrom_timeout(l4->l2, recv_buffer, L4Framesize, &timeout); // Ventre paa en pakke fra L2 i et gitt tidsrom (timeout).
-
-             if (recv_len == L2_TIMEOUT) {
-                 fprintf(stderr, "L4 Send: Attempt %d: Timeout waiting for ACK (Seq=%u expected).\n",
-                         attempts, (l4->next_seqno_send + 1) % 2);
-                 break;
-             } else if (recv_len < 0) {
-                 fprintf(stderr, "L4 Send: Attempt %d: Error receiving from L2.\n", attempts);
-                 break;
-             } else if (recv_len < L4Headersize) {
-                   fprintf(stderr, "L4 Send: Attempt %d: Received runt L4 packet (%d bytes), ignoring.\n", attempts, recv_len);
-                  continue;
-             }
-
-             L4Header* recv_header = (L4Header*)recv_buffer; // Tolker starten av recv_buffer som en L4Header-peker.
-
-             if (recv_header->type == L4_RESET) {
-                  fprintf(stderr, "L4 Send: Received L4_RESET. Terminating.\n");
-                  return L4_QUIT;
-             } else if (recv_header->type == L4_ACK) {
-                  uint8_t expected_ackno = (l4->next_seqno_send + 1) % 2; // Beregner det forventede ackno basert paa det sist sendte sekvensnummeret.
-                  if (recv_header->ackno == expected_ackno) {
-                      fprintf(stderr, "L4 Send: Correct ACK (AckNo=%u) received for DATA (Seq=%u).\n",
-                              recv_header->ackno, l4->next_seqno_send);
-                      l4->next_seqno_send = expected_ackno; // Oppdaterer neste sekvensnummer som skal sendes (snur biten 0/1).
-                      return payload_len;
-                  } else { // Hvis ackno ikke var forventet.
-                      fprintf(stderr, "L4 Send: Attempt %d: Received incorrect ACK (AckNo=%u, expected %u), ignoring.\n",
-                              attempts, recv_header->ackno, expected_ackno);
-                      continue;
-                  }
-             } else if (recv_header->type == L4_DATA) {
-                 fprintf(stderr, "L4 Send: Attempt %d: Received unexpected L4_DATA (Seq=%u), ignoring while waiting for ACK.\n",
-                         attempts, recv_header->seqno);
-                 continue;
-             } else { // Hvis den mottatte pakketypen er ukjent.
-                   fprintf(stderr, "L4 Send: Attempt %d: Received unknown L4 packet type (%u), ignoring.\n",
-                           attempts, recv_header->type);
-                   continue;
-             }
-        }
-    }
-
-    // Maks antall gjensendinger overskredet.
-    fprintf(stderr, "L4 Send: Max retries (%d) exceeded for DATA (Seq=%u). Send failed.\n",
-            L4_MAX_RETRIES, l4->next_seqno_send);
-    return L4_SEND_FAILED;
+    // Vent til det er plass i vinduet. For stop-and-wait er det alltid plass her.
+    while (l4->snd_nxt - l4->snd_una >= (uint32_t)l4->window) {
+        int r = l4_step(l4);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    int copy        = l4->window > 1;
+    int payload_len = queue_packet(l4, iov, iovcnt, copy);
+    if (payload_len < 0) {
+        return payload_len;
+    }
+
+    // Stop-and-wait venter her paa ACK, et vindu bare til det er plass til neste pakke
+    while (l4->snd_nxt - l4->snd_una >= (uint32_t)l4->window) {
+        int r = l4_step(l4);
+        if (r < 0) {
+            if (!copy && l4->snd_nxt != l4->snd_una) { // Framen peker inn i segmentene, som kalleren kan gjenbruke naa
+                fail_all(l4);
+            }
+            return r;
+        }
+    }
+    return payload_len;
+}
+
+/* Sends data as the next packet without waiting, or returns
+ * L4_WOULDBLOCK if the window is full.
+ */
+int l4sap_send_async(L4SAP* l4, const uint8_t* data, int len) {
+    if (!l4 || !l4->l2 || !data || len < 0) { // Sjekker om argumentene er gyldige.
+        fprintf(stderr, "L4SAP send_async: Invalid arguments.\n");
+        return -1;
+    }
+    if (l4->snd_nxt - l4->snd_una >= (uint32_t)l4->window) {
+        return L4_WOULDBLOCK;
+    }
+
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len  = (size_t)len;
+    return queue_packet(l4, &iov, 1, 1); // Kalleren kan gjenbruke data, saa det maa kopieres
+}
+
+
+/* Waits until all accepted packets are acknowledged. */
+int l4sap_flush(L4SAP* l4) {
+    if (!l4 || !l4->l2) {
+        fprintf(stderr, "L4SAP flush: Invalid arguments.\n");
+        return -1;
+    }
+    while (l4->snd_una != l4->snd_nxt) {
+        int r = l4_step(l4);
+        if (r < 0) {
+            return r;
+        }
+    }
+    return 0;
 }
 
 
@@ -191,96 +286,135 @@ int l4sap_recv(L4SAP* l4, uint8_t* data, int len) {
          return -1;
      }
 
-    uint8_t recv_buffer[L4Framesize]; // en mottaksbuffer recv_buffer for payload
-    int recv_len;
+    // Pakken mottas og valideres i et laant buffer, saa payload kopieres bare en gang
+    L2Buf* buf;
+    int payload_len = l4sap_recv_lend(l4, &buf);
+    if (payload_len < 0) {
+        return payload_len;
+    }
 
-    fprintf(stderr, "L4 Recv: Waiting for DATA (Expected Seq=%u)\n", l4->expected_seqno_recv);
+    return copy_out(buf, data, len); // Returnerer antall mottatte og kopierte payload-bytes
+}
+
+/* Like l4sap_recv, but only takes a packet that is already there. */
+int l4sap_recv_async(L4SAP* l4, uint8_t* data, int len) {
+    if (!l4 || !l4->l2 || !data || len < 0) { // Sjekker for ugyldige argumenter
+         fprintf(stderr, "L4SAP recv_async: Invalid arguments.\n");
+         return -1;
+     }
+
+    L2Buf** slot = &l4->rx[l4->rcv_deliver % l4->window];
+    if (!*slot) {
+        return L4_WOULDBLOCK;
+    }
+    L2Buf* buf = *slot;
+    *slot = NULL;
+    l4->rcv_deliver++;
+    return copy_out(buf, data, len);
+}
+
+
+/* Receives the next L4_DATA packet like l4sap_recv, but returns the
+ * L2 buffer it arrived in instead of copying the payload. buf->offset
+ * and buf->len describe the L4 payload. The caller releases the buffer
+ * with l2buf_release; every other packet is released here.
+ * Packets that arrived while l4sap_send waited for an ACK are
+ * delivered first, without waiting.
+ * While it waits, ACKs for earlier windowed sends are processed and
+ * their packets retransmitted if necessary.
+ */
+int l4sap_recv_lend(L4SAP* l4, L2Buf** buf) {
+    if (!l4 || !l4->l2 || !buf) { // Sjekker for ugyldige argumenter
+         fprintf(stderr, "L4SAP recv_lend: Invalid arguments.\n");
+         return -1;
+     }
+    *buf = NULL;
+
+    TRACE(TRACE_PACKET, TRACE_L4_RECV_WAIT, l4->rcv_deliver & l4->seq_mask);
 
     while (1) { // Starter en uendelig loop for aa vente paa pakker.
-        recv_len = l2sap_recvfrom(l4->l2, recv_buffer, L4Framesize); // vente paa en pakke (blokkerende kall, NULL timeout).
+        L2Buf** slot = &l4->rx[l4->rcv_deliver % l4->window];
+        if (*slot) { // Neste pakke i rekkefoelgen har kommet
+            *buf  = *slot;
+            *slot = NULL;
+            l4->rcv_deliver++;
+            return (*buf)->len;
+        }
+
+        int r = l4_step(l4);
+        if (r == L4_QUIT || r == -1) {
+            return r;
+        }
+        if (r == L4_SEND_FAILED) { // Gjelder en tidligere sending, mottaket fortsetter
+            TRACE(TRACE_ERROR, TRACE_L4_RECV_UNACKED, 0);
+        }
+    }
+}
 
-        if (recv_len < 0) {
-            fprintf(stderr, "L4 Recv: Error receiving from L2.\n");
+int l4sap_get_fd(const L4SAP* l4) {
+    if (!l4 || !l4->l2) {
+        return -1;
+    }
+    return l4->l2->socket;
+}
+
+/* Den tidligste fristen blant pakkene som venter paa ACK. */
+int l4sap_next_deadline(const L4SAP* l4, struct timespec* deadline) {
+    int found = 0;
+    for (uint32_t n = l4->snd_una; n != l4->snd_nxt; n++) {
+        const L4TxSlot* slot = &l4->tx[n % l4->window];
+        if (slot->acked) {
+            continue;
+        }
+        if (!found || slot->deadline.tv_sec < deadline->tv_sec ||
+            (slot->deadline.tv_sec == deadline->tv_sec && slot->deadline.tv_nsec < deadline->tv_nsec)) {
+            *deadline = slot->deadline;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/* One step of the non-blocking state machine: handles every packet
+ * that is waiting in the socket (at most L4_POLL_BATCH, so that one
+ * busy entity cannot starve the others in the caller's loop), then the
+ * retransmission timers.
+ */
+int l4sap_poll(L4SAP* l4, const struct timespec* now) {
+    if (!l4 || !l4->l2) {
+        fprintf(stderr, "L4SAP poll: Invalid arguments.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < L4_POLL_BATCH; i++) {
+        struct timeval zero = { 0, 0 }; // Bare det som allerede har kommet
+        L2Buf*         b;
+        if (l2sap_recv_lend(l4->l2, &b, &zero) < 0) {
+            fprintf(stderr, "L4: Error receiving from L2.\n");
             return -1;
-        } else if (recv_len == L2_TIMEOUT) { // Sjekker om L2_TIMEOUT ble returnert (boer ikke skje)
-             fprintf(stderr, "L4 Recv: Unexpected L2_TIMEOUT from l2sap_recvfrom.\n");
-             continue;
-        } else if (recv_len < L4Headersize) {
-             fprintf(stderr, "L4 Recv: Received runt L4 packet (%d bytes), ignoring.\n", recv_len);
-             continue;
-        }
-
-        L4Header* recv_header = (L4Header*)recv_buffer; // Tolker starten av recv_buffer som en L4Header-peker.
-
-        if (recv_header->type == L4_RESET) {
-            fprintf(stderr, "L4 Recv: Received L4_RESET. Terminating.\n");
-            return L4_QUIT;
-        } else if (recv_header->type == L4_ACK) { //Mottok ACK mens vi ventet paa DATA, ignorer den
-             fprintf(stderr, "L4 Recv: Received unexpected L4_ACK (AckNo=%u), ignoring.\n", recv_header->ackno);
-             continue;
-        } else if (recv_header->type == L4_DATA) {
-            fprintf(stderr, "L4 Recv: Received L4_DATA (Seq=%u, Expected Seq=%u)\n",
-                   recv_header->seqno, l4->expected_seqno_recv);
-
-            if (recv_header->seqno == l4->expected_seqno_recv) { // sjekker om det mottatte sekvensnummeret er det vi forventet.
-                int payload_len = recv_len - L4Headersize; // regner lengden paa payload
-                int copy_len = (payload_len < len) ? payload_len : len; // Bestemmer hvor mange bytes som skal kopieres avhengig av hva som er minst.
-
-                if (copy_len > 0) {
-                    memcpy(data, recv_buffer + L4Headersize, copy_len); // Kopierer antall bytes over til data
-                }
-                 if (payload_len > len) {
-                      fprintf(stderr, "L4 Recv: Warning: Received L4 payload (%d bytes) larger than buffer (%d bytes), truncated.\n",
-                              payload_len, len);
-                 }
-
-                // Oppdaterer forventet sekvensnummer for neste mottak.
-                l4->expected_seqno_recv = (l4->expected_seqno_recv + 1) % 2; // Snur det forventede sekvensnummeret (0/1).
-
-                // Sender ACK for den mottatte pakken.
-                L4Header ack_header;
-                ack_header.type = L4_ACK;
-                ack_header.seqno = 0;
-                ack_header.ackno = l4->expected_seqno_recv; // Setter ackno til det neste sekvensnummeret vi forventer
-                ack_header.mbz = 0;
-
-                fprintf(stderr, "L4 Recv: Sending ACK (AckNo=%u) for received DATA (Seq=%u)\n",
-                       ack_header.ackno, recv_header->seqno);
-
-                int ack_sent = l2sap_sendto(l4->l2, (uint8_t*)&ack_header, L4Headersize); // Sender ACK-headeren via L2-laget.
-                if (ack_sent < 0) {
-                    fprintf(stderr, "L4 Recv: Failed to send ACK.\n");
-                } else if (ack_sent != L4Headersize) {
-                     fprintf(stderr, "L4 Recv: Warning: Sent ACK length %d, expected %d.\n", ack_sent, L4Headersize);
-                }
-
-                return copy_len; // Returnerer antall mottatte og kopierte payload-bytes
-
-            } else { // Hvis det mottatte sekvensnummeret ikke var forventet
-                fprintf(stderr, "L4 Recv: Received duplicate/old DATA (Seq=%u, Expected=%u), discarding payload.\n",
-                        recv_header->seqno, l4->expected_seqno_recv);
-
-                // Sender ACK paa nytt for den sist korrekt mottatte pakken.
-                L4Header ack_header;
-                ack_header.type = L4_ACK;
-                ack_header.seqno = 0;
-                ack_header.ackno = l4->expected_seqno_recv; // Setter ackno til det neste sekvensnummeret vi forventer
-                ack_header.mbz = 0;
-
-                 fprintf(stderr, "L4 Recv: Re-sending ACK (AckNo=%u) for duplicate DATA (Seq=%u)\n",
-                         ack_header.ackno, recv_header->seqno);
-
-                int ack_sent = l2sap_sendto(l4->l2, (uint8_t*)&ack_header, L4Headersize); // Sender den nye ACK-headeren via L2.
-                 if (ack_sent < 0) {
-                      fprintf(stderr, "L4 Recv: Failed to re-send ACK for duplicate.\n");
-                 }
-                 continue;
-            }
-        } else { // Hvis den mottatte pakketypen var ukjent.
-             fprintf(stderr, "L4 Recv: Received unknown L4 packet type (%u), ignoring.\n", recv_header->type);
-             continue;
         }
+        if (!b) {
+            break;
+        }
+        int r = handle_packet(l4, b);
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    int r = check_timers(l4, now);
+    if (l4->callback && l4->rx[l4->rcv_deliver % l4->window]) {
+        l4->callback(l4, L4_EVENT_RECV, 0, l4->user);
+    }
+    return r;
+}
+
+void l4sap_set_callback(L4SAP* l4, L4Callback callback, void* user) {
+    if (!l4) {
+        return;
     }
+    l4->callback = callback;
+    l4->user     = user;
 }
 
 /** This function is called to terminate the L4 entity and
@@ -295,7 +429,7 @@ void l4sap_destroy(L4SAP* l4) {
     }
 
     if (l4->l2) { // sjekker om  l4->l2 ikke er null
-        fprintf(stderr, "L4 Destroy: Sending L4_RESET packets.\n");
+        TRACE(TRACE_INFO, TRACE_L4_RESET_SEND, 0);
 
         L4Header reset_header;
         reset_header.type = L4_RESET;
@@ -306,10 +440,472 @@ void l4sap_destroy(L4SAP* l4) {
             l2sap_sendto(l4->l2, (uint8_t*)&reset_header, L4Headersize); // Sender RESET-headeren via L2.
         }
 
+        window_free(l4); // Gir bufferne tilbake foer L2 og poolen forsvinner
         l2sap_destroy(l4->l2);
         l4->l2 = NULL; // Setter L2-pekeren til null for aa unngaa double free hvis l4sap_destroy kalles igjen.
     }
 
     free(l4);
-    fprintf(stderr, "L4SAP destroyed.\n");
+    TRACE(TRACE_INFO, TRACE_L4_DESTROY, 0);
+}
+
+/* Fyller neste slot i sendevinduet med en DATA pakke og sender den
+ * foerste gang. Med copy satt samles payload i slotten, ellers sendes
+ * den rett fra iov og iov maa leve til pakken er kvittert.
+ */
+static int queue_packet(L4SAP* l4, const struct iovec* iov, int iovcnt, int copy) {
+    L4TxSlot* slot = &l4->tx[l4->snd_nxt % l4->window];
+    if (copy && !slot->copy) { // Stop-and-wait har ingen kopi foer den foerste asynkrone sendingen
+        slot->copy = (uint8_t*)malloc(L4Payloadsize);
+        if (!slot->copy) {
+            perror("Failed to allocate L4SAP send buffer");
+            return -1;
+        }
+    }
+
+    // Fyller ut L4Header
+    slot->header.type = L4_DATA;
+    slot->header.seqno = (uint8_t)(l4->snd_nxt & l4->seq_mask); // Setter sekvensnummeret (seqno) i headeren til det neste som skal sendes.
+    slot->header.ackno = (uint8_t)(l4->rcv_nxt & l4->seq_mask); // Setter ackno til det sekvensnummeret vi forventer aa motta neste gang.
+    slot->header.mbz = 0;
+
+    // Header som foerste segment, deretter payload-segmentene.
+    // Alt etter L4Payloadsize bytes blir kuttet bort (truncate).
+    struct iovec segs[L2_MAX_IOV];
+    segs[0].iov_base = &slot->header;
+    segs[0].iov_len  = L4Headersize;
+    int    nsegs = 1;
+    size_t len   = 0;
+    size_t room  = L4Payloadsize;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+        size_t take = (iov[i].iov_len < room) ? iov[i].iov_len : room;
+        if (take > 0) {
+            if (copy) { // Vindu: samle segmentene i slotten
+                memcpy(slot->copy + (L4Payloadsize - room), iov[i].iov_base, take);
+            } else {
+                segs[nsegs].iov_base = iov[i].iov_base;
+                segs[nsegs].iov_len  = take;
+                nsegs++;
+            }
+            room -= take;
+        }
+    }
+    int payload_len = L4Payloadsize - (int)room;
+    if (len > (size_t)L4Payloadsize) { // Sjekker om den opprinnelige lengden overstiger L4Payloadsize.
+        fprintf(stderr, "L4SAP send: Warning: Data length %zu exceeds L4Payloadsize %d, truncating to %d bytes.\n",
+                 len, L4Payloadsize, payload_len);
+    }
+    if (copy && payload_len > 0) {
+        segs[1].iov_base = slot->copy;
+        segs[1].iov_len  = (size_t)payload_len;
+        nsegs = 2;
+    }
+
+    // Bygger L2 framen en gang, den sendes uendret ved hver gjensending
+    if (l2sap_prepare(l4->l2, &slot->frame, segs, nsegs) < 0) {
+        fprintf(stderr, "L4 Send: Could not prepare L2 frame.\n");
+        return -1;
+    }
+    slot->len      = payload_len;
+    slot->attempts = 1;
+    slot->acked    = 0;
+
+    l4->stats.data_out++;
+    l4->stats.bytes_out += (uint64_t)payload_len;
+    TRACE(TRACE_PACKET, TRACE_L4_SEND_DATA, slot->header.seqno, payload_len);
+
+    int l2_sent = l2sap_send_prepared(l4->l2, &slot->frame); // Sender den ferdige framen via L2-laget.
+    if (l2_sent < 0) {
+        fprintf(stderr, "L4 Send: L2 send failed, retransmitting after timeout.\n");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &slot->sent_at);
+    deadline_set(&slot->deadline, &slot->sent_at, l4->rtt.rto_us);
+    l4->snd_nxt++;
+    return payload_len;
+}
+
+/* Kopierer payload til L5, gir bufferet tilbake og returnerer antall bytes. */
+static int copy_out(L2Buf* buf, uint8_t* data, int len) {
+    int payload_len = buf->len;
+    int copy_len = (payload_len < len) ? payload_len : len; // Bestemmer hvor mange bytes som skal kopieres avhengig av hva som er minst.
+    if (copy_len > 0) {
+        memcpy(data, buf->data + buf->offset, copy_len); // Kopierer antall bytes over til data
+    }
+    if (payload_len > len) {
+        fprintf(stderr, "L4 Recv: Warning: Received L4 payload (%d bytes) larger than buffer (%d bytes), truncated.\n",
+                payload_len, len);
+    }
+    l2buf_release(buf);
+    return copy_len;
+}
+
+/* Allokerer sende- og mottaksvinduet og nullstiller tellerne. */
+static int window_alloc(L4SAP* l4, int window) {
+    l4->window = window;
+    l4->tx = (L4TxSlot*)calloc((size_t)window, sizeof(L4TxSlot));
+    l4->rx = (L2Buf**)calloc((size_t)window, sizeof(L2Buf*));
+    if (!l4->tx || !l4->rx) {
+        perror("Failed to allocate L4SAP window");
+        window_free(l4);
+        return -1;
+    }
+    if (window > 1) { // Bare et vindu trenger egne kopier av payload
+        for (int i = 0; i < window; i++) {
+            l4->tx[i].copy = (uint8_t*)malloc(L4Payloadsize);
+            if (!l4->tx[i].copy) {
+                perror("Failed to allocate L4SAP window");
+                window_free(l4);
+                return -1;
+            }
+        }
+    }
+
+    l4->seq_mask    = (window > 1) ? 0xff : 0x1; // 256 eller 2 sekvensnummer
+    l4->snd_una     = 0;
+    l4->snd_nxt     = 0;
+    l4->rcv_nxt     = 0;
+    l4->rcv_deliver = 0;
+    return 0;
+}
+
+static void window_free(L4SAP* l4) {
+    for (int i = 0; l4->tx && i < l4->window; i++) {
+        free(l4->tx[i].copy);
+    }
+    for (int i = 0; l4->rx && i < l4->window; i++) {
+        l2buf_release(l4->rx[i]);
+    }
+    free(l4->tx);
+    free(l4->rx);
+    l4->tx     = NULL;
+    l4->rx     = NULL;
+    l4->window = 0;
+}
+
+/* Venter paa en pakke, men ikke lenger enn til den neste
+ * gjensendingen, og behandler den. Deretter sendes pakker som har
+ * gaatt ut paa tid paa nytt.
+ * DATA tas imot ogsaa mens vi sender, og blir liggende i
+ * mottaksvinduet til neste l4sap_recv.
+ * Returnerer 0, L4_QUIT, L4_SEND_FAILED eller -1.
+ */
+static int l4_step(L4SAP* l4) {
+    struct timeval  tv;
+    struct timeval* p_tv = NULL;
+    struct timespec first;
+
+    if (l4sap_next_deadline(l4, &first)) { // Vent ikke lenger enn til den tidligste fristen
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long left_ns = (long long)(first.tv_sec - now.tv_sec) * 1000000000LL + (first.tv_nsec - now.tv_nsec);
+        if (left_ns < 0) {
+            left_ns = 0;
+        }
+        long long left_us = (left_ns + 999) / 1000; // Rund opp, saa vi ikke vaakner for tidlig
+        tv.tv_sec  = (time_t)(left_us / 1000000);
+        tv.tv_usec = (suseconds_t)(left_us % 1000000);
+        p_tv = &tv;
+    }
+
+    L2Buf* b;
+    int recv_len = l2sap_recv_lend(l4->l2, &b, p_tv);
+    if (recv_len < 0) {
+        fprintf(stderr, "L4: Error receiving from L2.\n");
+        return -1;
+    }
+    if (b) {
+        int r = handle_packet(l4, b);
+        if (r < 0) {
+            return r;
+        }
+    }
+    return check_timers(l4, NULL);
+}
+
+/* Behandler en mottatt pakke og gir bufferet tilbake, bortsett fra
+ * DATA som legges i mottaksvinduet.
+ */
+static int handle_packet(L4SAP* l4, L2Buf* b) {
+    if (b->len < L4Headersize) {
+        TRACE(TRACE_ERROR, TRACE_L4_RUNT, b->len);
+        l4->stats.runts++;
+        l2buf_release(b);
+        return 0;
+    }
+
+    L4Header* recv_header = (L4Header*)(b->data + b->offset); // Tolker starten av payload som en L4Header-peker.
+
+    if (recv_header->type == L4_RESET) {
+        TRACE(TRACE_INFO, TRACE_L4_RESET_RECV, 0);
+        l4->stats.resets_in++;
+        l2buf_release(b);
+        if (l4->callback) {
+            l4->callback(l4, L4_EVENT_QUIT, 0, l4->user);
+        }
+        return L4_QUIT;
+    } else if (recv_header->type == L4_ACK) {
+        l4->stats.acks_in++;
+        handle_ack(l4, recv_header->seqno, recv_header->ackno, 0);
+        l2buf_release(b);
+        return 0;
+    } else if (recv_header->type == L4_DATA) {
+        // ackno i DATA kvitterer ogsaa for det vi har sendt, selv om ACKen gikk tapt,
+        // men bare i ny DATA: et duplikat kan baere en gammel ackno, og med en
+        // sekvensbit ville den kvittert en pakke peeren aldri fikk
+        uint8_t seqno = recv_header->seqno;
+        uint8_t ackno = recv_header->ackno;
+        if (handle_data(l4, b)) {
+            handle_ack(l4, seqno, ackno, 1);
+        }
+        return 0;
+    }
+
+    // Hvis den mottatte pakketypen er ukjent.
+    TRACE(TRACE_ERROR, TRACE_L4_UNKNOWN, recv_header->type);
+    l4->stats.unknown++;
+    l2buf_release(b);
+    return 0;
+}
+
+/* ackno er kumulativ: alt foer ackno er mottatt. I vindusmodus sier
+ * seqno i tillegg hvilken enkelt pakke ACKen gjelder.
+ * implicit er satt naar ackno kommer fra en DATA pakke. Da er seqno
+ * peerens eget sekvensnummer, og det blir ingen RTT-maaling, fordi
+ * peeren kan ha ventet paa L5 foer den sendte.
+ */
+static void handle_ack(L4SAP* l4, uint8_t seqno, uint8_t ackno, int implicit) {
+    uint32_t in_flight = l4->snd_nxt - l4->snd_una;
+    uint32_t cum       = (ackno - l4->snd_una) & l4->seq_mask; // Antall pakker ACKen kvitterer for
+
+    if (cum > in_flight) {
+        cum = 0; // Gammel ACK, eller en som ikke passer i vinduet
+    }
+    // Bare pakken som seqno peker paa gir en maaling i vindusmodus; en
+    // kumulativ ACK kan komme lenge etter at de eldre pakkene kom frem.
+    L4TxSlot* named = NULL;
+    if (l4->seq_mask == 0xff && !implicit) {
+        uint32_t sel = (seqno - l4->snd_una) & l4->seq_mask;
+        if (sel < in_flight && !l4->tx[(l4->snd_una + sel) % l4->window].acked) {
+            named = &l4->tx[(l4->snd_una + sel) % l4->window];
+        }
+    }
+    if (!named && cum == 0) {
+        if (!implicit) {
+            TRACE(TRACE_PACKET, TRACE_L4_ACK_IGNORED, ackno);
+            l4->stats.acks_unexpected++;
+        }
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now); // En gang for alle pakkene ACKen kvitterer
+    if (named) {
+        rtt_sample(l4, named, &now);
+        slot_acked(l4, named, &now);
+    }
+    for (uint32_t i = 0; i < cum; i++) {
+        L4TxSlot* slot = &l4->tx[(l4->snd_una + i) % l4->window];
+        if (slot->acked) {
+            continue;
+        }
+        if (l4->seq_mask != 0xff && !implicit) { // Stop-and-wait: ACKen gjelder akkurat denne pakken
+            rtt_sample(l4, slot, &now);
+        }
+        slot_acked(l4, slot, &now);
+    }
+
+    // Flytter starten av vinduet forbi alle kvitterte pakker
+    while (l4->snd_una != l4->snd_nxt && l4->tx[l4->snd_una % l4->window].acked) {
+        L4TxSlot* slot = &l4->tx[l4->snd_una % l4->window];
+        TRACE(TRACE_PACKET, TRACE_L4_ACK, slot->header.seqno, ackno);
+        slot->acked = 0;
+        l4->snd_una++;
+        if (l4->callback) {
+            l4->callback(l4, L4_EVENT_SENT, slot->len, l4->user);
+        }
+    }
+}
+
+/* Legger DATA i mottaksvinduet og sender ACK. Pakker foran vinduet
+ * er duplikater og kvitteres paa nytt; pakker bak vinduet er det ikke
+ * plass til, og de forkastes uten ACK slik at avsenderen sender dem
+ * paa nytt senere. Returnerer 1 hvis pakken er ny og i vinduet, ellers
+ * 0. b er gitt tilbake eller lagt i vinduet naar funksjonen returnerer.
+ */
+static int handle_data(L4SAP* l4, L2Buf* b) {
+    L4Header* recv_header = (L4Header*)(b->data + b->offset);
+    uint8_t   seqno       = recv_header->seqno;
+    uint32_t  window      = (uint32_t)l4->window;
+    uint32_t  ahead       = (seqno - l4->rcv_nxt) & l4->seq_mask;
+
+    TRACE(TRACE_PACKET, TRACE_L4_RECV_DATA, seqno, l4->rcv_nxt & l4->seq_mask, b->len - L4Headersize);
+
+    if (ahead < window) { // Ny pakke
+        uint32_t n = l4->rcv_nxt + ahead;
+        if (n - l4->rcv_deliver >= window) { // L5 har ikke hentet nok, ingen plass
+            TRACE(TRACE_PACKET, TRACE_L4_RECV_FULL, seqno);
+            l4->stats.window_full++;
+            l2buf_release(b);
+            return 1;
+        }
+        L2Buf** slot = &l4->rx[n % window];
+        if (*slot) { // Allerede lagret
+            l4->stats.duplicates++;
+            l2buf_release(b);
+        } else {
+            l4->stats.data_in++;
+            l4->stats.bytes_in += (uint64_t)(b->len - L4Headersize);
+            // Payloaden blir liggende i bufferet, bare offset flyttes forbi L4 headeren
+            b->offset += L4Headersize;
+            b->len    -= L4Headersize;
+            *slot = b;
+        }
+        while (l4->rcv_nxt - l4->rcv_deliver < window && l4->rx[l4->rcv_nxt % window]) {
+            l4->rcv_nxt++;
+        }
+        send_ack(l4, seqno);
+        return 1;
+    } else if (ahead >= l4->seq_mask + 1 - window) { // Mottatt foer, ACKen kom nok ikke frem
+        TRACE(TRACE_PACKET, TRACE_L4_RECV_DUPLICATE, seqno);
+        l4->stats.duplicates++;
+        l2buf_release(b);
+        send_ack(l4, seqno);
+    } else {
+        TRACE(TRACE_ERROR, TRACE_L4_RECV_OUTSIDE, seqno);
+        l4->stats.outside_window++;
+        l2buf_release(b);
+    }
+    return 0;
+}
+
+static void send_ack(L4SAP* l4, uint8_t seqno) {
+    L4Header ack_header;
+    ack_header.type = L4_ACK;
+    ack_header.seqno = (l4->seq_mask == 0xff) ? seqno : 0; // Stop-and-wait bruker bare ackno
+    ack_header.ackno = (uint8_t)(l4->rcv_nxt & l4->seq_mask); // Setter ackno til det neste sekvensnummeret vi forventer
+    ack_header.mbz = 0;
+
+    TRACE(TRACE_PACKET, TRACE_L4_SEND_ACK, ack_header.ackno, seqno);
+
+    int ack_sent = l2sap_sendto(l4->l2, (uint8_t*)&ack_header, L4Headersize); // Sender ACK-headeren via L2-laget.
+    if (ack_sent < 0) {
+        fprintf(stderr, "L4 Recv: Failed to send ACK.\n");
+        return;
+    }
+    l4->stats.acks_out++;
+}
+
+/* Sender hver pakke som har gaatt ut paa tid paa nytt. En pakke som
+ * allerede er sendt max_retries ganger feiler hele vinduet.
+ */
+static int check_timers(L4SAP* l4, const struct timespec* at) {
+    if (l4->snd_una == l4->snd_nxt) {
+        return 0;
+    }
+
+    struct timespec now;
+    int             backed_off = 0;
+    if (at) { // Tiden kalleren oppga til l4sap_poll
+        now = *at;
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    for (uint32_t n = l4->snd_una; n != l4->snd_nxt; n++) {
+        L4TxSlot* slot = &l4->tx[n % l4->window];
+        if (slot->acked || slot->deadline.tv_sec > now.tv_sec ||
+            (slot->deadline.tv_sec == now.tv_sec && slot->deadline.tv_nsec > now.tv_nsec)) {
+            continue;
+        }
+        if (slot->attempts >= l4->max_retries) {
+            // Maks antall gjensendinger overskredet.
+            TRACE(TRACE_ERROR, TRACE_L4_SEND_FAILED, slot->header.seqno, slot->attempts);
+            fail_all(l4);
+            return L4_SEND_FAILED;
+        }
+        if (!backed_off) { // Dobler RTO en gang per runde, ikke en gang per pakke i vinduet
+            l4->rtt.rto_us = (l4->rtt.rto_us > l4->rtt.rto_max_us / 2) ? l4->rtt.rto_max_us : 2 * l4->rtt.rto_us;
+            backed_off = 1;
+        }
+        slot->attempts++;
+        l4->stats.retransmits++;
+        TRACE(TRACE_PACKET, TRACE_L4_RETRANSMIT, slot->header.seqno, slot->attempts, l4->rtt.rto_us);
+        // Oppdater ackno, ellers kan en gammel ackno kvittere feil pakke hos peeren
+        uint8_t ackno = (uint8_t)(l4->rcv_nxt & l4->seq_mask);
+        if (slot->header.ackno != ackno) {
+            l2sap_prepared_adjust(&slot->frame, slot->header.ackno, ackno);
+            slot->header.ackno = ackno;
+        }
+        if (l2sap_send_prepared(l4->l2, &slot->frame) < 0) {
+            fprintf(stderr, "L4 Send: Attempt %d: L2 send failed.\n", slot->attempts);
+        }
+        deadline_set(&slot->deadline, &now, l4->rtt.rto_us);
+    }
+    return 0;
+}
+
+/* Gir opp alle pakker i vinduet. Sekvensnummerene brukes paa nytt,
+ * slik den opprinnelige stop-and-wait sendingen gjorde.
+ */
+static void fail_all(L4SAP* l4) {
+    int dropped = (int)(l4->snd_nxt - l4->snd_una);
+    l4->stats.send_failed += (uint64_t)dropped;
+    for (uint32_t n = l4->snd_una; n != l4->snd_nxt; n++) {
+        l4->tx[n % l4->window].acked = 0;
+    }
+    l4->snd_nxt = l4->snd_una;
+    if (l4->callback) {
+        l4->callback(l4, L4_EVENT_FAILED, dropped, l4->user);
+    }
+}
+
+/* Oppdaterer SRTT, RTTVAR og RTO med tiden siden slot ble sendt, som
+ * i RFC 6298. Gjensendte pakker gir ingen maaling (Karns regel), fordi
+ * vi ikke vet hvilken av sendingene ACKen svarer paa.
+ */
+static void rtt_sample(L4SAP* l4, const L4TxSlot* slot, const struct timespec* now) {
+    if (slot->attempts != 1) {
+        return;
+    }
+    long r = (long)((now->tv_sec - slot->sent_at.tv_sec) * 1000000L + (now->tv_nsec - slot->sent_at.tv_nsec) / 1000);
+    if (r < 1) {
+        r = 1;
+    }
+
+    L4Rtt* rtt = &l4->rtt;
+    if (rtt->srtt_us == 0) { // Foerste maaling
+        rtt->srtt_us   = r;
+        rtt->rttvar_us = r / 2;
+    } else {
+        long err = (rtt->srtt_us > r) ? rtt->srtt_us - r : r - rtt->srtt_us;
+        rtt->rttvar_us = rtt->rttvar_us - rtt->rttvar_us / 4 + err / 4;     // beta = 1/4
+        rtt->srtt_us   = rtt->srtt_us - rtt->srtt_us / 8 + r / 8;          // alpha = 1/8
+    }
+
+    long var = 4 * rtt->rttvar_us;
+    if (var < L4_RTO_GRANULARITY_USEC) {
+        var = L4_RTO_GRANULARITY_USEC;
+    }
+    rtt->rto_us = rtt->srtt_us + var;
+    if (rtt->rto_us < rtt->rto_min_us) rtt->rto_us = rtt->rto_min_us;
+    if (rtt->rto_us > rtt->rto_max_us) rtt->rto_us = rtt->rto_max_us;
+}
+
+/* Markerer slot som kvittert og teller tiden siden foerste sending,
+ * ogsaa for gjensendte pakker.
+ */
+static void slot_acked(L4SAP* l4, L4TxSlot* slot, const struct timespec* now) {
+    long us = (long)((now->tv_sec - slot->sent_at.tv_sec) * 1000000L + (now->tv_nsec - slot->sent_at.tv_nsec) / 1000);
+    l4hist_record(&l4->ack_latency, us);
+    slot->acked = 1;
+}
+
+static void deadline_set(struct timespec* deadline, const struct timespec* now, long usec) {
+    deadline->tv_sec  = now->tv_sec + usec / 1000000L;
+    deadline->tv_nsec = now->tv_nsec + (usec % 1000000L) * 1000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
 }
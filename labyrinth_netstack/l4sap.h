@@ -1,15 +1,54 @@
 #ifndef L4SAP_H
 #define L4SAP_H
 
+#include <stdio.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <time.h>
 
 #include "l2sap.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define L4Framesize   (int)L2Payloadsize
 #define L4Headersize  (int)(sizeof(L4Header))
 #define L4Payloadsize (int)(L4Framesize-L4Headersize)
 
+/* l4sap_sendv takes at most this many payload segments, because the
+ * L4 header needs one of the L2 segments.
+ */
+#define L4_MAX_IOV    (L2_MAX_IOV-1)
+
+/* Retransmission defaults of every L4SAP, see l4sap_set_rto_limits
+ * and l4sap_set_max_retries. Times are in microseconds. Until the
+ * first round trip has been measured, the timeout is 1 second.
+ */
+#define L4_MAX_RETRIES       5
+#define L4_RTO_INITIAL_USEC  1000000L
+#define L4_RTO_MIN_USEC      200000L
+#define L4_RTO_MAX_USEC      60000000L
+
+/* The largest window of l4sap_set_window. With Selective Repeat, the
+ * window may use at most half of the 256 sequence numbers.
+ */
+#define L4_MAX_WINDOW 127
+
+/* Messages of l4sap_send_msg are split into fragments. Every fragment
+ * is one L4_DATA packet whose payload starts with an L4MsgHeader.
+ */
+#define L4MsgHeadersize (int)(sizeof(L4MsgHeader))
+#define L4MsgFragsize   (int)(L4Payloadsize-L4MsgHeadersize)
+
+/* l4sap_send_msgv takes one segment less than l4sap_sendv, because the
+ * fragment header needs one.
+ */
+#define L4_MSG_MAX_IOV  (L4_MAX_IOV-1)
+
+/* Messages that announce a larger size are discarded by the receiver. */
+#define L4_MAX_MSG      (256*1024*1024)
+
 /* The 3 types of packet that exist in this L4 layer. */
 #define L4_RESET    0x1 << 0
 #define L4_DATA     0x1 << 1
@@ -27,6 +66,16 @@
 #define L4_DATA_RECEIVED    -103
 #define L4_NODATA_RECEIVED  -104
 
+/* Returned by the non-blocking functions when they would have to wait. */
+#define L4_WOULDBLOCK       -105
+
+/* Events that are reported to the callback of l4sap_set_callback. */
+#define L4_EVENT_SENT       1   /* the oldest outstanding packet was acknowledged; value is its payload length */
+#define L4_EVENT_RECV       2   /* the next packet can be taken with l4sap_recv_async */
+#define L4_EVENT_FAILED     3   /* value packets were dropped: they exceeded their retransmissions,
+                                   or a stop-and-wait send failed while it waited for the ACK */
+#define L4_EVENT_QUIT       4   /* the peer sent L4_RESET */
+
 
 /* The design of the L4 layer is the following:
  *
@@ -77,17 +126,135 @@ struct L4Header
  * You can add any number of data structures that are convenient for you.
  */
 
+/* Header of a message fragment, in network byte order. total_len is
+ * the size of the whole message and offset the position of this
+ * fragment's data in it. The fragments of a message are sent in order,
+ * and a fragment with offset 0 starts a new message.
+ */
+typedef struct L4MsgHeader L4MsgHeader;
+struct L4MsgHeader
+{
+    uint32_t total_len;
+    uint32_t offset;
+};
+
+/* A DATA packet that has been sent and not acknowledged yet.
+ * The frame refers to header and, in windowed mode, to copy; in
+ * stop-and-wait mode it refers to the caller's buffers, which stay
+ * valid because l4sap_send does not return before the ACK.
+ */
+typedef struct L4TxSlot L4TxSlot;
+
+struct L4TxSlot
+{
+    L2Prepared      frame;
+    L4Header        header;
+    uint8_t*        copy;
+    int             len;
+    int             attempts;
+    struct timespec sent_at;    /* first transmission, for RTT samples */
+    struct timespec deadline;
+    uint8_t         acked;
+};
+
+/* Round-trip time estimate and retransmission timeout (RTO) in the
+ * style of RFC 6298. srtt_us and rttvar_us are 0 until the first
+ * sample. Only packets that were sent once give samples (Karn's
+ * rule). Every timeout doubles rto_us, up to rto_max_us, and the next
+ * sample computes it again from srtt_us and rttvar_us.
+ */
+typedef struct L4Rtt L4Rtt;
+
+struct L4Rtt
+{
+    long srtt_us;
+    long rttvar_us;
+    long rto_us;
+    long rto_min_us;
+    long rto_max_us;
+};
+
+/* Counters of an L4 entity. They are plain increments on the paths
+ * that already handle the packet, so they are always on.
+ */
+typedef struct L4Stats L4Stats;
+
+struct L4Stats
+{
+    uint64_t data_out;          /* DATA packets sent the first time */
+    uint64_t bytes_out;         /* their payload */
+    uint64_t retransmits;       /* DATA packets sent again after a timeout */
+    uint64_t send_failed;       /* DATA packets given up after max_retries or a failed wait */
+    uint64_t acks_out;
+    uint64_t data_in;           /* new DATA packets kept for L5 */
+    uint64_t bytes_in;          /* their payload */
+    uint64_t duplicates;        /* DATA that had been received before */
+    uint64_t outside_window;    /* DATA too far ahead, dropped */
+    uint64_t window_full;       /* DATA dropped because L5 had not read */
+    uint64_t acks_in;
+    uint64_t acks_unexpected;   /* ACKs that acknowledged nothing */
+    uint64_t resets_in;
+    uint64_t runts;             /* packets shorter than L4Headersize */
+    uint64_t unknown;           /* packets of an unknown type */
+};
+
+/* A histogram of times in microseconds in the style of HdrHistogram:
+ * every power of two is split into L4_HIST_SUB buckets, so a value is
+ * kept with a relative error below 1/L4_HIST_SUB. Values from 0 to
+ * L4_HIST_SUB-1 have a bucket each, and values above L4_HIST_MAX_US
+ * are counted as L4_HIST_MAX_US.
+ */
+#define L4_HIST_SUB_BITS  4
+#define L4_HIST_SUB       (1 << L4_HIST_SUB_BITS)
+#define L4_HIST_MAX_US    ((1L << 27) - 1)                          /* about 134 s */
+#define L4_HIST_BUCKETS   ((27 - L4_HIST_SUB_BITS + 1) * L4_HIST_SUB)
+
+typedef struct L4Histogram L4Histogram;
+
+struct L4Histogram
+{
+    uint64_t count;
+    uint64_t sum_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t buckets[L4_HIST_BUCKETS];
+};
+
 /* The data structure for maintaining the L4 entity should
  * be called L4SAP.
  */
 typedef struct L4SAP L4SAP;
 
+/* Completion callback, see l4sap_set_callback. */
+typedef void (*L4Callback)( L4SAP* l4, int event, int value, void* user );
+
 struct L4SAP
 {
     L2SAP* l2;
 
-    uint8_t next_seqno_send;
-    uint8_t expected_seqno_recv;
+    /* Sequence numbers are counted in 32 bits. The header carries
+     * them modulo seq_mask+1: 2 in stop-and-wait mode, 256 in
+     * windowed mode.
+     */
+    uint32_t  snd_una;      /* oldest DATA that is not acknowledged */
+    uint32_t  snd_nxt;      /* next DATA to send */
+    uint32_t  rcv_nxt;      /* next DATA that has not arrived */
+    uint32_t  rcv_deliver;  /* next DATA to hand to L5 */
+    uint32_t  seq_mask;
+
+    /* window entries each. Segment n uses entry n % window. */
+    int       window;
+    L4TxSlot* tx;
+    L2Buf**   rx;           /* received, not yet delivered; NULL if empty */
+
+    L4Rtt     rtt;
+    int       max_retries;  /* transmissions per packet before L4_SEND_FAILED */
+
+    L4Callback callback;    /* NULL if no events are wanted */
+    void*      user;
+
+    L4Stats     stats;
+    L4Histogram ack_latency;    /* first send to ACK of every DATA packet */
 };
 
 
@@ -95,6 +262,13 @@ struct L4SAP
  */
 L4SAP* l4sap_create( const char* server_ip, int server_port );
 
+/* Create an L4 entity on top of an existing L2 entity, for example a
+ * session accepted from an L2 server. The L4 entity owns l2 and
+ * destroys it in l4sap_destroy. Returns NULL on error, and then l2
+ * still belongs to the caller.
+ */
+L4SAP* l4sap_create_from_l2( L2SAP* l2 );
+
 /* l4sap_send is a blocking function that sends data to
  *l4sap_create its peer entity.
  *
@@ -118,9 +292,85 @@ L4SAP* l4sap_create( const char* server_ip, int server_port );
  * the error code L4_QUIT.
  *
  * DATA packets must be handled to achieve a full duplex operation.
+ * They are acknowledged right away and kept in the receive window
+ * until the next l4sap_recv. If the receive window is full, they are
+ * dropped without an ACK and the peer sends them again later.
+ * The ackno of an arriving DATA packet acknowledges our own packets
+ * like the ackno of an ACK, so a lost ACK costs no retransmission when
+ * the peer has something to send anyway.
  */
 int l4sap_send( L4SAP* l4, const uint8_t* data, int len );
 
+/* l4sap_sendv behaves like l4sap_send, but the payload is the
+ * concatenation of up to L4_MAX_IOV segments. Neither L4 nor L2 copy
+ * the segments; header and payload are handed to the kernel with
+ * sendmsg. Retransmissions reuse the frame and its checksum.
+ */
+int l4sap_sendv( L4SAP* l4, const struct iovec* iov, int iovcnt );
+
+/* Select the transfer mode. A window of 0 or 1 is the stop-and-wait
+ * protocol described above, with sequence numbers 0 and 1; this is
+ * the default. A window of 2 to L4_MAX_WINDOW uses Selective Repeat
+ * with the full 8-bit sequence space:
+ * - l4sap_send copies the payload and returns as soon as fewer than
+ *   window packets are unacknowledged. Each packet has its own
+ *   retransmission timer.
+ * - An ACK carries the sequence number of the packet that it
+ *   acknowledges in seqno, and the next expected sequence number
+ *   (cumulative ACK) in ackno.
+ * - The receiver keeps up to window packets that arrived out of
+ *   order and delivers them in order.
+ * Both peers must use the same mode, and it must be selected before
+ * the first packet is sent. Returns 0, or -1 if the window is out of
+ * range or packets are in flight.
+ */
+int l4sap_set_window( L4SAP* l4, int window );
+
+/* Block until every packet that l4sap_send accepted has been
+ * acknowledged. Returns 0, L4_SEND_FAILED if a packet exceeded its
+ * retransmissions, or L4_QUIT.
+ * In stop-and-wait mode, there is never anything to wait for.
+ */
+int l4sap_flush( L4SAP* l4 );
+
+/* Limit the retransmission timeout to [min_us, max_us]. A value of 0
+ * keeps the current limit. Returns 0, or -1 if min_us > max_us.
+ */
+int l4sap_set_rto_limits( L4SAP* l4, long min_us, long max_us );
+
+/* Set how often a packet is sent before l4sap_send gives up with
+ * L4_SEND_FAILED. The default is L4_MAX_RETRIES. Returns 0 or -1.
+ */
+int l4sap_set_max_retries( L4SAP* l4, int max_retries );
+
+/* Copy the current RTT estimate and timeout to rtt. */
+void l4sap_get_rtt( const L4SAP* l4, L4Rtt* rtt );
+
+/* Copy the counters of the entity to stats. */
+void l4sap_get_stats( const L4SAP* l4, L4Stats* stats );
+
+/* Copy the histogram of the time from the first transmission of a
+ * DATA packet to its ACK. Unlike the RTT estimate, retransmitted
+ * packets are included, so timeouts show up in the tail.
+ */
+void l4sap_get_ack_latency( const L4SAP* l4, L4Histogram* hist );
+
+/* Write the L2 and L4 counters and the ACK latency of the entity to f
+ * as one JSON object. Returns 0, or -1 if writing failed.
+ */
+int  l4sap_write_stats_json( const L4SAP* l4, FILE* f );
+
+/* Add a value to a histogram. */
+void l4hist_record( L4Histogram* hist, long us );
+
+/* Add the values of from to hist, for example of several sessions. */
+void l4hist_merge( L4Histogram* hist, const L4Histogram* from );
+
+/* The value below which the fraction p (0 to 1) of the values lie,
+ * rounded up to the end of its bucket. 0 if the histogram is empty.
+ */
+long l4hist_percentile( const L4Histogram* hist, double p );
+
 /* l4sap_recv is a blocking function that receives data from
  * its peer entity.
  *
@@ -145,13 +395,107 @@ int l4sap_send( L4SAP* l4, const uint8_t* data, int len );
  */
 int l4sap_recv( L4SAP* l4, uint8_t* data, int len );
 
+/* l4sap_recv_lend behaves like l4sap_recv, but instead of copying the
+ * payload it returns the buffer that the packet was received in.
+ * On success, *buf is set and the payload length is returned; the
+ * payload is the buf->len bytes at buf->data + buf->offset. The
+ * caller must give the buffer back with l2buf_release. At most
+ * L2_POOL_BUFFERS buffers can be held at the same time.
+ * On L4_QUIT and errors, *buf is NULL.
+ */
+int l4sap_recv_lend( L4SAP* l4, L2Buf** buf );
+
+/* The non-blocking interface. Instead of waiting inside L4, the
+ * caller waits for the socket of the entity (l4sap_get_fd) to become
+ * readable or for the next timer (l4sap_next_deadline) to expire, for
+ * example with epoll, and then calls l4sap_poll. One thread can drive
+ * any number of entities this way. The blocking functions may be used
+ * on the same entity too, but they do not return until they are done.
+ */
+
+/* Return the socket that becomes readable when a packet arrives. A
+ * session of an L2 server shares the server's socket.
+ */
+int  l4sap_get_fd( const L4SAP* l4 );
+
+/* Store the CLOCK_MONOTONIC time at which l4sap_poll has to run next
+ * to retransmit a packet in deadline, and return 1. Returns 0 if no
+ * packet is waiting for an ACK.
+ */
+int  l4sap_next_deadline( const L4SAP* l4, struct timespec* deadline );
+
+/* Process every packet that has arrived, without waiting, and
+ * retransmit the packets whose timer has expired at now (the
+ * CLOCK_MONOTONIC time, or NULL for the current time). Received DATA
+ * is kept for l4sap_recv_async. Returns 0, L4_SEND_FAILED if packets
+ * were given up, L4_QUIT, or -1 on error.
+ */
+int  l4sap_poll( L4SAP* l4, const struct timespec* now );
+
+/* Send without waiting. The payload is copied, so data can be reused
+ * at once. Returns the number of bytes accepted (truncated to
+ * L4Payloadsize), or L4_WOULDBLOCK if window packets are already
+ * waiting for an ACK. Completion is reported with L4_EVENT_SENT, in
+ * the order in which the packets were sent.
+ */
+int  l4sap_send_async( L4SAP* l4, const uint8_t* data, int len );
+
+/* Receive without waiting. Copies the next DATA packet like
+ * l4sap_recv and returns its length, or returns L4_WOULDBLOCK if
+ * l4sap_poll has not received it yet.
+ */
+int  l4sap_recv_async( L4SAP* l4, uint8_t* data, int len );
+
+/* Have callback called with user for the L4_EVENT_* events, from
+ * inside l4sap_poll and the blocking functions. L4_EVENT_RECV is
+ * reported by l4sap_poll as long as a packet is waiting. The callback
+ * may call l4sap_send_async and l4sap_recv_async, but must not
+ * destroy the entity. A NULL callback turns events off.
+ */
+void l4sap_set_callback( L4SAP* l4, L4Callback callback, void* user );
+
+/* Send a message of any length up to L4_MAX_MSG. It is split into
+ * fragments of L4MsgFragsize bytes, which are sent with l4sap_sendv;
+ * lost fragments are retransmitted by L4 like any other packet. In
+ * stop-and-wait mode every fragment costs a round trip, so large
+ * messages should be sent in windowed mode (l4sap_set_window).
+ * Returns len once every fragment has been accepted by l4sap_sendv,
+ * or the error of the first fragment that failed.
+ */
+int l4sap_send_msg( L4SAP* l4, const uint8_t* data, int len );
+
+/* l4sap_send_msg for a message that is the concatenation of up to
+ * L4_MSG_MAX_IOV segments. The segments are not copied.
+ */
+int l4sap_send_msgv( L4SAP* l4, const struct iovec* iov, int iovcnt );
+
+/* Receive a message that was sent with l4sap_send_msg and reassemble
+ * it in data. If it is larger than len, the rest is discarded. Returns
+ * the number of bytes copied to data, L4_QUIT, or another value < 0
+ * on error. Fragments that do not belong to a complete message (for
+ * example after the peer gave up on a message) are discarded.
+ */
+int l4sap_recv_msg( L4SAP* l4, uint8_t* data, int len );
+
+/* Like l4sap_recv_msg, but the message is reassembled in a buffer that
+ * is allocated with the size of the message. *data receives the buffer,
+ * which the caller frees. Returns the message size.
+ */
+int l4sap_recv_msg_alloc( L4SAP* l4, uint8_t** data );
+
 /* Send the L4_RESET message to the peer (OK to send it several
  * times, then delete the L2 and L4 entities and all memory
  * associated with them.
+ * In windowed mode, packets that have not been acknowledged are
+ * dropped; call l4sap_flush first to wait for them.
  */
 void l4sap_destroy( L4SAP* l4 );
 
 int l2sap_recvfrom(L2SAP* client, uint8_t* data, int len);
 
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "maze.h"
+#include "maze-solve.h"
+#include "trace.h"
+
+/* Ordene i en kolonne av 64 rader er en flis paa 4 KiB. Koeen holder
+ * fliser, og pending[t] har en bit for hver rad i flis t som skal
+ * besoekes, saa en flis blir jobbet ferdig mens den ligger i L1.
+ */
+#define TILE_ROWS 64
+
+/* Et ord med 64 ruter av en rad og alle bitplanene for dem, paa en
+ * cache-linje, saa et besoek leser faa linjer. Det finnes words ord per
+ * rad, og bit x%64 i ord y*words+x/64 hoerer til ruten (x,y).
+ */
+struct BitWord
+{
+    uint64_t r;           // kan gaa til hoeyre (og x+1 er innenfor)
+    uint64_t l;           // kan gaa til venstre
+    uint64_t u;           // kan gaa opp
+    uint64_t d;           // kan gaa ned
+    uint64_t v;           // naadd (eller utenfor griddet)
+    uint64_t p0;          // bit 0 av retningen tilbake (DIR_*), her i et bitplan
+    uint64_t p1;          // bit 1 av retningen tilbake
+    uint64_t pad;         // fyller ut til 64 bytes
+};
+
+struct BitMaze
+{
+    uint32_t        edge;
+    uint32_t        words;  // ord per rad
+    uint32_t        count;    // ord i hele griddet
+    uint32_t        tiles;    // fliser i hele griddet
+    struct BitWord* w;
+    uint64_t*       pending;  // rader som skal besoekes, per flis
+    uint32_t*       queue;    // ring med plass til alle fliser og en til
+    uint32_t        head;
+    uint32_t        tail;
+    uint32_t        current;  // flisen som jobbes med, den legges ikke i koeen
+};
+
+// Funksjon deklarasjon
+static int      bits_init(struct BitMaze* b, const struct Maze* maze);
+static void     bits_free(struct BitMaze* b);
+static void     bits_planes(struct BitMaze* b, struct Maze* maze);
+static void     bits_visit(struct BitMaze* b, uint32_t x, uint32_t y, uint64_t start);
+static void     bits_tile(struct BitMaze* b, uint32_t t);
+static void     bits_push(struct BitMaze* b, uint32_t x, uint32_t y);
+static uint64_t fill_right(uint64_t gen, uint64_t pro);
+static uint64_t fill_left(uint64_t gen, uint64_t pro);
+static uint32_t bits_mark(struct BitMaze* b, struct Maze* maze);
+
+/**
+ * @brief Marks a path from start to end with the bit mark, 64 squares at a time.
+ *
+ * The walls are first turned into four bit planes, one bit per square
+ * for each direction that is open. The search then works on 64-bit
+ * words of a row instead of single squares: a word takes the squares
+ * that its neighbours above and below can reach, and spreads them
+ * sideways along open corridors with a few shifts and ANDs, so a
+ * corridor of up to 64 squares costs one step. Words that gained
+ * squares mark their neighbours to be visited. The queue holds tiles
+ * of 64 x 64 squares, and a tile is worked on until none of its words
+ * gain anything more, so the words it touches stay in the L1 cache.
+ *
+ * Every square is reached once, and the direction it was reached from
+ * is kept in two more bit planes, which give the path back from the
+ * end. All planes of a word share one cache line. In a perfect maze
+ * this is the only path; if the maze has loops, it is a path, but not
+ * always the shortest one that mazeSolve finds.
+ * The memory is a little over one byte per square, and the grid is
+ * only written for the mark bits.
+ *
+ * @return The number of squares on the path, 0 if there is no path,
+ *         or -1 if the maze is invalid or memory is short.
+ */
+int mazeSolveBits(struct Maze* maze)
+{
+    return maze_solve_bits(maze, NULL);
+}
+
+/* mazeSolveBits som ogsaa teller rutene som ble naadd. */
+int maze_solve_bits(struct Maze* maze, uint32_t* visited)
+{
+    if (maze_check(maze, "mazeSolveBits") < 0) {
+        return -1;
+    }
+
+    struct BitMaze b;
+    if (bits_init(&b, maze) < 0) {
+        perror("mazeSolveBits: Could not allocate the bit planes");
+        return -1;
+    }
+
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_BEGIN, maze->startX, maze->startY, maze->endX, maze->endY, maze->edgeLen);
+
+    bits_planes(&b, maze);
+
+    uint32_t end   = maze->endY * b.words + maze->endX / 64;
+    uint64_t ebit  = 1ULL << (maze->endX % 64);
+
+    bits_visit(&b, maze->startX / 64, maze->startY, 1ULL << (maze->startX % 64));
+    while (b.head != b.tail && !(b.w[end].v & ebit)) {
+        uint32_t t = b.queue[b.head];
+        b.head = (b.head + 1 > b.tiles) ? 0 : b.head + 1;
+        bits_tile(&b, t);
+    }
+
+    uint32_t length = 0;
+    if (b.w[end].v & ebit) {
+        length = bits_mark(&b, maze);
+    }
+    if (visited) { // Alle naadde bits, minus de som er utenfor griddet
+        uint64_t count = 0;
+        for (uint32_t i = 0; i < b.count; ++i) {
+            count += (uint64_t)__builtin_popcountll(b.w[i].v);
+        }
+        *visited = (uint32_t)(count - (uint64_t)(b.words * 64 - b.edge) * b.edge);
+    }
+    bits_free(&b);
+
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_END, length > 0, length);
+    return (int)length;
+}
+
+static int bits_init(struct BitMaze* b, const struct Maze* maze)
+{
+    memset(b, 0, sizeof(*b));
+    b->edge  = maze->edgeLen;
+    b->words = (maze->edgeLen + 63) / 64;
+    b->count = b->words * maze->edgeLen;
+    b->tiles = b->words * ((maze->edgeLen + TILE_ROWS - 1) / TILE_ROWS);
+    b->current = UINT32_MAX;
+
+    b->w       = aligned_alloc(sizeof(struct BitWord), (size_t)b->count * sizeof(struct BitWord));
+    b->pending = calloc(b->tiles, sizeof(uint64_t));
+    b->queue   = malloc(((size_t)b->tiles + 1) * sizeof(uint32_t)); // en ekstra, saa full og tom ikke er like
+    if (!b->w || !b->pending || !b->queue) {
+        bits_free(b);
+        return -1;
+    }
+    return 0;
+}
+
+static void bits_free(struct BitMaze* b)
+{
+    free(b->w);
+    free(b->pending);
+    free(b->queue);
+}
+
+/* Lager bitplanene fra griddet og fjerner merker fra en tidligere
+ * loesning i samme runde. Paa little-endian leses aatte ruter som ett
+ * 64-bits ord, og bit k fra hver byte samles til en byte med en
+ * multiplikasjon. Retninger ut av griddet fjernes, og bitene etter siste
+ * rute i en rad regnes som naadd, saa de aldri blir fylt.
+ */
+static void bits_planes(struct BitMaze* b, struct Maze* maze)
+{
+    char*          grid  = maze->maze;
+    const uint64_t lsb   = 0x0101010101010101ULL;
+    const uint64_t magic = 0x0102040810204080ULL; // byte i sin bit 0 til bit 56+i
+    uint32_t       edge  = b->edge;
+
+    for (uint32_t y = 0; y < edge; ++y) {
+        char* row = grid + (size_t)y * edge;
+        for (uint32_t w = 0; w < b->words; ++w) {
+            uint32_t x0 = w * 64;
+            uint32_t n  = (edge - x0 < 64) ? edge - x0 : 64;
+            uint64_t r = 0, l = 0, u = 0, d = 0;
+            uint32_t x = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            for (; x + 8 <= n; x += 8) {
+                uint64_t cells;
+                memcpy(&cells, row + x0 + x, 8);
+                cells &= ~((uint64_t)(mark | tmark) * lsb);
+                memcpy(row + x0 + x, &cells, 8);
+                l |= ((((cells >> 1) & lsb) * magic) >> 56) << x;
+                r |= ((((cells >> 2) & lsb) * magic) >> 56) << x;
+                u |= ((((cells >> 3) & lsb) * magic) >> 56) << x;
+                d |= ((((cells >> 4) & lsb) * magic) >> 56) << x;
+            }
+#endif
+            for (; x < n; ++x) { // Resten av en kort rad
+                char c = row[x0 + x] &= ~(mark | tmark);
+                if (c & left)  l |= 1ULL << x;
+                if (c & right) r |= 1ULL << x;
+                if (c & up)    u |= 1ULL << x;
+                if (c & down)  d |= 1ULL << x;
+            }
+
+            uint64_t inside = (n == 64) ? ~0ULL : (1ULL << n) - 1;
+            if (x0 + n == edge) { // Siste rute i raden kan ikke gaa til hoeyre
+                r &= ~(1ULL << (n - 1));
+            }
+            if (w == 0) {
+                l &= ~1ULL;
+            }
+            if (y == 0) {
+                u = 0;
+            }
+            if (y + 1 == edge) {
+                d = 0;
+            }
+
+            struct BitWord* word = &b->w[y * b->words + w];
+            word->r      = r & inside;
+            word->l      = l & inside;
+            word->u      = u & inside;
+            word->d      = d & inside;
+            word->v      = ~inside;
+            word->p0     = 0;
+            word->p1     = 0;
+            word->pad    = 0;
+        }
+    }
+}
+
+/* Fyller ord x i rad y med rutene som naboene kan naa, og med start. Nye
+ * ruter faar retningen tilbake i p0/p1, og naboord som kan faa nye
+ * ruter av dem skal besoekes.
+ */
+static void bits_visit(struct BitMaze* b, uint32_t x, uint32_t y, uint64_t start)
+{
+    uint32_t        words = b->words;
+    struct BitWord* w     = &b->w[y * words + x];
+    struct BitWord* above = (y > 0) ? w - words : NULL;
+    struct BitWord* below = (y + 1 < b->edge) ? w + words : NULL;
+    struct BitWord* prev  = (x > 0) ? w - 1 : NULL;
+    struct BitWord* next  = (x + 1 < words) ? w + 1 : NULL;
+    uint64_t        seen  = w->v;
+
+    // Ruter som kan naas fra raden over, fra raden under og fra ordene ved siden av
+    uint64_t from_up = 0, from_down = 0, from_left = 0, from_right = 0;
+    if (above) {
+        from_up = above->v & above->d & ~seen;
+    }
+    if (below) {
+        from_down = below->v & below->u & ~seen & ~from_up;
+    }
+    if (prev && ((prev->v & prev->r) >> 63)) {
+        from_left = 1ULL & ~seen & ~from_up & ~from_down;
+    }
+    if (next && (next->v & next->l & 1ULL)) {
+        from_right = (1ULL << 63) & ~seen & ~from_up & ~from_down & ~from_left;
+    }
+    start &= ~seen;
+
+    uint64_t seeds = start | from_up | from_down | from_left | from_right;
+    if (!seeds) {
+        return;
+    }
+
+    // Sidelengs langs aapne ganger, bare gjennom ruter som ikke er naadd
+    uint64_t rfill = fill_right(seeds, (w->r << 1) & ~seen);
+    uint64_t lfill = fill_left(rfill, (w->l >> 1) & ~seen);
+    uint64_t by_l  = lfill & ~rfill; // kom fra hoeyre nabo
+
+    // rfill & ~seeds kom fra venstre nabo, og DIR_LEFT er 0 i begge planene
+    w->p0 |= from_right | by_l | from_down;
+    w->p1 |= from_up | from_down;
+    w->v   = seen | lfill;
+
+    // Naboord som kan faa nye ruter
+    if (above && (lfill & w->u & ~above->v)) {
+        bits_push(b, x, y - 1);
+    }
+    if (below && (lfill & w->d & ~below->v)) {
+        bits_push(b, x, y + 1);
+    }
+    if (prev && (lfill & w->l & 1ULL) && !(prev->v >> 63)) {
+        bits_push(b, x - 1, y);
+    }
+    if (next && ((lfill & w->r) >> 63) && !(next->v & 1ULL)) {
+        bits_push(b, x + 1, y);
+    }
+}
+
+/* Besoeker radene i flis t til ingen av dem venter lenger. */
+static void bits_tile(struct BitMaze* b, uint32_t t)
+{
+    uint32_t x     = t % b->words;
+    uint32_t first = (t / b->words) * TILE_ROWS;
+
+    b->current = t;
+    while (b->pending[t]) {
+        uint32_t row = (uint32_t)__builtin_ctzll(b->pending[t]);
+        b->pending[t] &= b->pending[t] - 1;
+        bits_visit(b, x, first + row, 0);
+    }
+    b->current = UINT32_MAX;
+}
+
+static void bits_push(struct BitMaze* b, uint32_t x, uint32_t y)
+{
+    uint32_t t   = (y / TILE_ROWS) * b->words + x;
+    uint64_t bit = 1ULL << (y % TILE_ROWS);
+
+    if (!b->pending[t] && t != b->current) { // Flisen ventet ikke fra foer
+        b->queue[b->tail] = t;
+        b->tail = (b->tail + 1 > b->tiles) ? 0 : b->tail + 1;
+    }
+    b->pending[t] |= bit;
+}
+
+/* Kogge-Stone fylling: gen spres mot hoeyere bits saa lenge pro er satt.
+ * Bit x i pro betyr at ruten x kan naas fra x-1. Seks skritt dekker 64 bits.
+ */
+static uint64_t fill_right(uint64_t gen, uint64_t pro)
+{
+    gen |= pro & (gen << 1);
+    pro &= pro << 1;
+    gen |= pro & (gen << 2);
+    pro &= pro << 2;
+    gen |= pro & (gen << 4);
+    pro &= pro << 4;
+    gen |= pro & (gen << 8);
+    pro &= pro << 8;
+    gen |= pro & (gen << 16);
+    pro &= pro << 16;
+    gen |= pro & (gen << 32);
+    return gen;
+}
+
+/* Samme mot lavere bits; bit x i pro betyr at x kan naas fra x+1. */
+static uint64_t fill_left(uint64_t gen, uint64_t pro)
+{
+    gen |= pro & (gen >> 1);
+    pro &= pro >> 1;
+    gen |= pro & (gen >> 2);
+    pro &= pro >> 2;
+    gen |= pro & (gen >> 4);
+    pro &= pro >> 4;
+    gen |= pro & (gen >> 8);
+    pro &= pro >> 8;
+    gen |= pro & (gen >> 16);
+    pro &= pro >> 16;
+    gen |= pro & (gen >> 32);
+    return gen;
+}
+
+/* Gaar tilbake fra slutt til start etter retningene i p0/p1 og merker
+ * stien. Returnerer antall ruter paa den.
+ */
+static uint32_t bits_mark(struct BitMaze* b, struct Maze* maze)
+{
+    uint32_t edge   = b->edge;
+    uint32_t x      = maze->endX;
+    uint32_t y      = maze->endY;
+    uint32_t length = 1;
+
+    maze->maze[y * edge + x] |= mark;
+    while (x != maze->startX || y != maze->startY) {
+        uint32_t i   = y * b->words + x / 64;
+        uint64_t bit = 1ULL << (x % 64);
+        int      dir = ((b->w[i].p0 & bit) ? 1 : 0) | ((b->w[i].p1 & bit) ? 2 : 0);
+        switch (dir) {
+        case DIR_LEFT:  x -= 1; break;
+        case DIR_RIGHT: x += 1; break;
+        case DIR_UP:    y -= 1; break;
+        default:        y += 1; break;
+        }
+        maze->maze[y * edge + x] |= mark;
+        length++;
+    }
+    return length;
+}
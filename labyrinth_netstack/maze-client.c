@@ -2,12 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
+#include <unistd.h>
 
 #include "l4sap.h"
 #include "maze.h"
 
-#define MAZE_HEADER_LEN (6*sizeof(uint32_t))
-
 static int maxi( int a, int b )
 {
     if( a > b ) return a;
@@ -16,28 +15,75 @@ static int maxi( int a, int b )
 
 void usage( const char* name )
 {
-    fprintf( stderr, "Usage: %s <serverip> <port> <maze-seed>\n"
+    fprintf( stderr, "Usage: %s [-m] [-p] [-r] [-a strategy] [-w window] <serverip> <port> <maze-seed>\n"
+                     "       -m        - ask for the maze as an L4 message (MAZE <seed> MSG), so it\n"
+                     "                   may be larger than one packet; the reply is sent the same way\n"
+                     "       -p        - ask for the packed encoding (MAZE <seed> PACK); the reply uses\n"
+                     "                   the encoding that the maze came in\n"
+                     "       -r        - send only the path of the solution (MAZE_ENCODING_PATH)\n"
+                     "                   instead of the marked grid, when that is shorter\n"
+                     "       -a strategy - solve with bfs (default), bits, astar, bidir, deadend,\n"
+                     "                   parallel, tiled or packed (mazeSolveEx) and print what it\n"
+                     "                   cost on stderr\n"
+                     "       -w window - use windowed L4 mode, 2..%d; the server must use the same window\n"
                      "       serverip - IPv4 address of the server in dotted decimal notation\n"
                      "       port     - The server's port\n"
-                     "       maze-seed - random number generator seed\n", name );
+                     "       maze-seed - random number generator seed\n", name, L4_MAX_WINDOW );
     exit( -1 );
 }
 
 int main( int argc, char *argv[] )
 {
-    if( argc != 4 ) usage( argv[0] );
+    int use_msg  = 0;
+    int use_pack = 0;
+    int use_path = 0;
+    int strategy = MAZE_STRATEGY_BFS;
+    int window   = 1;
+    int opt;
+    while( (opt = getopt( argc, argv, "mpra:w:" )) != -1 )
+    {
+        switch( opt )
+        {
+        case 'm' :
+            use_msg = 1;
+            break;
+        case 'p' :
+            use_pack = 1;
+            break;
+        case 'r' :
+            use_path = 1;
+            break;
+        case 'a' :
+            strategy = mazeStrategyParse( optarg );
+            if( strategy < 0 ) usage( argv[0] );
+            break;
+        case 'w' :
+            window = atoi( optarg );
+            if( window < 2 || window > L4_MAX_WINDOW ) usage( argv[0] );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+    if( argc - optind != 3 ) usage( argv[0] );
 
-    L4SAP* l4 = l4sap_create( argv[1], atoi(argv[2]) );
+    L4SAP* l4 = l4sap_create( argv[optind], atoi(argv[optind+1]) );
     if( !l4 )
     {
         fprintf( stderr, "%s: Failed to create server\n", __FUNCTION__ );
         return -1;
     }
+    if( window > 1 && l4sap_set_window( l4, window ) < 0 )
+    {
+        fprintf( stderr, "%s: Failed to set window %d\n", __FUNCTION__, window );
+        l4sap_destroy( l4 );
+        return -1;
+    }
 
-    long maze_seed = strtol( argv[3], NULL, 10 );
+    long maze_seed = strtol( argv[optind+2], NULL, 10 );
 
     char buffer[1024];
-    snprintf( buffer, 1024, "MAZE %ld", maze_seed );
+    snprintf( buffer, 1024, "MAZE %ld%s%s", maze_seed, use_msg ? " MSG" : "", use_pack ? " PACK" : "" );
 
     fprintf( stderr, "%s: Client sends: %s\n", __FUNCTION__, buffer );
 
@@ -47,7 +93,18 @@ int main( int argc, char *argv[] )
         fprintf( stderr, "%s: Failed to send data\n", __FUNCTION__ );
     }
 
-    retval = l4sap_recv( l4, (uint8_t*)buffer, 1024 );
+    /* In message mode the maze arrives in as many packets as it needs,
+     * and is reassembled in a buffer of its size.
+     */
+    uint8_t* message = (uint8_t*)buffer;
+    if( use_msg )
+    {
+        retval = l4sap_recv_msg_alloc( l4, &message );
+    }
+    else
+    {
+        retval = l4sap_recv( l4, (uint8_t*)buffer, 1024 );
+    }
     if( retval < 0 )
     {
         fprintf( stderr, "%s: Failed to receive data (error)\n", __FUNCTION__ );
@@ -60,66 +117,100 @@ int main( int argc, char *argv[] )
     {
         fprintf( stderr, "%s: Received a message of length %d\n", __FUNCTION__, retval );
 
-        if( retval < 8 )
+        /* The maze comes raw or packed, whatever the server chose. */
+        Maze maze;
+        int  encoding = mazeDecode( &maze, message, retval );
+        if( encoding < 0 )
         {
-            fprintf( stderr, "%s: Message too small, cannot contain a Maze\n", __FUNCTION__ );
+            fprintf( stderr, "%s: Could not decode the maze, not processing\n", __FUNCTION__ );
         }
         else
         {
-            Maze* maze = (Maze*)malloc( sizeof(Maze) );
-            if( maze == NULL )
+            mazePlot( &maze );
+
+            MazePath         path;
+            MazeSolveOptions opts = { .strategy = strategy };
+            MazeSolveStats   stats;
+            if( use_path ) opts.path = &path;
+            int solved = mazeSolveEx( &maze, &opts, &stats );
+            if( solved >= 0 )
             {
-                fprintf( stderr, "%s: Could not allocate a Maze structure\n", __FUNCTION__ );
+                fprintf( stderr, "%s: %u squares visited, path of %u squares, %.3f ms\n",
+                         mazeStrategyName( strategy ), stats.visited, stats.length, stats.nsec / 1e6 );
             }
 
-            uint32_t* header = (uint32_t*)buffer;
-            maze->edgeLen = ntohl( header[0] );
-            maze->size    = ntohl( header[1] );
-            if( retval != maze->size + MAZE_HEADER_LEN )
+            mazePlot( &maze );
+
+
+            uint32_t reply[6];
+            uint8_t* packed = NULL;
+            int      iovcnt = 2;
+
+            /* Send header and grid as two segments, so the grid
+             * is not copied into buffer first. A packed maze is
+             * answered packed, in one segment, and the path alone
+             * is sent instead of either when it is shorter.
+             */
+            struct iovec iov[2];
+            if( use_path && solved >= 0 &&
+                mazePathEncodedBound( &path ) < MAZE_HEADER_LEN + maze.size )
             {
-                fprintf( stderr, "%s: Message size should be %d, but it is %d, not processing\n",
-                         __FUNCTION__, (int)(maze->size + MAZE_HEADER_LEN), retval );
+                uint32_t cap = mazePathEncodedBound( &path );
+                packed = (uint8_t*)malloc( cap );
+                if( packed )
+                {
+                    iov[0].iov_base = packed;
+                    iov[0].iov_len  = mazeEncodePath( &maze, &path, packed, cap );
+                    iovcnt          = 1;
+                }
             }
-            else
+            if( iovcnt == 2 && encoding == MAZE_ENCODING_PACKED )
             {
-                maze->startX = ntohl( header[2] );
-                maze->startY = ntohl( header[3] );
-                maze->endX   = ntohl( header[4] );
-                maze->endY   = ntohl( header[5] );
-                maze->maze   = (char*)malloc( maze->size );
-                if( maze->maze == NULL )
+                uint32_t cap = mazeEncodedBound( &maze );
+                packed = (uint8_t*)malloc( cap );
+                if( packed )
                 {
-                    fprintf( stderr, "%s: Could not allocate a Maze data\n", __FUNCTION__ );
+                    iov[0].iov_base = packed;
+                    iov[0].iov_len  = mazeEncode( &maze, MAZE_ENCODING_PACKED, packed, cap );
+                    iovcnt          = 1;
                 }
-                else
-                {
-                    memcpy( maze->maze, &buffer[MAZE_HEADER_LEN], maze->size );
-
-                    mazePlot( maze );
-
-                    mazeSolve( maze );
-
-                    mazePlot( maze );
-
-
-                    uint32_t* header = (uint32_t*)buffer;
-                    header[0] = htonl( maze->edgeLen );
-                    header[1] = htonl( maze->size );
-                    header[2] = htonl( maze->startX );
-                    header[3] = htonl( maze->startY );
-                    header[4] = htonl( maze->endX );
-                    header[5] = htonl( maze->endY );
-                    memcpy( &buffer[MAZE_HEADER_LEN], maze->maze, maze->size );
+            }
+            if( iovcnt == 2 )
+            {
+                reply[0] = htonl( maze.edgeLen );
+                reply[1] = htonl( maze.size );
+                reply[2] = htonl( maze.startX );
+                reply[3] = htonl( maze.startY );
+                reply[4] = htonl( maze.endX );
+                reply[5] = htonl( maze.endY );
+
+                iov[0].iov_base = reply;
+                iov[0].iov_len  = MAZE_HEADER_LEN;
+                iov[1].iov_base = maze.maze;
+                iov[1].iov_len  = maze.size;
+            }
+            fprintf( stderr, "%s: Sending the solution in %d bytes\n", __FUNCTION__,
+                     (int)(iov[0].iov_len + (iovcnt == 2 ? iov[1].iov_len : 0)) );
 
-                    l4sap_send( l4, (uint8_t*)buffer, maze->size + MAZE_HEADER_LEN );
-                    free(maze->maze);
-                }
+            if( use_msg )
+            {
+                l4sap_send_msgv( l4, iov, iovcnt );
             }
-            free(maze);
+            else
+            {
+                l4sap_sendv( l4, iov, iovcnt );
+            }
+            free( packed );
+            if( use_path ) mazePathFree( &path );
+            free( maze.maze );
         }
     }
+    if( message != (uint8_t*)buffer ) free( message );
 
     l4sap_send( l4, (uint8_t*)"QUIT", 5 );
 
+    /* In windowed mode the sends above may still be unacknowledged. */
+    if( window > 1 ) l4sap_flush( l4 );
+
     l4sap_destroy( l4 );
 }
@@ -0,0 +1,560 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "maze.h"
+
+/* En byte per rute i et 64-bits ord, bit 0 i hver byte. */
+#define ONES  0x0101010101010101ULL
+
+/* Bitene i en rute som den pakkede formen ikke kan baere: bit 0 og 7. */
+#define OTHER_BITS  ( ONES * 0x81 )
+
+/* Lengste varint, for et tall under 2^32. */
+#define VARINT_MAX 5
+
+/* Rekkene av umerkede og merkede ruter mens de skrives. */
+typedef struct RunWriter
+{
+    uint8_t* p;
+    uint8_t* end;
+    uint64_t run;    // ruter i rekken som telles
+    uint64_t state;  // 1 hvis den er merket
+} RunWriter;
+
+// Funksjon deklarasjon
+static uint64_t load_squares(const uint8_t* p, uint32_t n);
+static void     store_squares(uint8_t* p, uint64_t w, uint32_t n);
+static uint64_t gather(uint64_t w);
+static uint64_t spread(uint64_t bits);
+#ifdef __SSE2__
+static __m128i  expand(uint32_t bits, int square);
+#endif
+static void     put_header(uint8_t* out, const struct Maze* maze);
+static void     get_header(struct Maze* maze, const uint8_t* data);
+static int64_t  encode_packed(const struct Maze* maze, uint8_t* out, uint64_t limit);
+static int      put_marks(RunWriter* w, uint64_t marks, uint32_t n);
+static int      decode_packed(struct Maze* maze, const uint8_t* data, uint32_t len);
+static uint8_t* put_varint(uint8_t* p, uint64_t v);
+static int      get_varint(const uint8_t** p, const uint8_t* end, uint64_t* v);
+
+uint32_t mazeEncodedBound(const struct Maze* maze)
+{
+    return MAZE_HEADER_LEN + maze->size;
+}
+
+/**
+ * @brief Writes header and grid of maze into out for the wire.
+ *
+ * With MAZE_ENCODING_PACKED the grid is packed if that is lossless and
+ * smaller than one byte per square; otherwise, and with
+ * MAZE_ENCODING_RAW, it is copied as it is. The receiver tells the two
+ * apart by the length, so the header is the same in both. tmark is
+ * not sent in the packed form. Returns the number of bytes written, or
+ * -1 if cap is smaller than mazeEncodedBound.
+ */
+int mazeEncode(const struct Maze* maze, int encoding, uint8_t* out, uint32_t cap)
+{
+    if (!maze || !maze->maze || !out || cap < mazeEncodedBound(maze)) {
+        fprintf(stderr, "mazeEncode: Invalid maze or output buffer too small.\n");
+        return -1;
+    }
+
+    put_header(out, maze);
+    if (encoding == MAZE_ENCODING_PACKED && maze->edgeLen > 0 &&
+        (uint64_t)maze->edgeLen * maze->edgeLen == maze->size) {
+        // Den pakkede formen maa vaere kortere, ellers ser mottakeren den som raa
+        int64_t len = encode_packed(maze, out + MAZE_HEADER_LEN, maze->size - 1);
+        if (len >= 0) {
+            return (int)(MAZE_HEADER_LEN + len);
+        }
+    }
+    memcpy(out + MAZE_HEADER_LEN, maze->maze, maze->size);
+    return (int)(MAZE_HEADER_LEN + maze->size);
+}
+
+/**
+ * @brief Reads a maze that mazeEncode wrote, in either encoding.
+ *
+ * A message of exactly MAZE_HEADER_LEN + size bytes is raw; anything
+ * shorter must start with MAZE_ENCODING_PACKED after the header. The
+ * grid is allocated with malloc and belongs to the caller.
+ */
+int mazeDecode(struct Maze* maze, const uint8_t* data, uint32_t len)
+{
+    maze->maze = NULL;
+    if (len < MAZE_HEADER_LEN) {
+        fprintf(stderr, "mazeDecode: Message of %u bytes is shorter than the header.\n", len);
+        return -1;
+    }
+
+    get_header(maze, data);
+    if (len == (uint64_t)MAZE_HEADER_LEN + maze->size) {
+        maze->maze = (char*)malloc(maze->size ? maze->size : 1);
+        if (!maze->maze) {
+            perror("mazeDecode: Could not allocate the grid");
+            return -1;
+        }
+        memcpy(maze->maze, data + MAZE_HEADER_LEN, maze->size);
+        return MAZE_ENCODING_RAW;
+    }
+    if (len > MAZE_HEADER_LEN && data[MAZE_HEADER_LEN] == MAZE_ENCODING_PACKED) {
+        if (decode_packed(maze, data + MAZE_HEADER_LEN, len - MAZE_HEADER_LEN) < 0) {
+            free(maze->maze);
+            maze->maze = NULL;
+            return -1;
+        }
+        return MAZE_ENCODING_PACKED;
+    }
+    fprintf(stderr, "mazeDecode: Message of %u bytes has an unknown encoding for %u squares.\n",
+            len, maze->size);
+    return -1;
+}
+
+uint32_t mazePathEncodedBound(const MazePath* path)
+{
+    return MAZE_HEADER_LEN + 1 + sizeof(uint32_t) + (path->steps + 3) / 4;
+}
+
+/**
+ * @brief Writes the header of maze and path as a solution for the wire.
+ *
+ * The steps are copied as they are, since MazePath already keeps them
+ * in the order and with the two bits of the wire; only the unused bits
+ * of the last byte are cleared.
+ */
+int mazeEncodePath(const struct Maze* maze, const MazePath* path, uint8_t* out, uint32_t cap)
+{
+    if (!maze || !path || !out || cap < mazePathEncodedBound(path) ||
+        (path->steps > 0 && !path->dirs)) {
+        fprintf(stderr, "mazeEncodePath: Invalid path or output buffer too small.\n");
+        return -1;
+    }
+    if (path->startX != maze->startX || path->startY != maze->startY) {
+        fprintf(stderr, "mazeEncodePath: The path does not begin at the start of the maze.\n");
+        return -1;
+    }
+
+    uint32_t bytes = (path->steps + 3) / 4;
+    uint32_t steps = htonl(path->steps);
+    uint8_t* p     = out + MAZE_HEADER_LEN;
+
+    put_header(out, maze);
+    *p++ = MAZE_ENCODING_PATH;
+    memcpy(p, &steps, sizeof(steps));
+    p += sizeof(steps);
+    if (bytes > 0) {
+        memcpy(p, path->dirs, bytes);
+        if (path->steps % 4) { // Ubrukte bit i siste byte er 0 paa linja
+            p[bytes - 1] &= (uint8_t)((1u << (path->steps % 4 * 2)) - 1);
+        }
+    }
+    return (int)mazePathEncodedBound(path);
+}
+
+/**
+ * @brief Reads a solution that mazeEncodePath wrote.
+ *
+ * The length must match the number of steps exactly, and a path of
+ * at least as many steps as the maze has squares would have to come
+ * back to a square, so it is refused before anything is allocated. The
+ * steps are allocated with malloc and belong to the caller.
+ */
+int mazeDecodePath(struct Maze* maze, MazePath* path, const uint8_t* data, uint32_t len)
+{
+    maze->maze  = NULL;
+    path->steps = 0;
+    path->dirs  = NULL;
+    if (len < MAZE_HEADER_LEN + 1 + sizeof(uint32_t) || data[MAZE_HEADER_LEN] != MAZE_ENCODING_PATH) {
+        fprintf(stderr, "mazeDecodePath: Message of %u bytes is not a path.\n", len);
+        return -1;
+    }
+
+    uint32_t steps;
+    get_header(maze, data);
+    memcpy(&steps, data + MAZE_HEADER_LEN + 1, sizeof(steps));
+    steps = ntohl(steps);
+
+    uint32_t bytes = (uint32_t)(((uint64_t)steps + 3) / 4);
+    if (steps >= maze->size || len != MAZE_HEADER_LEN + 1 + sizeof(uint32_t) + bytes) {
+        fprintf(stderr, "mazeDecodePath: Message of %u bytes does not hold a path of %u steps in %u squares.\n",
+                len, steps, maze->size);
+        return -1;
+    }
+    const uint8_t* p = data + MAZE_HEADER_LEN + 1 + sizeof(uint32_t);
+    if (steps % 4 && (p[bytes - 1] >> (steps % 4 * 2)) != 0) {
+        fprintf(stderr, "mazeDecodePath: Unused bits after the last step are set.\n");
+        return -1;
+    }
+
+    path->dirs = (uint8_t*)malloc(bytes ? bytes : 1);
+    if (!path->dirs) {
+        perror("mazeDecodePath: Could not allocate the path");
+        return -1;
+    }
+    memcpy(path->dirs, p, bytes);
+    path->startX = maze->startX;
+    path->startY = maze->startY;
+    path->steps  = steps;
+    return MAZE_ENCODING_PATH;
+}
+
+void mazePathFree(MazePath* path)
+{
+    if (path) {
+        free(path->dirs);
+        path->dirs  = NULL;
+        path->steps = 0;
+    }
+}
+
+/* Pakker griddet etter headeren: en byte med kodingen, to bit per rute
+ * (hoeyre og ned) rad for rad, og lengdene paa rekkene av umerkede og
+ * merkede ruter. Med SSE2 tas 16 ruter om gangen, og movemask henter en
+ * bit fra hver; ellers leses 8 ruter som ett ord og bitene samles med en
+ * multiplikasjon. Returnerer antall bytes, eller -1 hvis veggene ikke
+ * kan gjenskapes fra hoeyre og ned, eller resultatet blir lengre enn
+ * limit.
+ */
+static int64_t encode_packed(const struct Maze* maze, uint8_t* out, uint64_t limit)
+{
+    uint32_t       edge   = maze->edgeLen;
+    uint32_t       stride = (edge + 3) / 4;
+    const uint8_t* grid   = (const uint8_t*)maze->maze;
+
+    if (1 + (uint64_t)stride * edge + VARINT_MAX > limit) {
+        return -1;
+    }
+    out[0] = MAZE_ENCODING_PACKED;
+
+    RunWriter runs = { out + 1 + (uint64_t)stride * edge, out + limit, 0, 0 };
+    uint64_t  bad  = 0; // Bit som ikke stemmer med naboen eller ikke kan pakkes
+#ifdef __SSE2__
+    __m128i   bad_v = _mm_setzero_si128();
+#endif
+
+    for (uint32_t y = 0; y < edge; ++y) {
+        const uint8_t* row    = grid + (size_t)y * edge;
+        uint8_t*       dst    = out + 1 + (size_t)y * stride;
+        uint32_t       x      = 0;
+        uint64_t       bottom = y + 1 == edge ? ~(uint64_t)0 : 0; // Nederste rad har ingen down
+#ifdef __SSE2__
+        const __m128i other = _mm_set1_epi8((char)(bottom ? 0x81 | down : 0x81));
+        __m128i       prev  = _mm_setzero_si128(); // Ruten foer, i byte 15
+        for (; x + 16 <= edge; x += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+            __m128i a = y > 0 ? _mm_loadu_si128((const __m128i*)(row + x - edge)) : _mm_setzero_si128();
+            __m128i w = _mm_or_si128(_mm_slli_si128(v, 1), _mm_srli_si128(prev, 15));
+
+            // left er right til ruten foer, up er down til ruten over
+            __m128i wrong = _mm_and_si128(_mm_xor_si128(v, _mm_srli_epi16(w, 1)), _mm_set1_epi8(left));
+            wrong = _mm_or_si128(wrong, _mm_and_si128(_mm_xor_si128(v, _mm_srli_epi16(a, 1)), _mm_set1_epi8(up)));
+            wrong = _mm_or_si128(wrong, _mm_and_si128(v, other));
+            bad_v = _mm_or_si128(bad_v, wrong);
+            prev  = v;
+
+            uint32_t r = (uint32_t)_mm_movemask_epi8(_mm_slli_epi16(v, 5));
+            uint32_t d = (uint32_t)_mm_movemask_epi8(_mm_slli_epi16(v, 3));
+            uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_slli_epi16(v, 1));
+            dst[0] = (uint8_t)r;
+            dst[1] = (uint8_t)d;
+            dst[2] = (uint8_t)(r >> 8);
+            dst[3] = (uint8_t)(d >> 8);
+            dst += 4;
+            if (m == (runs.state ? 0xFFFF : 0)) {
+                runs.run += 16;
+            } else if (put_marks(&runs, m, 16) < 0) {
+                return -1;
+            }
+        }
+#endif
+        uint64_t carry = x > 0 ? row[x - 1] : 0;
+        for (; x < edge; x += 8) {
+            uint32_t n     = edge - x < 8 ? edge - x : 8;
+            uint64_t w     = load_squares(row + x, n);
+            uint64_t above = y > 0 ? load_squares(row + x - edge, n) : 0;
+
+            bad |= ((w >> 1) ^ (((w << 8) | carry) >> 2)) & ONES;
+            bad |= ((w >> 3) ^ (above >> 4)) & ONES;
+            bad |= (w >> 4) & ONES & bottom;
+            bad |= w & OTHER_BITS;
+            carry = w >> 56;
+
+            uint64_t open_right = gather((w >> 2) & ONES);
+            uint64_t open_down  = gather((w >> 4) & ONES);
+            if (n > 4) {
+                dst[0] = (uint8_t)open_right;
+                dst[1] = (uint8_t)open_down;
+            } else {
+                dst[0] = (uint8_t)(open_right | (open_down << 4));
+            }
+            dst += 2;
+
+            uint64_t marks = (w >> 6) & ONES;
+            if (n == 8 && marks == (runs.state ? ONES : 0)) {
+                runs.run += 8;
+            } else if (put_marks(&runs, gather(marks), n) < 0) {
+                return -1;
+            }
+        }
+        bad |= row[edge - 1] & right;
+    }
+#ifdef __SSE2__
+    bad |= _mm_movemask_epi8(_mm_cmpeq_epi8(bad_v, _mm_setzero_si128())) ^ 0xFFFF;
+#endif
+    if (bad || runs.p + VARINT_MAX > runs.end) {
+        return -1;
+    }
+    runs.p = put_varint(runs.p, runs.run);
+    return runs.p - out;
+}
+
+/* Legger n ruter til rekkene, med mark for rute k i bit k av marks. En
+ * rekke slutter der merket skifter. Returnerer -1 naar det ikke er plass.
+ */
+static int put_marks(RunWriter* w, uint64_t marks, uint32_t n)
+{
+    uint64_t flips = (marks ^ ((marks << 1) | w->state)) & (((uint64_t)1 << n) - 1);
+    uint32_t at    = 0;
+    while (flips) {
+        uint32_t k = (uint32_t)__builtin_ctzll(flips);
+        if (w->p + VARINT_MAX > w->end) {
+            return -1;
+        }
+        w->p   = put_varint(w->p, w->run + k - at);
+        w->run = 0;
+        at     = k;
+        flips &= flips - 1;
+    }
+    w->state = (marks >> (n - 1)) & 1;
+    w->run  += n - at;
+    return 0;
+}
+
+/* Motsatt av encode_packed. left kommer fra ruten til venstre og up fra
+ * ruten over, som allerede er skrevet. Meldinger som aapner ut av
+ * griddet eller ikke gaar opp, avvises.
+ */
+static int decode_packed(struct Maze* maze, const uint8_t* data, uint32_t len)
+{
+    uint32_t edge   = maze->edgeLen;
+    uint32_t stride = (edge + 3) / 4;
+
+    if (edge == 0 || (uint64_t)edge * edge != maze->size || 1 + (uint64_t)stride * edge > len) {
+        fprintf(stderr, "mazeDecode: Packed grid does not fit %u squares per edge.\n", edge);
+        return -1;
+    }
+    maze->maze = (char*)malloc(maze->size);
+    if (!maze->maze) {
+        perror("mazeDecode: Could not allocate the grid");
+        return -1;
+    }
+
+    uint8_t* grid = (uint8_t*)maze->maze;
+    uint64_t bad  = 0;
+    for (uint32_t y = 0; y < edge; ++y) {
+        uint8_t*       row = grid + (size_t)y * edge;
+        const uint8_t* src = data + 1 + (size_t)y * stride;
+        uint32_t       x   = 0;
+#ifdef __SSE2__
+        __m128i prev = _mm_setzero_si128(); // right til ruten foer, i byte 15
+        for (; x + 16 <= edge; x += 16) {
+            __m128i open_right = expand(src[0] | (uint32_t)src[2] << 8, right);
+            __m128i open_down  = expand(src[1] | (uint32_t)src[3] << 8, down);
+            __m128i west       = _mm_or_si128(_mm_slli_si128(open_right, 1), _mm_srli_si128(prev, 15));
+            __m128i v          = _mm_or_si128(_mm_or_si128(open_right, open_down), _mm_srli_epi16(west, 1));
+            if (y > 0) {
+                __m128i a = _mm_loadu_si128((const __m128i*)(row + x - edge));
+                v = _mm_or_si128(v, _mm_srli_epi16(_mm_and_si128(a, _mm_set1_epi8(down)), 1));
+            }
+            _mm_storeu_si128((__m128i*)(row + x), v);
+            prev = open_right;
+            src += 4;
+        }
+#endif
+        uint64_t carry = x > 0 ? (row[x - 1] & right) >> 2 : 0;
+        for (; x < edge; x += 8) {
+            uint32_t n = edge - x < 8 ? edge - x : 8;
+            uint64_t open_right;
+            uint64_t open_down;
+            if (n > 4) {
+                open_right = spread(src[0]);
+                open_down  = spread(src[1]);
+            } else {
+                open_right = spread(src[0] & 15);
+                open_down  = spread(src[0] >> 4);
+            }
+            if (n < 8) { // Bitene etter raden teller ikke
+                open_right &= ((uint64_t)1 << (n * 8)) - 1;
+                open_down  &= ((uint64_t)1 << (n * 8)) - 1;
+            }
+            uint64_t w = (open_right << 2) | (open_down << 4) | (((open_right << 8) | carry) << 1);
+            if (y > 0) {
+                w |= (load_squares(row + x - edge, n) & (ONES << 4)) >> 1;
+            }
+            carry = open_right >> 56;
+            store_squares(row + x, w, n);
+            src += 2;
+        }
+        bad |= row[edge - 1] & right;
+    }
+    for (uint32_t x = 0; x < edge; ++x) {
+        bad |= grid[(size_t)(edge - 1) * edge + x] & down;
+    }
+    if (bad) {
+        fprintf(stderr, "mazeDecode: Packed grid is open past the edge.\n");
+        return -1;
+    }
+
+    // Rekker av umerkede og merkede ruter, til alle rutene er med
+    const uint8_t* p     = data + 1 + (size_t)stride * edge;
+    const uint8_t* end   = data + len;
+    uint64_t       i     = 0;
+    int            state = 0;
+    while (i < maze->size) {
+        uint64_t run;
+        if (p < end && *p < 0x80) { // Kort rekke, det vanlige
+            run = *p++;
+        } else if (get_varint(&p, end, &run) < 0) {
+            run = UINT64_MAX;
+        }
+        if (run > maze->size - i) {
+            fprintf(stderr, "mazeDecode: Packed marks are cut off or too long.\n");
+            return -1;
+        }
+        if (state) {
+            for (uint64_t k = i; k < i + run; ++k) {
+                grid[k] |= mark;
+            }
+        }
+        i     += run;
+        state ^= 1;
+    }
+    if (p != end) {
+        fprintf(stderr, "mazeDecode: %ld bytes after the packed marks.\n", (long)(end - p));
+        return -1;
+    }
+    return 0;
+}
+
+static void put_header(uint8_t* out, const struct Maze* maze)
+{
+    uint32_t header[6];
+    header[0] = htonl(maze->edgeLen);
+    header[1] = htonl(maze->size);
+    header[2] = htonl(maze->startX);
+    header[3] = htonl(maze->startY);
+    header[4] = htonl(maze->endX);
+    header[5] = htonl(maze->endY);
+    memcpy(out, header, MAZE_HEADER_LEN);
+}
+
+static void get_header(struct Maze* maze, const uint8_t* data)
+{
+    uint32_t header[6];
+    memcpy(header, data, MAZE_HEADER_LEN);
+    maze->edgeLen = ntohl(header[0]);
+    maze->size    = ntohl(header[1]);
+    maze->startX  = ntohl(header[2]);
+    maze->startY  = ntohl(header[3]);
+    maze->endX    = ntohl(header[4]);
+    maze->endY    = ntohl(header[5]);
+}
+
+/* n ruter (hoeyst 8) som et ord, rute k i byte k, resten 0. */
+static uint64_t load_squares(const uint8_t* p, uint32_t n)
+{
+    uint64_t w = 0;
+    if (n == 8) {
+        memcpy(&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        return w;
+    }
+    for (uint32_t k = 0; k < n; ++k) {
+        w |= (uint64_t)p[k] << (k * 8);
+    }
+    return w;
+}
+
+static void store_squares(uint8_t* p, uint64_t w, uint32_t n)
+{
+    if (n == 8) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        memcpy(p, &w, 8);
+        return;
+    }
+    for (uint32_t k = 0; k < n; ++k) {
+        p[k] = (uint8_t)(w >> (k * 8));
+    }
+}
+
+/* Bit 0 av de 8 bytene i w til bit 0..7: byte k flyttes 56 - 7k opp, saa
+ * bitene havner i den oeverste byten uten aa overlappe.
+ */
+static uint64_t gather(uint64_t w)
+{
+    return (w * 0x0102040810204080ULL) >> 56;
+}
+
+/* Motsatt av gather: bit k av bits i bit 0 av byte k. Hver byte faar en
+ * kopi, beholder bit k, og +0x7f flytter den til bit 7.
+ */
+static uint64_t spread(uint64_t bits)
+{
+    uint64_t t = (bits * ONES) & 0x8040201008040201ULL;
+    return ((t + 0x7F7F7F7F7F7F7F7FULL) >> 7) & ONES;
+}
+
+#ifdef __SSE2__
+/* Bit k av 16 bits blir byte k: square hvis biten er satt, ellers 0. */
+static __m128i expand(uint32_t bits, int square)
+{
+    const __m128i select = _mm_set_epi8((char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1,
+                                        (char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1);
+    __m128i v = _mm_cvtsi32_si128((int)bits);
+    v = _mm_unpacklo_epi8(v, v);  // lo lo hi hi
+    v = _mm_unpacklo_epi16(v, v); // lo x4, hi x4
+    v = _mm_unpacklo_epi32(v, v); // lo x8, hi x8
+    v = _mm_cmpeq_epi8(_mm_and_si128(v, select), select);
+    return _mm_and_si128(v, _mm_set1_epi8((char)square));
+}
+#endif
+
+/* LEB128: 7 bit per byte, hoeyeste bit satt naar flere foelger. */
+static uint8_t* put_varint(uint8_t* p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static int get_varint(const uint8_t** p, const uint8_t* end, uint64_t* v)
+{
+    const uint8_t* q = *p;
+    uint64_t       r = 0;
+    for (int shift = 0; shift < 7 * VARINT_MAX; shift += 7) {
+        if (q == end) {
+            return -1;
+        }
+        uint8_t b = *q++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *p = q;
+            *v = r;
+            return 0;
+        }
+    }
+    return -1;
+}
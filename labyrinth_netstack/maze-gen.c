@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "maze.h"
+
+#define WALL_BITS ( left | right | up | down )
+
+// Funksjon deklarasjoner
+static uint64_t rng_next(uint64_t* state);
+static int      open_to(const struct Maze* maze, uint32_t index, int dir, uint32_t* next);
+static int      opposite(int dir);
+static int      same_header(const struct Maze* original, const struct Maze* solved);
+
+int mazeGenerate(struct Maze* maze, uint32_t edgeLen, uint64_t seed)
+{
+    if (!maze || edgeLen == 0 || edgeLen > MAZE_MAX_EDGE) {
+        fprintf(stderr, "mazeGenerate: Invalid arguments (edgeLen %u, max %d).\n", edgeLen, MAZE_MAX_EDGE);
+        return -1;
+    }
+
+    uint32_t  size  = edgeLen * edgeLen;
+    char*     grid  = (char*)calloc(size, 1);
+    uint32_t* stack = (uint32_t*)malloc((size_t)size * sizeof(uint32_t));
+    if (!grid || !stack) {
+        perror("mazeGenerate: Could not allocate the maze");
+        free(grid);
+        free(stack);
+        return -1;
+    }
+
+    uint64_t rng = seed * 0x9E3779B97F4A7C15ull + 0x2545F4914F6CDD1Dull; // Ikke 0, og naboseeds blir ulike
+    if (rng == 0) {
+        rng = 1;
+    }
+
+    // Iterativ randomisert DFS ("recursive backtracker"): gir en perfekt
+    // labyrint, med akkurat en vei mellom to ruter. En rute er besoekt
+    // naar den har minst en aapning, bortsett fra den foerste, som har
+    // tmark mens labyrinten bygges.
+    uint32_t top   = 0;
+    uint32_t first = (uint32_t)(rng_next(&rng) % size);
+    grid[first] |= tmark;
+    stack[top++] = first;
+    while (top > 0) {
+        uint32_t cur = stack[top - 1];
+        uint32_t x   = cur % edgeLen;
+        uint32_t y   = cur / edgeLen;
+
+        int      dirs[4];
+        uint32_t nexts[4];
+        int      n = 0;
+        if (x > 0           && !grid[cur - 1])       { dirs[n] = left;  nexts[n++] = cur - 1; }
+        if (x + 1 < edgeLen && !grid[cur + 1])       { dirs[n] = right; nexts[n++] = cur + 1; }
+        if (y > 0           && !grid[cur - edgeLen]) { dirs[n] = up;    nexts[n++] = cur - edgeLen; }
+        if (y + 1 < edgeLen && !grid[cur + edgeLen]) { dirs[n] = down;  nexts[n++] = cur + edgeLen; }
+
+        if (n == 0) { // Blindvei, gaa tilbake
+            top--;
+            continue;
+        }
+        int pick = (int)(rng_next(&rng) % (uint64_t)n);
+        grid[cur]         |= (char)dirs[pick];
+        grid[nexts[pick]] |= (char)opposite(dirs[pick]);
+        stack[top++] = nexts[pick];
+    }
+    grid[first] &= ~tmark;
+    free(stack);
+
+    maze->edgeLen = edgeLen;
+    maze->size    = size;
+    maze->startX  = (uint32_t)(rng_next(&rng) % edgeLen);
+    maze->startY  = (uint32_t)(rng_next(&rng) % edgeLen);
+    do { // Start og slutt er ulike ruter saa sant det finnes mer enn en
+        maze->endX = (uint32_t)(rng_next(&rng) % edgeLen);
+        maze->endY = (uint32_t)(rng_next(&rng) % edgeLen);
+    } while (size > 1 && maze->endX == maze->startX && maze->endY == maze->startY);
+    maze->maze = grid;
+    return 0;
+}
+
+int mazeVerify(const struct Maze* original, const struct Maze* solved)
+{
+    if (!original || !solved || !original->maze || !solved->maze) {
+        return MAZE_VERIFY_MISMATCH;
+    }
+    if (!same_header(original, solved)) {
+        return MAZE_VERIFY_MISMATCH;
+    }
+
+    uint32_t marked = 0;
+    for (uint32_t i = 0; i < original->size; i++) { // Veggene maa vaere de samme, bare merkene er nye
+        if ((solved->maze[i] & WALL_BITS) != (original->maze[i] & WALL_BITS)) {
+            return MAZE_VERIFY_MISMATCH;
+        }
+        if (solved->maze[i] & mark) {
+            marked++;
+        }
+    }
+
+    // Foelg de merkede rutene fra start. Hver rute paa veien har akkurat
+    // en merket nabo vi ikke kom fra; flere betyr en merket blindvei.
+    uint32_t end   = original->endY * original->edgeLen + original->endX;
+    uint32_t cur   = original->startY * original->edgeLen + original->startX;
+    uint32_t prev  = cur;
+    uint32_t steps = 1;
+    if (!(solved->maze[cur] & mark)) {
+        return MAZE_VERIFY_NO_PATH;
+    }
+    while (cur != end) {
+        static const int dirs[4] = { left, right, up, down };
+        uint32_t found = 0;
+        uint32_t next  = cur;
+        for (int d = 0; d < 4; d++) {
+            uint32_t n;
+            if (open_to(solved, cur, dirs[d], &n) && n != prev && (solved->maze[n] & mark)) {
+                found++;
+                next = n;
+            }
+        }
+        if (found == 0) {
+            return MAZE_VERIFY_NO_PATH;
+        }
+        if (found > 1) {
+            return MAZE_VERIFY_EXTRA_MARKS;
+        }
+        prev = cur;
+        cur  = next;
+        if (++steps > marked) { // Kan ikke skje i en perfekt labyrint, men en sirkel skal ikke henge
+            return MAZE_VERIFY_EXTRA_MARKS;
+        }
+    }
+    return steps == marked ? MAZE_VERIFY_OK : MAZE_VERIFY_EXTRA_MARKS;
+}
+
+/**
+ * @brief Checks a solution that came back as a path.
+ *
+ * The steps are replayed on the walls of original, so only the squares
+ * on the path are read and no grid comes from the client. A bitmap of
+ * one bit per square catches a path that comes back to a square; it is
+ * what mazeVerify finds as a marked square with two marked neighbours.
+ */
+int mazeVerifyPath(const struct Maze* original, const struct Maze* solved, const MazePath* path)
+{
+    static const int walls[4] = { left, right, up, down }; // Etter MAZE_STEP_*, dir ^ 1 er motsatt
+
+    if (!original || !solved || !path || !original->maze || (path->steps > 0 && !path->dirs)) {
+        return MAZE_VERIFY_MISMATCH;
+    }
+    if (!same_header(original, solved)) {
+        return MAZE_VERIFY_MISMATCH;
+    }
+    if (path->startX != original->startX || path->startY != original->startY) {
+        return MAZE_VERIFY_NO_PATH;
+    }
+    if (path->steps >= original->size) { // Minst en rute maa komme to ganger
+        return MAZE_VERIFY_LOOP;
+    }
+
+    uint8_t* seen = (uint8_t*)calloc(original->size / 8 + 1, 1);
+    if (!seen) {
+        perror("mazeVerifyPath: Could not allocate the bitmap");
+        return MAZE_VERIFY_MISMATCH;
+    }
+
+    const char* grid   = original->maze;
+    uint32_t    edge   = original->edgeLen;
+    uint32_t    end    = original->endY * edge + original->endX;
+    uint32_t    x      = original->startX;
+    uint32_t    y      = original->startY;
+    uint32_t    cur    = y * edge + x;
+    int         result = MAZE_VERIFY_OK;
+    seen[cur / 8] |= (uint8_t)(1 << (cur % 8));
+    for (uint32_t i = 0; i < path->steps; i++) {
+        // x og y foelges med, saa et skritt ikke trenger en divisjon som i open_to
+        int dir = (path->dirs[i / 4] >> (i % 4 * 2)) & 3;
+        x += (dir == MAZE_STEP_RIGHT) - (dir == MAZE_STEP_LEFT);
+        y += (dir == MAZE_STEP_DOWN) - (dir == MAZE_STEP_UP);
+        uint32_t next = y * edge + x;
+        if (x >= edge || y >= edge || !(grid[cur] & walls[dir]) || !(grid[next] & walls[dir ^ 1])) { // Ut av griddet eller gjennom en vegg
+            result = MAZE_VERIFY_NO_PATH;
+            break;
+        }
+        if (seen[next / 8] & (1 << (next % 8))) {
+            result = MAZE_VERIFY_LOOP;
+            break;
+        }
+        seen[next / 8] |= (uint8_t)(1 << (next % 8));
+        cur = next;
+    }
+    free(seen);
+
+    if (result == MAZE_VERIFY_OK && cur != end) {
+        result = MAZE_VERIFY_NO_PATH;
+    }
+    return result;
+}
+
+const char* mazeVerifyString(int result)
+{
+    switch (result) {
+    case MAZE_VERIFY_OK:          return "correct";
+    case MAZE_VERIFY_MISMATCH:    return "not the maze that was sent";
+    case MAZE_VERIFY_NO_PATH:     return "marks do not connect start and end";
+    case MAZE_VERIFY_EXTRA_MARKS: return "squares off the path are marked";
+    case MAZE_VERIFY_LOOP:        return "the path comes back to a square";
+    default:                      return "unknown result";
+    }
+}
+
+/* xorshift64*, samme generator som i l2sap-impair.c. */
+static uint64_t rng_next(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+// Finner naboen i retning dir hvis veggen er aapen paa begge sider
+static int open_to(const struct Maze* maze, uint32_t index, int dir, uint32_t* next)
+{
+    uint32_t x = index % maze->edgeLen;
+    uint32_t y = index / maze->edgeLen;
+    if (!(maze->maze[index] & dir)) {
+        return 0;
+    }
+    switch (dir) {
+    case left:  if (x == 0) return 0;                 *next = index - 1;             break;
+    case right: if (x + 1 >= maze->edgeLen) return 0; *next = index + 1;             break;
+    case up:    if (y == 0) return 0;                 *next = index - maze->edgeLen; break;
+    default:    if (y + 1 >= maze->edgeLen) return 0; *next = index + maze->edgeLen; break;
+    }
+    return (maze->maze[*next] & opposite(dir)) != 0;
+}
+
+// Samme header som den som ble sendt
+static int same_header(const struct Maze* original, const struct Maze* solved)
+{
+    return solved->edgeLen == original->edgeLen && solved->size == original->size &&
+           solved->startX == original->startX && solved->startY == original->startY &&
+           solved->endX == original->endX && solved->endY == original->endY;
+}
+
+static int opposite(int dir)
+{
+    switch (dir) {
+    case left:  return right;
+    case right: return left;
+    case up:    return down;
+    default:    return up;
+    }
+}
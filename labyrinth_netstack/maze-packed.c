@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "maze.h"
+#include "maze-solve.h"
+#include "trace.h"
+
+/* Bitene til rute i i passages: aapen til hoeyre og aapen nedover. */
+#define OPEN_RIGHT( p, i )  ( ((p)->passages[(i) >> 5] >> (((i) & 31) * 2)) & 1 )
+#define OPEN_DOWN( p, i )   ( ((p)->passages[(i) >> 5] >> (((i) & 31) * 2 + 1)) & 1 )
+
+#define BIT_GET( bits, i )  ( ((bits)[(i) >> 6] >> ((i) & 63)) & 1 )
+#define BIT_SET( bits, i )  ( (bits)[(i) >> 6] |= (uint64_t)1 << ((i) & 63) )
+
+/* Rekkefoelgen naboene proeves i, den samme som i solve_bfs. */
+static const int try_order[4] = { DIR_UP, DIR_DOWN, DIR_LEFT, DIR_RIGHT };
+
+/* Bitene i struct Maze for DIR_*. */
+static const char dir_walls[4] = { left, right, up, down };
+
+// Funksjon deklarasjon
+static uint64_t words(uint64_t bits);
+static int      open_to(const MazePacked* p, uint64_t index, uint32_t x, uint32_t y, int dir);
+static uint64_t step_to(uint32_t edge, uint64_t index, uint32_t* x, uint32_t* y, int dir);
+static int      push(uint64_t** stack, uint64_t* cap, uint64_t depth, int k);
+static int      stack_get(const uint64_t* stack, uint64_t depth);
+static uint64_t shortcut(MazePacked* p, const uint64_t* stack, uint64_t depth);
+static int      dir_between(uint32_t fx, uint32_t fy, uint32_t tx, uint32_t ty);
+
+/**
+ * @brief Packs maze into two bits per square.
+ *
+ * left and up of a square are right and down of its neighbours, so
+ * only right and down are stored. A passage is open if either of the
+ * two squares has it open, as in dead-end filling, so a maze with walls
+ * that are open from one side only comes back with them open from
+ * both. tmark and mark go to the visited and path bitmaps.
+ */
+int mazePackedFromMaze(MazePacked* packed, const struct Maze* maze)
+{
+    if (maze_check(maze, "mazePackedFromMaze") < 0) {
+        return -1;
+    }
+
+    uint32_t edge = maze->edgeLen;
+    uint64_t n    = (uint64_t)edge * edge;
+
+    packed->edgeLen  = edge;
+    packed->startX   = maze->startX;
+    packed->startY   = maze->startY;
+    packed->endX     = maze->endX;
+    packed->endY     = maze->endY;
+    packed->passages = (uint64_t*)calloc(words(2 * n), sizeof(uint64_t));
+    packed->visited  = (uint64_t*)calloc(words(n), sizeof(uint64_t));
+    packed->path     = (uint64_t*)calloc(words(n), sizeof(uint64_t));
+    if (!packed->passages || !packed->visited || !packed->path) {
+        perror("mazePackedFromMaze: Could not allocate the bitmaps");
+        mazePackedFree(packed);
+        return -1;
+    }
+
+    // 64 ruter om gangen, saa hvert ord skrives en gang
+    const char* grid = maze->maze;
+    uint32_t    x    = 0;
+    uint32_t    y    = 0;
+    for (uint64_t base = 0; base < n; base += 64) {
+        uint64_t count   = n - base < 64 ? n - base : 64;
+        uint64_t pass[2] = { 0, 0 };
+        uint64_t reached = 0;
+        uint64_t onpath  = 0;
+        for (uint64_t k = 0; k < count; ++k) {
+            uint64_t i     = base + k;
+            uint8_t  walls = (uint8_t)grid[i];
+            uint8_t  east  = x + 1 < edge ? (uint8_t)grid[i + 1] : 0;    // Bare left brukes
+            uint8_t  south = y + 1 < edge ? (uint8_t)grid[i + edge] : 0; // Bare up brukes
+            uint64_t bits  = (uint64_t)((((walls & right) >> 2) | ((east & left) >> 1)) & (x + 1 < edge)) |
+                             (uint64_t)((((walls & down) >> 3) | ((south & up) >> 2)) & ((y + 1 < edge) << 1));
+            pass[k >> 5] |= bits << ((k & 31) * 2);
+            reached      |= (uint64_t)((walls & tmark) != 0) << k;
+            onpath       |= (uint64_t)((walls & mark) != 0) << k;
+            if (++x == edge) {
+                x = 0;
+                y++;
+            }
+        }
+        packed->passages[base >> 5] = pass[0];
+        if (count > 32) {
+            packed->passages[(base >> 5) + 1] = pass[1];
+        }
+        packed->visited[base >> 6] = reached;
+        packed->path[base >> 6]    = onpath;
+    }
+    return 0;
+}
+
+/**
+ * @brief Unpacks into the byte per square of struct Maze.
+ *
+ * maze->maze must have room for edgeLen * edgeLen squares. Every
+ * passage is open from both sides; visited becomes tmark and path
+ * becomes mark.
+ */
+void mazePackedToMaze(const MazePacked* packed, struct Maze* maze)
+{
+    uint32_t edge = packed->edgeLen;
+
+    maze->edgeLen = edge;
+    maze->size    = edge * edge;
+    maze->startX  = packed->startX;
+    maze->startY  = packed->startY;
+    maze->endX    = packed->endX;
+    maze->endY    = packed->endY;
+
+    uint64_t n    = (uint64_t)edge * edge;
+    uint32_t x    = 0;
+    uint32_t y    = 0;
+    int      west = 0; // Om ruten til venstre er aapen mot hoeyre
+    for (uint64_t base = 0; base < n; base += 64) {
+        uint64_t count   = n - base < 64 ? n - base : 64;
+        uint64_t reached = packed->visited[base >> 6];
+        uint64_t onpath  = packed->path[base >> 6];
+        for (uint64_t k = 0; k < count; ++k) {
+            uint64_t i      = base + k;
+            uint64_t bits   = packed->passages[i >> 5] >> ((i & 31) * 2);
+            char     square = 0;
+            if (bits & 1) {
+                square |= right;
+            }
+            if (bits & 2) {
+                square |= down;
+            }
+            if (west) {
+                square |= left;
+            }
+            if (y > 0 && OPEN_DOWN(packed, i - edge)) {
+                square |= up;
+            }
+            if ((reached >> k) & 1) {
+                square |= tmark;
+            }
+            if ((onpath >> k) & 1) {
+                square |= mark;
+            }
+            maze->maze[i] = square;
+            west = (int)(bits & 1);
+            if (++x == edge) {
+                x    = 0;
+                west = 0;
+                y++;
+            }
+        }
+    }
+}
+
+void mazePackedFree(MazePacked* packed)
+{
+    free(packed->passages);
+    free(packed->visited);
+    free(packed->path);
+    packed->passages = NULL;
+    packed->visited  = NULL;
+    packed->path     = NULL;
+}
+
+char mazePackedGet(const MazePacked* packed, uint32_t x, uint32_t y)
+{
+    uint64_t i      = (uint64_t)y * packed->edgeLen + x;
+    char     square = 0;
+
+    for (int dir = DIR_LEFT; dir <= DIR_DOWN; ++dir) {
+        if (open_to(packed, i, x, y, dir)) {
+            square |= dir_walls[dir];
+        }
+    }
+    if (BIT_GET(packed->visited, i)) {
+        square |= tmark;
+    }
+    if (BIT_GET(packed->path, i)) {
+        square |= mark;
+    }
+    return square;
+}
+
+/**
+ * @brief Marks a path from start to end in the path bitmap.
+ *
+ * Depth-first search with an explicit stack that holds, for every
+ * square on the current path, in which direction the next square was
+ * entered, in two bits. When a square has no more unvisited
+ * neighbours, the search steps back and tries the next direction of
+ * the square before. The stack is the path when the end is reached, so
+ * the search needs the visited bit of every square and two bits per
+ * square on the path instead of the 4 bytes per square of a BFS queue.
+ * Where the path passes next to itself, it is shortened afterwards. In
+ * a perfect maze the path is the one of mazeSolve; with loops it is not
+ * always the shortest.
+ */
+int64_t mazeSolvePacked(MazePacked* packed)
+{
+    return maze_solve_packed(packed, NULL);
+}
+
+/* mazeSolvePacked som ogsaa teller rutene som ble naadd. */
+int64_t maze_solve_packed(MazePacked* packed, uint64_t* visited)
+{
+    if (!packed || !packed->passages || !packed->visited || !packed->path || packed->edgeLen == 0) {
+        fprintf(stderr, "mazeSolvePacked: Invalid packed maze provided.\n");
+        return -1;
+    }
+    if (packed->startX >= packed->edgeLen || packed->startY >= packed->edgeLen ||
+        packed->endX >= packed->edgeLen || packed->endY >= packed->edgeLen) {
+        fprintf(stderr, "mazeSolvePacked: Start or End coordinates are out of bounds.\n");
+        return -1;
+    }
+
+    uint32_t  edge    = packed->edgeLen;
+    uint64_t  n       = (uint64_t)edge * edge;
+    uint64_t* stack   = NULL;
+    uint64_t  cap     = 0;
+    uint64_t  depth   = 0;
+    uint64_t  reached = 1;
+
+    memset(packed->visited, 0, words(n) * sizeof(uint64_t));
+    memset(packed->path, 0, words(n) * sizeof(uint64_t));
+
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_BEGIN, packed->startX, packed->startY, packed->endX, packed->endY, edge);
+
+    uint32_t x     = packed->startX;
+    uint32_t y     = packed->startY;
+    uint64_t index = (uint64_t)y * edge + x;
+    int      k     = 0; // Neste retning i try_order aa proeve fra denne ruten
+    int      found = 1;
+
+    BIT_SET(packed->visited, index);
+    while (x != packed->endX || y != packed->endY) {
+        while (k < 4) {
+            int dir = try_order[k];
+            if (open_to(packed, index, x, y, dir)) {
+                uint32_t nx = x, ny = y;
+                uint64_t next = step_to(edge, index, &nx, &ny, dir);
+                if (!BIT_GET(packed->visited, next)) {
+                    break;
+                }
+            }
+            k++;
+        }
+        if (k < 4) { // Gaar videre til en ny rute
+            if (push(&stack, &cap, depth, k) < 0) {
+                perror("mazeSolvePacked: Could not grow the stack");
+                free(stack);
+                return -1;
+            }
+            depth++;
+            index = step_to(edge, index, &x, &y, try_order[k]);
+            BIT_SET(packed->visited, index);
+            reached++;
+            k = 0;
+        } else if (depth == 0) { // Alt som kan naas er sett
+            found = 0;
+            break;
+        } else { // Tilbake, og videre med retningen etter den vi kom fra
+            depth--;
+            int back = stack_get(stack, depth);
+            index = step_to(edge, index, &x, &y, try_order[back] ^ 1);
+            k = back + 1;
+        }
+    }
+
+    int64_t length = 0;
+    if (found) { // Stabelen er stien fra start
+        x     = packed->startX;
+        y     = packed->startY;
+        index = (uint64_t)y * edge + x;
+        BIT_SET(packed->path, index);
+        for (uint64_t d = 0; d < depth; ++d) {
+            index = step_to(edge, index, &x, &y, try_order[stack_get(stack, d)]);
+            BIT_SET(packed->path, index);
+        }
+        length = (int64_t)shortcut(packed, stack, depth);
+    }
+    free(stack);
+
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_END, length > 0, (uint64_t)length);
+    if (visited) {
+        *visited = reached;
+    }
+    return length;
+}
+
+/* En sti fra DFS kan gaa forbi seg selv, med en aapen vei mellom to
+ * ruter paa stien som ikke kommer etter hverandre, og da godtar ikke
+ * mazeVerify den. Gaar stien paa stabelen fra start og hopper fra hver
+ * rute som beholdes til den siste ruten paa stien som er en aapen nabo;
+ * rutene imellom mister merket. Etter et hopp kan ingen tidligere rute
+ * vaere nabo, saa bare merkede naboer foran telles. Returnerer antall
+ * ruter som er igjen paa stien.
+ */
+static uint64_t shortcut(MazePacked* p, const uint64_t* stack, uint64_t depth)
+{
+    uint32_t edge  = p->edgeLen;
+    uint32_t cx    = p->startX; // Ruten som sist ble beholdt
+    uint32_t cy    = p->startY;
+    uint64_t cur   = (uint64_t)cy * edge + cx;
+    uint64_t prev  = cur;
+    uint32_t x     = cx;        // Ruten d paa stabelen
+    uint32_t y     = cy;
+    uint64_t index = cur;
+    uint64_t d     = 0;
+    uint64_t kept  = 1;
+
+    while (d < depth) {
+        int ahead = 0;
+        for (int dir = DIR_LEFT; dir <= DIR_DOWN; ++dir) {
+            if (open_to(p, cur, cx, cy, dir)) {
+                uint32_t nx = cx, ny = cy;
+                uint64_t next = step_to(edge, cur, &nx, &ny, dir);
+                if (next != prev && BIT_GET(p->path, next)) {
+                    ahead++;
+                }
+            }
+        }
+        for (int met = 0;;) {
+            index = step_to(edge, index, &x, &y, try_order[stack_get(stack, d++)]);
+            int dir = dir_between(cx, cy, x, y);
+            if (dir >= 0 && open_to(p, cur, cx, cy, dir) && ++met == ahead) {
+                break;
+            }
+            p->path[index >> 6] &= ~((uint64_t)1 << (index & 63));
+        }
+        prev = cur;
+        cur  = index;
+        cx   = x;
+        cy   = y;
+        kept++;
+    }
+    return kept;
+}
+
+/* Retningen fra (fx,fy) til nabo (tx,ty), eller -1 hvis de ikke er naboer. */
+static int dir_between(uint32_t fx, uint32_t fy, uint32_t tx, uint32_t ty)
+{
+    if (fy == ty) {
+        return tx + 1 == fx ? DIR_LEFT : fx + 1 == tx ? DIR_RIGHT : -1;
+    }
+    if (fx == tx) {
+        return ty + 1 == fy ? DIR_UP : fy + 1 == ty ? DIR_DOWN : -1;
+    }
+    return -1;
+}
+
+/* Retningen (indeks i try_order) paa plass depth i stabelen. */
+static int stack_get(const uint64_t* stack, uint64_t depth)
+{
+    return (int)((stack[depth >> 5] >> ((depth & 31) * 2)) & 3);
+}
+
+/* Antall 64-bits ord for bits biter. */
+static uint64_t words(uint64_t bits)
+{
+    return (bits + 63) / 64;
+}
+
+/* Om ruten index = (x,y) har en aapen vei i retning dir. */
+static int open_to(const MazePacked* p, uint64_t index, uint32_t x, uint32_t y, int dir)
+{
+    switch (dir) {
+    case DIR_LEFT:  return x > 0 && OPEN_RIGHT(p, index - 1);
+    case DIR_RIGHT: return x + 1 < p->edgeLen && OPEN_RIGHT(p, index);
+    case DIR_UP:    return y > 0 && OPEN_DOWN(p, index - p->edgeLen);
+    default:        return y + 1 < p->edgeLen && OPEN_DOWN(p, index);
+    }
+}
+
+/* Naboen i retning dir, og flytter (x,y) dit. */
+static uint64_t step_to(uint32_t edge, uint64_t index, uint32_t* x, uint32_t* y, int dir)
+{
+    switch (dir) {
+    case DIR_LEFT:  --*x; return index - 1;
+    case DIR_RIGHT: ++*x; return index + 1;
+    case DIR_UP:    --*y; return index - edge;
+    default:        ++*y; return index + edge;
+    }
+}
+
+/* Legger k i to biter paa plass depth i stabelen, som vokser ved behov.
+ * Returnerer 0, eller -1 hvis den ikke kunne vokse.
+ */
+static int push(uint64_t** stack, uint64_t* cap, uint64_t depth, int k)
+{
+    if (depth == *cap) {
+        uint64_t  grown = *cap ? *cap * 2 : 4096;
+        uint64_t* s     = (uint64_t*)realloc(*stack, words(2 * grown) * sizeof(uint64_t));
+        if (!s) {
+            return -1;
+        }
+        *stack = s;
+        *cap   = grown;
+    }
+    uint64_t* word  = &(*stack)[depth >> 5];
+    int       shift = (int)(depth & 31) * 2;
+    *word = (*word & ~((uint64_t)3 << shift)) | ((uint64_t)k << shift);
+    return 0;
+}
@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "maze.h"
+#include "maze-solve.h"
+#include "trace.h"
+
+/* En oppgave er et baand av hele rader med minst saa mange ruter. */
+#define TASK_SQUARES  16384
+
+/* Flere traader enn dette startes ikke, uansett hva som blir bedt om. */
+#define MAX_THREADS   64
+
+/* Tilstanden til en rute under fyllingen, en byte per rute: retningene
+ * (1 << DIR_*) der den er forbundet med en nabo i de fire nederste
+ * bitene, og hvor mange av disse naboene som ikke er fylt i de fire
+ * oeverste. Bare de oeverste endres, med atomisk subtraksjon.
+ */
+#define LINK_BITS   0x0f
+#define DEGREE_ONE  0x10
+
+/* Fasene som alle traadene gaar gjennom, hver over alle baandene. */
+#define PHASE_CLEAR  0
+#define PHASE_LINKS  1
+#define PHASE_FILL   2
+
+/* Oppgavene [lo,hi) som en traad ikke har tatt ennaa, i ett ord saa
+ * eieren kan ta fra lo og andre kan stjele fra hi med compare-and-swap.
+ */
+#define SPAN( lo, hi )  ( ((uint64_t)(lo) << 32) | (uint32_t)(hi) )
+#define SPAN_LO( s )    ( (uint32_t)((s) >> 32) )
+#define SPAN_HI( s )    ( (uint32_t)(s) )
+
+/* En stabel som vokser, for fyllingen i hver traad og BFS til slutt. */
+typedef struct Stack
+{
+    uint32_t* e;
+    uint32_t  count;
+    uint32_t  cap;
+} Stack;
+
+typedef struct Pool   Pool;
+typedef struct Worker Worker;
+
+struct Worker
+{
+    _Alignas(64) uint64_t span; // Egen cache-linje, den endres av andre traader
+    Pool*     pool;
+    int       id;
+    int       phase;
+    pthread_t thread;
+    Stack     stack;
+    uint32_t  filled;
+};
+
+struct Pool
+{
+    struct Maze* maze;
+    uint8_t*     state;
+    uint32_t     start;
+    uint32_t     end;
+    uint32_t     rows;  // Rader per oppgave
+    uint32_t     tasks;
+    int          threads;
+    int          error;
+    Worker*      workers;
+};
+
+// Funksjon deklarasjon
+static void     run_phase(Pool* pool, int phase);
+static void*    worker_main(void* arg);
+static int      take(Worker* w, uint32_t* task);
+static int      steal(Worker* w);
+static void     task_clear(Pool* pool, uint32_t begin, uint32_t end);
+static void     task_links(Pool* pool, uint32_t y0, uint32_t y1);
+static void     task_fill(Worker* w, uint32_t begin, uint32_t end);
+static uint32_t search(struct Maze* maze, Stack* queue);
+static uint32_t neighbour(uint32_t edge, uint32_t index, int dir);
+static int      stack_push(Stack* s, uint32_t index);
+
+/* Dead-end filling paa flere traader, fulgt av BFS gjennom det som er
+ * igjen. Baandene deles likt paa traadene, og en traad som er ferdig
+ * stjeler halvparten av det en annen har igjen. En fylt rute faar tmark
+ * med en atomisk or i griddet; naar en nabo faller til en forbindelse,
+ * fylles den av traaden som talte den ned, ogsaa i et annet baand.
+ * Fyllingen fjerner aldri en rute paa en enkel vei mellom to ruter som
+ * ikke er fylt, saa BFS-en gjennom resten ser rutene i samme rekkefoelge
+ * som mazeSolve og merker den samme stien. Returnerer lengden paa
+ * stien, 0 uten sti, eller -1.
+ */
+int maze_solve_parallel(struct Maze* maze, int threads, uint32_t* visited)
+{
+    if (maze_check(maze, "mazeSolveEx") < 0) {
+        return -1;
+    }
+
+    uint32_t edge = maze->edgeLen;
+    uint32_t n    = edge * edge;
+    Pool     pool;
+
+    pool.maze  = maze;
+    pool.start = maze->startY * edge + maze->startX;
+    pool.end   = maze->endY * edge + maze->endX;
+    pool.rows  = edge >= TASK_SQUARES ? 1 : (TASK_SQUARES + edge - 1) / edge;
+    pool.tasks = (edge + pool.rows - 1) / pool.rows;
+    pool.error = 0;
+
+    if (threads <= 0) { // En per CPU
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if ((uint32_t)threads > pool.tasks) { // Ingen traad uten oppgave
+        threads = (int)pool.tasks;
+    }
+    pool.threads = threads;
+
+    pool.state   = (uint8_t*)malloc(n);
+    pool.workers = (Worker*)aligned_alloc(64, (size_t)threads * sizeof(Worker));
+    if (!pool.state || !pool.workers) {
+        perror("mazeSolveEx: Could not allocate the parallel solver state");
+        free(pool.state);
+        free(pool.workers);
+        return -1;
+    }
+    memset(pool.workers, 0, (size_t)threads * sizeof(Worker));
+    for (int i = 0; i < threads; ++i) {
+        pool.workers[i].pool = &pool;
+        pool.workers[i].id   = i;
+    }
+
+    run_phase(&pool, PHASE_CLEAR);
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_BEGIN, maze->startX, maze->startY, maze->endX, maze->endY, maze->edgeLen);
+    run_phase(&pool, PHASE_LINKS);
+    run_phase(&pool, PHASE_FILL);
+
+    uint32_t filled = 0;
+    for (int i = 0; i < threads; ++i) {
+        filled += pool.workers[i].filled;
+        free(pool.workers[i].stack.e);
+    }
+    free(pool.workers);
+    free(pool.state);
+
+    Stack    queue  = { NULL, 0, 0 };
+    uint32_t length = 0;
+    if (!pool.error) {
+        length = search(maze, &queue);
+    }
+    for (uint32_t i = 0; i < queue.count; ++i) { // Bare BFS-en satte retningsbiter
+        maze->maze[queue.e[i]] &= ~PARENT_BITS;
+    }
+    free(queue.e);
+
+    if (pool.error || length == (uint32_t)-1) {
+        fprintf(stderr, "mazeSolveEx: Could not grow a stack of the parallel solver\n");
+        return -1;
+    }
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_END, length > 0, length);
+    *visited = filled + queue.count;
+    return (int)length;
+}
+
+/* Kjoerer en fase paa alle traadene og venter til den er ferdig. Hver
+ * traad faar sin del av baandene foer noen starter. Kan en traad ikke
+ * startes, blir delen dens stjaalet av de andre.
+ */
+static void run_phase(Pool* pool, int phase)
+{
+    for (int i = 0; i < pool->threads; ++i) {
+        Worker*  w  = &pool->workers[i];
+        uint32_t lo = (uint32_t)((uint64_t)pool->tasks * i / pool->threads);
+        uint32_t hi = (uint32_t)((uint64_t)pool->tasks * (i + 1) / pool->threads);
+        w->span  = SPAN(lo, hi);
+        w->phase = phase;
+    }
+
+    int started[MAX_THREADS] = { 0 };
+    for (int i = 1; i < pool->threads; ++i) {
+        started[i] = pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) == 0;
+    }
+    worker_main(&pool->workers[0]); // Den som kaller er traad 0
+    for (int i = 1; i < pool->threads; ++i) {
+        if (started[i]) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+    }
+}
+
+/* Tar oppgaver, og stjeler nye naar egne er oppbrukt, til alle er tatt. */
+static void* worker_main(void* arg)
+{
+    Worker*  w    = (Worker*)arg;
+    Pool*    pool = w->pool;
+    uint32_t edge = pool->maze->edgeLen;
+    uint32_t task;
+
+    while (take(w, &task) == 0 || (steal(w) == 0 && take(w, &task) == 0)) {
+        uint32_t y0 = task * pool->rows;
+        uint32_t y1 = y0 + pool->rows < edge ? y0 + pool->rows : edge;
+        switch (w->phase) {
+        case PHASE_CLEAR: task_clear(pool, y0 * edge, y1 * edge); break;
+        case PHASE_LINKS: task_links(pool, y0, y1);                break;
+        default:          task_fill(w, y0 * edge, y1 * edge);      break;
+        }
+    }
+    return NULL;
+}
+
+/* Tar den foerste oppgaven traaden har igjen. Returnerer 0, eller -1
+ * hvis den ikke har flere.
+ */
+static int take(Worker* w, uint32_t* task)
+{
+    uint64_t span = __atomic_load_n(&w->span, __ATOMIC_ACQUIRE);
+
+    while (SPAN_LO(span) < SPAN_HI(span)) {
+        if (__atomic_compare_exchange_n(&w->span, &span, SPAN(SPAN_LO(span) + 1, SPAN_HI(span)),
+                                        0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *task = SPAN_LO(span);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Flytter den siste halvparten av oppgavene til en annen traad over til
+ * w, som ikke har flere. Returnerer 0, eller -1 hvis ingen hadde noe
+ * igjen.
+ */
+static int steal(Worker* w)
+{
+    Pool* pool = w->pool;
+
+    for (int i = 1; i < pool->threads; ++i) {
+        Worker*  victim = &pool->workers[(w->id + i) % pool->threads];
+        uint64_t span   = __atomic_load_n(&victim->span, __ATOMIC_ACQUIRE);
+        while (SPAN_LO(span) < SPAN_HI(span)) {
+            uint32_t lo  = SPAN_LO(span);
+            uint32_t hi  = SPAN_HI(span);
+            uint32_t mid = hi - (hi - lo + 1) / 2;
+            if (__atomic_compare_exchange_n(&victim->span, &span, SPAN(lo, mid),
+                                            0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&w->span, SPAN(mid, hi), __ATOMIC_RELEASE);
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Fjerner en tidligere loesning fra rutene [begin,end), som mazeSolve. */
+static void task_clear(Pool* pool, uint32_t begin, uint32_t end)
+{
+    char* grid = pool->maze->maze;
+
+    for (uint32_t i = begin; i < end; ++i) {
+        grid[i] &= ~(mark | tmark | PARENT_BITS);
+    }
+}
+
+/* Forbindelsene til rutene i radene [y0,y1): en vei i en av retningene
+ * er nok, som i solve_deadend.
+ */
+static void task_links(Pool* pool, uint32_t y0, uint32_t y1)
+{
+    const char* grid = pool->maze->maze;
+    uint32_t    edge = pool->maze->edgeLen;
+
+    for (uint32_t y = y0; y < y1; ++y) {
+        for (uint32_t x = 0; x < edge; ++x) {
+            uint32_t i     = y * edge + x;
+            char     walls = grid[i];
+            int      links = 0;
+            if (x > 0 && ((walls & left) || (grid[i - 1] & right))) {
+                links |= 1 << DIR_LEFT;
+            }
+            if (x + 1 < edge && ((walls & right) || (grid[i + 1] & left))) {
+                links |= 1 << DIR_RIGHT;
+            }
+            if (y > 0 && ((walls & up) || (grid[i - edge] & down))) {
+                links |= 1 << DIR_UP;
+            }
+            if (y + 1 < edge && ((walls & down) || (grid[i + edge] & up))) {
+                links |= 1 << DIR_DOWN;
+            }
+            pool->state[i] = (uint8_t)(links | __builtin_popcount(links) * DEGREE_ONE);
+        }
+    }
+}
+
+/* Fyller blindveiene som begynner i rutene [begin,end). Om en rute var
+ * en blindvei fra starten, sier forbindelsene, ikke tallet som andre
+ * traader kan ha talt ned. En rute legges paa en stabel bare av den som
+ * teller den ned til en forbindelse, saa den fylles bare en gang.
+ */
+static void task_fill(Worker* w, uint32_t begin, uint32_t end)
+{
+    Pool*    pool  = w->pool;
+    char*    grid  = pool->maze->maze;
+    uint8_t* state = pool->state;
+    uint32_t edge  = pool->maze->edgeLen;
+    Stack*   stack = &w->stack;
+
+    for (uint32_t i = begin; i < end; ++i) {
+        int links = __atomic_load_n(&state[i], __ATOMIC_RELAXED) & LINK_BITS;
+        if (__builtin_popcount(links) > 1 || i == pool->start || i == pool->end) {
+            continue;
+        }
+        if (stack_push(stack, i) < 0) {
+            __atomic_store_n(&pool->error, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        while (stack->count > 0) {
+            uint32_t index = stack->e[--stack->count];
+            int      links = __atomic_load_n(&state[index], __ATOMIC_RELAXED) & LINK_BITS;
+            __atomic_fetch_or(&grid[index], tmark, __ATOMIC_RELAXED);
+            w->filled++;
+            for (int dir = DIR_LEFT; dir <= DIR_DOWN; ++dir) {
+                if (!(links & (1 << dir))) {
+                    continue;
+                }
+                uint32_t next = neighbour(edge, index, dir);
+                if (__atomic_sub_fetch(&state[next], DEGREE_ONE, __ATOMIC_RELAXED) / DEGREE_ONE == 1 &&
+                    next != pool->start && next != pool->end && stack_push(stack, next) < 0) {
+                    __atomic_store_n(&pool->error, 1, __ATOMIC_RELAXED);
+                    return;
+                }
+            }
+        }
+    }
+}
+
+/* BFS fra start gjennom rutene uten tmark, med naboene i samme
+ * rekkefoelge som solve_bfs i maze.c. Returnerer lengden paa stien, 0
+ * uten sti, eller (uint32_t)-1 hvis koeen ikke kunne vokse.
+ */
+static uint32_t search(struct Maze* maze, Stack* queue)
+{
+    char*    grid  = maze->maze;
+    uint32_t edge  = maze->edgeLen;
+    uint32_t start = maze->startY * edge + maze->startX;
+    uint32_t end   = maze->endY * edge + maze->endX;
+    uint32_t head  = 0;
+
+    grid[start] |= tmark;
+    if (stack_push(queue, start) < 0) {
+        return (uint32_t)-1;
+    }
+    while (head < queue->count && !(grid[end] & tmark)) {
+        uint32_t index = queue->e[head++];
+        uint32_t x     = index % edge;
+        uint32_t y     = index / edge;
+        char     walls = grid[index];
+        uint32_t next[4];
+        int      dirs[4];
+        int      count = 0;
+
+        if ((walls & up) && y > 0) {
+            next[count] = index - edge;
+            dirs[count++] = DIR_DOWN;
+        }
+        if ((walls & down) && y + 1 < edge) {
+            next[count] = index + edge;
+            dirs[count++] = DIR_UP;
+        }
+        if ((walls & left) && x > 0) {
+            next[count] = index - 1;
+            dirs[count++] = DIR_RIGHT;
+        }
+        if ((walls & right) && x + 1 < edge) {
+            next[count] = index + 1;
+            dirs[count++] = DIR_LEFT;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (grid[next[i]] & tmark) {
+                continue;
+            }
+            if (stack_push(queue, next[i]) < 0) {
+                return (uint32_t)-1;
+            }
+            grid[next[i]] |= tmark | PARENT_FOR(dirs[i]);
+        }
+    }
+
+    if (!(grid[end] & tmark)) { // Slutten ble aldri naadd
+        return 0;
+    }
+    return maze_mark_path(maze, end, start);
+}
+
+/* Naboen i retning dir, som maa vaere i griddet. */
+static uint32_t neighbour(uint32_t edge, uint32_t index, int dir)
+{
+    switch (dir) {
+    case DIR_LEFT:  return index - 1;
+    case DIR_RIGHT: return index + 1;
+    case DIR_UP:    return index - edge;
+    default:        return index + edge;
+    }
+}
+
+/* Returnerer 0, eller -1 hvis stabelen ikke kunne vokse. */
+static int stack_push(Stack* s, uint32_t index)
+{
+    if (s->count == s->cap) {
+        uint32_t  cap = s->cap ? s->cap * 2 : 1024;
+        uint32_t* e   = (uint32_t*)realloc(s->e, (size_t)cap * sizeof(uint32_t));
+        if (!e) {
+            return -1;
+        }
+        s->e   = e;
+        s->cap = cap;
+    }
+    s->e[s->count++] = index;
+    return 0;
+}
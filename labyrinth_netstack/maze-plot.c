@@ -1,51 +1,58 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "maze.h"
 
 void mazePlot( const struct Maze* maze )
+{
+    mazePlotFile( maze, stdout );
+}
+
+void mazePlotFile( const struct Maze* maze, FILE* f )
 {
     int gridLen = maze->edgeLen * 2 + 1;
+    int lineLen = gridLen + 1; /* every line ends with its newline */
 
-    char* grid = malloc( gridLen * gridLen );
+    char* grid = malloc( (size_t)gridLen * lineLen );
+    if( grid == NULL )
+    {
+        fprintf( stderr, "%s: Could not allocate the plot\n", __FUNCTION__ );
+        return;
+    }
     for( int y=0; y<gridLen; y++ )
-        for( int x=0; x<gridLen; x++ )
-            grid[y*gridLen+x] = 'X';
+    {
+        memset( &grid[y*lineLen], 'X', gridLen );
+        grid[y*lineLen+gridLen] = '\n';
+    }
 
     for( int row=0; row<maze->edgeLen; row++ )
     {
         for( int col=0; col<maze->edgeLen; col++ )
         {
-            grid[ (row*2+1) * gridLen + (col*2+1) ] = ' ';
+            grid[ (row*2+1) * lineLen + (col*2+1) ] = ' ';
             char val = maze->maze[ row*maze->edgeLen + col ];
-            if( val & left  ) grid[ (row*2+1+0) * gridLen + (col*2+1-1) ] = ' ';
-            if( val & right ) grid[ (row*2+1+0) * gridLen + (col*2+1+1) ] = ' ';
-            if( val & up    ) grid[ (row*2+1-1) * gridLen + (col*2+1+0) ] = ' ';
-            if( val & down  ) grid[ (row*2+1+1) * gridLen + (col*2+1+0) ] = ' ';
+            if( val & left  ) grid[ (row*2+1+0) * lineLen + (col*2+1-1) ] = ' ';
+            if( val & right ) grid[ (row*2+1+0) * lineLen + (col*2+1+1) ] = ' ';
+            if( val & up    ) grid[ (row*2+1-1) * lineLen + (col*2+1+0) ] = ' ';
+            if( val & down  ) grid[ (row*2+1+1) * lineLen + (col*2+1+0) ] = ' ';
 
             if( val & mark  )
-                grid[ (row*2+1) * gridLen + (col*2+1) ] = 'o';
+                grid[ (row*2+1) * lineLen + (col*2+1) ] = 'o';
         }
     }
 
     int col = maze->startX;
     int row = maze->startY;
-    grid[ (row*2+1) * gridLen + (col*2+1) ] = 'A';
+    grid[ (row*2+1) * lineLen + (col*2+1) ] = 'A';
     col = maze->endX;
     row = maze->endY;
-    grid[ (row*2+1) * gridLen + (col*2+1) ] = 'B';
+    grid[ (row*2+1) * lineLen + (col*2+1) ] = 'B';
 
-    for( int y=0; y<gridLen; y++ )
-    {
-        for( int x=0; x<gridLen; x++ )
-        {
-            printf( "%c", grid[y*gridLen+x] );
-        }
-        printf( "\n" );
-    }
-    printf( "\n" );
+    /* One write for the whole plot instead of one printf per square. */
+    fwrite( grid, 1, (size_t)gridLen * lineLen, f );
+    fputc( '\n', f );
 
     free( grid );
 }
-
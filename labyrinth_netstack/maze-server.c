@@ -0,0 +1,393 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "l4sap-shard.h"
+#include "maze.h"
+
+/* Edge length of mazes that are asked for as messages (MAZE <seed> MSG),
+ * unless -e is given. A maze in one packet has an edge of 5..31, so
+ * that header and grid fit into L4Payloadsize.
+ */
+#define DEFAULT_MSG_EDGE 64
+#define MIN_EDGE         5
+#define MAX_PACKET_EDGE  31
+
+static volatile sig_atomic_t stop = 0;
+
+static int      verbose  = 0;
+static uint32_t msg_edge = DEFAULT_MSG_EDGE;
+
+/* Updated by all shards. */
+static unsigned long long mazes_sent      = 0;
+static unsigned long long solutions_ok    = 0;
+static unsigned long long solutions_wrong = 0;
+
+static void on_signal( int sig )
+{
+    (void)sig;
+    stop = 1;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-v] [-s shards] [-w window] [-e edge] <port>\n"
+                     "       -v        - print every maze and verdict, and the counters once per second\n"
+                     "       -s shards - server threads, all bound to the port with SO_REUSEPORT\n"
+                     "                   (default: number of CPUs)\n"
+                     "       -w window - use windowed L4 mode, 2..%d; the clients must use the same window\n"
+                     "       -e edge   - edge length of mazes sent as messages, %d..%d (default %d)\n"
+                     "       port      - The UDP port to serve on\n"
+                     "A client sends \"MAZE <seed>\" for a maze of 5..31 squares per edge in one\n"
+                     "packet, or \"MAZE <seed> MSG\" for a maze sent as an L4 message. The same\n"
+                     "seed always gives the same maze. With \" PACK\" at the end of the request, the\n"
+                     "maze is sent in the packed encoding. The solution that comes back, as a grid\n"
+                     "or as the path alone, is verified.\n"
+                     "Stop with Ctrl-C.\n",
+                     name, L4_MAX_WINDOW, MIN_EDGE, MAZE_MAX_EDGE, DEFAULT_MSG_EDGE );
+    exit( -1 );
+}
+
+/* What the server keeps for one client, in l4->user. */
+typedef struct Session Session;
+
+struct Session
+{
+    int      use_msg;
+
+    /* The client asked for MAZE_ENCODING_PACKED, so its solution may
+     * come packed as well.
+     */
+    int      use_pack;
+
+    /* The maze that was sent, while its solution is awaited. */
+    Maze     maze;
+    int      waiting;
+
+    /* The reply (header and grid) and how much of it has been handed
+     * to L4. In message mode it goes out in fragments, as far as the
+     * window allows, and continues on L4_EVENT_SENT.
+     */
+    uint8_t* out;
+    uint32_t out_len;
+    uint32_t out_off;
+
+    /* The solution, reassembled from fragments in message mode. */
+    uint8_t* in;
+    uint32_t in_len;
+    uint32_t in_got;
+};
+
+static void pump( L4SAP* l4, Session* s )
+{
+    uint8_t packet[L4Payloadsize];
+
+    while( s->out && s->out_off < s->out_len )
+    {
+        uint32_t chunk;
+        int      r;
+        if( s->use_msg )
+        {
+            L4MsgHeader hdr;
+            chunk = s->out_len - s->out_off;
+            if( chunk > (uint32_t)L4MsgFragsize ) chunk = L4MsgFragsize;
+            hdr.total_len = htonl( s->out_len );
+            hdr.offset    = htonl( s->out_off );
+            memcpy( packet, &hdr, L4MsgHeadersize );
+            memcpy( packet + L4MsgHeadersize, s->out + s->out_off, chunk );
+            r = l4sap_send_async( l4, packet, L4MsgHeadersize + chunk );
+        }
+        else
+        {
+            chunk = s->out_len;
+            r     = l4sap_send_async( l4, s->out, s->out_len );
+        }
+        if( r == L4_WOULDBLOCK ) return;
+        if( r < 0 )
+        {
+            fprintf( stderr, "%s: Sending the maze failed\n", __FUNCTION__ );
+            break;
+        }
+        s->out_off += chunk;
+    }
+    free( s->out );
+    s->out = NULL;
+}
+
+/* The L4 callback of every session. Packets are taken by the shard,
+ * so only the progress of the reply matters here.
+ */
+static void on_event( L4SAP* l4, int event, int value, void* user )
+{
+    (void)value;
+    if( event == L4_EVENT_SENT ) pump( l4, (Session*)user );
+}
+
+static void free_session( Session* s )
+{
+    free( s->maze.maze );
+    free( s->out );
+    free( s->in );
+    free( s );
+}
+
+/* Generate the maze for a request and start sending it. */
+static void request( L4SAP* l4, Session* s, const char* text )
+{
+    unsigned long long seed = strtoull( text + 5, NULL, 10 );
+    s->use_msg  = strstr( text, " MSG" ) != NULL;
+    s->use_pack = strstr( text, " PACK" ) != NULL;
+
+    free( s->maze.maze );
+    s->maze.maze = NULL;
+    s->waiting   = 0;
+    free( s->out );
+    s->out = NULL;
+
+    uint32_t edge = s->use_msg ? msg_edge : MIN_EDGE + (uint32_t)(seed % (MAX_PACKET_EDGE - MIN_EDGE + 1));
+    if( mazeGenerate( &s->maze, edge, seed ) < 0 ) return;
+
+    uint32_t cap = mazeEncodedBound( &s->maze );
+    s->out_off = 0;
+    s->out     = (uint8_t*)malloc( cap );
+    if( !s->out )
+    {
+        fprintf( stderr, "%s: Could not allocate the reply\n", __FUNCTION__ );
+        return;
+    }
+    int len = mazeEncode( &s->maze, s->use_pack ? MAZE_ENCODING_PACKED : MAZE_ENCODING_RAW, s->out, cap );
+    if( len < 0 )
+    {
+        free( s->out );
+        s->out = NULL;
+        return;
+    }
+    s->out_len = len;
+
+    if( verbose )
+    {
+        fprintf( stderr, "Maze %llu: %ux%u squares from (%u,%u) to (%u,%u) in %u bytes%s\n", seed, edge, edge,
+                 s->maze.startX, s->maze.startY, s->maze.endX, s->maze.endY, s->out_len,
+                 s->use_msg ? " as a message" : "" );
+    }
+    s->waiting = 1;
+    __atomic_add_fetch( &mazes_sent, 1, __ATOMIC_RELAXED );
+    pump( l4, s );
+}
+
+/* Check a complete solution of header and grid, or header and path.
+ * A raw grid is checked where it is; a packed one is decoded first. A
+ * path is replayed on the maze that was sent.
+ */
+static void verify( const uint8_t* data, uint32_t len, Session* s )
+{
+    int result = MAZE_VERIFY_MISMATCH;
+    if( len == MAZE_HEADER_LEN + s->maze.size )
+    {
+        const uint32_t* header = (const uint32_t*)data;
+        Maze solved;
+        solved.edgeLen = ntohl( header[0] );
+        solved.size    = ntohl( header[1] );
+        solved.startX  = ntohl( header[2] );
+        solved.startY  = ntohl( header[3] );
+        solved.endX    = ntohl( header[4] );
+        solved.endY    = ntohl( header[5] );
+        solved.maze    = (char*)data + MAZE_HEADER_LEN;
+        result = mazeVerify( &s->maze, &solved );
+    }
+    else if( data && len > MAZE_HEADER_LEN && data[MAZE_HEADER_LEN] == MAZE_ENCODING_PATH )
+    {
+        Maze     solved;
+        MazePath path;
+        if( mazeDecodePath( &solved, &path, data, len ) == MAZE_ENCODING_PATH )
+        {
+            result = mazeVerifyPath( &s->maze, &solved, &path );
+        }
+        mazePathFree( &path );
+    }
+    else if( s->use_pack && data )
+    {
+        Maze solved;
+        if( mazeDecode( &solved, data, len ) == MAZE_ENCODING_PACKED )
+        {
+            result = mazeVerify( &s->maze, &solved );
+        }
+        free( solved.maze );
+    }
+
+    if( result == MAZE_VERIFY_OK ) __atomic_add_fetch( &solutions_ok, 1, __ATOMIC_RELAXED );
+    else                           __atomic_add_fetch( &solutions_wrong, 1, __ATOMIC_RELAXED );
+    if( verbose || result != MAZE_VERIFY_OK )
+    {
+        fprintf( stderr, "Solution of %u bytes: %s\n", len, mazeVerifyString( result ) );
+    }
+
+    free( s->maze.maze );
+    s->maze.maze = NULL;
+    s->waiting   = 0;
+}
+
+/* Add one fragment of a solution in message mode. Fragments arrive in
+ * order, since L4 delivers in order; one with offset 0 starts over.
+ */
+static void fragment( const uint8_t* data, int len, Session* s )
+{
+    L4MsgHeader hdr;
+    if( len < L4MsgHeadersize ) return;
+    memcpy( &hdr, data, L4MsgHeadersize );
+    uint32_t total  = ntohl( hdr.total_len );
+    uint32_t offset = ntohl( hdr.offset );
+    uint32_t chunk  = len - L4MsgHeadersize;
+
+    if( offset == 0 )
+    {
+        if( total > MAZE_HEADER_LEN + s->maze.size ) total = 0; /* cannot be the solution */
+        free( s->in );
+        s->in     = total ? (uint8_t*)malloc( total ) : NULL;
+        s->in_len = total;
+        s->in_got = 0;
+        if( !s->in )
+        {
+            verify( NULL, 0, s );
+            return;
+        }
+    }
+    if( !s->in || total != s->in_len || offset != s->in_got || chunk > total - offset ) return;
+
+    memcpy( s->in + offset, data + L4MsgHeadersize, chunk );
+    s->in_got += chunk;
+    if( s->in_got == s->in_len )
+    {
+        verify( s->in, s->in_len, s );
+        free( s->in );
+        s->in = NULL;
+    }
+}
+
+/* Runs in the shard's thread for every packet of a session, and with
+ * data NULL when the session ends.
+ */
+static void handle( L4SAP* l4, const uint8_t* data, int len, void* user )
+{
+    (void)user;
+    Session* s = (Session*)l4->user;
+
+    if( !data )
+    {
+        if( s )
+        {
+            l4sap_set_callback( l4, NULL, NULL );
+            free_session( s );
+        }
+        return;
+    }
+    if( len == 5 && memcmp( data, "QUIT", 5 ) == 0 ) return;
+
+    if( !s )
+    {
+        s = (Session*)calloc( 1, sizeof(Session) );
+        if( !s )
+        {
+            fprintf( stderr, "%s: Could not allocate a session\n", __FUNCTION__ );
+            return;
+        }
+        l4sap_set_callback( l4, on_event, s );
+    }
+
+    /* A request is a short string; a solution starts with a binary
+     * header, whose first byte is 0 for every maze we send.
+     */
+    if( len > 5 && len < 64 && memcmp( data, "MAZE ", 5 ) == 0 && memchr( data, 0, len ) )
+    {
+        request( l4, s, (const char*)data );
+    }
+    else if( s->waiting && s->use_msg )
+    {
+        fragment( data, len, s );
+    }
+    else if( s->waiting )
+    {
+        verify( data, len, s );
+    }
+    else if( verbose )
+    {
+        fprintf( stderr, "%s: Unexpected packet of %d bytes\n", __FUNCTION__, len );
+    }
+}
+
+static void print_stats( const L4ShardServer* srv )
+{
+    L4ShardStats s;
+    l4shard_server_stats( srv, &s, NULL );
+    fprintf( stderr, "%llu mazes sent, %llu solutions correct, %llu wrong; "
+                     "%llu sessions open, %llu total, %llu failed sends, %llu L2 drops\n",
+             __atomic_load_n( &mazes_sent, __ATOMIC_RELAXED ),
+             __atomic_load_n( &solutions_ok, __ATOMIC_RELAXED ),
+             __atomic_load_n( &solutions_wrong, __ATOMIC_RELAXED ),
+             (unsigned long long)s.sessions_open, (unsigned long long)s.sessions_total,
+             (unsigned long long)s.send_failed, (unsigned long long)s.l2_drops );
+}
+
+int main( int argc, char *argv[] )
+{
+    L4ShardConfig config;
+    memset( &config, 0, sizeof(config) );
+
+    int opt;
+    while( (opt = getopt( argc, argv, "vs:w:e:" )) != -1 )
+    {
+        switch( opt )
+        {
+        case 'v' :
+            verbose = 1;
+            break;
+        case 's' :
+            config.shards = atoi( optarg );
+            if( config.shards < 1 ) usage( argv[0] );
+            break;
+        case 'w' :
+            config.window = atoi( optarg );
+            if( config.window < 2 || config.window > L4_MAX_WINDOW ) usage( argv[0] );
+            break;
+        case 'e' :
+            msg_edge = (uint32_t)atoi( optarg );
+            if( msg_edge < MIN_EDGE || msg_edge > MAZE_MAX_EDGE ) usage( argv[0] );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+    if( argc - optind != 1 ) usage( argv[0] );
+    int port = atoi( argv[optind] );
+
+    struct sigaction sa;
+    memset( &sa, 0, sizeof(sa) );
+    sa.sa_handler = on_signal;
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+
+    L4ShardServer* srv = l4shard_server_start( port, &config, handle, NULL );
+    if( !srv )
+    {
+        fprintf( stderr, "%s: Failed to start server on port %d\n", argv[0], port );
+        return -1;
+    }
+    fprintf( stderr, "%s: Serving port %d with %d shard(s)\n", argv[0], port, l4shard_server_shards( srv ) );
+
+    int ticks = 0;
+    while( !stop )
+    {
+        struct timespec tick = { 0, 100000000 };
+        nanosleep( &tick, NULL );
+        if( verbose && ++ticks % 10 == 0 ) print_stats( srv );
+    }
+
+    print_stats( srv );
+    l4shard_server_stop( srv );
+    return 0;
+}
@@ -0,0 +1,605 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "maze.h"
+#include "maze-solve.h"
+#include "trace.h"
+
+/* Bidireksjonal BFS bruker mark under soeket for aa vite hvilken side
+ * en naadd rute hoerer til. Stien merkes foerst naar soeket er ferdig.
+ */
+#define BACKWARD  mark
+
+/* Ruter som dead-end filling har fylt igjen. */
+#define FILLED    0xff
+
+/* Ruter som venter i A*, en stabel per verdi av f. */
+typedef struct Bucket
+{
+    uint32_t* e;
+    uint32_t  count;
+    uint32_t  cap;
+} Bucket;
+
+static const char* strategy_names[MAZE_STRATEGY_COUNT] = { "bfs", "bits", "astar", "bidir", "deadend", "parallel", "tiled", "packed" };
+
+// Funksjon deklarasjon
+static int      solve_astar(struct Maze* maze, uint32_t* visited);
+static int      solve_bidir(struct Maze* maze, uint32_t* visited);
+static int      solve_deadend(struct Maze* maze, uint32_t* visited);
+static int      solve_tiled(struct Maze* maze, uint32_t* visited);
+static int      solve_packed(struct Maze* maze, uint32_t* visited);
+static void     solve_begin(struct Maze* maze);
+static void     solve_end(struct Maze* maze, uint32_t length);
+static int      inside(uint32_t edge, uint32_t x, uint32_t y);
+static int      moves_out(const struct Maze* maze, uint32_t index);
+static int      moves_in(const struct Maze* maze, uint32_t index);
+static int      walls_out(char walls, int in);
+static int      walls_in(const struct Maze* maze, uint32_t index, int in);
+static uint32_t step(const struct Maze* maze, uint32_t index, int dir);
+static uint32_t distance(const struct Maze* maze, uint32_t index);
+static uint32_t path_edges(const struct Maze* maze, uint32_t from, uint32_t to);
+static int      bucket_push(Bucket* b, uint32_t index);
+
+/**
+ * @brief Solves the maze with the strategy in opts and reports what it cost.
+ *
+ * The strategies differ in how many squares they touch, which depends
+ * on the maze: A* goes straight for the end when the path is short and
+ * the maze is open, the bidirectional search touches about half the
+ * squares of a plain BFS when the frontier grows with the distance,
+ * and dead-end filling does not depend on where start and end are. The
+ * stats make it possible to choose from measurements.
+ */
+int mazeSolveEx(struct Maze* maze, const MazeSolveOptions* opts, MazeSolveStats* stats)
+{
+    int             strategy = opts ? opts->strategy : MAZE_STRATEGY_BFS;
+    uint32_t        visited  = 0;
+    int             length   = -1;
+    MazePath*       path     = opts ? opts->path : NULL;
+    struct timespec t0, t1;
+
+    if (path) {
+        path->steps = 0;
+        path->dirs  = NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    switch (strategy) {
+    case MAZE_STRATEGY_BFS:     length = maze_solve_bfs(maze, &visited, path); break;
+    case MAZE_STRATEGY_BITS:    length = maze_solve_bits(maze, &visited); break;
+    case MAZE_STRATEGY_ASTAR:   length = solve_astar(maze, &visited);     break;
+    case MAZE_STRATEGY_BIDIR:   length = solve_bidir(maze, &visited);     break;
+    case MAZE_STRATEGY_DEADEND: length = solve_deadend(maze, &visited);   break;
+    case MAZE_STRATEGY_PARALLEL:
+        length = maze_solve_parallel(maze, opts->threads, &visited);
+        break;
+    case MAZE_STRATEGY_TILED:   length = solve_tiled(maze, &visited);     break;
+    case MAZE_STRATEGY_PACKED:  length = solve_packed(maze, &visited);    break;
+    default:
+        fprintf(stderr, "mazeSolveEx: Unknown strategy %d.\n", strategy);
+        break;
+    }
+    if (path && length >= 0 && strategy != MAZE_STRATEGY_BFS && mazePathFromMarks(maze, path) < 0) {
+        length = -1; // BFS har skrevet stien selv, de andre har bare merket den
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (stats) {
+        stats->visited = visited;
+        stats->length  = length > 0 ? (uint32_t)length : 0;
+        stats->nsec    = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL + (uint64_t)t1.tv_nsec - (uint64_t)t0.tv_nsec;
+    }
+    return length;
+}
+
+const char* mazeStrategyName(int strategy)
+{
+    if (strategy < 0 || strategy >= MAZE_STRATEGY_COUNT) {
+        return "unknown";
+    }
+    return strategy_names[strategy];
+}
+
+int mazeStrategyParse(const char* name)
+{
+    for (int i = 0; name && i < MAZE_STRATEGY_COUNT; ++i) {
+        if (strcmp(name, strategy_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Reads the marked path of maze as steps from the start.
+ *
+ * For the strategies that only mark the path. The marks are followed
+ * from the start, through walls that are open on both sides, as
+ * mazeVerify does; the first walk counts the steps and the second
+ * writes them, so path->dirs is allocated once at its size.
+ */
+int mazePathFromMarks(const struct Maze* maze, MazePath* path)
+{
+    path->steps = 0;
+    path->dirs  = NULL;
+    if (maze_check(maze, "mazePathFromMarks") < 0) {
+        return -1;
+    }
+
+    uint32_t edge  = maze->edgeLen;
+    uint32_t start = maze->startY * edge + maze->startX;
+    uint32_t end   = maze->endY * edge + maze->endX;
+
+    path->startX = maze->startX;
+    path->startY = maze->startY;
+    if (!(maze->maze[start] & mark)) { // Ingen sti
+        return 0;
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        uint32_t index = start;
+        uint32_t steps = 0;
+        int      from  = -1; // Retningen tilbake, den foelges ikke
+        while (index != end) {
+            int open = moves_out(maze, index) & moves_in(maze, index);
+            int next = -1;
+            for (int dir = 0; dir < 4; ++dir) {
+                if ((open & (1 << dir)) && dir != from && (maze->maze[step(maze, index, dir)] & mark)) {
+                    next = next < 0 ? dir : 4; // 4: mer enn en merket nabo
+                }
+            }
+            if (next < 0 || next == 4 || steps + 1 >= maze->size) { // Ingen, flere, eller en sirkel
+                fprintf(stderr, "mazePathFromMarks: The marks are not one path from start to end.\n");
+                free(path->dirs);
+                path->dirs  = NULL;
+                path->steps = 0;
+                return -1;
+            }
+            if (pass == 1) {
+                path->dirs[steps / 4] |= (uint8_t)(next << (steps % 4 * 2));
+            }
+            steps++;
+            from  = next ^ 1;
+            index = step(maze, index, next);
+        }
+        if (pass == 0) {
+            path->dirs = (uint8_t*)calloc(steps / 4 + 1, 1);
+            if (!path->dirs) {
+                perror("mazePathFromMarks: Could not allocate the path");
+                return -1;
+            }
+        }
+        path->steps = steps;
+    }
+    return (int)(path->steps + 1);
+}
+
+/* A* med Manhattan-avstanden til slutten. Den er aldri for stor og
+ * endres med 1 per skritt, saa en rute er ferdig naar den tas ut, og
+ * stien er en korteste. Et skritt endrer f = g + h med 0 eller 2, saa
+ * i stedet for en heap holder to stabler rutene med f og med f + 2.
+ * Stabelen gjoer at den dypeste ruten med samme f gaar foerst. En rute
+ * kan bli lagt inn igjen med mindre g; den gamle oppfoeringen hoppes
+ * over fordi ruten da er ferdig.
+ */
+static int solve_astar(struct Maze* maze, uint32_t* visited)
+{
+    if (maze_check(maze, "mazeSolveEx") < 0) {
+        return -1;
+    }
+
+    char*     grid = maze->maze;
+    uint32_t  edge = maze->edgeLen;
+    uint32_t  n    = edge * edge;
+    uint32_t* g    = (uint32_t*)malloc((size_t)n * sizeof(uint32_t));
+    Bucket    now  = { NULL, 0, 0 };
+    Bucket    later = { NULL, 0, 0 };
+    if (!g) {
+        perror("mazeSolveEx: Could not allocate the A* state");
+        return -1;
+    }
+    memset(g, 0xff, (size_t)n * sizeof(uint32_t)); // UINT32_MAX er ikke naadd
+
+    solve_begin(maze);
+
+    uint32_t start = maze->startY * edge + maze->startX;
+    uint32_t end   = maze->endY * edge + maze->endX;
+    uint32_t f     = distance(maze, start);
+    int      error = bucket_push(&now, start);
+
+    g[start] = 0;
+    *visited = 1;
+    while (!error && !(grid[end] & tmark)) {
+        if (now.count == 0) { // Alle med denne f er ferdige
+            if (later.count == 0) {
+                break;
+            }
+            Bucket tmp = now; now = later; later = tmp;
+            f += 2;
+        }
+        uint32_t index = now.e[--now.count];
+        if (grid[index] & tmark) { // Gammel oppfoering
+            continue;
+        }
+        grid[index] |= tmark;
+
+        int out = moves_out(maze, index);
+        for (int dir = DIR_LEFT; dir <= DIR_DOWN && !error; ++dir) {
+            if (!(out & (1 << dir))) {
+                continue;
+            }
+            uint32_t next = step(maze, index, dir);
+            if ((grid[next] & tmark) || g[next] <= g[index] + 1) {
+                continue;
+            }
+            if (g[next] == UINT32_MAX) {
+                (*visited)++;
+            }
+            g[next]    = g[index] + 1;
+            grid[next] = (char)((grid[next] & ~PARENT_BITS) | PARENT_FOR(dir ^ 1));
+            error = bucket_push(g[next] + distance(maze, next) == f ? &now : &later, next);
+        }
+    }
+    if (error) {
+        perror("mazeSolveEx: Could not grow the A* queue");
+    }
+
+    uint32_t length = (!error && (grid[end] & tmark)) ? maze_mark_path(maze, end, start) : 0;
+
+    free(g);
+    free(now.e);
+    free(later.e);
+    solve_end(maze, length);
+    return error ? -1 : (int)length;
+}
+
+/* BFS fra begge ender, ett helt nivaa om gangen fra siden med minst
+ * front. Hver rute eies av siden som naadde den foerst; BACKWARD-biten
+ * sier hvilken, og PARENT-bitene peker mot start eller mot slutt.
+ * Bakover gaar soeket til naboer som kan gaa hit. Moetes sidene over en
+ * kant, regnes lengden ut ved aa gaa tilbake begge veier. Soeket
+ * stopper naar den beste stien er hoeyst dybdene til sammen pluss en,
+ * for en sti som ikke er funnet, maa gaa over en kant mellom to fronter.
+ * Koeen deles: fremover fra starten av tabellen, bakover fra slutten.
+ */
+static int solve_bidir(struct Maze* maze, uint32_t* visited)
+{
+    if (maze_check(maze, "mazeSolveEx") < 0) {
+        return -1;
+    }
+
+    char*     grid  = maze->maze;
+    uint32_t  edge  = maze->edgeLen;
+    uint32_t  n     = edge * edge;
+    uint32_t* queue = (uint32_t*)malloc((size_t)n * sizeof(uint32_t)); // Hver rute hoerer til en side
+    if (!queue) {
+        perror("mazeSolveEx: Could not allocate the BFS queue");
+        return -1;
+    }
+
+    solve_begin(maze);
+
+    uint32_t start  = maze->startY * edge + maze->startX;
+    uint32_t end    = maze->endY * edge + maze->endX;
+    uint32_t length = 0;
+
+    if (start == end) {
+        grid[start] |= tmark | mark;
+        *visited = 1;
+        free(queue);
+        solve_end(maze, 1);
+        return 1;
+    }
+
+    // Fremover: queue[fhead..ftail), bakover: queue[n-1-k] for k i [bhead..btail)
+    uint32_t fhead = 0, ftail = 0, bhead = 0, btail = 0;
+    uint32_t fdepth = 0, bdepth = 0;
+    uint32_t best = UINT32_MAX, meet_f = 0, meet_b = 0; // best er antall kanter
+
+    grid[start] |= tmark;
+    grid[end]   |= tmark | BACKWARD;
+    queue[ftail++]         = start;
+    queue[n - 1 - btail++] = end;
+
+    while (fhead < ftail && bhead < btail) {
+        if (ftail - fhead <= btail - bhead) {
+            uint32_t level_end = ftail;
+            while (fhead < level_end) {
+                uint32_t index = queue[fhead++];
+                int      out   = moves_out(maze, index);
+                for (int dir = DIR_LEFT; dir <= DIR_DOWN; ++dir) {
+                    if (!(out & (1 << dir))) {
+                        continue;
+                    }
+                    uint32_t next = step(maze, index, dir);
+                    if (!(grid[next] & tmark)) {
+                        grid[next] |= tmark | PARENT_FOR(dir ^ 1);
+                        queue[ftail++] = next;
+                    } else if (grid[next] & BACKWARD) { // Moetes
+                        uint32_t total = fdepth + 1 + path_edges(maze, next, end);
+                        if (total < best) {
+                            best = total; meet_f = index; meet_b = next;
+                        }
+                    }
+                }
+            }
+            fdepth++;
+        } else {
+            uint32_t level_end = btail;
+            while (bhead < level_end) {
+                uint32_t index = queue[n - 1 - bhead++];
+                int      in    = moves_in(maze, index);
+                for (int dir = DIR_LEFT; dir <= DIR_DOWN; ++dir) {
+                    if (!(in & (1 << dir))) {
+                        continue;
+                    }
+                    uint32_t prev = step(maze, index, dir);
+                    if (!(grid[prev] & tmark)) {
+                        grid[prev] |= tmark | BACKWARD | PARENT_FOR(dir ^ 1);
+                        queue[n - 1 - btail++] = prev;
+                    } else if (!(grid[prev] & BACKWARD)) { // Moetes
+                        uint32_t total = path_edges(maze, prev, start) + 1 + bdepth;
+                        if (total < best) {
+                            best = total; meet_f = prev; meet_b = index;
+                        }
+                    }
+                }
+            }
+            bdepth++;
+        }
+        if (best != UINT32_MAX && best <= fdepth + bdepth + 1) {
+            break;
+        }
+    }
+    *visited = ftail + btail;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        grid[i] &= ~BACKWARD; // Sidene trengs ikke mer, mark blir stien
+    }
+    if (best != UINT32_MAX) {
+        length = maze_mark_path(maze, meet_f, start) + maze_mark_path(maze, meet_b, end);
+    }
+
+    free(queue);
+    solve_end(maze, length);
+    return (int)length;
+}
+
+/* Fyller igjen blindveier: en rute som er forbundet med hoeyst en rute
+ * som ikke er fylt, i en av retningene, er en blindvei hvis den ikke er
+ * start eller slutt, og naar den fylles, kan naboen bli en. Hver rute
+ * legges paa stabelen hoeyst en gang. I en perfekt labyrint er bare
+ * stien igjen; med loekker er loekkene ogsaa igjen, saa stien finnes til
+ * slutt med BFS gjennom rutene som er igjen.
+ */
+static int solve_deadend(struct Maze* maze, uint32_t* visited)
+{
+    if (maze_check(maze, "mazeSolveEx") < 0) {
+        return -1;
+    }
+
+    char*     grid   = maze->maze;
+    uint32_t  edge   = maze->edgeLen;
+    uint32_t  n      = edge * edge;
+    uint8_t*  degree = (uint8_t*)malloc(n);
+    uint8_t*  links  = (uint8_t*)malloc(n);
+    uint32_t* stack  = (uint32_t*)malloc((size_t)n * sizeof(uint32_t));
+    if (!degree || !links || !stack) {
+        perror("mazeSolveEx: Could not allocate the dead-end state");
+        free(degree);
+        free(links);
+        free(stack);
+        return -1;
+    }
+
+    solve_begin(maze);
+
+    uint32_t start  = maze->startY * edge + maze->startX;
+    uint32_t end    = maze->endY * edge + maze->endX;
+    uint32_t top    = 0;
+    uint32_t filled = 0;
+
+    for (uint32_t y = 0; y < edge; ++y) {
+        for (uint32_t x = 0; x < edge; ++x) {
+            uint32_t i  = y * edge + x;
+            int      in = inside(edge, x, y);
+            links[i]  = (uint8_t)(walls_out(grid[i], in) | walls_in(maze, i, in));
+            degree[i] = (uint8_t)__builtin_popcount(links[i]);
+            if (degree[i] <= 1 && i != start && i != end) {
+                stack[top++] = i;
+            }
+        }
+    }
+    while (top > 0) {
+        uint32_t index = stack[--top];
+        degree[index] = FILLED;
+        filled++;
+        for (int dir = DIR_LEFT; dir <= DIR_DOWN; ++dir) {
+            if (!(links[index] & (1 << dir))) {
+                continue;
+            }
+            uint32_t next = step(maze, index, dir);
+            if (degree[next] != FILLED && --degree[next] == 1 && next != start && next != end) {
+                stack[top++] = next;
+            }
+        }
+    }
+
+    // BFS gjennom det som er igjen, med stabelen som koe
+    uint32_t head = 0, tail = 0;
+    grid[start] |= tmark;
+    stack[tail++] = start;
+    while (head < tail && !(grid[end] & tmark)) {
+        uint32_t index = stack[head++];
+        int      out   = moves_out(maze, index);
+        for (int dir = DIR_LEFT; dir <= DIR_DOWN; ++dir) {
+            if (!(out & (1 << dir))) {
+                continue;
+            }
+            uint32_t next = step(maze, index, dir);
+            if (degree[next] != FILLED && !(grid[next] & tmark)) {
+                grid[next] |= tmark | PARENT_FOR(dir ^ 1);
+                stack[tail++] = next;
+            }
+        }
+    }
+    *visited = filled + tail;
+
+    uint32_t length = (grid[end] & tmark) ? maze_mark_path(maze, end, start) : 0;
+
+    free(degree);
+    free(links);
+    free(stack);
+    solve_end(maze, length);
+    return (int)length;
+}
+
+/* Kopierer mazen inn i fliser, loeser den der og kopierer den tilbake,
+ * slik en mottaker av en stor maze fra nettet ville gjort.
+ */
+static int solve_tiled(struct Maze* maze, uint32_t* visited)
+{
+    MazeTiled tiled;
+
+    if (mazeTiledFromMaze(&tiled, maze) < 0) {
+        return -1;
+    }
+    int length = maze_solve_tiled(&tiled, visited);
+    if (length >= 0) {
+        mazeTiledToMaze(&tiled, maze);
+    }
+    mazeTiledFree(&tiled);
+    return length;
+}
+
+/* Pakker mazen, loeser den pakket og pakker den ut igjen. */
+static int solve_packed(struct Maze* maze, uint32_t* visited)
+{
+    MazePacked packed;
+    uint64_t   reached = 0;
+
+    if (mazePackedFromMaze(&packed, maze) < 0) {
+        return -1;
+    }
+    int length = (int)maze_solve_packed(&packed, &reached);
+    if (length >= 0) {
+        mazePackedToMaze(&packed, maze);
+    }
+    mazePackedFree(&packed);
+    *visited = (uint32_t)reached;
+    return length;
+}
+
+/* Fjerner en tidligere loesning, som mazeSolve. */
+static void solve_begin(struct Maze* maze)
+{
+    for (uint32_t i = 0; i < maze->size; ++i) {
+        maze->maze[i] &= ~(mark | tmark | PARENT_BITS);
+    }
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_BEGIN, maze->startX, maze->startY, maze->endX, maze->endY, maze->edgeLen);
+}
+
+/* Fjerner retningsbitene igjen, saa bare veggene, mark og tmark er igjen. */
+static void solve_end(struct Maze* maze, uint32_t length)
+{
+    for (uint32_t i = 0; i < maze->size; ++i) {
+        maze->maze[i] &= ~PARENT_BITS;
+    }
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_END, length > 0, length);
+}
+
+/* Retningene (bit 1 << DIR_*) der ruten (x,y) har en nabo i griddet. */
+static int inside(uint32_t edge, uint32_t x, uint32_t y)
+{
+    return (x > 0        ? 1 << DIR_LEFT  : 0) |
+           (x + 1 < edge ? 1 << DIR_RIGHT : 0) |
+           (y > 0        ? 1 << DIR_UP    : 0) |
+           (y + 1 < edge ? 1 << DIR_DOWN  : 0);
+}
+
+/* Retningene ruten index kan gaa i. */
+static int moves_out(const struct Maze* maze, uint32_t index)
+{
+    uint32_t edge = maze->edgeLen;
+    return walls_out(maze->maze[index], inside(edge, index % edge, index / edge));
+}
+
+/* Retningene der naboen kan gaa til ruten index. */
+static int moves_in(const struct Maze* maze, uint32_t index)
+{
+    uint32_t edge = maze->edgeLen;
+    return walls_in(maze, index, inside(edge, index % edge, index / edge));
+}
+
+/* Retningene i walls som er aapne, av dem i in. */
+static int walls_out(char walls, int in)
+{
+    return in & (((walls & left)  ? 1 << DIR_LEFT  : 0) |
+                 ((walls & right) ? 1 << DIR_RIGHT : 0) |
+                 ((walls & up)    ? 1 << DIR_UP    : 0) |
+                 ((walls & down)  ? 1 << DIR_DOWN  : 0));
+}
+
+/* Retningene, av dem i in, der naboen er aapen mot ruten index. */
+static int walls_in(const struct Maze* maze, uint32_t index, int in)
+{
+    const char* grid = maze->maze;
+    uint32_t    edge = maze->edgeLen;
+
+    return ((in & (1 << DIR_LEFT))  && (grid[index - 1] & right)   ? 1 << DIR_LEFT  : 0) |
+           ((in & (1 << DIR_RIGHT)) && (grid[index + 1] & left)    ? 1 << DIR_RIGHT : 0) |
+           ((in & (1 << DIR_UP))    && (grid[index - edge] & down) ? 1 << DIR_UP    : 0) |
+           ((in & (1 << DIR_DOWN))  && (grid[index + edge] & up)   ? 1 << DIR_DOWN  : 0);
+}
+
+/* Naboen i retning dir, som maa vaere i griddet. DIR_* ^ 1 er motsatt retning. */
+static uint32_t step(const struct Maze* maze, uint32_t index, int dir)
+{
+    switch (dir) {
+    case DIR_LEFT:  return index - 1;
+    case DIR_RIGHT: return index + 1;
+    case DIR_UP:    return index - maze->edgeLen;
+    default:        return index + maze->edgeLen;
+    }
+}
+
+/* Manhattan-avstanden fra ruten index til slutten. */
+static uint32_t distance(const struct Maze* maze, uint32_t index)
+{
+    uint32_t x  = index % maze->edgeLen;
+    uint32_t y  = index / maze->edgeLen;
+    uint32_t dx = x > maze->endX ? x - maze->endX : maze->endX - x;
+    uint32_t dy = y > maze->endY ? y - maze->endY : maze->endY - y;
+    return dx + dy;
+}
+
+/* Antall kanter fra from tilbake til to etter PARENT-bitene. */
+static uint32_t path_edges(const struct Maze* maze, uint32_t from, uint32_t to)
+{
+    uint32_t count = 0;
+
+    while (from != to) {
+        from = step(maze, from, PARENT_OF(maze->maze[from]));
+        count++;
+    }
+    return count;
+}
+
+/* Returnerer 0, eller -1 hvis stabelen ikke kunne vokse. */
+static int bucket_push(Bucket* b, uint32_t index)
+{
+    if (b->count == b->cap) {
+        uint32_t  cap = b->cap ? b->cap * 2 : 1024;
+        uint32_t* e   = (uint32_t*)realloc(b->e, (size_t)cap * sizeof(uint32_t));
+        if (!e) {
+            return -1;
+        }
+        b->e   = e;
+        b->cap = cap;
+    }
+    b->e[b->count++] = index;
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef MAZE_SOLVE_H
+#define MAZE_SOLVE_H
+
+#include "maze.h"
+
+/* Internal interface between the solvers in maze.c, maze-bits.c,
+ * maze-parallel.c, maze-tiled.c, maze-packed.c and maze-solve.c.
+ * Applications use the functions that are declared in maze.h.
+ */
+
+/* The direction from a square back to the square it was reached from,
+ * in the two bits of a square that the maze format leaves free: bit 0
+ * (below left) and bit 7 (above mark).
+ */
+#define PARENT_LO    ( 0x1 << 0 )
+#define PARENT_HI    ( 0x1 << 7 )
+#define PARENT_BITS  ( PARENT_LO | PARENT_HI )
+
+/* The same values as MAZE_STEP_*, so a direction is a step of MazePath. */
+#define DIR_LEFT   MAZE_STEP_LEFT
+#define DIR_RIGHT  MAZE_STEP_RIGHT
+#define DIR_UP     MAZE_STEP_UP
+#define DIR_DOWN   MAZE_STEP_DOWN
+
+/* The parent bits for dir, and the direction in the parent bits of cell. */
+#define PARENT_FOR( dir )  ( (((dir) & 1) ? PARENT_LO : 0) | (((dir) & 2) ? PARENT_HI : 0) )
+#define PARENT_OF( cell )  ( (((cell) & PARENT_LO) ? 1 : 0) | (((cell) & PARENT_HI) ? 2 : 0) )
+
+/* Print why maze cannot be solved, prefixed with caller, and return -1;
+ * return 0 if it can.
+ */
+int  maze_check( const struct Maze* maze, const char* caller );
+
+/* Follow the parent directions from the square at index from until the
+ * square at index to, and set mark on all of them. Returns the number
+ * of squares.
+ */
+uint32_t maze_mark_path( struct Maze* maze, uint32_t from, uint32_t to );
+
+/* mazeSolve and mazeSolveBits, which also count the squares they
+ * reached. Both return the path length, 0 or -1. maze_solve_bfs also
+ * writes the path into path if it is not NULL, as mazeSolvePath.
+ */
+int  maze_solve_bfs( struct Maze* maze, uint32_t* visited, MazePath* path );
+int  maze_solve_bits( struct Maze* maze, uint32_t* visited );
+
+/* MAZE_STRATEGY_PARALLEL on threads threads (0 for one per CPU). */
+int  maze_solve_parallel( struct Maze* maze, int threads, uint32_t* visited );
+
+/* mazeSolveTiled, which also counts the squares it reached. */
+int  maze_solve_tiled( MazeTiled* tiled, uint32_t* visited );
+
+/* mazeSolvePacked, which also counts the squares it reached. */
+int64_t maze_solve_packed( MazePacked* packed, uint64_t* visited );
+
+#endif
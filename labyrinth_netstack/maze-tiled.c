@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "maze.h"
+#include "maze-solve.h"
+#include "trace.h"
+
+/* Indeksen til ruten (X,Y) i griddet med kanten rundt, der X = x + 1 og
+ * Y = y + 1: flisen, saa raden i flisen, saa kolonnen.
+ */
+#define TILE_INDEX( t, X, Y )  ( ((((Y) >> 3) * (t)->tiles + ((X) >> 3)) << 6) | (((Y) & 7) << 3) | ((X) & 7) )
+
+// Funksjon deklarasjon
+static uint32_t tiled_step(const MazeTiled* t, uint32_t index, int dir);
+
+/**
+ * @brief Copies maze into a new grid of 8x8 tiles.
+ *
+ * One tile is 64 bytes, a cache line, so a step up or down stays in
+ * the same line seven times out of eight. The tiles are stored row by
+ * row and surround the maze with at least one empty square on every
+ * side, so that a step from a square on the edge still lands inside
+ * the grid and the solver needs no bounds checks. Every row of the
+ * maze is copied in runs of up to 8 bytes, one per tile.
+ */
+int mazeTiledFromMaze(MazeTiled* tiled, const struct Maze* maze)
+{
+    if (maze_check(maze, "mazeTiledFromMaze") < 0) {
+        return -1;
+    }
+
+    uint32_t edge = maze->edgeLen;
+
+    tiled->edgeLen = edge;
+    tiled->tiles   = (edge + 2 + 7) / 8;
+    tiled->size    = tiled->tiles * tiled->tiles * 64;
+    tiled->startX  = maze->startX;
+    tiled->startY  = maze->startY;
+    tiled->endX    = maze->endX;
+    tiled->endY    = maze->endY;
+    tiled->cells   = (char*)aligned_alloc(64, tiled->size);
+    if (!tiled->cells) {
+        perror("mazeTiledFromMaze: Could not allocate the tiles");
+        return -1;
+    }
+    memset(tiled->cells, 0, tiled->size); // Kanten har ingen veier
+
+    for (uint32_t y = 0; y < edge; ++y) {
+        const char* src = maze->maze + (size_t)y * edge;
+        for (uint32_t x = 0; x < edge;) {
+            uint32_t X   = x + 1;
+            uint32_t run = 8 - (X & 7); // Resten av raden i denne flisen
+            if (run > edge - x) {
+                run = edge - x;
+            }
+            memcpy(tiled->cells + TILE_INDEX(tiled, X, y + 1), src + x, run);
+            x += run;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies the squares of tiled back into maze in row-major order.
+ *
+ * maze->maze must have room for edgeLen * edgeLen squares. The header
+ * fields of maze are set from tiled.
+ */
+void mazeTiledToMaze(const MazeTiled* tiled, struct Maze* maze)
+{
+    uint32_t edge = tiled->edgeLen;
+
+    maze->edgeLen = edge;
+    maze->size    = edge * edge;
+    maze->startX  = tiled->startX;
+    maze->startY  = tiled->startY;
+    maze->endX    = tiled->endX;
+    maze->endY    = tiled->endY;
+
+    for (uint32_t y = 0; y < edge; ++y) {
+        char* dst = maze->maze + (size_t)y * edge;
+        for (uint32_t x = 0; x < edge;) {
+            uint32_t X   = x + 1;
+            uint32_t run = 8 - (X & 7);
+            if (run > edge - x) {
+                run = edge - x;
+            }
+            memcpy(dst + x, tiled->cells + TILE_INDEX(tiled, X, y + 1), run);
+            x += run;
+        }
+    }
+}
+
+void mazeTiledFree(MazeTiled* tiled)
+{
+    free(tiled->cells);
+    tiled->cells = NULL;
+}
+
+char mazeTiledGet(const MazeTiled* tiled, uint32_t x, uint32_t y)
+{
+    return tiled->cells[TILE_INDEX(tiled, x + 1, y + 1)];
+}
+
+void mazeTiledSet(MazeTiled* tiled, uint32_t x, uint32_t y, char square)
+{
+    tiled->cells[TILE_INDEX(tiled, x + 1, y + 1)] = square;
+}
+
+/**
+ * @brief Marks the path of mazeSolve directly in the tiles.
+ *
+ * The same breadth-first search as mazeSolve, with the neighbours in
+ * the same order, so the same squares get mark and tmark. The queue
+ * holds indices into the tiles, and the neighbours are found from the
+ * index alone.
+ */
+int mazeSolveTiled(MazeTiled* tiled)
+{
+    return maze_solve_tiled(tiled, NULL);
+}
+
+/* mazeSolveTiled som ogsaa teller rutene som ble naadd. */
+int maze_solve_tiled(MazeTiled* tiled, uint32_t* visited)
+{
+    if (!tiled || !tiled->cells || tiled->edgeLen == 0) {
+        fprintf(stderr, "mazeSolveTiled: Invalid tiled maze provided.\n");
+        return -1;
+    }
+    if (tiled->startX >= tiled->edgeLen || tiled->startY >= tiled->edgeLen ||
+        tiled->endX >= tiled->edgeLen || tiled->endY >= tiled->edgeLen) {
+        fprintf(stderr, "mazeSolveTiled: Start or End coordinates are out of bounds.\n");
+        return -1;
+    }
+
+    char*     grid  = tiled->cells;
+    uint32_t* queue = (uint32_t*)malloc((size_t)tiled->size * sizeof(uint32_t));
+    if (!queue) {
+        perror("mazeSolveTiled: Could not allocate the BFS queue");
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < tiled->size; ++i) {
+        grid[i] &= ~(mark | tmark | PARENT_BITS);
+    }
+
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_BEGIN, tiled->startX, tiled->startY, tiled->endX, tiled->endY, tiled->edgeLen);
+
+    uint32_t start = TILE_INDEX(tiled, tiled->startX + 1, tiled->startY + 1);
+    uint32_t end   = TILE_INDEX(tiled, tiled->endX + 1, tiled->endY + 1);
+    uint32_t head  = 0;
+    uint32_t tail  = 0;
+
+    grid[start] |= tmark;
+    queue[tail++] = start;
+    while (head < tail) {
+        uint32_t index = queue[head++];
+        if (index == end) {
+            break;
+        }
+        char walls = grid[index];
+
+        // Kanten rundt gjoer at naboene alltid er i griddet
+        if (walls & up) {
+            uint32_t next = tiled_step(tiled, index, DIR_UP);
+            if (!(grid[next] & tmark)) {
+                grid[next] |= tmark | PARENT_FOR(DIR_DOWN);
+                queue[tail++] = next;
+            }
+        }
+        if (walls & down) {
+            uint32_t next = tiled_step(tiled, index, DIR_DOWN);
+            if (!(grid[next] & tmark)) {
+                grid[next] |= tmark | PARENT_FOR(DIR_UP);
+                queue[tail++] = next;
+            }
+        }
+        if (walls & left) {
+            uint32_t next = tiled_step(tiled, index, DIR_LEFT);
+            if (!(grid[next] & tmark)) {
+                grid[next] |= tmark | PARENT_FOR(DIR_RIGHT);
+                queue[tail++] = next;
+            }
+        }
+        if (walls & right) {
+            uint32_t next = tiled_step(tiled, index, DIR_RIGHT);
+            if (!(grid[next] & tmark)) {
+                grid[next] |= tmark | PARENT_FOR(DIR_LEFT);
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    uint32_t length = 0;
+    if (grid[end] & tmark) { // Merker stien baklengs, som maze_mark_path
+        uint32_t index = end;
+        for (;;) {
+            grid[index] |= mark;
+            length++;
+            if (index == start) {
+                break;
+            }
+            index = tiled_step(tiled, index, PARENT_OF(grid[index]));
+        }
+    }
+    for (uint32_t i = 0; i < tail; ++i) {
+        grid[queue[i]] &= ~PARENT_BITS;
+    }
+    free(queue);
+
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_END, length > 0, length);
+    if (visited) {
+        *visited = tail;
+    }
+    return (int)length;
+}
+
+/* Naboen i retning dir. Inne i en flis er det 1 eller 8 bytes bort;
+ * over kanten av flisen er det naboflisen, 64 bytes bort til siden og
+ * en rad med fliser bort opp eller ned.
+ */
+static uint32_t tiled_step(const MazeTiled* t, uint32_t index, int dir)
+{
+    switch (dir) {
+    case DIR_LEFT:  return (index & 7) ? index - 1 : index - 64 + 7;
+    case DIR_RIGHT: return (index & 7) != 7 ? index + 1 : index + 64 - 7;
+    case DIR_UP:    return (index & 56) ? index - 8 : index - t->tiles * 64 + 56;
+    default:        return (index & 56) != 56 ? index + 8 : index + t->tiles * 64 - 56;
+    }
+}
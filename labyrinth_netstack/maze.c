@@ -4,87 +4,210 @@
 #include <stdbool.h>
 
 #include "maze.h"
+#include "maze-solve.h"
+#include "trace.h"
 
 // Funksjon deklarasjon
-static bool solve_recursive(struct Maze* maze, int x, int y);
-
+static uint32_t solve_bfs(struct Maze* maze, uint32_t* queue, uint32_t* visited);
+static int      parent_path(const struct Maze* maze, uint32_t length, MazePath* path);
+
+/**
+ * @brief Marks the shortest path from start to end with the bit mark.
+ *
+ * Breadth-first search with an explicit queue of maze->size cell
+ * indices, so the time is linear in the number of squares and the
+ * memory is 4 bytes per square, allocated once. Every visited square
+ * gets tmark and the direction back to the square it was reached
+ * from; the path is then marked by walking these directions back
+ * from the end. The direction bits are cleared again at the end, so
+ * only the wall bits, mark and tmark are left.
+ */
 void mazeSolve(struct Maze* maze)
 {
-    if (!maze || !maze->maze) { // Maze eller maze pekeren er null
-        fprintf(stderr, "mazeSolve: Invalid maze pointer provided.\n");
-        return;
+    maze_solve_bfs(maze, NULL, NULL);
+}
+
+/**
+ * @brief mazeSolve that also returns the path as steps.
+ *
+ * The directions back to the parents are still in the squares when
+ * the path has been marked, so the steps are read from them on the
+ * same walk back from the end, written from the back of path->dirs,
+ * before they are cleared. That costs one pass over the path and no
+ * pass over the grid.
+ */
+int mazeSolvePath(struct Maze* maze, MazePath* path)
+{
+    return maze_solve_bfs(maze, NULL, path);
+}
+
+/* mazeSolve som ogsaa teller rutene som ble naadd, og skriver stien
+ * til path hvis den ikke er NULL. Returnerer lengden paa stien, 0 uten
+ * sti, eller -1.
+ */
+int maze_solve_bfs(struct Maze* maze, uint32_t* visited, MazePath* path)
+{
+    if (path) {
+        path->steps = 0;
+        path->dirs  = NULL;
     }
-    if (maze->size == 0 || maze->edgeLen == 0) { // Stoerelse paa maze er 0 (ingenting aa loese)
-        fprintf(stderr, "mazeSolve: Maze has zero size or edgeLen.\n");
-        return;
+    if (maze_check(maze, "mazeSolve") < 0) {
+        return -1;
     }
-    if (maze->startX >= maze->edgeLen || maze->startY >= maze->edgeLen ||
-        maze->endX >= maze->edgeLen || maze->endY >= maze->edgeLen) { // Om A eller B (start eller slutt) er utenfor koordinatene til mazen
-        fprintf(stderr, "mazeSolve: Start or End coordinates are out of bounds.\n");
-        return;
+
+    uint32_t* queue = (uint32_t*)malloc((size_t)maze->size * sizeof(uint32_t)); // Hver rute kommer i koeen hoeyst en gang
+    if (!queue) {
+        perror("mazeSolve: Could not allocate the BFS queue");
+        return -1;
     }
 
-    fprintf(stderr, "mazeSolve: Clearing previous marks...\n");
     for (uint32_t i = 0; i < maze->size; ++i) { // For stoerelse paa maze
-        maze->maze[i] &= ~(mark | tmark); // XOR operasjon paa mark og tmark for aa bytte markeringer
+        maze->maze[i] &= ~(mark | tmark | PARENT_BITS); // Fjerner merker fra en tidligere loesning
     }
 
-    fprintf(stderr, "mazeSolve: Starting DFS from (%u, %u) to (%u, %u)...\n",
-            maze->startX, maze->startY, maze->endX, maze->endY);
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_BEGIN, maze->startX, maze->startY, maze->endX, maze->endY, maze->edgeLen);
 
-    bool path_found = solve_recursive(maze, maze->startX, maze->startY); // Kall til rekursiv funksjon
+    uint32_t reached = 0;
+    uint32_t length  = solve_bfs(maze, queue, &reached);
+    int      failed  = path && parent_path(maze, length, path) < 0; // Foer PARENT-bitene fjernes
 
-    if (path_found) {
-        fprintf(stderr, "mazeSolve: Path found and marked.\n");
-    } else {
-        fprintf(stderr, "mazeSolve: No path found.\n");
+    for (uint32_t i = 0; i < maze->size; ++i) {
+        maze->maze[i] &= ~PARENT_BITS;
     }
-}
+    free(queue);
 
-static bool solve_recursive(struct Maze* maze, int x, int y)
-{
-    if (x < 0 || x >= maze->edgeLen || y < 0 || y >= maze->edgeLen) { // Om start koordinater er out of bounds saa finnes det ingen vei
-        return false;
+    TRACE(TRACE_INFO, TRACE_MAZE_SOLVE_END, length > 0, length);
+    if (visited) {
+        *visited = reached;
     }
+    return failed ? -1 : (int)length;
+}
 
-    int index = y * maze->edgeLen + x; // Beregn indeks til cellen
-
-    if (maze->maze[index] & tmark) { // Hvis cellen allerede er markert
-        return false;
+/* Sjekker at maze kan loeses, og skriver ut hvorfor ikke med caller foran. */
+int maze_check(const struct Maze* maze, const char* caller)
+{
+    if (!maze || !maze->maze) { // Maze eller maze pekeren er null
+        fprintf(stderr, "%s: Invalid maze pointer provided.\n", caller);
+        return -1;
     }
-
-    maze->maze[index] |= tmark; // Merker cellen som besoekt
-
-    if (x == maze->endX && y == maze->endY) { // Om vi har kommet til slutt koordinatene
-        maze->maze[index] |= mark;  // Marker stien fra A til B
-        return true;
+    if (maze->size == 0 || maze->edgeLen == 0) { // Stoerelse paa maze er 0 (ingenting aa loese)
+        fprintf(stderr, "%s: Maze has zero size or edgeLen.\n", caller);
+        return -1;
     }
-
-    char walls = maze->maze[index]; // Setter vegger
-
-    // Finn sti utifra rettningene opp, ned, venstre, hoeyre
-    bool path_found = false;
-    if ((walls & up) && solve_recursive(maze, x, y - 1)) { // Sjekker om det er mulig aa gaa opp og rekursivt proever aa finne en vei
-        maze->maze[index] |= mark; // Hvis solve gir true (sti funnet) marker cellen som del av stien
-        path_found = true;
+    if (maze->startX >= maze->edgeLen || maze->startY >= maze->edgeLen ||
+        maze->endX >= maze->edgeLen || maze->endY >= maze->edgeLen) { // Om A eller B (start eller slutt) er utenfor koordinatene til mazen
+        fprintf(stderr, "%s: Start or End coordinates are out of bounds.\n", caller);
+        return -1;
     }
-    if ((walls & down) && solve_recursive(maze, x, y + 1)) { // Sjekker om det er mulig aa gaa ned og rekursivt proever aa finne en vei
-        maze->maze[index] |= mark; // Hvis solve gir true (sti funnet) marker cellen som del av stien
-        path_found = true;
+    if ((uint64_t)maze->edgeLen * maze->edgeLen > maze->size) { // Ruter utenfor griddet ville blitt lest og skrevet
+        fprintf(stderr, "%s: Grid of %u squares is smaller than %u x %u.\n",
+                caller, maze->size, maze->edgeLen, maze->edgeLen);
+        return -1;
     }
-    if ((walls & left) && solve_recursive(maze, x - 1, y)) { // Sjekker om det er mulig aa gaa til venstre og rekursivt proever aa finne en vei
-        maze->maze[index] |= mark; // Hvis solve gir true (sti funnet) marker cellen som del av stien
-        path_found = true;
+    return 0;
+}
+
+/* BFS fra start til slutt er naadd, deretter merkes veien baklengs.
+ * Returnerer antall ruter paa veien, eller 0 hvis det ikke finnes en.
+ */
+static uint32_t solve_bfs(struct Maze* maze, uint32_t* queue, uint32_t* visited)
+{
+    char*    grid  = maze->maze;
+    uint32_t edge  = maze->edgeLen;
+    uint32_t start = maze->startY * edge + maze->startX;
+    uint32_t end   = maze->endY * edge + maze->endX;
+    uint32_t head  = 0;
+    uint32_t tail  = 0;
+
+    grid[start] |= tmark;
+    queue[tail++] = start;
+    while (head < tail) {
+        uint32_t index = queue[head++];
+        if (index == end) {
+            break;
+        }
+        uint32_t x     = index % edge;
+        uint32_t y     = index / edge;
+        char     walls = grid[index];
+
+        // Naboer som er aapne fra denne ruten og ikke besoekt, faar retningen tilbake hit
+        if ((walls & up) && y > 0 && !(grid[index - edge] & tmark)) {
+            grid[index - edge] |= tmark | PARENT_FOR(DIR_DOWN);
+            queue[tail++] = index - edge;
+        }
+        if ((walls & down) && y + 1 < edge && !(grid[index + edge] & tmark)) {
+            grid[index + edge] |= tmark | PARENT_FOR(DIR_UP);
+            queue[tail++] = index + edge;
+        }
+        if ((walls & left) && x > 0 && !(grid[index - 1] & tmark)) {
+            grid[index - 1] |= tmark | PARENT_FOR(DIR_RIGHT);
+            queue[tail++] = index - 1;
+        }
+        if ((walls & right) && x + 1 < edge && !(grid[index + 1] & tmark)) {
+            grid[index + 1] |= tmark | PARENT_FOR(DIR_LEFT);
+            queue[tail++] = index + 1;
+        }
     }
-    if ((walls & right) && solve_recursive(maze, x + 1, y)) { // Sjekker om det er mulig aa gaa til hoeyre og rekursivt proever aa finne en vei
-        maze->maze[index] |= mark; // Hvis solve gir true (sti funnet) marker cellen som del av stien
-        path_found = true;
+
+    *visited = tail;
+    if (!(grid[end] & tmark)) { // Slutten ble aldri naadd
+        return 0;
     }
+    return maze_mark_path(maze, end, start);
+}
 
-    // Gaa tilbake om ingen sti var funnet og fjern markering av cellen
-    if (!path_found) {
-        maze->maze[index] &= ~tmark;  // Fjern markering av cellen
+/* Gaar tilbake fra from til to etter retningene i PARENT-bitene og
+ * markerer stien. Returnerer antall ruter paa den.
+ */
+uint32_t maze_mark_path(struct Maze* maze, uint32_t from, uint32_t to)
+{
+    char*    grid   = maze->maze;
+    uint32_t edge   = maze->edgeLen;
+    uint32_t length = 1;
+    uint32_t index  = from;
+
+    grid[index] |= mark;
+    while (index != to) {
+        switch (PARENT_OF(grid[index])) {
+        case DIR_LEFT:  index -= 1;    break;
+        case DIR_RIGHT: index += 1;    break;
+        case DIR_UP:    index -= edge; break;
+        default:        index += edge; break;
+        }
+        grid[index] |= mark;
+        length++;
     }
+    return length;
+}
 
-    return path_found;
+/* Skriver skrittene paa stien med length ruter til path etter
+ * PARENT-bitene. De leses baklengs fra slutten og skrives bakfra, saa
+ * path gaar fra start til slutt. Returnerer 0, eller -1 uten minne.
+ */
+static int parent_path(const struct Maze* maze, uint32_t length, MazePath* path)
+{
+    const char* grid  = maze->maze;
+    uint32_t    edge  = maze->edgeLen;
+    uint32_t    index = maze->endY * edge + maze->endX;
+
+    path->startX = maze->startX;
+    path->startY = maze->startY;
+    path->steps  = length > 0 ? length - 1 : 0;
+    path->dirs   = (uint8_t*)calloc(path->steps / 4 + 1, 1);
+    if (!path->dirs) {
+        perror("mazeSolvePath: Could not allocate the path");
+        path->steps = 0;
+        return -1;
+    }
+    for (uint32_t i = path->steps; i-- > 0;) {
+        int back = PARENT_OF(grid[index]);
+        path->dirs[i / 4] |= (uint8_t)((back ^ 1) << (i % 4 * 2)); // Skrittet hit er motsatt av veien tilbake
+        switch (back) {
+        case DIR_LEFT:  index -= 1;    break;
+        case DIR_RIGHT: index += 1;    break;
+        case DIR_UP:    index -= edge; break;
+        default:        index += edge; break;
+        }
+    }
+    return 0;
 }
@@ -1,6 +1,7 @@
 #ifndef MAZE_H
 #define MAZE_H
 
+#include <stdio.h>
 #include <inttypes.h>
 
 #define left   ( 0x1 << 1 )
@@ -50,6 +51,9 @@ struct Maze
  */
 void mazePlot( const struct Maze* maze );
 
+/* Like mazePlot, but plot to f. */
+void mazePlotFile( const struct Maze* maze, FILE* f );
+
 /* This function takes a maze data structure. It will search
  * for a path through the maze from (startX,startY) to (endX,endY)
  * and mark the path by adding the bit "mark" on the direct
@@ -63,5 +67,318 @@ void mazePlot( const struct Maze* maze );
  */
 void mazeSolve( struct Maze* maze );
 
+/* Directions of the steps in struct MazePath. */
+#define MAZE_STEP_LEFT   0
+#define MAZE_STEP_RIGHT  1
+#define MAZE_STEP_UP     2
+#define MAZE_STEP_DOWN   3
+
+typedef struct MazePath MazePath;
+
+/* A path through a maze as the steps from the start instead of marks
+ * in the grid, two bits per step. A path of n squares has n-1 steps.
+ */
+struct MazePath
+{
+    /* the first square, which is the start of the maze */
+    uint32_t startX;
+    uint32_t startY;
+
+    /* number of steps */
+    uint32_t steps;
+
+    /* step i is the MAZE_STEP_* in bits 2*(i%4) and 2*(i%4)+1 of
+     * dirs[i/4]; allocated with malloc, free it with mazePathFree
+     */
+    uint8_t* dirs;
+};
+
+/* Like mazeSolve, and also write the marked path into path. With no
+ * path from start to end, path has no steps. Returns the number of
+ * squares on the path, 0 if there is none, or -1 if the maze is
+ * invalid or memory is short.
+ */
+int  mazeSolvePath( struct Maze* maze, MazePath* path );
+
+/* Read the path that is marked in maze into path. Returns the number of
+ * squares on it, 0 if the start is not marked, or -1 if the marks are
+ * not one path from start to end or memory is short.
+ */
+int  mazePathFromMarks( const struct Maze* maze, MazePath* path );
+
+/* Free the steps of path. */
+void mazePathFree( MazePath* path );
+
+/* Like mazeSolve, but the search works on bit planes with 64 squares
+ * per word, which is much faster on large mazes. Only mark is set,
+ * not tmark. In a maze with loops the marked path is not always the
+ * shortest one. Returns the number of squares on the path, 0 if there
+ * is none, or -1 if the maze is invalid or memory is short.
+ */
+int  mazeSolveBits( struct Maze* maze );
+
+/* Strategies of mazeSolveEx. */
+enum MazeStrategy
+{
+    MAZE_STRATEGY_BFS = 0,  /* mazeSolve */
+    MAZE_STRATEGY_BITS,     /* mazeSolveBits */
+    MAZE_STRATEGY_ASTAR,    /* A* with the Manhattan distance to the end */
+    MAZE_STRATEGY_BIDIR,    /* breadth-first from both ends, meeting in the middle */
+    MAZE_STRATEGY_DEADEND,  /* fill dead ends, then search what is left */
+    MAZE_STRATEGY_PARALLEL, /* MAZE_STRATEGY_DEADEND on several threads, marks the path of mazeSolve */
+    MAZE_STRATEGY_TILED,    /* mazeSolveTiled, including the copies into and out of the tiles */
+    MAZE_STRATEGY_PACKED,   /* mazeSolvePacked, including packing and unpacking */
+    MAZE_STRATEGY_COUNT
+};
+
+typedef struct MazeSolveOptions MazeSolveOptions;
+
+struct MazeSolveOptions
+{
+    /* one of MAZE_STRATEGY_* */
+    int strategy;
+
+    /* threads of MAZE_STRATEGY_PARALLEL, 0 for one per online CPU */
+    int threads;
+
+    /* if not NULL, the marked path is also written here, as by
+     * mazeSolvePath; it counts into the time of the call
+     */
+    MazePath* path;
+};
+
+typedef struct MazeSolveStats MazeSolveStats;
+
+struct MazeSolveStats
+{
+    /* squares that the strategy reached or, for dead-end filling, filled */
+    uint32_t visited;
+
+    /* squares on the marked path, 0 if there is no path */
+    uint32_t length;
+
+    /* time of the whole call in nanoseconds */
+    uint64_t nsec;
+};
+
+/* Like mazeSolve, with the strategy in opts (NULL means
+ * MAZE_STRATEGY_BFS). All strategies except MAZE_STRATEGY_BITS and
+ * MAZE_STRATEGY_PACKED mark a shortest path and set tmark on the
+ * squares they reached. If stats is not NULL, it is filled in. Returns
+ * the number of squares on the path, 0 if there is none, or -1 if the
+ * maze or the strategy is invalid or memory is short.
+ */
+int  mazeSolveEx( struct Maze* maze, const MazeSolveOptions* opts, MazeSolveStats* stats );
+
+/* The short name of a strategy ("bfs", "bits", "astar", "bidir",
+ * "deadend", "parallel", "tiled", "packed"), and the strategy for
+ * such a name, or -1.
+ */
+const char* mazeStrategyName( int strategy );
+int  mazeStrategyParse( const char* name );
+
+typedef struct MazeTiled MazeTiled;
+
+/* A maze stored as 8x8 tiles of one cache line each instead of rows,
+ * so that most steps up and down stay in the same cache line. Only the
+ * functions below know where a square is.
+ */
+struct MazeTiled
+{
+    /* as in struct Maze */
+    uint32_t edgeLen;
+
+    /* tiles per row and per column, including a border of empty squares */
+    uint32_t tiles;
+
+    /* bytes in cells, 64 per tile */
+    uint32_t size;
+
+    uint32_t startX;
+    uint32_t startY;
+    uint32_t endX;
+    uint32_t endY;
+
+    /* the squares, with the same bits as in struct Maze */
+    char* cells;
+};
+
+/* Copy maze into newly allocated tiles. Returns 0, or -1 if the maze is
+ * invalid or memory is short.
+ */
+int  mazeTiledFromMaze( MazeTiled* tiled, const struct Maze* maze );
+
+/* Copy the squares back into maze->maze, which must have room for all
+ * of them, in the row-major order of struct Maze and the wire.
+ */
+void mazeTiledToMaze( const MazeTiled* tiled, struct Maze* maze );
+
+/* Free the tiles of mazeTiledFromMaze. */
+void mazeTiledFree( MazeTiled* tiled );
+
+/* The square (x,y), and set it. */
+char mazeTiledGet( const MazeTiled* tiled, uint32_t x, uint32_t y );
+void mazeTiledSet( MazeTiled* tiled, uint32_t x, uint32_t y, char square );
+
+/* mazeSolve on the tiles: marks the same path and sets tmark on the same
+ * squares. Returns the number of squares on the path, 0 if there is
+ * none, or -1 if the maze is invalid or memory is short.
+ */
+int  mazeSolveTiled( MazeTiled* tiled );
+
+typedef struct MazePacked MazePacked;
+
+/* A maze in two bits per square instead of a byte: left and up of a
+ * square are right and down of its neighbours, so only those are kept.
+ * tmark and mark are bitmaps of their own. Indices are 64 bits wide, so
+ * the edge may be far above MAZE_MAX_EDGE.
+ */
+struct MazePacked
+{
+    uint32_t edgeLen;
+    uint32_t startX;
+    uint32_t startY;
+    uint32_t endX;
+    uint32_t endY;
+
+    /* square i = y*edgeLen+x is open to the right in bit 2*(i%32) and
+     * downwards in bit 2*(i%32)+1 of passages[i/32]
+     */
+    uint64_t* passages;
+
+    /* bit i%64 of word i/64: reached by the solver (tmark), on the path (mark) */
+    uint64_t* visited;
+    uint64_t* path;
+};
+
+/* Pack maze into newly allocated bitmaps. A passage that is open from
+ * one side only counts as open. Returns 0, or -1 if the maze is invalid
+ * or memory is short.
+ */
+int  mazePackedFromMaze( MazePacked* packed, const struct Maze* maze );
+
+/* Unpack into maze->maze, which must have room for all squares. */
+void mazePackedToMaze( const MazePacked* packed, struct Maze* maze );
+
+/* Free the bitmaps of mazePackedFromMaze. */
+void mazePackedFree( MazePacked* packed );
+
+/* The square (x,y) with the bits of struct Maze. */
+char mazePackedGet( const MazePacked* packed, uint32_t x, uint32_t y );
+
+/* Mark a path from start to end in packed->path with a depth-first
+ * search, and the squares it reached in packed->visited. In a perfect
+ * maze it is the path of mazeSolve; with loops it is not always the
+ * shortest. Returns the number of squares on the path, 0 if there is
+ * none, or -1 if the maze is invalid or memory is short.
+ */
+int64_t mazeSolvePacked( MazePacked* packed );
+
+/* The largest edge length that mazeGenerate accepts. Such a maze has
+ * 64 MiB of squares, which still fits into one L4 message.
+ */
+#define MAZE_MAX_EDGE 8192
+
+/* Results of mazeVerify. */
+#define MAZE_VERIFY_OK            0
+#define MAZE_VERIFY_MISMATCH     -1  /* other header or other walls than the original */
+#define MAZE_VERIFY_NO_PATH      -2  /* the marked squares do not lead from start to end */
+#define MAZE_VERIFY_EXTRA_MARKS  -3  /* squares that are not on the path are marked */
+#define MAZE_VERIFY_LOOP         -4  /* the steps of a path come back to a square */
+
+/* Fill maze with a new perfect maze (exactly one path between any two
+ * squares) of edgeLen x edgeLen squares, with a random start and end.
+ * The same seed always gives the same maze. maze->maze is allocated
+ * with malloc and belongs to the caller.
+ * Returns 0, or -1 if edgeLen is 0 or above MAZE_MAX_EDGE or memory
+ * is short.
+ */
+int  mazeGenerate( struct Maze* maze, uint32_t edgeLen, uint64_t seed );
+
+/* Check a solution that a client returned for original: the header
+ * and the walls must be unchanged, and the squares with the bit
+ * "mark" must be exactly the path from start to end. tmark is
+ * ignored. Returns one of the MAZE_VERIFY_* values.
+ */
+int  mazeVerify( const struct Maze* original, const struct Maze* solved );
+
+/* Check a solution that a client returned as a path, with the header
+ * in solved (solved->maze is not used): the header must be unchanged,
+ * and the steps must go from start to end through open walls of
+ * original without coming back to a square. Returns one of the
+ * MAZE_VERIFY_* values.
+ */
+int  mazeVerifyPath( const struct Maze* original, const struct Maze* solved, const MazePath* path );
+
+/* A short description of a MAZE_VERIFY_* value. */
+const char* mazeVerifyString( int result );
+
+/* The header in front of the grid on the wire: edgeLen, size, startX,
+ * startY, endX and endY as 32-bit words in network byte order.
+ */
+#define MAZE_HEADER_LEN (6*sizeof(uint32_t))
+
+/* Encodings of the grid after the header. A client asks for the packed
+ * one by adding " PACK" to its request; a server that does not know it
+ * ignores the word and answers raw. The answer is raw if it is exactly
+ * MAZE_HEADER_LEN + size bytes long, so both ends take either.
+ */
+#define MAZE_ENCODING_RAW     0  /* one byte per square, as in struct Maze */
+#define MAZE_ENCODING_PACKED  1  /* see below */
+#define MAZE_ENCODING_PATH    2  /* a solution as a MazePath, see below */
+
+/* The packed grid is the byte MAZE_ENCODING_PACKED, then every row in
+ * (edgeLen+3)/4 bytes, and then the lengths of the runs of squares
+ * without and with mark in row-major order, starting with a run without,
+ * as LEB128 numbers that add up to size. A row is split into groups of
+ * 8 squares: a byte with right of square x in bit x%8, then a byte with
+ * down. A last group of at most 4 squares has right in the low and down
+ * in the high half of one byte. left and up follow from the neighbours
+ * and tmark is not sent.
+ */
+
+/* The most bytes that mazeEncode writes for maze. */
+uint32_t mazeEncodedBound( const struct Maze* maze );
+
+/* Write header and grid of maze into out, which has room for cap bytes.
+ * With MAZE_ENCODING_PACKED the grid is packed if the walls agree on
+ * both sides, no square is open past the edge, no bits other than walls,
+ * tmark and mark are set, and the result is shorter; otherwise it is
+ * raw. Returns the number of bytes, or -1 if maze is invalid or cap is
+ * below mazeEncodedBound.
+ */
+int  mazeEncode( const struct Maze* maze, int encoding, uint8_t* out, uint32_t cap );
+
+/* Read a message of mazeEncode in either encoding into maze, with the
+ * grid in a new buffer from malloc. Returns the MAZE_ENCODING_* of the
+ * message, or -1 if it is malformed or memory is short.
+ */
+int  mazeDecode( struct Maze* maze, const uint8_t* data, uint32_t len );
+
+/* A solution may instead be sent as its path: the header, the byte
+ * MAZE_ENCODING_PATH, the number of steps as a 32-bit word in network
+ * byte order, and (steps+3)/4 bytes of steps as in struct MazePath,
+ * with the unused bits of the last byte 0. The path starts at the
+ * start in the header. That is a quarter byte per square on the path
+ * instead of a byte per square of the maze: tens of kilobytes instead
+ * of a megabyte for a 1000x1000 maze, and it is checked without a grid.
+ */
+
+/* The number of bytes that mazeEncodePath writes for path. */
+uint32_t mazePathEncodedBound( const MazePath* path );
+
+/* Write the header of maze and path into out, which has room for cap
+ * bytes. Returns the number of bytes, or -1 if the path does not start
+ * at the start of maze or cap is below mazePathEncodedBound.
+ */
+int  mazeEncodePath( const struct Maze* maze, const MazePath* path, uint8_t* out, uint32_t cap );
+
+/* Read a message of mazeEncodePath: the header into maze, with
+ * maze->maze NULL, and the steps into path. Returns MAZE_ENCODING_PATH,
+ * or -1 if the message is malformed, has at least as many steps as the
+ * maze has squares, or memory is short.
+ */
+int  mazeDecodePath( struct Maze* maze, MazePath* path, const uint8_t* data, uint32_t len );
+
 #endif
 
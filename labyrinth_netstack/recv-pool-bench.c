@@ -0,0 +1,194 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stddef.h>
+
+#include "l4sap.h"
+#include "l2sap.h"
+
+/* Number of packets that are sent before the receiver drains them.
+ * It is kept below the default UDP receive buffer so that loopback
+ * does not drop packets in the middle of a burst.
+ */
+#define BURST 32
+
+/* Frames per run of the user space measurement. */
+#define MEM_FRAMES 2000000
+
+static double now_sec( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Keeps the compiler from dropping results that are never used. */
+static volatile uint8_t sink;
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [packets]\n"
+                     "       packets - number of L4 packets per socket measurement (default 100000)\n",
+                     name );
+    exit( -1 );
+}
+
+/* The receive side work per full-size L4 packet, without sockets.
+ * frame holds a valid L2 frame with an L4 DATA packet inside.
+ *   two copies: L2 validates into an L4 buffer, L4 copies to L5
+ *               (l4sap_recv before the buffer pool)
+ *   one copy:   validate in a pool buffer, L4 copies to L5 (l4sap_recv)
+ *   lend:       validate in a pool buffer, L5 reads it there
+ *               (l4sap_recv_lend)
+ */
+static void run_memory( const uint8_t* frame, int frame_len )
+{
+    static uint8_t l4buf[L4Framesize];
+    static uint8_t user[L4Payloadsize];
+    int            plen;
+    uint8_t        acc = 0;
+
+    double t0 = now_sec();
+    for( int i=0; i<MEM_FRAMES; i++ )
+    {
+        l2sap_frame_check_copy( frame, frame_len, l4buf, sizeof(l4buf), &plen );
+        memcpy( user, l4buf + L4Headersize, plen - L4Headersize );
+        acc ^= user[i % L4Payloadsize];
+    }
+    double t1 = now_sec();
+    for( int i=0; i<MEM_FRAMES; i++ )
+    {
+        l2sap_frame_check( frame, frame_len, &plen );
+        memcpy( user, frame + L2Headersize + L4Headersize, plen - L4Headersize );
+        acc ^= user[i % L4Payloadsize];
+    }
+    double t2 = now_sec();
+    for( int i=0; i<MEM_FRAMES; i++ )
+    {
+        l2sap_frame_check( frame, frame_len, &plen );
+        acc ^= frame[L2Headersize + L4Headersize + i % L4Payloadsize];
+    }
+    double t3 = now_sec();
+    sink = acc;
+
+    printf( "user space, %d byte payload:\n", L4Payloadsize );
+    printf( "  two copies: %7.1f ns/packet\n", (t1 - t0) * 1e9 / MEM_FRAMES );
+    printf( "  one copy:   %7.1f ns/packet\n", (t2 - t1) * 1e9 / MEM_FRAMES );
+    printf( "  lend:       %7.1f ns/packet\n", (t3 - t2) * 1e9 / MEM_FRAMES );
+}
+
+/* Bind an entity to an ephemeral loopback port and return the port. */
+static int bind_any( L2SAP* sap )
+{
+    struct sockaddr_in addr;
+    socklen_t          addrlen = sizeof(addr);
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port        = 0;
+    if( bind( sap->socket, (struct sockaddr*)&addr, sizeof(addr) ) < 0 ||
+        getsockname( sap->socket, (struct sockaddr*)&addr, &addrlen ) < 0 )
+    {
+        perror( "bind" );
+        return -1;
+    }
+    return ntohs( addr.sin_port );
+}
+
+/* Send packets L4 DATA packets from a raw L2 entity and receive them
+ * with l4sap_recv or l4sap_recv_lend. The ACKs of the receiver are
+ * never read; the sender does not wait for them.
+ */
+static double run_socket( L2SAP* tx, L4SAP* rx, const uint8_t* payload, int packets, int lend, int* lost )
+{
+    static uint8_t user[L4Payloadsize];
+    L4Header       hdr   = { L4_DATA, 0, 0, 0 };
+    struct iovec   iov[2];
+    int            done  = 0;
+    uint8_t        acc   = 0;
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len  = L4Headersize;
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len  = L4Payloadsize;
+
+    *lost = 0;
+    double start = now_sec();
+    while( done < packets )
+    {
+        int burst = packets - done < BURST ? packets - done : BURST;
+        for( int i=0; i<burst; i++ )
+        {
+            hdr.seqno = (uint8_t)((done + i) % 2);
+            l2sap_sendv( tx, iov, 2 );
+        }
+        for( int i=0; i<burst; i++ )
+        {
+            if( lend )
+            {
+                L2Buf* buf;
+                if( l4sap_recv_lend( rx, &buf ) != L4Payloadsize ) (*lost)++;
+                if( buf ) acc ^= buf->data[buf->offset + i];
+                l2buf_release( buf );
+            }
+            else
+            {
+                if( l4sap_recv( rx, user, sizeof(user) ) != L4Payloadsize ) (*lost)++;
+                acc ^= user[i];
+            }
+        }
+        done += burst;
+    }
+    sink = acc;
+    return now_sec() - start;
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc > 2 ) usage( argv[0] );
+
+    int packets = argc > 1 ? atoi( argv[1] ) : 100000;
+    if( packets <= 0 ) usage( argv[0] );
+
+    uint8_t payload[L4Payloadsize];
+    for( int i=0; i<L4Payloadsize; i++ ) payload[i] = (uint8_t)(i * 7 + 1);
+
+    // A complete frame as it arrives from the network, for the user space part
+    uint8_t  frame[L2Framesize];
+    L4Header hdr = { L4_DATA, 0, 0, 0 };
+    l2sap_frame_header( frame, htonl( INADDR_LOOPBACK ), L2Framesize );
+    memcpy( frame + L2Headersize, &hdr, L4Headersize );
+    memcpy( frame + L2Headersize + L4Headersize, payload, L4Payloadsize );
+    frame[offsetof(L2Header, checksum)] = 0;
+    uint8_t checksum = 0;
+    for( int i=0; i<L2Framesize; i++ ) checksum ^= frame[i];
+    frame[offsetof(L2Header, checksum)] = checksum;
+
+    run_memory( frame, L2Framesize );
+
+    // The receiver is an L4 entity, the sender a bare L2 entity
+    L4SAP* rx = l4sap_create( "127.0.0.1", 9 );
+    if( !rx ) return -1;
+    int rx_port = bind_any( rx->l2 );
+    L2SAP* tx = l2sap_create( "127.0.0.1", rx_port );
+    if( rx_port < 0 || !tx ) return -1;
+    int tx_port = bind_any( tx );
+    if( tx_port < 0 ) return -1;
+    rx->l2->peer_addr.sin_port = htons( tx_port );
+
+    int    lost_copy, lost_lend;
+    double t_copy = run_socket( tx, rx, payload, packets, 0, &lost_copy );
+    double t_lend = run_socket( tx, rx, payload, packets, 1, &lost_lend );
+
+    printf( "loopback, %d packets, burst %d:\n", packets, BURST );
+    printf( "  l4sap_recv:      %10.0f packets/s  (%d lost)\n", packets / t_copy, lost_copy );
+    printf( "  l4sap_recv_lend: %10.0f packets/s  (%d lost)\n", packets / t_lend, lost_lend );
+
+    l2sap_destroy( tx );
+    l2sap_destroy( rx->l2 );
+    free( rx );
+    return 0;
+}
@@ -0,0 +1,116 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-s] <tracefile>\n"
+                     "       -s        - print only the number of records per event\n"
+                     "       tracefile - written by a program that ran with NETSTACK_TRACE=<level>\n"
+                     "Prints the records of all threads in time order. Times are in\n"
+                     "seconds since the first record.\n",
+                     name );
+    exit( -1 );
+}
+
+static int by_time( const void* a, const void* b )
+{
+    const TraceRecord* ra = (const TraceRecord*)a;
+    const TraceRecord* rb = (const TraceRecord*)b;
+    if( ra->ts_ns != rb->ts_ns ) return ra->ts_ns < rb->ts_ns ? -1 : 1;
+    return (int)ra->thread - (int)rb->thread;
+}
+
+int main( int argc, char *argv[] )
+{
+    int summary = 0;
+    int opt;
+    while( (opt = getopt( argc, argv, "s" )) != -1 )
+    {
+        if( opt == 's' ) summary = 1;
+        else             usage( argv[0] );
+    }
+    if( optind != argc - 1 ) usage( argv[0] );
+
+    FILE* f = fopen( argv[optind], "rb" );
+    if( !f )
+    {
+        perror( argv[optind] );
+        return -1;
+    }
+
+    TraceFileHeader fh;
+    if( fread( &fh, sizeof(fh), 1, f ) != 1 || memcmp( fh.magic, TRACE_MAGIC, sizeof(fh.magic) ) != 0 )
+    {
+        fprintf( stderr, "%s: %s is not a trace file\n", argv[0], argv[optind] );
+        fclose( f );
+        return -1;
+    }
+    if( fh.record_size != sizeof(TraceRecord) )
+    {
+        fprintf( stderr, "%s: Records of %u bytes, this decoder reads %zu\n",
+                 argv[0], fh.record_size, sizeof(TraceRecord) );
+        fclose( f );
+        return -1;
+    }
+
+    TraceRecord* records = NULL;
+    size_t       count   = 0;
+    for( uint32_t i=0; i<fh.rings; i++ )
+    {
+        TraceRingHeader rh;
+        if( fread( &rh, sizeof(rh), 1, f ) != 1 ) break;
+        if( rh.lost ) printf( "# thread %u: %llu older records were overwritten\n",
+                              rh.thread, (unsigned long long)rh.lost );
+
+        TraceRecord* more = (TraceRecord*)realloc( records, (count + rh.records) * sizeof(TraceRecord) );
+        if( !more )
+        {
+            perror( "realloc" );
+            break;
+        }
+        records = more;
+        count  += fread( records + count, sizeof(TraceRecord), rh.records, f );
+    }
+    fclose( f );
+
+    qsort( records, count, sizeof(TraceRecord), by_time );
+
+    if( summary )
+    {
+        size_t per_event[TRACE_EVENT_COUNT] = { 0 };
+        for( size_t i=0; i<count; i++ )
+        {
+            if( records[i].event < TRACE_EVENT_COUNT ) per_event[records[i].event]++;
+        }
+        for( int e=1; e<TRACE_EVENT_COUNT; e++ )
+        {
+            if( per_event[e] ) printf( "%10zu  %s\n", per_event[e], trace_event_name( e ) );
+        }
+    }
+    else
+    {
+        for( size_t i=0; i<count; i++ )
+        {
+            const TraceRecord* r    = &records[i];
+            const char*        name = trace_event_name( r->event );
+            printf( "%12.6f  t%-3u  ", (r->ts_ns - records[0].ts_ns) * 1e-9, r->thread );
+            if( !name )
+            {
+                printf( "event %u  %u %u %u %u %u\n", r->event, r->a, r->b, r->c, r->d, r->e );
+                continue;
+            }
+            printf( "%-24s", name );
+            printf( trace_event_format( r->event ), r->a, r->b, r->c, r->d, r->e );
+            printf( "\n" );
+        }
+    }
+
+    printf( "# %zu records from %u threads\n", count, fh.rings );
+    free( records );
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+
+/* The ring of one thread. Only the owner writes records and head;
+ * trace_dump reads them.
+ */
+typedef struct TraceRing TraceRing;
+
+struct TraceRing
+{
+    uint64_t    head;       /* records written so far */
+    uint16_t    thread;
+    TraceRing*  next;       /* in the list of all rings */
+    TraceRecord records[TRACE_RING_RECORDS];
+};
+
+int trace_level = 0;
+
+static __thread TraceRing* my_ring;
+static TraceRing*          all_rings;
+static uint16_t            next_thread;
+static const char*         dump_path;
+
+static TraceRing* ring_create(void);
+static void       dump_at_exit(void);
+
+#define TRACE_NAME_( id, name, format ) [id] = name,
+static const char* const event_names[TRACE_EVENT_COUNT] = { TRACE_EVENTS(TRACE_NAME_) };
+#undef TRACE_NAME_
+
+#define TRACE_FORMAT_( id, name, format ) [id] = format,
+static const char* const event_formats[TRACE_EVENT_COUNT] = { TRACE_EVENTS(TRACE_FORMAT_) };
+#undef TRACE_FORMAT_
+
+/* Leser NETSTACK_TRACE foer main, saa et program kan spores uten aa
+ * endres.
+ */
+__attribute__((constructor))
+static void trace_init(void) {
+    const char* level = getenv("NETSTACK_TRACE");
+    if (!level || atoi(level) <= 0) {
+        return;
+    }
+    dump_path = getenv("NETSTACK_TRACE_FILE");
+    if (!dump_path || !*dump_path) {
+        dump_path = "netstack.trace";
+    }
+    trace_level = atoi(level);
+    atexit(dump_at_exit);
+}
+
+/**
+ * @brief Writes one record into the calling thread's ring.
+ *
+ * The ring is allocated at the first record of a thread. When it is
+ * full, the oldest records are overwritten. If the ring cannot be
+ * allocated, the record is lost.
+ */
+void trace_emit(int event, uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e) {
+    TraceRing* ring = my_ring;
+    if (!ring) {
+        ring = ring_create();
+        if (!ring) {
+            return;
+        }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t     head = ring->head;
+    TraceRecord* r    = &ring->records[head & (TRACE_RING_RECORDS - 1)];
+    r->ts_ns  = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    r->event  = (uint16_t)event;
+    r->thread = ring->thread;
+    r->a = a;
+    r->b = b;
+    r->c = c;
+    r->d = d;
+    r->e = e;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE); // Recorden er ferdig foer den telles
+}
+
+void trace_set_level(int level) {
+    __atomic_store_n(&trace_level, level < 0 ? 0 : level, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Writes every thread's ring to a file for trace-decode.
+ *
+ * @param path The file to create.
+ * @return int 0 on success, -1 on error.
+ */
+int trace_dump(const char* path) {
+    if (!path) {
+        fprintf(stderr, "trace_dump: Invalid arguments.\n");
+        return -1;
+    }
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        perror("trace_dump: Could not open the trace file");
+        return -1;
+    }
+
+    TraceFileHeader fh;
+    memset(&fh, 0, sizeof(fh));
+    memcpy(fh.magic, TRACE_MAGIC, sizeof(fh.magic));
+    fh.record_size = sizeof(TraceRecord);
+    TraceRing* rings = __atomic_load_n(&all_rings, __ATOMIC_ACQUIRE); // Nye ringer havner foran denne
+    for (TraceRing* ring = rings; ring; ring = ring->next) {
+        fh.rings++;
+    }
+    int ok = fwrite(&fh, sizeof(fh), 1, f) == 1;
+
+    for (TraceRing* ring = rings; ring && ok; ring = ring->next) {
+        uint64_t head  = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t first = head > TRACE_RING_RECORDS ? head - TRACE_RING_RECORDS : 0;
+
+        TraceRingHeader rh;
+        memset(&rh, 0, sizeof(rh));
+        rh.thread  = ring->thread;
+        rh.records = (uint32_t)(head - first);
+        rh.lost    = first;
+        ok = fwrite(&rh, sizeof(rh), 1, f) == 1;
+
+        // Eldste foerst: fra first til slutten av arrayet, saa resten
+        uint32_t start = (uint32_t)(first & (TRACE_RING_RECORDS - 1));
+        uint32_t tail  = rh.records < TRACE_RING_RECORDS - start ? rh.records : TRACE_RING_RECORDS - start;
+        if (ok && tail) {
+            ok = fwrite(&ring->records[start], sizeof(TraceRecord), tail, f) == tail;
+        }
+        if (ok && rh.records > tail) {
+            ok = fwrite(&ring->records[0], sizeof(TraceRecord), rh.records - tail, f) == rh.records - tail;
+        }
+    }
+
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        perror("trace_dump: Could not write the trace file");
+        return -1;
+    }
+    return 0;
+}
+
+const char* trace_event_name(int event) {
+    return (event > TRACE_NONE && event < TRACE_EVENT_COUNT) ? event_names[event] : NULL;
+}
+
+const char* trace_event_format(int event) {
+    return (event > TRACE_NONE && event < TRACE_EVENT_COUNT) ? event_formats[event] : NULL;
+}
+
+/* Ringene frigjoeres aldri, saa en dump ved exit ogsaa har med traader
+ * som er ferdige.
+ */
+static TraceRing* ring_create(void) {
+    TraceRing* ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+    if (!ring) {
+        __atomic_store_n(&trace_level, 0, __ATOMIC_RELAXED); // Ikke proev igjen for hver record
+        perror("Failed to allocate trace ring");
+        return NULL;
+    }
+    ring->thread = __atomic_fetch_add(&next_thread, 1, __ATOMIC_RELAXED);
+
+    // Legg ringen foerst i lista uten laas
+    TraceRing* head = __atomic_load_n(&all_rings, __ATOMIC_RELAXED);
+    do {
+        ring->next = head;
+    } while (!__atomic_compare_exchange_n(&all_rings, &head, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    my_ring = ring;
+    return ring;
+}
+
+static void dump_at_exit(void) {
+    if (trace_dump(dump_path) == 0) {
+        fprintf(stderr, "Trace written to %s\n", dump_path);
+    }
+}
@@ -0,0 +1,159 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Binary event tracing for L2, L4 and L5.
+ *
+ * A trace point writes one fixed-size TraceRecord into a ring buffer
+ * of the calling thread. Nothing is formatted and no lock is taken;
+ * the tool trace-decode turns a dump into text afterwards.
+ *
+ * Trace points are gated twice:
+ * - at compile time by TRACE_COMPILE_LEVEL. Points above it are not
+ *   compiled at all (-DTRACE_COMPILE_LEVEL=0 removes every one).
+ * - at run time by trace_level, which is 0 (off) unless the
+ *   environment variable NETSTACK_TRACE sets it or the program calls
+ *   trace_set_level. A disabled point costs one load and one branch.
+ *
+ * With NETSTACK_TRACE set, the rings are written at exit to the file
+ * in NETSTACK_TRACE_FILE, or to netstack.trace.
+ */
+
+#define TRACE_ERROR   1     /* given-up sends, protocol violations */
+#define TRACE_INFO    2     /* entities created and destroyed */
+#define TRACE_PACKET  3     /* every frame and packet */
+
+#ifndef TRACE_COMPILE_LEVEL
+#define TRACE_COMPILE_LEVEL TRACE_PACKET
+#endif
+
+/* Records per thread. Older records are overwritten. */
+#define TRACE_RING_RECORDS (1 << 15)
+
+/* The events, with a format for the decoder. The format takes up to
+ * five unsigned arguments, a to e of the record.
+ */
+#define TRACE_EVENTS(X) \
+    X( TRACE_L2_CREATE,          "l2 create",              "port=%u" ) \
+    X( TRACE_L2_DESTROY,         "l2 destroy",             "" ) \
+    X( TRACE_L2_SEND,            "l2 send",                "len=%u" ) \
+    X( TRACE_L2_RECV,            "l2 recv",                "len=%u" ) \
+    X( TRACE_L2_DROP_RUNT,       "l2 drop runt",           "bytes=%u" ) \
+    X( TRACE_L2_DROP_LENGTH,     "l2 drop length",         "header_len=%u bytes=%u" ) \
+    X( TRACE_L2_DROP_CHECKSUM,   "l2 drop checksum",       "checksum=0x%02x" ) \
+    X( TRACE_L2_DROP_INVALID,    "l2 drop invalid",        "status=%u bytes=%u" ) \
+    X( TRACE_L2_SERVER_CREATE,   "l2 server create",       "port=%u max_sessions=%u" ) \
+    X( TRACE_L2_SERVER_DESTROY,  "l2 server destroy",      "" ) \
+    X( TRACE_L2_IMPAIR_DROP,     "l2 impair drop",         "len=%u" ) \
+    X( TRACE_L2_IMPAIR_CORRUPT,  "l2 impair corrupt",      "len=%u bit=%u" ) \
+    X( TRACE_L2_IMPAIR_HOLD,     "l2 impair hold",         "len=%u hold_us=%u" ) \
+    X( TRACE_L4_CREATE,          "l4 create",              "" ) \
+    X( TRACE_L4_DESTROY,         "l4 destroy",             "" ) \
+    X( TRACE_L4_SEND_DATA,       "l4 send data",           "seq=%u len=%u" ) \
+    X( TRACE_L4_RETRANSMIT,      "l4 retransmit",          "seq=%u attempt=%u rto_us=%u" ) \
+    X( TRACE_L4_SEND_FAILED,     "l4 send failed",         "seq=%u attempts=%u" ) \
+    X( TRACE_L4_ACK,             "l4 ack",                 "seq=%u ackno=%u" ) \
+    X( TRACE_L4_ACK_IGNORED,     "l4 ack ignored",         "ackno=%u" ) \
+    X( TRACE_L4_RECV_WAIT,       "l4 recv wait",           "expected=%u" ) \
+    X( TRACE_L4_RECV_DATA,       "l4 recv data",           "seq=%u expected=%u len=%u" ) \
+    X( TRACE_L4_RECV_DUPLICATE,  "l4 recv duplicate",      "seq=%u" ) \
+    X( TRACE_L4_RECV_OUTSIDE,    "l4 recv outside window", "seq=%u" ) \
+    X( TRACE_L4_RECV_FULL,       "l4 recv window full",    "seq=%u" ) \
+    X( TRACE_L4_RECV_UNACKED,    "l4 recv unacked lost",   "" ) \
+    X( TRACE_L4_SEND_ACK,        "l4 send ack",            "ackno=%u seq=%u" ) \
+    X( TRACE_L4_RESET_SEND,      "l4 reset send",          "" ) \
+    X( TRACE_L4_RESET_RECV,      "l4 reset recv",          "" ) \
+    X( TRACE_L4_RUNT,            "l4 runt",                "bytes=%u" ) \
+    X( TRACE_L4_UNKNOWN,         "l4 unknown type",        "type=%u" ) \
+    X( TRACE_L4_MSG_DISCARD,     "l4 msg discard",         "offset=%u total=%u len=%u" ) \
+    X( TRACE_MAZE_SOLVE_BEGIN,   "maze solve begin",       "start=(%u,%u) end=(%u,%u) edge=%u" ) \
+    X( TRACE_MAZE_SOLVE_END,     "maze solve end",         "found=%u length=%u" )
+
+#define TRACE_ENUM_( id, name, format ) id,
+enum TraceEvent
+{
+    TRACE_NONE = 0,
+    TRACE_EVENTS( TRACE_ENUM_ )
+    TRACE_EVENT_COUNT
+};
+#undef TRACE_ENUM_
+
+/* One event. The size is fixed so that a dump is an array of these. */
+typedef struct TraceRecord TraceRecord;
+
+struct TraceRecord
+{
+    uint64_t ts_ns;         /* CLOCK_MONOTONIC */
+    uint16_t event;         /* enum TraceEvent */
+    uint16_t thread;        /* numbered in order of the first record */
+    uint32_t a, b, c, d, e;
+};
+
+/* The layout of a dump file: a TraceFileHeader, then for every thread
+ * a TraceRingHeader followed by its records, oldest first.
+ */
+#define TRACE_MAGIC "NSTRACE1"
+
+typedef struct TraceFileHeader TraceFileHeader;
+
+struct TraceFileHeader
+{
+    char     magic[8];
+    uint32_t record_size;
+    uint32_t rings;
+};
+
+typedef struct TraceRingHeader TraceRingHeader;
+
+struct TraceRingHeader
+{
+    uint32_t thread;
+    uint32_t records;
+    uint64_t lost;          /* overwritten before the dump */
+};
+
+/* Read on every trace point, so it is a plain global. The relaxed
+ * load is an ordinary load on the usual CPUs.
+ */
+extern int trace_level;
+
+#define TRACE_ENABLED( level ) \
+    ((level) <= TRACE_COMPILE_LEVEL && \
+     __builtin_expect( __atomic_load_n( &trace_level, __ATOMIC_RELAXED ) >= (level), 0 ))
+
+#define TRACE_ARGS_( a, b, c, d, e, ... ) \
+    (uint32_t)(a), (uint32_t)(b), (uint32_t)(c), (uint32_t)(d), (uint32_t)(e)
+
+/* TRACE( level, event, a [, b [, c [, d [, e]]]] ) */
+#define TRACE( level, event, ... ) \
+    do { \
+        if( TRACE_ENABLED( level ) ) \
+            trace_emit( (event), TRACE_ARGS_( __VA_ARGS__, 0, 0, 0, 0, 0 ) ); \
+    } while( 0 )
+
+/* Write a record into the calling thread's ring. Use TRACE instead. */
+void trace_emit( int event, uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e );
+
+/* Set the run-time level, 0 to stop tracing. */
+void trace_set_level( int level );
+
+/* Write every thread's ring to path. Records that a thread writes
+ * while the dump runs may be torn, so dump when the threads are quiet.
+ * Returns 0, or -1 on error.
+ */
+int  trace_dump( const char* path );
+
+/* The name and decoder format of an event, or NULL. */
+const char* trace_event_name( int event );
+const char* trace_event_format( int event );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,119 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "l4sap-shard.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static int verbose = 0;
+
+static void on_signal( int sig )
+{
+    (void)sig;
+    stop = 1;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-v] [-s shards] [-w window] <port>\n"
+                     "       -v        - print every packet and the counters once per second\n"
+                     "       -s shards - server threads, all bound to the port with SO_REUSEPORT\n"
+                     "                   (default: number of CPUs)\n"
+                     "       -w window - use windowed L4 mode, 2..%d; the clients must use the same window\n"
+                     "       port      - The UDP port to serve on\n"
+                     "Every DATA packet is sent back to its sender, except QUIT. Stop with Ctrl-C.\n",
+                     name, L4_MAX_WINDOW );
+    exit( -1 );
+}
+
+/* Runs in the shard's thread. A packet that does not fit into the
+ * window is dropped; the client then waits for it in vain, just as
+ * with loss on the way back.
+ */
+static void echo( L4SAP* l4, const uint8_t* data, int len, void* user )
+{
+    (void)user;
+    if( !data ) return;
+    if( len == 5 && memcmp( data, "QUIT", 5 ) == 0 ) return;
+
+    if( verbose )
+    {
+        fprintf( stderr, "Received %d bytes: '%.*s'\n", len, (int)strnlen( (const char*)data, len ), data );
+    }
+    if( l4sap_send_async( l4, data, len ) < 0 )
+    {
+        fprintf( stderr, "%s: Window full, reply of %d bytes dropped\n", __FUNCTION__, len );
+    }
+}
+
+static void print_stats( const L4ShardServer* srv )
+{
+    L4ShardStats s;
+    l4shard_server_stats( srv, &s, NULL );
+    fprintf( stderr, "%llu sessions open, %llu total, %llu packets in (%llu bytes), %llu out, "
+                     "%llu failed, %llu L2 drops\n",
+             (unsigned long long)s.sessions_open, (unsigned long long)s.sessions_total,
+             (unsigned long long)s.packets_in, (unsigned long long)s.bytes_in,
+             (unsigned long long)s.packets_out, (unsigned long long)s.send_failed,
+             (unsigned long long)s.l2_drops );
+}
+
+int main( int argc, char *argv[] )
+{
+    L4ShardConfig config;
+    memset( &config, 0, sizeof(config) );
+
+    int opt;
+    while( (opt = getopt( argc, argv, "vs:w:" )) != -1 )
+    {
+        switch( opt )
+        {
+        case 'v' :
+            verbose = 1;
+            break;
+        case 's' :
+            config.shards = atoi( optarg );
+            if( config.shards < 1 ) usage( argv[0] );
+            break;
+        case 'w' :
+            config.window = atoi( optarg );
+            if( config.window < 2 || config.window > L4_MAX_WINDOW ) usage( argv[0] );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+    if( argc - optind != 1 ) usage( argv[0] );
+    int port = atoi( argv[optind] );
+
+    struct sigaction sa;
+    memset( &sa, 0, sizeof(sa) );
+    sa.sa_handler = on_signal;
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+
+    L4ShardServer* srv = l4shard_server_start( port, &config, echo, NULL );
+    if( !srv )
+    {
+        fprintf( stderr, "%s: Failed to start server on port %d\n", argv[0], port );
+        return -1;
+    }
+    fprintf( stderr, "%s: Serving port %d with %d shard(s)\n", argv[0], port, l4shard_server_shards( srv ) );
+
+    int ticks = 0;
+    while( !stop )
+    {
+        struct timespec tick = { 0, 100000000 };
+        nanosleep( &tick, NULL );
+        if( verbose && ++ticks % 10 == 0 ) print_stats( srv );
+    }
+
+    if( verbose ) print_stats( srv );
+    l4shard_server_stop( srv );
+    return 0;
+}